@@ -0,0 +1,212 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "batch.h"
+#include "tst.h"
+#include "files.h"
+#include "exit.h"
+#include "threadpool.h"
+
+
+#define TST_EXTENSION ".tst"
+#define HDL_EXTENSION ".hdl"
+
+/*
+ * One script of the batch. status and errmsg are filled in by the worker that
+ * ran it and are reported by the main thread, once all are done.
+ */
+struct batch_file {
+    char *path;
+    int status;
+    char errmsg[MAX_ERROR_LEN + 1];
+};
+
+struct batch {
+    struct batch_file *files;
+    unsigned count;
+    unsigned allocated;
+    const char *builtin_dir;
+    const char *keys;
+};
+
+
+static void batch_add(struct batch *batch, const char *path, int status, const char *errmsg)
+{
+    if (batch->count == batch->allocated) {
+        batch->allocated = batch->allocated ? batch->allocated * 2 : 64;
+        struct batch_file *p = realloc(batch->files, batch->allocated * sizeof(*p));
+        if (p == NULL) {
+            exit_program(EXIT_OUT_OF_MEMORY);
+        }
+        batch->files = p;
+    }
+
+    struct batch_file *file = &batch->files[batch->count++];
+
+    if ((file->path = strdup(path)) == NULL) {
+        exit_program(EXIT_OUT_OF_MEMORY);
+    }
+    file->status = status;
+    strcpy(file->errmsg, errmsg);
+}
+
+static bool has_extension(const char *path, const char *ext)
+{
+    const char *dot = strrchr(path, '.');
+    return dot != NULL && !strcmp(dot, ext);
+}
+
+/*
+ * Whether the script at path loads an .hdl chip, rather than a program for
+ * the CPU or VM emulator.
+ */
+static bool loads_chip(const char *path)
+{
+    char *text = read_file(path);
+    bool chip = false;
+
+    for (char *p = text; p && !chip && (p = strstr(p, "load")); p += 4) {
+        char *name = p + 4, *end;
+
+        if (!isspace((unsigned char) *name)) {
+            continue;
+        }
+        while (isspace((unsigned char) *name)) {
+            name++;
+        }
+        for (end = name; *end && !isspace((unsigned char) *end) && !strchr(",;", *end); end++) {
+            ;
+        }
+        chip = end - name > 4 && !strncmp(end - 4, HDL_EXTENSION, 4);
+    }
+
+    free(text);
+    return chip;
+}
+
+static int compare_files(const void *a, const void *b)
+{
+    return strcmp(((const struct batch_file *) a)->path,
+                  ((const struct batch_file *) b)->path);
+}
+
+/*
+ * Add path to the batch, or all chip scripts under it if it is a directory.
+ * Paths that can't be run are added along with the error, so that they are
+ * reported in order with the rest.
+ */
+static void collect_files(struct batch *batch, const char *path, bool explicit)
+{
+    char errmsg[MAX_ERROR_LEN + 1];
+    struct stat path_stat;
+
+    if (stat(path, &path_stat) != 0) {
+        int status = error_format(errmsg, EXIT_CANNOT_OPEN_FILE, path);
+        batch_add(batch, path, status, errmsg);
+    } else if (S_ISREG(path_stat.st_mode)) {
+        // files named on the command line are taken whatever they load
+        if (explicit || (has_extension(path, TST_EXTENSION) && loads_chip(path))) {
+            batch_add(batch, path, 0, "");
+        }
+    } else if (S_ISDIR(path_stat.st_mode)) {
+        DIR *d = opendir(path);
+        struct dirent *dir;
+        unsigned first = batch->count;
+
+        if (d == NULL) {
+            int status = error_format(errmsg, EXIT_CANNOT_OPEN_FILE, path);
+            batch_add(batch, path, status, errmsg);
+            return;
+        }
+
+        while ((dir = readdir(d)) != NULL) {
+            if (!strcmp(dir->d_name, ".") || !strcmp(dir->d_name, "..")) {
+                continue;
+            }
+            char child[strlen(path) + strlen(dir->d_name) + 2];
+            sprintf(child, "%s/%s", path, dir->d_name);
+            collect_files(batch, child, false);
+        }
+        closedir(d);
+
+        // readdir order is arbitrary; report in a predictable one
+        qsort(batch->files + first, batch->count - first,
+              sizeof(struct batch_file), compare_files);
+    } else if (explicit) {
+        int status = error_format(errmsg, EXIT_CANNOT_OPEN_FILE, path);
+        batch_add(batch, path, status, errmsg);
+    }
+}
+
+struct job {
+    const struct batch *batch;
+    struct batch_file *file;
+};
+
+static void run_file(void *ctx, void *arg)
+{
+    struct job *job = arg;
+
+    (void) ctx;
+    job->file->status = tst_run(job->file->path, job->batch->builtin_dir, job->batch->keys,
+                                job->file->errmsg);
+}
+
+int tst_batch(int npaths, char *paths[], int njobs, const char *builtin_dir, const char *keys)
+{
+    struct batch batch = { .builtin_dir = builtin_dir, .keys = keys };
+    int status = 0;
+
+    for (int i = 0; i < npaths; i++) {
+        collect_files(&batch, paths[i], true);
+    }
+
+    struct job *jobs = malloc((batch.count + 1) * sizeof(struct job));
+    ThreadPool pool = threadpool_create(njobs, NULL, NULL);
+
+    if (jobs == NULL || pool == NULL) {
+        exit_program(EXIT_OUT_OF_MEMORY);
+    }
+
+    for (unsigned i = 0; i < batch.count; i++) {
+        jobs[i] = (struct job) { &batch, &batch.files[i] };
+        if (batch.files[i].status == 0 && threadpool_submit(pool, run_file, &jobs[i]) != 0) {
+            exit_program(EXIT_OUT_OF_MEMORY);
+        }
+    }
+
+    threadpool_destroy(pool);
+
+    for (unsigned i = 0; i < batch.count; i++) {
+        struct batch_file *file = &batch.files[i];
+
+        if (file->status) {
+            char msg[strlen(file->path) + MAX_ERROR_LEN + 3];
+
+            // messages that already name the script don't need it twice
+            if (strstr(file->errmsg, file->path)) {
+                strcpy(msg, file->errmsg);
+            } else {
+                sprintf(msg, "%s: %s", file->path, file->errmsg);
+            }
+            error_print(msg);
+
+            if (!status) {
+                status = file->status;
+            }
+        } else {
+            printf("%s: End of script - Comparison ended successfully\n", file->path);
+        }
+        free(file->path);
+    }
+
+    free(jobs);
+    free(batch.files);
+
+    return status;
+}
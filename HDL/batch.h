@@ -0,0 +1,15 @@
+#pragma once
+
+/**
+ * Run every script in paths on njobs worker threads (one per CPU if
+ * njobs < 1). Directories are searched recursively for .tst scripts that
+ * load an .hdl chip; the scripts of the CPU and VM emulators are skipped.
+ * Built-in chips come from builtin_dir, and keys are pressed as described
+ * in tst.h.
+ *
+ * The result of each script is reported in path order once all have run.
+ *
+ * retval - 0 if all scripts passed, else the exit code of the first script
+ *          that failed.
+ */
+int tst_batch(int npaths, char *paths[], int njobs, const char *builtin_dir, const char *keys);
@@ -0,0 +1,241 @@
+#include <string.h>
+
+#include "builtin.h"
+
+struct builtin {
+    const char *name;
+    /* Names of the pins the implementation uses, separated by spaces. */
+    const char *pins;
+    builtin_fn fn;
+};
+
+
+static uint32_t *pin(const struct chip_def *chip, uint32_t *pins[], const char *name)
+{
+    return pins[hdl_find_pin(chip, name)];
+}
+
+static unsigned width(const struct chip_def *chip, const char *name)
+{
+    return chip->pins[hdl_find_pin(chip, name)].width;
+}
+
+/* out = a op b, bit by bit */
+static void bitwise(struct netlist *nl, const struct chip_def *chip, uint32_t *pins[],
+                    enum gate_op op)
+{
+    uint32_t *a = pin(chip, pins, "a"), *b = pin(chip, pins, "b"), *out = pin(chip, pins, "out");
+
+    for (unsigned i = 0; i < width(chip, "out"); i++) {
+        gate_to(nl, op, out[i], a[i], b[i], NET_FALSE);
+    }
+}
+
+static void nand(struct netlist *nl, const struct chip_def *chip, uint32_t *pins[])
+{
+    bitwise(nl, chip, pins, GATE_NAND);
+}
+
+static void and(struct netlist *nl, const struct chip_def *chip, uint32_t *pins[])
+{
+    bitwise(nl, chip, pins, GATE_AND);
+}
+
+static void or(struct netlist *nl, const struct chip_def *chip, uint32_t *pins[])
+{
+    bitwise(nl, chip, pins, GATE_OR);
+}
+
+static void xor(struct netlist *nl, const struct chip_def *chip, uint32_t *pins[])
+{
+    bitwise(nl, chip, pins, GATE_XOR);
+}
+
+static void not(struct netlist *nl, const struct chip_def *chip, uint32_t *pins[])
+{
+    uint32_t *in = pin(chip, pins, "in"), *out = pin(chip, pins, "out");
+
+    for (unsigned i = 0; i < width(chip, "out"); i++) {
+        gate_to(nl, GATE_NOT, out[i], in[i], NET_FALSE, NET_FALSE);
+    }
+}
+
+/*
+ * Multiplexor of the 2, 4 or 8 buses a, b, ... as a tree of 2-way ones.
+ */
+static void mux(struct netlist *nl, const struct chip_def *chip, uint32_t *pins[])
+{
+    static const char *inputs[] = { "a", "b", "c", "d", "e", "f", "g", "h" };
+    uint32_t *sel = pin(chip, pins, "sel"), *out = pin(chip, pins, "out");
+    unsigned sel_bits = width(chip, "sel");
+    uint32_t level[8];
+
+    for (unsigned i = 0; i < width(chip, "out"); i++) {
+        for (unsigned k = 0; k < 1u << sel_bits; k++) {
+            level[k] = pin(chip, pins, inputs[k])[i];
+        }
+        for (unsigned j = 0; j < sel_bits; j++) {
+            unsigned n = 1u << (sel_bits - j - 1);
+
+            for (unsigned k = 0; k < n; k++) {
+                if (j + 1 == sel_bits) {
+                    gate_to(nl, GATE_MUX, out[i], level[2*k], level[2*k+1], sel[j]);
+                } else {
+                    level[k] = gate(nl, GATE_MUX, level[2*k], level[2*k+1], sel[j]);
+                }
+            }
+        }
+    }
+}
+
+/*
+ * Demultiplexor of in to the 2, 4 or 8 outputs a, b, ...: each output is in
+ * and-ed with the sel bits, or their negations.
+ */
+static void dmux(struct netlist *nl, const struct chip_def *chip, uint32_t *pins[])
+{
+    static const char *outputs[] = { "a", "b", "c", "d", "e", "f", "g", "h" };
+    uint32_t *in = pin(chip, pins, "in"), *sel = pin(chip, pins, "sel");
+    unsigned sel_bits = width(chip, "sel");
+    uint32_t not_sel[3];
+
+    for (unsigned j = 0; j < sel_bits; j++) {
+        not_sel[j] = gate(nl, GATE_NOT, sel[j], NET_FALSE, NET_FALSE);
+    }
+
+    for (unsigned k = 0; k < 1u << sel_bits; k++) {
+        uint32_t term = in[0];
+
+        for (unsigned j = 0; j < sel_bits; j++) {
+            uint32_t s = (k >> j) & 1 ? sel[j] : not_sel[j];
+
+            if (j + 1 == sel_bits) {
+                gate_to(nl, GATE_AND, pin(chip, pins, outputs[k])[0], term, s, NET_FALSE);
+            } else {
+                term = gate(nl, GATE_AND, term, s, NET_FALSE);
+            }
+        }
+    }
+}
+
+static void or8way(struct netlist *nl, const struct chip_def *chip, uint32_t *pins[])
+{
+    uint32_t *in = pin(chip, pins, "in"), *out = pin(chip, pins, "out");
+    uint32_t acc = in[0];
+
+    for (unsigned i = 1; i < 7; i++) {
+        acc = gate(nl, GATE_OR, acc, in[i], NET_FALSE);
+    }
+    gate_to(nl, GATE_OR, out[0], acc, in[7], NET_FALSE);
+}
+
+/*
+ * Ripple carry adder of n bits: out = a + b + carry.
+ */
+static void adder(struct netlist *nl, const uint32_t *a, const uint32_t *b, uint32_t carry,
+                  const uint32_t *out, unsigned n)
+{
+    for (unsigned i = 0; i < n; i++) {
+        uint32_t half = gate(nl, GATE_XOR, a[i], b[i], NET_FALSE);
+
+        gate_to(nl, GATE_XOR, out[i], half, carry, NET_FALSE);
+        if (i + 1 < n) {
+            uint32_t both = gate(nl, GATE_AND, a[i], b[i], NET_FALSE);
+            uint32_t passed = gate(nl, GATE_AND, half, carry, NET_FALSE);
+            carry = gate(nl, GATE_OR, both, passed, NET_FALSE);
+        }
+    }
+}
+
+static void half_adder(struct netlist *nl, const struct chip_def *chip, uint32_t *pins[])
+{
+    uint32_t a = pin(chip, pins, "a")[0], b = pin(chip, pins, "b")[0];
+
+    gate_to(nl, GATE_XOR, pin(chip, pins, "sum")[0], a, b, NET_FALSE);
+    gate_to(nl, GATE_AND, pin(chip, pins, "carry")[0], a, b, NET_FALSE);
+}
+
+static void full_adder(struct netlist *nl, const struct chip_def *chip, uint32_t *pins[])
+{
+    uint32_t a = pin(chip, pins, "a")[0], b = pin(chip, pins, "b")[0], c = pin(chip, pins, "c")[0];
+    uint32_t half = gate(nl, GATE_XOR, a, b, NET_FALSE);
+    uint32_t both = gate(nl, GATE_AND, a, b, NET_FALSE);
+    uint32_t passed = gate(nl, GATE_AND, half, c, NET_FALSE);
+
+    gate_to(nl, GATE_XOR, pin(chip, pins, "sum")[0], half, c, NET_FALSE);
+    gate_to(nl, GATE_OR, pin(chip, pins, "carry")[0], both, passed, NET_FALSE);
+}
+
+static void add16(struct netlist *nl, const struct chip_def *chip, uint32_t *pins[])
+{
+    adder(nl, pin(chip, pins, "a"), pin(chip, pins, "b"), NET_FALSE, pin(chip, pins, "out"), 16);
+}
+
+static void inc16(struct netlist *nl, const struct chip_def *chip, uint32_t *pins[])
+{
+    static const uint32_t zero[16] = { NET_FALSE };
+
+    adder(nl, pin(chip, pins, "in"), zero, NET_TRUE, pin(chip, pins, "out"), 16);
+}
+
+static void alu(struct netlist *nl, const struct chip_def *chip, uint32_t *pins[])
+{
+    uint32_t *x = pin(chip, pins, "x"), *y = pin(chip, pins, "y"), *out = pin(chip, pins, "out");
+    uint32_t zx = pin(chip, pins, "zx")[0], nx = pin(chip, pins, "nx")[0];
+    uint32_t zy = pin(chip, pins, "zy")[0], ny = pin(chip, pins, "ny")[0];
+    uint32_t f = pin(chip, pins, "f")[0], no = pin(chip, pins, "no")[0];
+    uint32_t xs[16], ys[16], sum[16];
+    uint32_t any;
+
+    for (unsigned i = 0; i < 16; i++) {
+        xs[i] = gate(nl, GATE_XOR, gate(nl, GATE_MUX, x[i], NET_FALSE, zx), nx, NET_FALSE);
+        ys[i] = gate(nl, GATE_XOR, gate(nl, GATE_MUX, y[i], NET_FALSE, zy), ny, NET_FALSE);
+        sum[i] = net_new(nl);
+    }
+    adder(nl, xs, ys, NET_FALSE, sum, 16);
+
+    for (unsigned i = 0; i < 16; i++) {
+        uint32_t both = gate(nl, GATE_AND, xs[i], ys[i], NET_FALSE);
+        uint32_t result = gate(nl, GATE_MUX, both, sum[i], f);
+
+        gate_to(nl, GATE_XOR, out[i], result, no, NET_FALSE);
+    }
+
+    any = out[0];
+    for (unsigned i = 1; i < 16; i++) {
+        any = gate(nl, GATE_OR, any, out[i], NET_FALSE);
+    }
+    gate_to(nl, GATE_NOT, pin(chip, pins, "zr")[0], any, NET_FALSE, NET_FALSE);
+    net_join(nl, pin(chip, pins, "ng")[0], out[15]);
+}
+
+static const struct builtin builtins[] = {
+    { "Nand", "a b out", nand },
+    { "And", "a b out", and },
+    { "Or", "a b out", or },
+    { "Xor", "a b out", xor },
+    { "Not", "in out", not },
+    { "Not16", "in out", not },
+    { "Mux", "a b sel out", mux },
+    { "Mux4Way16", "a b c d sel out", mux },
+    { "Mux8Way16", "a b c d e f g h sel out", mux },
+    { "DMux", "in sel a b", dmux },
+    { "DMux4Way", "in sel a b c d", dmux },
+    { "DMux8Way", "in sel a b c d e f g h", dmux },
+    { "Or8Way", "in out", or8way },
+    { "HalfAdder", "a b sum carry", half_adder },
+    { "FullAdder", "a b c sum carry", full_adder },
+    { "Add16", "a b out", add16 },
+    { "Inc16", "in out", inc16 },
+    { "ALU", "x y zx nx zy ny f no out zr ng", alu },
+};
+
+builtin_fn builtin_find(const char *name, const struct chip_def *chip)
+{
+    for (unsigned i = 0; i < sizeof(builtins) / sizeof(builtins[0]); i++) {
+        if (!strcmp(builtins[i].name, name) && hdl_has_pins(chip, builtins[i].pins)) {
+            return builtins[i].fn;
+        }
+    }
+    return NULL;
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "hdl.h"
+#include "netlist.h"
+
+/*
+ * Built-in chips, the ones of tools/builtInChips. Their pins come from the
+ * .hdl files there; their implementations here expand them to primitive
+ * gates while flattening.
+ */
+
+/*
+ * Add the gates of a built-in chip to nl. pins[i] holds the nets of the
+ * chip's pin i.
+ */
+typedef void (*builtin_fn)(struct netlist *nl, const struct chip_def *chip, uint32_t *pins[]);
+
+/*
+ * Find the implementation called name that fits the pins of chip.
+ *
+ * \retval - the implementation, or NULL if there is none.
+ */
+builtin_fn builtin_find(const char *name, const struct chip_def *chip);
@@ -0,0 +1,55 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "exit.h"
+
+
+const char *program_name = "HDL Simulator";
+
+const char *error_messages[] =
+{
+    [EXIT_CANNOT_OPEN_FILE] = "Can't open file %s",
+    [EXIT_INVALID_OPTION] = "Usage: hdlsim [-b builtin_dir] [-k keys] [-j jobs] file.tst|dir...",
+    [EXIT_HDL_SYNTAX] = "%s, line %u: %s",
+    [EXIT_CHIP_NOT_FOUND] = "Chip %s not found",
+    [EXIT_INVALID_CHIP] = "Chip %s: %s",
+    [EXIT_TST_SYNTAX] = "%s, line %u: %s",
+    [EXIT_COMPARISON_FAILURE] = "%s: Comparison failure at line %u, column %s",
+    [EXIT_OUT_OF_MEMORY] = "CRITICAL: Unable to allocate memory!",
+    [EXIT_ENDLESS_LOOP] = "%s, line %u: Endless while loop (keys to press can be given with -k)",
+};
+
+
+void exit_program(enum exitcode code, ...)
+{
+    char msg[MAX_ERROR_LEN + 1];
+    va_list arguments;
+
+    va_start(arguments, code);
+    vsnprintf(msg, sizeof(msg), error_messages[code], arguments);
+    va_end(arguments);
+
+    exit_with_message(code, msg);
+}
+
+void exit_with_message(enum exitcode code, const char *msg)
+{
+    error_print(msg);
+    exit(code);
+}
+
+void error_print(const char *msg)
+{
+    printf("%s: ERROR: %s\n", program_name, msg);
+}
+
+int error_format(char *msg, enum exitcode code, ...)
+{
+    va_list arguments;
+
+    va_start(arguments, code);
+    vsnprintf(msg, MAX_ERROR_LEN + 1, error_messages[code], arguments);
+    va_end(arguments);
+
+    return code;
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <stdarg.h>
+
+/*
+ * Maximum length of a formatted error message.
+ */
+#define MAX_ERROR_LEN 511
+
+enum exitcode {
+    /*
+     * Exit code 1 represents that a file couldn't be opened.
+     */
+    EXIT_CANNOT_OPEN_FILE = 1,
+    /*
+     * Exit code 2 represents that an invalid command line option was given.
+     */
+    EXIT_INVALID_OPTION = 2,
+    /*
+     * Exit code 3 represents that an .hdl file is not valid HDL.
+     */
+    EXIT_HDL_SYNTAX = 3,
+    /*
+     * Exit code 4 represents that a chip used by another one doesn't exist.
+     */
+    EXIT_CHIP_NOT_FOUND = 4,
+    /*
+     * Exit code 5 represents that a chip's parts don't fit together.
+     */
+    EXIT_INVALID_CHIP = 5,
+    /*
+     * Exit code 6 represents that a .tst script is not valid.
+     */
+    EXIT_TST_SYNTAX = 6,
+    /*
+     * Exit code 7 represents that the output of a script differs from its .cmp file.
+     */
+    EXIT_COMPARISON_FAILURE = 7,
+    /*
+     * Exit code 8 represents that the program run out of memory.
+     */
+    EXIT_OUT_OF_MEMORY = 8,
+    /*
+     * Exit code 9 represents that a while loop of a script can't end.
+     */
+    EXIT_ENDLESS_LOOP = 9,
+};
+
+/*
+ * Name of the program that error messages are reported by.
+ */
+extern const char *program_name;
+
+
+/**
+ * Print the error message that corresponds to code and terminate the program.
+ */
+void exit_program(enum exitcode code, ...);
+
+/**
+ * Print an already formatted error message and terminate the program.
+ */
+void exit_with_message(enum exitcode code, const char *msg);
+
+/**
+ * Print an already formatted error message without terminating the program.
+ */
+void error_print(const char *msg);
+
+/**
+ * Format the error message that corresponds to code into msg, which must be
+ * able to hold MAX_ERROR_LEN + 1 chars. This is for code paths that must not
+ * terminate the program, e.g. the loading of chips.
+ *
+ * retval - code
+ */
+int error_format(char *msg, enum exitcode code, ...);
@@ -0,0 +1,67 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "files.h"
+
+char *read_file(const char *filename)
+{
+    FILE *fp = fopen(filename, "r");
+    char *buf = NULL;
+    size_t len = 0, size = 0, n;
+
+    if (fp == NULL) {
+        return NULL;
+    }
+
+    do {
+        if (len + 1 >= size) {
+            size = size ? 2 * size : 4096;
+            char *p = realloc(buf, size);
+            if (p == NULL) {
+                free(buf);
+                fclose(fp);
+                return NULL;
+            }
+            buf = p;
+        }
+        n = fread(buf + len, 1, size - len - 1, fp);
+        len += n;
+    } while (n > 0);
+
+    fclose(fp);
+    buf[len] = '\0';
+
+    return buf;
+}
+
+const char *map_file(const char *filename, size_t *len)
+{
+    int fd = open(filename, O_RDONLY);
+    struct stat st;
+    void *p;
+
+    if (fd < 0) {
+        return NULL;
+    }
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return NULL;
+    }
+
+    *len = st.st_size;
+    p = *len ? mmap(NULL, *len, PROT_READ, MAP_PRIVATE, fd, 0) : "";
+    close(fd);
+
+    return p == MAP_FAILED ? NULL : p;
+}
+
+void unmap_file(const char *p, size_t len)
+{
+    if (p && len) {
+        munmap((void *) p, len);
+    }
+}
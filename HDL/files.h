@@ -0,0 +1,21 @@
+#pragma once
+
+#include <stddef.h>
+
+/*
+ * Read a whole file into a null terminated buffer.
+ *
+ * \retval - the buffer, which the caller frees, or NULL if the file can't be
+ *           read or there isn't enough memory.
+ */
+char *read_file(const char *filename);
+
+/*
+ * Map a whole file into memory, read only. An empty file maps to "".
+ *
+ * \retval - the contents, which the caller unmaps with unmap_file, or NULL if
+ *           the file can't be mapped. *len is set to their length.
+ */
+const char *map_file(const char *filename, size_t *len);
+
+void unmap_file(const char *p, size_t len);
@@ -0,0 +1,346 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "hdl.h"
+#include "files.h"
+#include "exit.h"
+
+/* Longest token; names are checked against MAX_NAME_LEN separately. */
+#define MAX_TOKEN_LEN 255
+
+struct lexer {
+    const char *filename;
+    const char *p;
+    unsigned line;
+    char tok[MAX_TOKEN_LEN + 1];
+    char *errmsg;
+};
+
+
+static int syntax_error(struct lexer *lx, const char *msg)
+{
+    return error_format(lx->errmsg, EXIT_HDL_SYNTAX, lx->filename, lx->line, msg);
+}
+
+/*
+ * Read the next token into lx->tok: a name, a number, "..", a symbol, or
+ * "" at the end of the file.
+ */
+static void next(struct lexer *lx)
+{
+    const char *p = lx->p;
+    size_t n = 0;
+
+    for (;;) {
+        while (isspace((unsigned char) *p)) {
+            lx->line += *p++ == '\n';
+        }
+        if (p[0] == '/' && p[1] == '/') {
+            while (*p && *p != '\n') {
+                p++;
+            }
+        } else if (p[0] == '/' && p[1] == '*') {
+            for (p += 2; *p && !(p[0] == '*' && p[1] == '/'); p++) {
+                lx->line += *p == '\n';
+            }
+            p += *p ? 2 : 0;
+        } else {
+            break;
+        }
+    }
+
+    if (isalnum((unsigned char) *p) || *p == '_') {
+        // e.g. ALU-nostat
+        while ((isalnum((unsigned char) *p) || strchr("_.-", *p)) && *p && n < MAX_TOKEN_LEN) {
+            // a number followed by ".." is a range, not a name
+            if (*p == '.' && p[1] == '.') {
+                break;
+            }
+            lx->tok[n++] = *p++;
+        }
+    } else if (p[0] == '.' && p[1] == '.') {
+        lx->tok[n++] = *p++;
+        lx->tok[n++] = *p++;
+    } else if (*p) {
+        lx->tok[n++] = *p++;
+    }
+
+    lx->tok[n] = '\0';
+    lx->p = p;
+}
+
+static bool accept(struct lexer *lx, const char *tok)
+{
+    if (strcmp(lx->tok, tok)) {
+        return false;
+    }
+    next(lx);
+    return true;
+}
+
+static int expect(struct lexer *lx, const char *tok)
+{
+    char msg[MAX_TOKEN_LEN + 32];
+
+    if (accept(lx, tok)) {
+        return 0;
+    }
+    snprintf(msg, sizeof(msg), "Expected %s", tok);
+    return syntax_error(lx, msg);
+}
+
+static int name(struct lexer *lx, char *dst)
+{
+    if (!isalpha((unsigned char) lx->tok[0]) && lx->tok[0] != '_') {
+        return syntax_error(lx, "Expected a name");
+    }
+    if (strlen(lx->tok) > MAX_NAME_LEN) {
+        return syntax_error(lx, "Name too long");
+    }
+    strcpy(dst, lx->tok);
+    next(lx);
+    return 0;
+}
+
+static int number(struct lexer *lx, unsigned *n)
+{
+    char *end;
+
+    *n = strtoul(lx->tok, &end, 10);
+    if (!isdigit((unsigned char) lx->tok[0]) || *end) {
+        return syntax_error(lx, "Expected a number");
+    }
+    next(lx);
+    return 0;
+}
+
+/*
+ * name or name[i] or name[i..j]
+ */
+static int bus_ref(struct lexer *lx, struct bus_ref *ref)
+{
+    int rc = name(lx, ref->name);
+
+    ref->sub = false;
+    if (rc || !accept(lx, "[")) {
+        return rc;
+    }
+
+    ref->sub = true;
+    if ((rc = number(lx, &ref->lo))) {
+        return rc;
+    }
+    ref->hi = ref->lo;
+    if (accept(lx, "..") && (rc = number(lx, &ref->hi))) {
+        return rc;
+    }
+    if (ref->hi < ref->lo || ref->hi >= MAX_WIDTH) {
+        return syntax_error(lx, "Invalid sub bus");
+    }
+    return expect(lx, "]");
+}
+
+/*
+ * Pin declarations up to the ;
+ */
+static int pin_list(struct lexer *lx, struct chip_def *chip)
+{
+    int rc;
+
+    do {
+        struct pin *pin = &chip->pins[chip->npins];
+
+        if (chip->npins == MAX_PINS) {
+            return syntax_error(lx, "Too many pins");
+        }
+        if ((rc = name(lx, pin->name))) {
+            return rc;
+        }
+        pin->width = 1;
+        pin->clocked = false;
+        if (accept(lx, "[")) {
+            if ((rc = number(lx, &pin->width)) || (rc = expect(lx, "]"))) {
+                return rc;
+            }
+            if (pin->width < 1 || pin->width > MAX_WIDTH) {
+                return syntax_error(lx, "Invalid bus width");
+            }
+        }
+        chip->npins++;
+    } while (accept(lx, ","));
+
+    return expect(lx, ";");
+}
+
+static int part(struct lexer *lx, struct part *part)
+{
+    unsigned max = 0;
+    int rc;
+
+    part->line = lx->line;
+    part->conns = NULL;
+    part->nconns = 0;
+
+    if ((rc = name(lx, part->chip)) || (rc = expect(lx, "("))) {
+        return rc;
+    }
+
+    do {
+        if (part->nconns == max) {
+            max = max ? 2 * max : 8;
+            struct connection *c = realloc(part->conns, max * sizeof(*c));
+            if (c == NULL) {
+                return error_format(lx->errmsg, EXIT_OUT_OF_MEMORY);
+            }
+            part->conns = c;
+        }
+        struct connection *conn = &part->conns[part->nconns++];
+
+        if ((rc = bus_ref(lx, &conn->pin)) || (rc = expect(lx, "=")) ||
+            (rc = bus_ref(lx, &conn->wire))) {
+            return rc;
+        }
+    } while (accept(lx, ","));
+
+    if ((rc = expect(lx, ")"))) {
+        return rc;
+    }
+    return expect(lx, ";");
+}
+
+static int parts(struct lexer *lx, struct chip_def *chip)
+{
+    unsigned max = 0;
+    int rc;
+
+    while (strcmp(lx->tok, "}") && lx->tok[0]) {
+        if (chip->nparts == max) {
+            max = max ? 2 * max : 16;
+            struct part *p = realloc(chip->parts, max * sizeof(*p));
+            if (p == NULL) {
+                return error_format(lx->errmsg, EXIT_OUT_OF_MEMORY);
+            }
+            chip->parts = p;
+        }
+        if ((rc = part(lx, &chip->parts[chip->nparts++]))) {
+            return rc;
+        }
+    }
+    return 0;
+}
+
+/*
+ * CLOCKED pin names up to the ;
+ */
+static int clocked_list(struct lexer *lx, struct chip_def *chip)
+{
+    char pin[MAX_NAME_LEN + 1];
+    int rc;
+
+    chip->clocked = true;
+    do {
+        if ((rc = name(lx, pin))) {
+            return rc;
+        }
+        int i = hdl_find_pin(chip, pin);
+        if (i < 0) {
+            return syntax_error(lx, "Unknown clocked pin");
+        }
+        chip->pins[i].clocked = true;
+    } while (accept(lx, ","));
+
+    return expect(lx, ";");
+}
+
+static int chip_body(struct lexer *lx, struct chip_def *chip)
+{
+    int rc;
+
+    if ((rc = expect(lx, "CHIP")) || (rc = name(lx, chip->name)) || (rc = expect(lx, "{"))) {
+        return rc;
+    }
+
+    if (accept(lx, "IN") && (rc = pin_list(lx, chip))) {
+        return rc;
+    }
+    chip->nin = chip->npins;
+    if (accept(lx, "OUT") && (rc = pin_list(lx, chip))) {
+        return rc;
+    }
+
+    if (accept(lx, "PARTS")) {
+        if ((rc = expect(lx, ":")) || (rc = parts(lx, chip))) {
+            return rc;
+        }
+    } else if (accept(lx, "BUILTIN")) {
+        if ((rc = name(lx, chip->builtin)) || (rc = expect(lx, ";"))) {
+            return rc;
+        }
+        if (accept(lx, "CLOCKED") && (rc = clocked_list(lx, chip))) {
+            return rc;
+        }
+    } else {
+        return syntax_error(lx, "Expected PARTS or BUILTIN");
+    }
+
+    return expect(lx, "}");
+}
+
+int hdl_parse(const char *filename, struct chip_def *chip, char *errmsg)
+{
+    struct lexer lx = { .filename = filename, .line = 1, .errmsg = errmsg };
+    char *text = read_file(filename);
+
+    memset(chip, 0, sizeof(*chip));
+
+    if (text == NULL) {
+        return error_format(errmsg, EXIT_CANNOT_OPEN_FILE, filename);
+    }
+
+    lx.p = text;
+    next(&lx);
+    int rc = chip_body(&lx, chip);
+    free(text);
+
+    if (rc) {
+        hdl_free(chip);
+    }
+    return rc;
+}
+
+void hdl_free(struct chip_def *chip)
+{
+    for (unsigned i = 0; i < chip->nparts; i++) {
+        free(chip->parts[i].conns);
+    }
+    free(chip->parts);
+    chip->parts = NULL;
+    chip->nparts = 0;
+}
+
+int hdl_find_pin(const struct chip_def *chip, const char *name)
+{
+    for (unsigned i = 0; i < chip->npins; i++) {
+        if (!strcmp(chip->pins[i].name, name)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+bool hdl_has_pins(const struct chip_def *chip, const char *pins)
+{
+    char names[MAX_PINS * (MAX_NAME_LEN + 1)], *save;
+    unsigned n = 0;
+
+    strcpy(names, pins);
+    for (char *s = strtok_r(names, " ", &save); s; s = strtok_r(NULL, " ", &save)) {
+        if (hdl_find_pin(chip, s) < 0) {
+            return false;
+        }
+        n++;
+    }
+    return n == chip->npins;
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <stdbool.h>
+
+/*
+ * Parser of .hdl chip definitions:
+ *
+ *     CHIP Name {
+ *         IN a, b[16];
+ *         OUT out[16];
+ *         PARTS:
+ *         Part(pin=wire, pin[0..7]=wire[8..15], ...);
+ *     }
+ *
+ * where PARTS may be replaced by BUILTIN Name; and CLOCKED pins;
+ */
+
+#define MAX_NAME_LEN 63
+/* Max number of IN plus OUT pins of a chip. */
+#define MAX_PINS 64
+/* Widest bus. */
+#define MAX_WIDTH 16
+
+struct pin {
+    char name[MAX_NAME_LEN + 1];
+    unsigned width;
+    /* Whether the pin is sampled at the clock edge only. */
+    bool clocked;
+};
+
+/* A pin or wire, with the bits lo..hi if sub is set. */
+struct bus_ref {
+    char name[MAX_NAME_LEN + 1];
+    bool sub;
+    unsigned lo;
+    unsigned hi;
+};
+
+struct connection {
+    struct bus_ref pin;   /* of the part */
+    struct bus_ref wire;  /* of the chip */
+};
+
+struct part {
+    char chip[MAX_NAME_LEN + 1];
+    unsigned line;
+    struct connection *conns;
+    unsigned nconns;
+};
+
+struct chip_def {
+    char name[MAX_NAME_LEN + 1];
+    /* IN pins first, then OUT pins. */
+    struct pin pins[MAX_PINS];
+    unsigned nin;
+    unsigned npins;
+    struct part *parts;
+    unsigned nparts;
+    /* Name of the built-in implementation, or "" if the chip has parts. */
+    char builtin[MAX_NAME_LEN + 1];
+    /* Whether the chip keeps state across clock cycles. */
+    bool clocked;
+};
+
+
+/*
+ * Parse the chip definition in filename into chip.
+ *
+ * \retval - 0 on success, else an exit code with its message in errmsg.
+ */
+int hdl_parse(const char *filename, struct chip_def *chip, char *errmsg);
+
+/*
+ * Free the parts of a parsed chip.
+ */
+void hdl_free(struct chip_def *chip);
+
+/*
+ * Index of the pin called name in chip, or -1 if there is none.
+ */
+int hdl_find_pin(const struct chip_def *chip, const char *name);
+
+/*
+ * Whether chip has the pins named in pins, separated by spaces, and no others.
+ */
+bool hdl_has_pins(const struct chip_def *chip, const char *pins);
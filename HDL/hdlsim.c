@@ -0,0 +1,75 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+
+#include "batch.h"
+#include "exit.h"
+
+/*
+ * Simulator of the chips of projects/01 to 05, driven by .tst scripts like
+ * the HardwareSimulator of the tools. Each script runs its chip and compares
+ * the output with its .cmp file. Scripts run in parallel, on -j workers or
+ * one per CPU, and directories are searched for the scripts of chips, so
+ * that "hdlsim projects" runs the whole hardware suite.
+ *
+ * Built-in chips are looked up in tools/builtInChips next to the directory
+ * of the executable, unless -b gives another directory. Scripts that wait
+ * for the keyboard, like Memory.tst, get the keys given with -k, e.g. -k KY.
+ */
+
+/*
+ * The default directory of built-in chips, ../tools/builtInChips relative to
+ * the executable.
+ */
+static void default_builtin_dir(char *dir)
+{
+    char exe[PATH_MAX];
+    ssize_t n = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+    char *slash;
+
+    if (n <= 0) {
+        strcpy(dir, "tools/builtInChips");
+        return;
+    }
+    exe[n] = '\0';
+    slash = strrchr(exe, '/');
+    *slash = '\0';
+    snprintf(dir, PATH_MAX, "%.*s/../tools/builtInChips", PATH_MAX - 32, exe);
+}
+
+int main(int argc, char *argv[])
+{
+    char builtin_dir[PATH_MAX] = "";
+    const char *keys = "";
+    int njobs = 0;
+    int opt;
+
+    program_name = "hdlsim";
+
+    while ((opt = getopt(argc, argv, "b:k:j:")) != -1) {
+        switch (opt) {
+        case 'b':
+            snprintf(builtin_dir, sizeof(builtin_dir), "%s", optarg);
+            break;
+        case 'k':
+            keys = optarg;
+            break;
+        case 'j':
+            njobs = atoi(optarg);
+            break;
+        default:
+            exit_program(EXIT_INVALID_OPTION);
+        }
+    }
+
+    if (optind == argc) {
+        exit_program(EXIT_INVALID_OPTION);
+    }
+    if (!builtin_dir[0]) {
+        default_builtin_dir(builtin_dir);
+    }
+
+    return tst_batch(argc - optind, argv + optind, njobs, builtin_dir, keys);
+}
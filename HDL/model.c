@@ -0,0 +1,236 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "model.h"
+#include "netlist.h"
+#include "exit.h"
+
+struct model_type {
+    const char *name;
+    /* Names of the pins, separated by spaces. */
+    const char *pins;
+    enum model_kind kind;
+};
+
+static const struct model_type types[] = {
+    { "DFF", "in out", MODEL_REGISTER },
+    { "Bit", "in load out", MODEL_REGISTER },
+    { "Register", "in load out", MODEL_REGISTER },
+    { "ARegister", "in load out", MODEL_REGISTER },
+    { "DRegister", "in load out", MODEL_REGISTER },
+    { "PC", "in load inc reset out", MODEL_REGISTER },
+    { "RAM8", "in load address out", MODEL_RAM },
+    { "RAM64", "in load address out", MODEL_RAM },
+    { "RAM512", "in load address out", MODEL_RAM },
+    { "RAM4K", "in load address out", MODEL_RAM },
+    { "RAM16K", "in load address out", MODEL_RAM },
+    { "Screen", "in load address out", MODEL_RAM },
+    { "ROM32K", "address out", MODEL_ROM },
+    { "Keyboard", "out", MODEL_KEYBOARD },
+};
+
+
+const struct model_type *model_find(const char *name, const struct chip_def *chip)
+{
+    for (unsigned i = 0; i < sizeof(types) / sizeof(types[0]); i++) {
+        if (!strcmp(types[i].name, name) && hdl_has_pins(chip, types[i].pins)) {
+            return &types[i];
+        }
+    }
+    return NULL;
+}
+
+/*
+ * The n nets of the pin called name, padded with net, which is all of them
+ * if chip has no such pin.
+ */
+static void pin_nets(uint32_t *dst, unsigned n, const struct chip_def *chip, uint32_t *pins[],
+                     const char *name, uint32_t net)
+{
+    int i = hdl_find_pin(chip, name);
+
+    for (unsigned b = 0; b < n; b++) {
+        dst[b] = i >= 0 && b < chip->pins[i].width ? pins[i][b] : net;
+    }
+}
+
+void model_init(struct model *m, const struct model_type *type, const struct chip_def *chip,
+                uint32_t *pins[])
+{
+    int address = hdl_find_pin(chip, "address");
+
+    memset(m, 0, sizeof(*m));
+    m->kind = type->kind;
+    strcpy(m->name, chip->name);
+    m->width = chip->pins[hdl_find_pin(chip, "out")].width;
+    m->address_bits = address >= 0 ? chip->pins[address].width : 0;
+
+    pin_nets(m->in, MAX_WIDTH, chip, pins, "in", NET_FALSE);
+    pin_nets(m->out, MAX_WIDTH, chip, pins, "out", NET_FALSE);
+    pin_nets(m->address, MAX_WIDTH, chip, pins, "address", NET_FALSE);
+    // a DFF loads at every clock
+    pin_nets(&m->load, 1, chip, pins, "load", NET_TRUE);
+    pin_nets(&m->inc, 1, chip, pins, "inc", NET_FALSE);
+    pin_nets(&m->reset, 1, chip, pins, "reset", NET_FALSE);
+
+    if (model_reads(m)) {
+        unsigned npages = ((1u << m->address_bits) + PAGE_SIZE - 1) / PAGE_SIZE;
+
+        m->pages = calloc(npages, sizeof(uint16_t *));
+        if (m->pages == NULL) {
+            exit_program(EXIT_OUT_OF_MEMORY);
+        }
+    }
+}
+
+void model_free(struct model *m)
+{
+    if (m->pages) {
+        unsigned npages = ((1u << m->address_bits) + PAGE_SIZE - 1) / PAGE_SIZE;
+
+        for (unsigned i = 0; i < npages; i++) {
+            free(m->pages[i]);
+        }
+        free(m->pages);
+        m->pages = NULL;
+    }
+}
+
+bool model_reads(const struct model *m)
+{
+    return m->kind == MODEL_RAM || m->kind == MODEL_ROM;
+}
+
+void model_renumber(struct model *m, const uint32_t *id)
+{
+    for (unsigned b = 0; b < MAX_WIDTH; b++) {
+        m->in[b] = id[m->in[b]];
+        m->out[b] = id[m->out[b]];
+        m->address[b] = id[m->address[b]];
+    }
+    m->load = id[m->load];
+    m->inc = id[m->inc];
+    m->reset = id[m->reset];
+}
+
+/* The word on the n nets in lane. */
+static uint16_t word(const uint64_t *values, const uint32_t *nets, unsigned n, unsigned lane)
+{
+    uint16_t w = 0;
+
+    for (unsigned b = 0; b < n; b++) {
+        w |= ((values[nets[b]] >> lane) & 1) << b;
+    }
+    return w;
+}
+
+/* The word at address of a memory. */
+static uint16_t word_at(const struct model *m, unsigned address)
+{
+    address &= (1u << m->address_bits) - 1;
+
+    const uint16_t *page = m->pages[address >> PAGE_BITS];
+    return page ? page[address & (PAGE_SIZE - 1)] : 0;
+}
+
+/* Set the outputs to value in all lanes. */
+static void drive(const struct model *m, uint64_t *values, uint16_t value)
+{
+    for (unsigned b = 0; b < m->width; b++) {
+        values[m->out[b]] = (value >> b) & 1 ? ~(uint64_t) 0 : 0;
+    }
+}
+
+void model_read(const struct model *m, uint64_t *values, unsigned lanes)
+{
+    uint64_t bits[MAX_WIDTH] = { 0 };
+
+    for (unsigned lane = 0; lane < lanes; lane++) {
+        uint16_t w = word_at(m, word(values, m->address, m->address_bits, lane));
+
+        for (unsigned b = 0; b < m->width; b++) {
+            bits[b] |= (uint64_t) ((w >> b) & 1) << lane;
+        }
+    }
+    for (unsigned b = 0; b < m->width; b++) {
+        values[m->out[b]] = bits[b];
+    }
+}
+
+void model_tick(struct model *m, const uint64_t *values, unsigned lane)
+{
+    bool load = (values[m->load] >> lane) & 1;
+
+    switch (m->kind) {
+    case MODEL_REGISTER:
+        if ((values[m->reset] >> lane) & 1) {
+            m->next = 0;
+        } else if (load) {
+            m->next = word(values, m->in, m->width, lane);
+        } else if ((values[m->inc] >> lane) & 1) {
+            m->next = m->value + 1;
+        } else {
+            m->next = m->value;
+        }
+        break;
+    case MODEL_RAM:
+        m->write = load;
+        m->write_address = word(values, m->address, m->address_bits, lane);
+        m->write_value = word(values, m->in, m->width, lane);
+        break;
+    default:
+        break;
+    }
+}
+
+void model_tock(struct model *m, uint64_t *values)
+{
+    switch (m->kind) {
+    case MODEL_REGISTER:
+        if (m->next != m->value) {
+            m->value = m->next;
+            drive(m, values, m->value);
+        }
+        break;
+    case MODEL_RAM:
+        if (m->write) {
+            model_poke(m, m->write_address, m->write_value, values);
+            m->write = false;
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+uint16_t model_peek(const struct model *m, unsigned address)
+{
+    if (!model_reads(m)) {
+        return m->next;
+    }
+    if (m->write && m->write_address == (address & ((1u << m->address_bits) - 1))) {
+        return m->write_value;
+    }
+    return word_at(m, address);
+}
+
+void model_poke(struct model *m, unsigned address, uint16_t value, uint64_t *values)
+{
+    if (!model_reads(m)) {
+        m->value = m->next = value;
+        drive(m, values, value);
+        return;
+    }
+
+    address &= (1u << m->address_bits) - 1;
+    uint16_t **page = &m->pages[address >> PAGE_BITS];
+    if (*page == NULL) {
+        if (value == 0) {
+            return;
+        }
+        if ((*page = calloc(PAGE_SIZE, sizeof(uint16_t))) == NULL) {
+            exit_program(EXIT_OUT_OF_MEMORY);
+        }
+    }
+    (*page)[address & (PAGE_SIZE - 1)] = value;
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "hdl.h"
+
+/*
+ * Behavioral models of the clocked chips: registers (DFF, Bit, Register,
+ * ARegister, DRegister, PC), memories (RAM8 to RAM16K, Screen), ROM32K and
+ * Keyboard. Rather than flattening e.g. RAM16K into 262144 DFFs, the netlist
+ * keeps each of them as one model, which holds its state in plain variables.
+ *
+ * The outputs of registers depend on their state only, so they are sources
+ * of the netlist, like the chip's inputs. Memories and the ROM read the word
+ * at their address inputs, which makes them a gate of the netlist (see
+ * GATE_READ). Their words are kept in pages that are allocated when first
+ * written, so that a big memory costs only what is used of it.
+ *
+ * At a tick, models sample their inputs in one lane; at the following tock,
+ * they commit what they sampled.
+ */
+
+/* Words of a page of memory. */
+#define PAGE_BITS 8
+#define PAGE_SIZE (1u << PAGE_BITS)
+
+enum model_kind {
+    MODEL_REGISTER,
+    MODEL_RAM,
+    MODEL_ROM,
+    MODEL_KEYBOARD,
+};
+
+struct model_type;
+
+struct model {
+    enum model_kind kind;
+    /* Name of the chip, by which scripts refer to it, e.g. RAM16K[3] */
+    char name[MAX_NAME_LEN + 1];
+    unsigned width;
+    unsigned address_bits;
+
+    /* Nets of the pins, NET_FALSE or NET_TRUE if the chip has no such pin. */
+    uint32_t in[MAX_WIDTH];
+    uint32_t out[MAX_WIDTH];
+    uint32_t address[MAX_WIDTH];
+    uint32_t load;
+    uint32_t inc;
+    uint32_t reset;
+
+    /* Registers and the keyboard: the value, and the one sampled at a tick. */
+    uint16_t value;
+    uint16_t next;
+
+    /* Memories and the ROM: pages of words, NULL until written. */
+    uint16_t **pages;
+    /* A write sampled at a tick. */
+    bool write;
+    uint16_t write_address;
+    uint16_t write_value;
+};
+
+
+/*
+ * Find the model called name that fits the pins of chip.
+ *
+ * \retval - the model, or NULL if there is none.
+ */
+const struct model_type *model_find(const char *name, const struct chip_def *chip);
+
+/*
+ * Initialize m as a model of type, for chip whose pin i has the nets pins[i].
+ */
+void model_init(struct model *m, const struct model_type *type, const struct chip_def *chip,
+                uint32_t *pins[]);
+
+void model_free(struct model *m);
+
+/*
+ * Whether the outputs of m depend on its address inputs, i.e. whether it
+ * must be evaluated as a gate.
+ */
+bool model_reads(const struct model *m);
+
+/*
+ * Renumber the nets of m, from net to id[net].
+ */
+void model_renumber(struct model *m, const uint32_t *id);
+
+/*
+ * Set the outputs of a memory to the words at its address, in lanes 0 to
+ * lanes - 1.
+ */
+void model_read(const struct model *m, uint64_t *values, unsigned lanes);
+
+/*
+ * Clock up: sample the inputs in lane.
+ */
+void model_tick(struct model *m, const uint64_t *values, unsigned lane);
+
+/*
+ * Clock down: commit what the last tick sampled.
+ */
+void model_tock(struct model *m, uint64_t *values);
+
+/*
+ * The word at address of a memory, or the value of a register, as scripts
+ * see them: between a tick and a tock, that is what the tock will commit.
+ */
+uint16_t model_peek(const struct model *m, unsigned address);
+
+/*
+ * Set the word at address of a memory, or the value of a register.
+ */
+void model_poke(struct model *m, unsigned address, uint16_t value, uint64_t *values);
@@ -0,0 +1,715 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include "netlist.h"
+#include "builtin.h"
+#include "exit.h"
+
+/* Deepest nesting of parts, which catches chips that contain themselves. */
+#define MAX_DEPTH 64
+
+/* What drives a net. */
+enum source {
+    SOURCE_NONE,
+    SOURCE_CONSTANT,
+    SOURCE_INPUT,
+    SOURCE_STATE,
+    SOURCE_GATE,
+};
+
+/* A name in the scope of a chip's parts. */
+struct wire {
+    const char *name;
+    unsigned width;
+    /* The pin index, for the chip's own pins, or -1 for internal wires. */
+    int pin;
+    /* Whether some part output drives the wire. */
+    bool driven;
+    uint32_t nets[MAX_WIDTH];
+};
+
+struct scope {
+    struct wire *wires;
+    unsigned nwires;
+};
+
+
+void library_init(struct library *lib, const char *dir, const char *builtin_dir)
+{
+    memset(lib, 0, sizeof(*lib));
+    lib->dir = dir;
+    lib->builtin_dir = builtin_dir;
+}
+
+void library_free(struct library *lib)
+{
+    for (unsigned i = 0; i < lib->nchips; i++) {
+        hdl_free(lib->chips[i]);
+        free(lib->chips[i]);
+    }
+    free(lib->chips);
+    lib->chips = NULL;
+    lib->nchips = 0;
+}
+
+int library_get(struct library *lib, const char *name, const struct chip_def **chip,
+                char *errmsg)
+{
+    char path[PATH_MAX];
+    FILE *fp;
+
+    for (unsigned i = 0; i < lib->nchips; i++) {
+        if (!strcmp(lib->chips[i]->name, name)) {
+            *chip = lib->chips[i];
+            return 0;
+        }
+    }
+
+    // the chip's own directory comes first, then the built-in chips
+    snprintf(path, sizeof(path), "%s/%s.hdl", lib->dir, name);
+    if ((fp = fopen(path, "r")) == NULL) {
+        snprintf(path, sizeof(path), "%s/%s.hdl", lib->builtin_dir, name);
+        if ((fp = fopen(path, "r")) == NULL) {
+            return error_format(errmsg, EXIT_CHIP_NOT_FOUND, name);
+        }
+    }
+    fclose(fp);
+
+    if (lib->nchips == lib->max_chips) {
+        unsigned max = lib->max_chips ? 2 * lib->max_chips : 32;
+        struct chip_def **p = realloc(lib->chips, max * sizeof(*p));
+
+        if (p == NULL) {
+            return error_format(errmsg, EXIT_OUT_OF_MEMORY);
+        }
+        lib->chips = p;
+        lib->max_chips = max;
+    }
+
+    struct chip_def *def = malloc(sizeof(*def));
+    if (def == NULL) {
+        return error_format(errmsg, EXIT_OUT_OF_MEMORY);
+    }
+
+    int rc = hdl_parse(path, def, errmsg);
+    if (rc) {
+        free(def);
+        return rc;
+    }
+    if (strcmp(def->name, name)) {
+        rc = error_format(errmsg, EXIT_INVALID_CHIP, name, "File defines another chip");
+        hdl_free(def);
+        free(def);
+        return rc;
+    }
+
+    lib->chips[lib->nchips++] = def;
+    *chip = def;
+    return 0;
+}
+
+uint32_t net_new(struct netlist *nl)
+{
+    if (nl->nnets == nl->max_nets) {
+        unsigned max = nl->max_nets ? 2 * nl->max_nets : 1024;
+        uint32_t *p = realloc(nl->parent, max * sizeof(*p));
+
+        if (p == NULL) {
+            exit_program(EXIT_OUT_OF_MEMORY);
+        }
+        nl->parent = p;
+        nl->max_nets = max;
+    }
+    nl->parent[nl->nnets] = nl->nnets;
+    return nl->nnets++;
+}
+
+static uint32_t find(struct netlist *nl, uint32_t net)
+{
+    while (nl->parent[net] != net) {
+        nl->parent[net] = nl->parent[nl->parent[net]];
+        net = nl->parent[net];
+    }
+    return net;
+}
+
+void net_join(struct netlist *nl, uint32_t a, uint32_t b)
+{
+    a = find(nl, a);
+    b = find(nl, b);
+
+    // constants stay the roots of their sets
+    if (a < b) {
+        nl->parent[b] = a;
+    } else {
+        nl->parent[a] = b;
+    }
+}
+
+void gate_to(struct netlist *nl, enum gate_op op, uint32_t out,
+             uint32_t a, uint32_t b, uint32_t c)
+{
+    if (nl->ngates == nl->max_gates) {
+        unsigned max = nl->max_gates ? 2 * nl->max_gates : 1024;
+        struct gate *p = realloc(nl->gates, max * sizeof(*p));
+
+        if (p == NULL) {
+            exit_program(EXIT_OUT_OF_MEMORY);
+        }
+        nl->gates = p;
+        nl->max_gates = max;
+    }
+    nl->gates[nl->ngates++] = (struct gate) { .op = op, .in = { a, b, c }, .out = out };
+}
+
+uint32_t gate(struct netlist *nl, enum gate_op op, uint32_t a, uint32_t b, uint32_t c)
+{
+    uint32_t out = net_new(nl);
+
+    gate_to(nl, op, out, a, b, c);
+    return out;
+}
+
+static struct wire *scope_find(struct scope *scope, const char *name)
+{
+    for (unsigned i = 0; i < scope->nwires; i++) {
+        if (!strcmp(scope->wires[i].name, name)) {
+            return &scope->wires[i];
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Resolve the bits lo..hi of ref, a pin or wire of the given width.
+ */
+static bool bits(const struct bus_ref *ref, unsigned width, unsigned *lo, unsigned *hi)
+{
+    *lo = ref->sub ? ref->lo : 0;
+    *hi = ref->sub ? ref->hi : width - 1;
+
+    return *hi < width;
+}
+
+static bool is_constant(const char *name)
+{
+    return !strcmp(name, "true") || !strcmp(name, "false");
+}
+
+static int part_error(char *errmsg, const struct chip_def *chip, const struct part *part,
+                      const char *what, const char *name)
+{
+    char msg[MAX_ERROR_LEN + 1];
+
+    snprintf(msg, sizeof(msg), "%s %s, in part %s at line %u", what, name, part->chip, part->line);
+    return error_format(errmsg, EXIT_INVALID_CHIP, chip->name, msg);
+}
+
+static void add_model(struct netlist *nl, const struct model_type *type,
+                      const struct chip_def *chip, uint32_t *pins[])
+{
+    if (nl->nmodels == nl->max_models) {
+        unsigned max = nl->max_models ? 2 * nl->max_models : 16;
+        struct model *p = realloc(nl->models, max * sizeof(*p));
+
+        if (p == NULL) {
+            exit_program(EXIT_OUT_OF_MEMORY);
+        }
+        nl->models = p;
+        nl->max_models = max;
+    }
+
+    struct model *m = &nl->models[nl->nmodels];
+    model_init(m, type, chip, pins);
+    if (model_reads(m)) {
+        gate_to(nl, GATE_READ, NET_FALSE, nl->nmodels, NET_FALSE, NET_FALSE);
+    }
+    nl->nmodels++;
+}
+
+static int instantiate(struct netlist *nl, struct library *lib, const struct chip_def *chip,
+                       uint32_t *pins[], unsigned depth, char *errmsg);
+
+/*
+ * Declare the internal wires of chip, with the width of the part outputs
+ * that drive them, and give them nets.
+ */
+static int declare_wires(struct netlist *nl, struct library *lib, const struct chip_def *chip,
+                         struct scope *scope, char *errmsg)
+{
+    for (unsigned p = 0; p < chip->nparts; p++) {
+        const struct part *part = &chip->parts[p];
+        const struct chip_def *def;
+        int rc = library_get(lib, part->chip, &def, errmsg);
+
+        if (rc) {
+            return rc;
+        }
+
+        for (unsigned c = 0; c < part->nconns; c++) {
+            const struct connection *conn = &part->conns[c];
+            int pi = hdl_find_pin(def, conn->pin.name);
+            unsigned lo, hi;
+
+            if (pi < 0) {
+                return part_error(errmsg, chip, part, "Unknown pin", conn->pin.name);
+            }
+            if (!bits(&conn->pin, def->pins[pi].width, &lo, &hi)) {
+                return part_error(errmsg, chip, part, "Sub bus out of range of", conn->pin.name);
+            }
+            if ((unsigned) pi < def->nin) {
+                continue;
+            }
+
+            if (is_constant(conn->wire.name)) {
+                return part_error(errmsg, chip, part, "Output connected to", conn->wire.name);
+            }
+
+            struct wire *w = scope_find(scope, conn->wire.name);
+            if (w == NULL) {
+                w = &scope->wires[scope->nwires++];
+                *w = (struct wire) { .name = conn->wire.name, .pin = -1 };
+            } else if (w->pin >= 0 && (unsigned) w->pin < chip->nin) {
+                return part_error(errmsg, chip, part, "Output connected to input pin", w->name);
+            }
+            if (w->pin < 0 && !conn->wire.sub && hi - lo + 1 > w->width) {
+                w->width = hi - lo + 1;
+            }
+            w->driven = true;
+        }
+    }
+
+    for (unsigned i = 0; i < scope->nwires; i++) {
+        struct wire *w = &scope->wires[i];
+
+        if (w->pin < 0) {
+            for (unsigned b = 0; b < w->width; b++) {
+                w->nets[b] = net_new(nl);
+            }
+        }
+    }
+    return 0;
+}
+
+/*
+ * Connect the pins of a part to the wires of chip, and flatten it.
+ */
+static int connect_part(struct netlist *nl, struct library *lib, const struct chip_def *chip,
+                        const struct part *part, struct scope *scope, unsigned depth,
+                        char *errmsg)
+{
+    const struct chip_def *def;
+    uint32_t nets[MAX_PINS][MAX_WIDTH];
+    uint32_t *pins[MAX_PINS];
+    int rc = library_get(lib, part->chip, &def, errmsg);
+
+    if (rc) {
+        return rc;
+    }
+
+    // inputs are false unless connected, outputs may go nowhere
+    for (unsigned i = 0; i < def->npins; i++) {
+        for (unsigned b = 0; b < def->pins[i].width; b++) {
+            nets[i][b] = i < def->nin ? NET_FALSE : net_new(nl);
+        }
+        pins[i] = nets[i];
+    }
+
+    for (unsigned c = 0; c < part->nconns; c++) {
+        const struct connection *conn = &part->conns[c];
+        unsigned pi = hdl_find_pin(def, conn->pin.name);
+        unsigned lo, hi, wlo, whi;
+        uint32_t constant[MAX_WIDTH];
+        const uint32_t *wire_nets = constant;
+
+        bits(&conn->pin, def->pins[pi].width, &lo, &hi);
+
+        if (is_constant(conn->wire.name)) {
+            for (unsigned b = 0; b < MAX_WIDTH; b++) {
+                constant[b] = conn->wire.name[0] == 't' ? NET_TRUE : NET_FALSE;
+            }
+            wlo = 0;
+            whi = hi - lo;
+        } else {
+            struct wire *w = scope_find(scope, conn->wire.name);
+
+            if (w == NULL || (w->pin < 0 && !w->driven)) {
+                return part_error(errmsg, chip, part, "Undriven pin", conn->wire.name);
+            }
+            if (!bits(&conn->wire, w->width, &wlo, &whi)) {
+                return part_error(errmsg, chip, part, "Sub bus out of range of", w->name);
+            }
+            wire_nets = w->nets;
+        }
+
+        if (hi - lo != whi - wlo) {
+            return part_error(errmsg, chip, part, "Width mismatch of", conn->pin.name);
+        }
+
+        for (unsigned b = 0; b <= hi - lo; b++) {
+            if (pi < def->nin) {
+                nets[pi][lo + b] = wire_nets[wlo + b];
+            } else {
+                net_join(nl, nets[pi][lo + b], wire_nets[wlo + b]);
+            }
+        }
+    }
+
+    return instantiate(nl, lib, def, pins, depth + 1, errmsg);
+}
+
+/*
+ * Add the gates of chip, whose pins are connected to the given nets.
+ */
+static int instantiate(struct netlist *nl, struct library *lib, const struct chip_def *chip,
+                       uint32_t *pins[], unsigned depth, char *errmsg)
+{
+    const char *name = chip->builtin[0] ? chip->builtin : chip->name;
+    const struct model_type *type = NULL;
+
+    // registers and memories below the chip under test are models
+    if (chip->builtin[0] || depth > 0) {
+        type = model_find(name, chip);
+    }
+    if (type) {
+        add_model(nl, type, chip, pins);
+        return 0;
+    }
+
+    if (chip->builtin[0]) {
+        builtin_fn fn = builtin_find(chip->builtin, chip);
+
+        if (fn == NULL) {
+            return error_format(errmsg, EXIT_INVALID_CHIP, chip->name,
+                                "No such built-in implementation");
+        }
+        fn(nl, chip, pins);
+        return 0;
+    }
+
+    if (depth == MAX_DEPTH) {
+        return error_format(errmsg, EXIT_INVALID_CHIP, chip->name, "Parts nested too deep");
+    }
+
+    // the chip's pins, plus at most one internal wire per part output
+    unsigned max = chip->npins;
+    for (unsigned p = 0; p < chip->nparts; p++) {
+        max += chip->parts[p].nconns;
+    }
+
+    struct scope scope = { .wires = malloc(max * sizeof(struct wire)) };
+    if (scope.wires == NULL) {
+        return error_format(errmsg, EXIT_OUT_OF_MEMORY);
+    }
+
+    for (unsigned i = 0; i < chip->npins; i++) {
+        struct wire *w = &scope.wires[scope.nwires++];
+
+        *w = (struct wire) { .name = chip->pins[i].name, .width = chip->pins[i].width, .pin = i };
+        memcpy(w->nets, pins[i], w->width * sizeof(uint32_t));
+    }
+
+    int rc = declare_wires(nl, lib, chip, &scope, errmsg);
+
+    for (unsigned p = 0; p < chip->nparts && !rc; p++) {
+        rc = connect_part(nl, lib, chip, &chip->parts[p], &scope, depth, errmsg);
+    }
+
+    free(scope.wires);
+    return rc;
+}
+
+/*
+ * The nets that a gate reads, or drives.
+ */
+static unsigned gate_inputs(const struct netlist *nl, const struct gate *g, const uint32_t **nets)
+{
+    if (g->op == GATE_READ) {
+        *nets = nl->models[g->in[0]].address;
+        return nl->models[g->in[0]].address_bits;
+    }
+    *nets = g->in;
+    return 3;
+}
+
+static unsigned gate_outputs(const struct netlist *nl, const struct gate *g, const uint32_t **nets)
+{
+    if (g->op == GATE_READ) {
+        *nets = nl->models[g->in[0]].out;
+        return nl->models[g->in[0]].width;
+    }
+    *nets = &g->out;
+    return 1;
+}
+
+/*
+ * Merge connected nets, check that each has at most one source, and sort
+ * the gates so that each comes after those driving its inputs.
+ */
+static int levelize(struct netlist *nl, char *errmsg)
+{
+    unsigned nnets = nl->nnets, ngates = nl->ngates;
+    uint32_t *id = malloc(nnets * sizeof(uint32_t));
+    uint8_t *source = calloc(nnets, 1);
+    int32_t *driver = malloc(nnets * sizeof(int32_t));
+    unsigned *level = calloc(ngates, sizeof(unsigned));
+    unsigned *count = NULL;
+    struct gate *sorted = malloc(ngates * sizeof(struct gate) + 1);
+    unsigned n = 0, nlevels = 0;
+    int rc = 0;
+
+    if (!id || !source || !driver || !level || !sorted) {
+        rc = error_format(errmsg, EXIT_OUT_OF_MEMORY);
+        goto out;
+    }
+
+    // number the sets of connected nets densely, constants first
+    for (unsigned i = 0; i < nnets; i++) {
+        if (find(nl, i) == i) {
+            id[i] = n++;
+        }
+    }
+    for (unsigned i = 0; i < nnets; i++) {
+        id[i] = id[find(nl, i)];
+    }
+
+    source[id[NET_FALSE]] = SOURCE_CONSTANT;
+    if (source[id[NET_TRUE]]) {
+        rc = error_format(errmsg, EXIT_INVALID_CHIP, nl->top->name, "Pin connected to true and false");
+        goto out;
+    }
+    source[id[NET_TRUE]] = SOURCE_CONSTANT;
+
+    for (unsigned i = 0; i < nl->top->nin; i++) {
+        for (unsigned b = 0; b < nl->top->pins[i].width; b++) {
+            source[id[nl->pins[i][b]]] = SOURCE_INPUT;
+        }
+    }
+
+    // registers are sources, like the inputs
+    for (unsigned i = 0; i < nl->nmodels; i++) {
+        struct model *m = &nl->models[i];
+
+        model_renumber(m, id);
+        for (unsigned b = 0; b < m->width && !model_reads(m); b++) {
+            if (source[m->out[b]]) {
+                rc = error_format(errmsg, EXIT_INVALID_CHIP, nl->top->name, "Pin with more than one source");
+                goto out;
+            }
+            source[m->out[b]] = SOURCE_STATE;
+        }
+    }
+
+    for (unsigned g = 0; g < ngates; g++) {
+        struct gate *gate = &nl->gates[g];
+        const uint32_t *outs;
+
+        if (gate->op != GATE_READ) {
+            for (unsigned k = 0; k < 3; k++) {
+                gate->in[k] = id[gate->in[k]];
+            }
+            gate->out = id[gate->out];
+        }
+        for (unsigned k = 0, nouts = gate_outputs(nl, gate, &outs); k < nouts; k++) {
+            if (source[outs[k]]) {
+                rc = error_format(errmsg, EXIT_INVALID_CHIP, nl->top->name, "Pin with more than one source");
+                goto out;
+            }
+            source[outs[k]] = SOURCE_GATE;
+            driver[outs[k]] = g;
+        }
+    }
+
+    for (unsigned i = 0; i < nl->top->npins; i++) {
+        for (unsigned b = 0; b < nl->top->pins[i].width; b++) {
+            nl->pins[i][b] = id[nl->pins[i][b]];
+        }
+    }
+
+    /*
+     * The level of a gate is one more than that of the gates driving its
+     * inputs. Gates come in the order they were flattened, which mostly
+     * follows the signals, so a few passes settle the levels.
+     */
+    for (unsigned pass = 0, changed = 1; changed; pass++) {
+        if (pass > ngates) {
+            rc = error_format(errmsg, EXIT_INVALID_CHIP, nl->top->name, "Combinational loop");
+            goto out;
+        }
+        changed = 0;
+        for (unsigned g = 0; g < ngates; g++) {
+            const uint32_t *ins;
+
+            for (unsigned k = 0, nins = gate_inputs(nl, &nl->gates[g], &ins); k < nins; k++) {
+                uint32_t in = ins[k];
+
+                if (source[in] == SOURCE_GATE && level[driver[in]] + 1 > level[g]) {
+                    level[g] = level[driver[in]] + 1;
+                    changed = 1;
+                }
+            }
+            if (level[g] + 1 > nlevels) {
+                nlevels = level[g] + 1;
+            }
+        }
+    }
+
+    // counting sort by level
+    count = calloc(nlevels + 1, sizeof(unsigned));
+    if (count == NULL) {
+        rc = error_format(errmsg, EXIT_OUT_OF_MEMORY);
+        goto out;
+    }
+    for (unsigned g = 0; g < ngates; g++) {
+        count[level[g] + 1]++;
+    }
+    for (unsigned l = 0; l < nlevels; l++) {
+        count[l + 1] += count[l];
+    }
+    for (unsigned g = 0; g < ngates; g++) {
+        sorted[count[level[g]]++] = nl->gates[g];
+    }
+
+    free(nl->gates);
+    nl->gates = sorted;
+    nl->max_gates = ngates;
+    sorted = NULL;
+    nl->nnets = n;
+
+out:
+    free(id);
+    free(source);
+    free(driver);
+    free(level);
+    free(count);
+    free(sorted);
+    return rc;
+}
+
+int netlist_build(struct netlist *nl, struct library *lib, const char *name, char *errmsg)
+{
+    uint32_t *pins[MAX_PINS];
+    int rc;
+
+    memset(nl, 0, sizeof(*nl));
+    net_new(nl);  // NET_FALSE
+    net_new(nl);  // NET_TRUE
+
+    if ((rc = library_get(lib, name, &nl->top, errmsg))) {
+        return rc;
+    }
+
+    for (unsigned i = 0; i < nl->top->npins; i++) {
+        for (unsigned b = 0; b < nl->top->pins[i].width; b++) {
+            nl->pins[i][b] = net_new(nl);
+        }
+        pins[i] = nl->pins[i];
+    }
+
+    if ((rc = instantiate(nl, lib, nl->top, pins, 0, errmsg)) || (rc = levelize(nl, errmsg))) {
+        return rc;
+    }
+
+    free(nl->parent);
+    nl->parent = NULL;
+
+    nl->values = calloc(nl->nnets, sizeof(uint64_t));
+    if (nl->values == NULL) {
+        return error_format(errmsg, EXIT_OUT_OF_MEMORY);
+    }
+    nl->values[NET_TRUE] = ~(uint64_t) 0;
+
+    return 0;
+}
+
+void netlist_free(struct netlist *nl)
+{
+    for (unsigned i = 0; i < nl->nmodels; i++) {
+        model_free(&nl->models[i]);
+    }
+    free(nl->models);
+    free(nl->gates);
+    free(nl->parent);
+    free(nl->values);
+    memset(nl, 0, sizeof(*nl));
+}
+
+void netlist_eval(struct netlist *nl, unsigned lanes)
+{
+    uint64_t *v = nl->values;
+
+    for (const struct gate *g = nl->gates, *end = g + nl->ngates; g < end; g++) {
+        const uint32_t *in = g->in;
+
+        switch (g->op) {
+        case GATE_NAND:
+            v[g->out] = ~(v[in[0]] & v[in[1]]);
+            break;
+        case GATE_NOT:
+            v[g->out] = ~v[in[0]];
+            break;
+        case GATE_AND:
+            v[g->out] = v[in[0]] & v[in[1]];
+            break;
+        case GATE_OR:
+            v[g->out] = v[in[0]] | v[in[1]];
+            break;
+        case GATE_XOR:
+            v[g->out] = v[in[0]] ^ v[in[1]];
+            break;
+        case GATE_MUX:
+            v[g->out] = (v[in[0]] & ~v[in[2]]) | (v[in[1]] & v[in[2]]);
+            break;
+        case GATE_READ:
+            model_read(&nl->models[in[0]], v, lanes);
+            break;
+        }
+    }
+}
+
+void netlist_tick(struct netlist *nl, unsigned lane)
+{
+    for (unsigned i = 0; i < nl->nmodels; i++) {
+        model_tick(&nl->models[i], nl->values, lane);
+    }
+}
+
+void netlist_tock(struct netlist *nl)
+{
+    for (unsigned i = 0; i < nl->nmodels; i++) {
+        model_tock(&nl->models[i], nl->values);
+    }
+}
+
+struct model *netlist_model(struct netlist *nl, const char *name)
+{
+    for (unsigned i = 0; i < nl->nmodels; i++) {
+        if (!strcmp(nl->models[i].name, name)) {
+            return &nl->models[i];
+        }
+    }
+    return NULL;
+}
+
+void netlist_set(struct netlist *nl, unsigned pin, unsigned lane, uint16_t value)
+{
+    uint64_t bit = (uint64_t) 1 << lane;
+
+    for (unsigned b = 0; b < nl->top->pins[pin].width; b++) {
+        uint64_t *v = &nl->values[nl->pins[pin][b]];
+
+        *v = (value >> b) & 1 ? *v | bit : *v & ~bit;
+    }
+}
+
+uint16_t netlist_get(const struct netlist *nl, unsigned pin, unsigned lane)
+{
+    uint16_t value = 0;
+
+    for (unsigned b = 0; b < nl->top->pins[pin].width; b++) {
+        value |= ((nl->values[nl->pins[pin][b]] >> lane) & 1) << b;
+    }
+    return value;
+}
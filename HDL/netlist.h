@@ -0,0 +1,149 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "hdl.h"
+#include "model.h"
+
+/*
+ * Flat gate level netlist of a chip. Chips defined in HDL are flattened
+ * recursively down to Nand and the built-in chips (see builtin.h), which
+ * expand to primitive gates. Gates are then sorted by level, so that one
+ * pass over them evaluates the whole chip.
+ *
+ * Every net holds 64 bits, one per independent test vector ("lane"), so
+ * that a pass evaluates the chip for 64 input combinations at once.
+ *
+ * Clocked chips are behavioral models (see model.h), and so are the parts
+ * that are registers or memories by name and pins, even if defined in HDL,
+ * e.g. the RAM8 parts of a RAM64. The chip under test is always simulated
+ * from its own parts.
+ */
+
+/* Lanes evaluated by one pass. */
+#define LANES 64
+
+/* Nets of the constants false and true. */
+#define NET_FALSE 0
+#define NET_TRUE  1
+
+enum gate_op {
+    GATE_NAND,
+    GATE_NOT,
+    GATE_AND,
+    GATE_OR,
+    GATE_XOR,
+    GATE_MUX,   /* in[0] if in[2] is 0, else in[1] */
+    GATE_READ,  /* the memory model in[0] reads the word at its address */
+};
+
+struct gate {
+    uint8_t op;
+    uint32_t in[3];
+    uint32_t out;
+};
+
+/*
+ * Chip definitions by name, loaded on first use from the directory of the
+ * chip under test, or else from the directory of built-in chips.
+ */
+struct library {
+    const char *dir;
+    const char *builtin_dir;
+    struct chip_def **chips;
+    unsigned nchips;
+    unsigned max_chips;
+};
+
+struct netlist {
+    const struct chip_def *top;
+    /* Nets of each bit of each pin of the top chip. */
+    uint32_t pins[MAX_PINS][MAX_WIDTH];
+
+    struct gate *gates;
+    unsigned ngates;
+    unsigned max_gates;
+
+    unsigned nnets;
+    unsigned max_nets;
+    /* Union-find forest of nets connected by wires, while flattening. */
+    uint32_t *parent;
+
+    struct model *models;
+    unsigned nmodels;
+    unsigned max_models;
+
+    uint64_t *values;
+};
+
+
+void library_init(struct library *lib, const char *dir, const char *builtin_dir);
+
+void library_free(struct library *lib);
+
+/*
+ * Find the chip called name, loading it if needed.
+ *
+ * \retval - 0 on success, else an exit code with its message in errmsg.
+ */
+int library_get(struct library *lib, const char *name, const struct chip_def **chip,
+                char *errmsg);
+
+/*
+ * Flatten the chip called name into nl.
+ *
+ * \retval - 0 on success, else an exit code with its message in errmsg.
+ */
+int netlist_build(struct netlist *nl, struct library *lib, const char *name, char *errmsg);
+
+void netlist_free(struct netlist *nl);
+
+/*
+ * Evaluate all gates, in lanes 0 to lanes - 1.
+ */
+void netlist_eval(struct netlist *nl, unsigned lanes);
+
+/*
+ * Clock up: the clocked chips sample their inputs in lane.
+ */
+void netlist_tick(struct netlist *nl, unsigned lane);
+
+/*
+ * Clock down: the clocked chips commit what they sampled, which changes
+ * their outputs in all lanes.
+ */
+void netlist_tock(struct netlist *nl);
+
+/*
+ * The model of the first part that is a chip called name, or NULL if there
+ * is none.
+ */
+struct model *netlist_model(struct netlist *nl, const char *name);
+
+/*
+ * Set the top chip's pin to value in a lane.
+ */
+void netlist_set(struct netlist *nl, unsigned pin, unsigned lane, uint16_t value);
+
+/*
+ * Value of the top chip's pin in a lane.
+ */
+uint16_t netlist_get(const struct netlist *nl, unsigned pin, unsigned lane);
+
+/*
+ * Functions for built-in chips, to add gates and nets while flattening.
+ */
+
+/* A new net. */
+uint32_t net_new(struct netlist *nl);
+
+/* Connect nets a and b, which makes them one. */
+void net_join(struct netlist *nl, uint32_t a, uint32_t b);
+
+/* Add a gate driving the net out. */
+void gate_to(struct netlist *nl, enum gate_op op, uint32_t out,
+             uint32_t a, uint32_t b, uint32_t c);
+
+/* Add a gate driving a new net, which is returned. */
+uint32_t gate(struct netlist *nl, enum gate_op op, uint32_t a, uint32_t b, uint32_t c);
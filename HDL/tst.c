@@ -0,0 +1,944 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <limits.h>
+
+#include "tst.h"
+#include "netlist.h"
+#include "files.h"
+#include "exit.h"
+
+#define MAX_TOKEN_LEN 255
+/* Max number of columns in an output-list. */
+#define MAX_COLUMNS 64
+
+struct lexer {
+    const char *p;
+    unsigned line;
+    char tok[MAX_TOKEN_LEN + 1];
+};
+
+/* What a script refers to by name: a pin, the time, or the state of a part. */
+struct ref {
+    enum {
+        REF_PIN,
+        REF_TIME,
+        REF_MODEL,
+    } kind;
+    unsigned pin;
+    /* e.g. RAM16K[3] or DRegister[] */
+    struct model *model;
+    unsigned address;
+};
+
+/* A column of the output, e.g. out%D1.6.1 */
+struct column {
+    char name[MAX_NAME_LEN + 1];
+    struct ref ref;
+    char format;
+    unsigned lpad;
+    unsigned len;
+    unsigned rpad;
+};
+
+/* An output command of the current batch. */
+struct row {
+    uint16_t inputs[MAX_PINS];
+    /* The lane of the last eval, or -1 for the outputs of an earlier batch. */
+    int lane;
+    unsigned time;
+};
+
+struct tst {
+    const char *filename;
+    char dir[PATH_MAX];
+    /* Keys for the keyboard to press, one per while loop. */
+    const char *keys;
+    char *errmsg;
+    struct lexer lx;
+
+    struct library lib;
+    struct netlist nl;
+    bool loaded;
+
+    struct column columns[MAX_COLUMNS];
+    unsigned ncolumns;
+
+    /* Values set by the script. */
+    uint16_t inputs[MAX_PINS];
+    /* Outputs of the last eval before the current batch. */
+    uint16_t outputs[MAX_PINS];
+    unsigned lanes;
+    int last_lane;
+    struct row *rows;
+    unsigned nrows;
+    unsigned max_rows;
+    /* Half clock cycles since the start, odd after a tick. */
+    unsigned time;
+
+    /* The output, a line at a time. */
+    FILE *output_file;
+    char *out;
+    size_t out_len;
+    size_t out_max;
+    /* The compare file, how much of it was compared, and its line there. */
+    const char *cmp;
+    size_t cmp_len;
+    size_t cmp_pos;
+    unsigned cmp_line;
+    /* Exit code of a comparison failure, which ends the script. */
+    int failure;
+};
+
+
+static int syntax_error(struct tst *t, const char *msg)
+{
+    return error_format(t->errmsg, EXIT_TST_SYNTAX, t->filename, t->lx.line, msg);
+}
+
+/*
+ * Read the next token into lx->tok: a word, a string with its quotes, one
+ * of , ; ! { } or "" at the end of the script.
+ */
+static void next(struct lexer *lx)
+{
+    const char *p = lx->p;
+    size_t n = 0;
+
+    for (;;) {
+        while (isspace((unsigned char) *p)) {
+            lx->line += *p++ == '\n';
+        }
+        if (p[0] == '/' && p[1] == '/') {
+            while (*p && *p != '\n') {
+                p++;
+            }
+        } else if (p[0] == '/' && p[1] == '*') {
+            for (p += 2; *p && !(p[0] == '*' && p[1] == '/'); p++) {
+                lx->line += *p == '\n';
+            }
+            p += *p ? 2 : 0;
+        } else {
+            break;
+        }
+    }
+
+    if (*p == '"') {
+        do {
+            lx->tok[n++] = *p++;
+        } while (*p && *p != '"' && *p != '\n' && n < MAX_TOKEN_LEN - 1);
+        if (*p == '"') {
+            lx->tok[n++] = *p++;
+        }
+    } else if (*p && strchr(",;!{}", *p)) {
+        lx->tok[n++] = *p++;
+    } else {
+        while (*p && !isspace((unsigned char) *p) && !strchr(",;!{}\"", *p) && n < MAX_TOKEN_LEN) {
+            lx->tok[n++] = *p++;
+        }
+    }
+
+    lx->tok[n] = '\0';
+    lx->p = p;
+}
+
+static bool accept(struct lexer *lx, const char *tok)
+{
+    if (strcmp(lx->tok, tok)) {
+        return false;
+    }
+    next(lx);
+    return true;
+}
+
+static void append(struct tst *t, const char *s, size_t n)
+{
+    if (t->out_len + n + 1 > t->out_max) {
+        size_t max = t->out_max ? 2 * t->out_max : 65536;
+
+        while (max < t->out_len + n + 1) {
+            max *= 2;
+        }
+        char *p = realloc(t->out, max);
+        if (p == NULL) {
+            exit_program(EXIT_OUT_OF_MEMORY);
+        }
+        t->out = p;
+        t->out_max = max;
+    }
+    memcpy(t->out + t->out_len, s, n);
+    t->out_len += n;
+    t->out[t->out_len] = '\0';
+}
+
+static void append_spaces(struct tst *t, unsigned n)
+{
+    while (n--) {
+        append(t, " ", 1);
+    }
+}
+
+/*
+ * End the current line of output: write it to the output file, and compare
+ * it with the next line of the compare file, where '*' matches any char.
+ * The first mismatch is reported with the line and the output column.
+ */
+static void end_line(struct tst *t)
+{
+    const char *c = t->cmp + t->cmp_pos;
+    size_t clen = 0, i = 0;
+
+    if (t->failure) {
+        return;
+    }
+    if (t->output_file) {
+        fwrite(t->out, 1, t->out_len, t->output_file);
+        fputc('\n', t->output_file);
+    }
+
+    if (t->cmp) {
+        while (t->cmp_pos + clen < t->cmp_len && c[clen] != '\n' && c[clen] != '\r') {
+            clen++;
+        }
+        while (i < t->out_len && i < clen && (c[i] == '*' || c[i] == t->out[i])) {
+            i++;
+        }
+        t->cmp_line++;
+
+        if (i < t->out_len || i < clen) {
+            unsigned column = 0;
+
+            for (size_t k = 1; k < i && k < t->out_len; k++) {
+                column += t->out[k] == '|';
+            }
+            if (column >= t->ncolumns) {
+                column = t->ncolumns - 1;
+            }
+            t->failure = error_format(t->errmsg, EXIT_COMPARISON_FAILURE, t->filename,
+                                      t->cmp_line, t->columns[column].name);
+        }
+
+        t->cmp_pos += clen;
+        t->cmp_pos += t->cmp_pos < t->cmp_len && t->cmp[t->cmp_pos] == '\r';
+        t->cmp_pos += t->cmp_pos < t->cmp_len && t->cmp[t->cmp_pos] == '\n';
+    }
+
+    t->out_len = 0;
+}
+
+/*
+ * Parse a value: decimal, or %B binary, %X hex, %D decimal.
+ */
+static bool parse_value(const char *s, int32_t *value)
+{
+    int base = 10;
+    char *end;
+
+    if (s[0] == '%') {
+        switch (s[1]) {
+        case 'B':
+            base = 2;
+            break;
+        case 'X':
+            base = 16;
+            break;
+        case 'D':
+            break;
+        default:
+            return false;
+        }
+        s += 2;
+    }
+    *value = strtol(s, &end, base);
+
+    return *s && !*end;
+}
+
+/*
+ * Resolve the n chars of s: a pin, time, or the state of a part as
+ * Part[address] or Part[].
+ */
+static int parse_ref(struct tst *t, const char *s, size_t n, struct ref *ref)
+{
+    char name[MAX_NAME_LEN + 1];
+    const char *bracket = memchr(s, '[', n);
+    size_t len = bracket ? (size_t) (bracket - s) : n;
+
+    if (len == 0 || len > MAX_NAME_LEN) {
+        return syntax_error(t, "Invalid pin name");
+    }
+    memcpy(name, s, len);
+    name[len] = '\0';
+
+    if (bracket) {
+        char *end;
+
+        ref->kind = REF_MODEL;
+        ref->address = strtoul(bracket + 1, &end, 10);
+        if (end != s + n - 1 || *end != ']') {
+            return syntax_error(t, "Invalid part reference");
+        }
+        if ((ref->model = netlist_model(&t->nl, name)) == NULL) {
+            return syntax_error(t, "Unknown part");
+        }
+        return 0;
+    }
+
+    if (!strcmp(name, "time")) {
+        ref->kind = REF_TIME;
+        return 0;
+    }
+
+    int pin = hdl_find_pin(t->nl.top, name);
+    if (pin < 0) {
+        return syntax_error(t, "Unknown pin");
+    }
+    ref->kind = REF_PIN;
+    ref->pin = pin;
+    return 0;
+}
+
+/* Width of what ref refers to. */
+static unsigned ref_width(const struct tst *t, const struct ref *ref)
+{
+    switch (ref->kind) {
+    case REF_PIN:
+        return t->nl.top->pins[ref->pin].width;
+    case REF_MODEL:
+        return ref->model->width;
+    default:
+        return 16;
+    }
+}
+
+/*
+ * Parse name%F<lpad>.<len>.<rpad>, or a plain name with the default format.
+ */
+static int parse_column(struct tst *t, const char *s, struct column *c)
+{
+    const char *fmt = strchr(s, '%');
+    size_t n = fmt ? (size_t) (fmt - s) : strlen(s);
+    int rc;
+
+    if (n == 0 || n > MAX_NAME_LEN) {
+        return syntax_error(t, "Invalid output column");
+    }
+    memcpy(c->name, s, n);
+    c->name[n] = '\0';
+
+    if ((rc = parse_ref(t, s, n, &c->ref))) {
+        return rc;
+    }
+
+    if (fmt == NULL) {
+        c->format = 'B';
+        c->lpad = c->rpad = 1;
+        c->len = ref_width(t, &c->ref);
+        return 0;
+    }
+
+    if (sscanf(fmt, "%%%c%u.%u.%u", &c->format, &c->lpad, &c->len, &c->rpad) != 4 ||
+        !strchr("BDXS", c->format) || c->len == 0 || c->lpad + c->len + c->rpad > MAX_TOKEN_LEN) {
+        return syntax_error(t, "Invalid output format");
+    }
+    return 0;
+}
+
+static void format_header(struct tst *t)
+{
+    append(t, "|", 1);
+    for (unsigned i = 0; i < t->ncolumns; i++) {
+        const struct column *c = &t->columns[i];
+        unsigned width = c->lpad + c->len + c->rpad;
+        unsigned n = strlen(c->name);
+
+        // centered, and cut if it doesn't fit
+        n = n < width ? n : width;
+        append_spaces(t, (width - n) / 2);
+        append(t, c->name, n);
+        append_spaces(t, width - n - (width - n) / 2);
+        append(t, "|", 1);
+    }
+    end_line(t);
+}
+
+static void format_value(struct tst *t, const struct column *c, uint16_t value)
+{
+    char buf[MAX_TOKEN_LEN + 1];
+
+    switch (c->format) {
+    case 'B':
+        for (unsigned i = 0; i < c->len; i++) {
+            unsigned bit = c->len - 1 - i;
+            buf[i] = bit < 16 && (value >> bit) & 1 ? '1' : '0';
+        }
+        buf[c->len] = '\0';
+        break;
+    case 'X':
+        snprintf(buf, sizeof(buf), "%0*X", c->len, value);
+        break;
+    case 'D':
+        // 16 bit buses hold two's complement numbers
+        snprintf(buf, sizeof(buf), "%*d", c->len,
+                 ref_width(t, &c->ref) == 16 ? (int16_t) value : value);
+        break;
+    default:
+        if (c->ref.kind == REF_TIME) {
+            char time[16];
+
+            snprintf(time, sizeof(time), "%u%s", value / 2, value & 1 ? "+" : "");
+            snprintf(buf, sizeof(buf), "%-*s", c->len, time);
+        } else {
+            snprintf(buf, sizeof(buf), "%-*u", c->len, value);
+        }
+        break;
+    }
+
+    append_spaces(t, c->lpad);
+    append(t, buf, strlen(buf));
+    append_spaces(t, c->rpad);
+    append(t, "|", 1);
+}
+
+/*
+ * Value of a pin, in a row of the current batch.
+ */
+static uint16_t pin_value(const struct tst *t, unsigned pin, const uint16_t *inputs, int lane)
+{
+    if (pin < t->nl.top->nin) {
+        return inputs[pin];
+    }
+    return lane < 0 ? t->outputs[pin] : netlist_get(&t->nl, pin, lane);
+}
+
+/*
+ * Evaluate the current batch and format its rows. Parts can't change state
+ * while rows are pending, so their state is that of the rows.
+ */
+static void flush(struct tst *t)
+{
+    const struct chip_def *top = t->nl.top;
+
+    if (t->lanes) {
+        netlist_eval(&t->nl, t->lanes);
+    }
+
+    for (unsigned r = 0; r < t->nrows; r++) {
+        const struct row *row = &t->rows[r];
+
+        append(t, "|", 1);
+        for (unsigned i = 0; i < t->ncolumns; i++) {
+            const struct ref *ref = &t->columns[i].ref;
+            uint16_t value;
+
+            if (ref->kind == REF_PIN) {
+                value = pin_value(t, ref->pin, row->inputs, row->lane);
+            } else if (ref->kind == REF_TIME) {
+                value = row->time;
+            } else {
+                value = model_peek(ref->model, ref->address);
+            }
+            format_value(t, &t->columns[i], value);
+        }
+        end_line(t);
+    }
+
+    if (t->last_lane >= 0) {
+        for (unsigned pin = top->nin; pin < top->npins; pin++) {
+            t->outputs[pin] = netlist_get(&t->nl, pin, t->last_lane);
+        }
+    }
+
+    t->lanes = 0;
+    t->last_lane = -1;
+    t->nrows = 0;
+}
+
+static void eval(struct tst *t)
+{
+    const struct chip_def *top = t->nl.top;
+
+    if (t->lanes == LANES) {
+        flush(t);
+    }
+    for (unsigned pin = 0; pin < top->nin; pin++) {
+        netlist_set(&t->nl, pin, t->lanes, t->inputs[pin]);
+    }
+    t->last_lane = t->lanes++;
+}
+
+static void output(struct tst *t)
+{
+    if (t->nrows == t->max_rows) {
+        unsigned max = t->max_rows ? 2 * t->max_rows : 2 * LANES;
+        struct row *p = realloc(t->rows, max * sizeof(*p));
+
+        if (p == NULL) {
+            exit_program(EXIT_OUT_OF_MEMORY);
+        }
+        t->rows = p;
+        t->max_rows = max;
+    }
+
+    struct row *row = &t->rows[t->nrows++];
+    memcpy(row->inputs, t->inputs, sizeof(row->inputs));
+    row->lane = t->last_lane;
+    row->time = t->time;
+}
+
+/*
+ * Clock up: evaluate the chip, and let its parts sample their inputs.
+ */
+static void tick(struct tst *t)
+{
+    int lane;
+
+    eval(t);
+    lane = t->last_lane;
+    flush(t);
+    netlist_tick(&t->nl, lane);
+    t->time++;
+}
+
+/*
+ * Clock down: the parts commit their new state, then the chip is evaluated.
+ */
+static void tock(struct tst *t)
+{
+    flush(t);
+    netlist_tock(&t->nl);
+    t->time++;
+    eval(t);
+}
+
+/*
+ * The current value of ref, signed if 16 bits wide.
+ */
+static int32_t ref_value(struct tst *t, const struct ref *ref)
+{
+    uint16_t value;
+
+    flush(t);
+    switch (ref->kind) {
+    case REF_PIN:
+        value = pin_value(t, ref->pin, t->inputs, -1);
+        break;
+    case REF_MODEL:
+        value = model_peek(ref->model, ref->address);
+        break;
+    default:
+        return t->time / 2;
+    }
+    return ref_width(t, ref) == 16 ? (int16_t) value : value;
+}
+
+static void path(const struct tst *t, char *dst, const char *name)
+{
+    if (snprintf(dst, PATH_MAX, "%s/%s", t->dir, name) >= PATH_MAX) {
+        dst[0] = '\0';
+    }
+}
+
+static int load(struct tst *t, const char *file)
+{
+    char name[MAX_NAME_LEN + 1];
+    size_t n = strlen(file);
+
+    if (n > 4 && !strcmp(file + n - 4, ".hdl")) {
+        n -= 4;
+    }
+    if (n > MAX_NAME_LEN) {
+        return syntax_error(t, "Invalid chip name");
+    }
+    memcpy(name, file, n);
+    name[n] = '\0';
+
+    if (t->loaded) {
+        flush(t);
+        netlist_free(&t->nl);
+    }
+    memset(t->inputs, 0, sizeof(t->inputs));
+    memset(t->outputs, 0, sizeof(t->outputs));
+    t->ncolumns = 0;
+    t->time = 0;
+
+    int rc = netlist_build(&t->nl, &t->lib, name, t->errmsg);
+    t->loaded = rc == 0;
+    return rc;
+}
+
+/*
+ * Load a .hack file, a binary word per line, into the memory of a part.
+ */
+static int load_memory(struct tst *t, struct model *m, const char *file)
+{
+    char filename[PATH_MAX];
+    char *text, *line, *save;
+    unsigned address = 0;
+
+    path(t, filename, file);
+    if ((text = read_file(filename)) == NULL) {
+        return error_format(t->errmsg, EXIT_CANNOT_OPEN_FILE, filename);
+    }
+
+    flush(t);
+    for (line = strtok_r(text, "\r\n", &save); line; line = strtok_r(NULL, "\r\n", &save)) {
+        model_poke(m, address++, strtoul(line, NULL, 2), t->nl.values);
+    }
+
+    free(text);
+    return 0;
+}
+
+static int open_output(struct tst *t, const char *filename)
+{
+    if (t->output_file) {
+        fclose(t->output_file);
+    }
+    if ((t->output_file = fopen(filename, "w")) == NULL) {
+        return error_format(t->errmsg, EXIT_CANNOT_OPEN_FILE, filename);
+    }
+    return 0;
+}
+
+static int open_compare(struct tst *t, const char *filename)
+{
+    unmap_file(t->cmp, t->cmp_len);
+    if ((t->cmp = map_file(filename, &t->cmp_len)) == NULL) {
+        return error_format(t->errmsg, EXIT_CANNOT_OPEN_FILE, filename);
+    }
+    t->cmp_pos = 0;
+    t->cmp_line = 0;
+    return 0;
+}
+
+static int commands(struct tst *t);
+
+/*
+ * Skip the commands of a block, up to its }
+ */
+static int skip_block(struct tst *t)
+{
+    for (unsigned depth = 0; depth || strcmp(t->lx.tok, "}"); next(&t->lx)) {
+        if (!t->lx.tok[0]) {
+            return syntax_error(t, "Expected }");
+        }
+        depth += !strcmp(t->lx.tok, "{");
+        depth -= depth && !strcmp(t->lx.tok, "}");
+    }
+    return 0;
+}
+
+/*
+ * repeat n { commands }
+ */
+static int repeat(struct tst *t)
+{
+    int32_t n;
+    int rc;
+
+    if (!parse_value(t->lx.tok, &n) || n < 0) {
+        return syntax_error(t, "Expected a repeat count");
+    }
+    next(&t->lx);
+    if (!accept(&t->lx, "{")) {
+        return syntax_error(t, "Expected {");
+    }
+
+    struct lexer body = t->lx;
+
+    if (n == 0 && (rc = skip_block(t))) {
+        return rc;
+    }
+    for (int32_t i = 0; i < n; i++) {
+        t->lx = body;
+        if ((rc = commands(t))) {
+            return rc;
+        }
+    }
+
+    if (!accept(&t->lx, "}")) {
+        return syntax_error(t, "Expected }");
+    }
+    return 0;
+}
+
+static const char *comparisons[] = { "=", "<>", "<", ">", "<=", ">=" };
+
+static int find_comparison(const char *op)
+{
+    for (unsigned i = 0; i < sizeof(comparisons) / sizeof(comparisons[0]); i++) {
+        if (!strcmp(comparisons[i], op)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static bool compare_values(int32_t a, int op, int32_t b)
+{
+    switch (op) {
+    case 0:
+        return a == b;
+    case 1:
+        return a != b;
+    case 2:
+        return a < b;
+    case 3:
+        return a > b;
+    case 4:
+        return a <= b;
+    default:
+        return a >= b;
+    }
+}
+
+/*
+ * while ref op value { commands }
+ *
+ * A loop waiting for the keyboard gets the next key of those given with -k.
+ */
+static int while_loop(struct tst *t)
+{
+    struct lexer *lx = &t->lx;
+    struct model *keyboard;
+    struct ref ref;
+    int32_t value;
+    int op, rc;
+
+    if ((rc = parse_ref(t, lx->tok, strlen(lx->tok), &ref))) {
+        return rc;
+    }
+    next(lx);
+    if ((op = find_comparison(lx->tok)) < 0) {
+        return syntax_error(t, "Expected a comparison");
+    }
+    next(lx);
+    if (!parse_value(lx->tok, &value)) {
+        return syntax_error(t, "Invalid value");
+    }
+    next(lx);
+    if (!accept(lx, "{")) {
+        return syntax_error(t, "Expected {");
+    }
+
+    if ((keyboard = netlist_model(&t->nl, "Keyboard")) && *t->keys) {
+        flush(t);
+        model_poke(keyboard, 0, *t->keys++, t->nl.values);
+    }
+
+    struct lexer body = t->lx;
+    unsigned line = lx->line;
+
+    while (compare_values(ref_value(t, &ref), op, value)) {
+        unsigned time = t->time;
+
+        t->lx = body;
+        if ((rc = commands(t))) {
+            return rc;
+        }
+        // without a clock, the next rounds would do the same
+        if (t->time == time && compare_values(ref_value(t, &ref), op, value)) {
+            return error_format(t->errmsg, EXIT_ENDLESS_LOOP, t->filename, line);
+        }
+    }
+
+    t->lx = body;
+    if ((rc = skip_block(t))) {
+        return rc;
+    }
+    next(lx);
+    return 0;
+}
+
+/*
+ * set pin value, or set Part[address] value
+ */
+static int set(struct tst *t)
+{
+    struct lexer *lx = &t->lx;
+    struct ref ref;
+    int32_t value;
+    int rc;
+
+    if ((rc = parse_ref(t, lx->tok, strlen(lx->tok), &ref))) {
+        return rc;
+    }
+    if (ref.kind == REF_TIME || (ref.kind == REF_PIN && ref.pin >= t->nl.top->nin)) {
+        return syntax_error(t, "Not an input pin");
+    }
+    next(lx);
+    if (!parse_value(lx->tok, &value)) {
+        return syntax_error(t, "Invalid value");
+    }
+    next(lx);
+
+    if (ref.kind == REF_MODEL) {
+        flush(t);
+        model_poke(ref.model, ref.address, value, t->nl.values);
+    } else {
+        t->inputs[ref.pin] = value & ((1u << t->nl.top->pins[ref.pin].width) - 1);
+    }
+    return 0;
+}
+
+static int command(struct tst *t)
+{
+    struct lexer *lx = &t->lx;
+    char cmd[MAX_TOKEN_LEN + 1];
+    struct model *m;
+
+    strcpy(cmd, lx->tok);
+    next(lx);
+
+    if (!strcmp(cmd, "repeat")) {
+        return repeat(t);
+    }
+
+    if (!strcmp(cmd, "load")) {
+        strcpy(cmd, lx->tok);
+        next(lx);
+        return load(t, cmd);
+    }
+    if (!strcmp(cmd, "echo")) {
+        printf("%.*s\n", (int) strlen(lx->tok) - 2, lx->tok + 1);
+        next(lx);
+        return 0;
+    }
+    if (!strcmp(cmd, "clear-echo")) {
+        return 0;
+    }
+    if (!strcmp(cmd, "output-file") || !strcmp(cmd, "compare-to")) {
+        char filename[PATH_MAX];
+
+        path(t, filename, lx->tok);
+        next(lx);
+        return cmd[0] == 'o' ? open_output(t, filename) : open_compare(t, filename);
+    }
+
+    if (!t->loaded) {
+        return syntax_error(t, "No chip loaded");
+    }
+
+    if (!strcmp(cmd, "output-list")) {
+        int rc;
+
+        flush(t);
+        for (t->ncolumns = 0; lx->tok[0] && !strchr(",;!{}", lx->tok[0]); next(lx)) {
+            if (t->ncolumns == MAX_COLUMNS) {
+                return syntax_error(t, "Too many output columns");
+            }
+            if ((rc = parse_column(t, lx->tok, &t->columns[t->ncolumns++]))) {
+                return rc;
+            }
+        }
+        format_header(t);
+        return 0;
+    }
+    if (!strcmp(cmd, "set")) {
+        return set(t);
+    }
+    if (!strcmp(cmd, "eval")) {
+        eval(t);
+        return 0;
+    }
+    if (!strcmp(cmd, "output")) {
+        output(t);
+        return 0;
+    }
+    if (!strcmp(cmd, "tick")) {
+        tick(t);
+        return 0;
+    }
+    if (!strcmp(cmd, "tock")) {
+        tock(t);
+        return 0;
+    }
+    if (!strcmp(cmd, "while")) {
+        return while_loop(t);
+    }
+
+    // e.g. ROM32K load Max.hack
+    if ((m = netlist_model(&t->nl, cmd)) && model_reads(m) && accept(lx, "load")) {
+        strcpy(cmd, lx->tok);
+        next(lx);
+        return load_memory(t, m, cmd);
+    }
+
+    return syntax_error(t, "Unknown command");
+}
+
+/*
+ * Commands, each ended by , ; or ! up to a } or the end of the script.
+ */
+static int commands(struct tst *t)
+{
+    struct lexer *lx = &t->lx;
+    int rc;
+
+    while (lx->tok[0] && strcmp(lx->tok, "}")) {
+        bool block = !strcmp(lx->tok, "repeat") || !strcmp(lx->tok, "while");
+
+        if ((rc = command(t)) || (rc = t->failure)) {
+            return rc;
+        }
+        if (!accept(lx, ",") && !accept(lx, ";") && !accept(lx, "!") && !block) {
+            return syntax_error(t, "Expected , or ;");
+        }
+    }
+    return 0;
+}
+
+int tst_run(const char *filename, const char *builtin_dir, const char *keys, char *errmsg)
+{
+    struct tst *t = calloc(1, sizeof(*t));
+    const char *slash = strrchr(filename, '/');
+    char *text = read_file(filename);
+    int rc;
+
+    if (t == NULL) {
+        free(text);
+        return error_format(errmsg, EXIT_OUT_OF_MEMORY);
+    }
+    if (text == NULL) {
+        free(t);
+        return error_format(errmsg, EXIT_CANNOT_OPEN_FILE, filename);
+    }
+
+    t->filename = filename;
+    t->keys = keys;
+    t->errmsg = errmsg;
+    t->last_lane = -1;
+    if (slash) {
+        snprintf(t->dir, sizeof(t->dir), "%.*s", (int) (slash - filename), filename);
+    } else {
+        strcpy(t->dir, ".");
+    }
+    library_init(&t->lib, t->dir, builtin_dir);
+    append(t, "", 0);
+
+    t->lx = (struct lexer) { .p = text, .line = 1 };
+    next(&t->lx);
+
+    rc = commands(t);
+    if (!rc && t->lx.tok[0]) {
+        rc = syntax_error(t, "Unexpected }");
+    }
+    if (!rc && t->loaded) {
+        flush(t);
+        rc = t->failure;
+    }
+    if (t->output_file) {
+        fclose(t->output_file);
+    }
+    unmap_file(t->cmp, t->cmp_len);
+
+    netlist_free(&t->nl);
+    library_free(&t->lib);
+    free(t->rows);
+    free(t->out);
+    free(text);
+    free(t);
+    return rc;
+}
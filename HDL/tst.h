@@ -0,0 +1,38 @@
+#pragma once
+
+/*
+ * Runner of .tst test scripts:
+ *
+ *     load Chip.hdl,
+ *     output-file Chip.out,
+ *     compare-to Chip.cmp,
+ *     output-list a%B3.1.3 out%D1.6.1;
+ *
+ *     set a 1,
+ *     eval,
+ *     output;
+ *
+ *     tick, output, tock, output;
+ *
+ *     repeat 4 { ... }
+ *     while out <> 75 { ... }
+ *
+ * The chip is flattened to a netlist (see netlist.h), and evaluated for up
+ * to LANES eval commands at once: each eval takes a lane, and output rows
+ * are formatted once the batch is evaluated. Clocked parts change state at
+ * tick and tock only, which end the batch; scripts refer to their state as
+ * e.g. RAM16K[3] or DRegister[].
+ *
+ * Each line of output is written to the output file and compared with the
+ * next line of the compare file as soon as it is formatted, where '*'
+ * matches any character. The script stops at the first mismatch.
+ */
+
+/*
+ * Run the script in filename, with built-in chips from builtin_dir. The
+ * keyboard presses the next char of keys at each while loop.
+ *
+ * \retval - 0 if the script ran and its output matched, else an exit code
+ *           with its message in errmsg.
+ */
+int tst_run(const char *filename, const char *builtin_dir, const char *keys, char *errmsg);
@@ -0,0 +1,96 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "batch.h"
+#include "jack.h"
+#include "exit.h"
+#include "threadpool.h"
+
+
+/*
+ * One class of the batch. status and errmsg are filled in by the worker that
+ * compiled it and are checked by the main thread, once all are done.
+ */
+struct batch_file {
+    const char *path;
+    char *text;
+    const struct jack_signatures *sigs;
+    struct vm_stream *out;
+    int status;
+    char errmsg[MAX_ERROR_LEN + 1];
+};
+
+
+static void compile_file(void *ctx, void *arg)
+{
+    struct batch_file *file = arg;
+
+    (void) ctx;
+    file->status = jack_compile(file->text, file->path, file->sigs, file->out, file->errmsg);
+}
+
+int jack_batch(int nfiles, char filenames[][MAX_FILENAME_LEN+1], char *texts[],
+               int njobs, struct vm_stream streams[], char *errmsg)
+{
+    struct batch_file *files = calloc(nfiles + 1, sizeof(struct batch_file));
+    struct jack_signatures sigs;
+    ThreadPool pool = NULL;
+    int nclasses = 0;
+    int status = 0;
+
+    if (files == NULL) {
+        return error_format(errmsg, EXIT_OUT_OF_MEMORY);
+    }
+    jack_signatures_init(&sigs);
+
+    // the scan only parses declarations, so it is cheap enough to run alone
+    for (int i = 0; i < nfiles && !status; i++) {
+        if (texts[i] == NULL) {
+            continue;
+        }
+        files[i].path = filenames[i];
+        files[i].text = texts[i];
+        status = jack_scan(files[i].text, files[i].path, &sigs, errmsg);
+        nclasses++;
+    }
+
+    if (status || nclasses == 0) {
+        goto done;
+    }
+
+    jack_signatures_sort(&sigs);
+
+    if ((pool = threadpool_create(njobs, NULL, NULL)) == NULL) {
+        status = error_format(errmsg, EXIT_OUT_OF_MEMORY);
+        goto done;
+    }
+
+    for (int i = 0; i < nfiles; i++) {
+        if (files[i].text == NULL) {
+            continue;
+        }
+        files[i].sigs = &sigs;
+        files[i].out = &streams[i];
+        // a class that can't be queued is compiled right away
+        if (threadpool_submit(pool, compile_file, &files[i]) != 0) {
+            compile_file(NULL, &files[i]);
+        }
+    }
+
+    threadpool_destroy(pool);
+
+    for (int i = 0; i < nfiles; i++) {
+        if (files[i].status) {
+            status = files[i].status;
+            strcpy(errmsg, files[i].errmsg);
+            break;
+        }
+    }
+
+done:
+    free(files);
+    jack_signatures_free(&sigs);
+
+    return status;
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include "stream.h"
+#include "files.h"
+
+/**
+ * Compile the Jack classes among filenames on njobs worker threads (one per
+ * CPU if njobs < 1). texts[i] holds the source of filenames[i] if that is a
+ * .jack file, as read by the caller, and is NULL otherwise. All classes are
+ * scanned for the signatures of their subroutines first, so that each class
+ * can then be compiled on its own.
+ *
+ * streams[i] receives the commands of filenames[i] if that is a .jack file,
+ * and is left alone otherwise. The streams must have been initialized.
+ *
+ * retval - 0 on success, else the exit code of the first file, in the order
+ *          given, that failed, with its message in errmsg.
+ */
+int jack_batch(int nfiles, char filenames[][MAX_FILENAME_LEN+1], char *texts[],
+               int njobs, struct vm_stream streams[], char *errmsg);
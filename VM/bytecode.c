@@ -0,0 +1,382 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "bytecode.h"
+#include "files.h"
+#include "exit.h"
+
+#define VMB_MAGIC "VMB1"
+#define VMB_MAGIC_LEN 4
+
+/* Largest number of a command, as vm_command_number() takes them. */
+#define MAX_NUMBER 32767
+/* Numbers below this share one token per file once decoded. */
+#define SMALL_NUMBERS 256
+
+/* The segments of push and pop, by their id in the file. */
+static const char *const segments[] = {
+    "argument", "local", "static", "constant", "this", "that", "pointer", "temp"
+};
+
+#define NSEGMENTS (sizeof(segments) / sizeof(segments[0]))
+
+
+/*
+ * The names of the file being encoded, in the order of their indices, and a
+ * hash table of them. A slot holds the index of a name plus one, or 0.
+ */
+struct names {
+    const char **name;
+    unsigned count;
+    unsigned *slots;
+    unsigned mask;
+};
+
+static int segment_id(const char *segment)
+{
+    for (unsigned i = 0; i < NSEGMENTS; i++) {
+        if (!strcmp(segment, segments[i])) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static bool has_name(cmd_id id)
+{
+    return id == CMD_LABEL || id == CMD_GOTO || id == CMD_IFGOTO
+           || id == CMD_FUNCTION || id == CMD_CALL;
+}
+
+static bool encodable(const struct vm_command *cmd)
+{
+    switch (cmd->id) {
+    case CMD_INVALID:
+        return false;
+    case CMD_PUSH:
+    case CMD_POP:
+        return vm_command_number(cmd) >= 0 && segment_id(cmd->tokens[1]) >= 0;
+    case CMD_LABEL:
+    case CMD_GOTO:
+    case CMD_IFGOTO:
+        return cmd->ntokens == 2;
+    case CMD_FUNCTION:
+    case CMD_CALL:
+        return vm_command_number(cmd) >= 0;
+    default:
+        return cmd->ntokens == 1;
+    }
+}
+
+static uint32_t hash(const char *s)
+{
+    uint32_t h = 2166136261u;
+
+    while (*s) {
+        h = (h ^ (unsigned char) *s++) * 16777619u;
+    }
+    return h;
+}
+
+/*
+ * The index of name, which is added if it is new.
+ */
+static unsigned names_intern(struct names *names, const char *name)
+{
+    unsigned i = hash(name) & names->mask;
+
+    while (names->slots[i]) {
+        if (!strcmp(names->name[names->slots[i] - 1], name)) {
+            return names->slots[i] - 1;
+        }
+        i = (i + 1) & names->mask;
+    }
+    names->name[names->count] = name;
+    names->slots[i] = ++names->count;
+
+    return names->count - 1;
+}
+
+static void put_varint(FILE *fp, uint32_t v)
+{
+    while (v >= 0x80) {
+        fputc((v & 0x7f) | 0x80, fp);
+        v >>= 7;
+    }
+    fputc(v, fp);
+}
+
+int vm_bytecode_write(const struct vm_stream *s, FILE *fp, char *errmsg)
+{
+    struct names names = { NULL, 0, NULL, 0 };
+    unsigned size = 16;
+    uint32_t strings_size = 0;
+    unsigned line = 0;
+
+    // at most one name per command, and the table at most half full
+    while (size < 2 * s->count) {
+        size *= 2;
+    }
+    names.name = malloc((s->count + 1) * sizeof(const char *));
+    names.slots = calloc(size, sizeof(unsigned));
+    names.mask = size - 1;
+
+    if (names.name == NULL || names.slots == NULL) {
+        free(names.name);
+        free(names.slots);
+        return error_format(errmsg, EXIT_OUT_OF_MEMORY);
+    }
+
+    for (unsigned i = 0; i < s->count; i++) {
+        const struct vm_command *cmd = &s->commands[i];
+
+        if (!encodable(cmd)) {
+            char text[MAX_LINE_LEN + 1];
+
+            vm_command_format(cmd, text);
+            free(names.name);
+            free(names.slots);
+            return error_format(errmsg, EXIT_INVALID_COMMAND, cmd->line, text);
+        }
+        if (has_name(cmd->id)) {
+            unsigned count = names.count;
+
+            names_intern(&names, cmd->tokens[1]);
+            if (names.count > count) {
+                strings_size += strlen(cmd->tokens[1]) + 1;
+            }
+        }
+    }
+
+    fwrite(VMB_MAGIC, 1, VMB_MAGIC_LEN, fp);
+    put_varint(fp, names.count);
+    put_varint(fp, strings_size);
+    for (unsigned i = 0; i < names.count; i++) {
+        fwrite(names.name[i], 1, strlen(names.name[i]) + 1, fp);
+    }
+    put_varint(fp, s->count);
+
+    for (unsigned i = 0; i < s->count; i++) {
+        const struct vm_command *cmd = &s->commands[i];
+        int32_t delta = (int32_t) (cmd->line - line);
+
+        line = cmd->line;
+        fputc(cmd->id, fp);
+        put_varint(fp, ((uint32_t) delta << 1) ^ (uint32_t) (delta >> 31));
+
+        if (cmd->id == CMD_PUSH || cmd->id == CMD_POP) {
+            fputc(segment_id(cmd->tokens[1]), fp);
+        } else if (has_name(cmd->id)) {
+            put_varint(fp, names_intern(&names, cmd->tokens[1]));
+        }
+        if (cmd->ntokens == 3) {
+            put_varint(fp, vm_command_number(cmd));
+        }
+    }
+
+    free(names.name);
+    free(names.slots);
+
+    return 0;
+}
+
+
+/*
+ * Cursor over the bytes of a file being decoded. ok is cleared by any read
+ * past its end.
+ */
+struct reader {
+    const unsigned char *p;
+    const unsigned char *end;
+    bool ok;
+};
+
+static unsigned get_byte(struct reader *r)
+{
+    if (r->p == r->end) {
+        r->ok = false;
+        return 0;
+    }
+    return *r->p++;
+}
+
+static uint32_t get_varint(struct reader *r)
+{
+    uint32_t v = 0;
+
+    for (int shift = 0; shift < 32; shift += 7) {
+        unsigned b = get_byte(r);
+
+        v |= (uint32_t) (b & 0x7f) << shift;
+        if (!(b & 0x80)) {
+            return v;
+        }
+    }
+    r->ok = false;
+    return 0;
+}
+
+/*
+ * The token of the number n, which must be at most MAX_NUMBER. Small ones
+ * are kept in small, to be shared by all commands of the file.
+ *
+ * \retval - the token, or NULL if out of memory.
+ */
+static const char *number_token(struct vm_stream *s, uint32_t n, const char *small[SMALL_NUMBERS])
+{
+    char digits[8];
+    char *d = digits + sizeof(digits);
+    uint32_t rest = n;
+
+    if (n < SMALL_NUMBERS && small[n]) {
+        return small[n];
+    }
+
+    *--d = '\0';
+    do {
+        *--d = '0' + rest % 10;
+        rest /= 10;
+    } while (rest);
+
+    size_t len = digits + sizeof(digits) - d;
+    char *token = vm_stream_alloc(s, len);
+
+    if (token == NULL) {
+        return NULL;
+    }
+    memcpy(token, d, len);
+    if (n < SMALL_NUMBERS) {
+        small[n] = token;
+    }
+    return token;
+}
+
+/*
+ * Decode the commands that follow the strings of the file, whose names are
+ * given, into s.
+ *
+ * \retval - 0 on success, else an exit code.
+ */
+static int read_commands(struct reader *r, const char *names[], uint32_t nstrings,
+                         struct vm_stream *s)
+{
+    const char *small[SMALL_NUMBERS] = { NULL };
+    uint32_t ncommands = get_varint(r);
+    unsigned line = 0;
+
+    // every command takes two bytes at least
+    if (!r->ok || ncommands > (size_t) (r->end - r->p) / 2) {
+        return EXIT_INVALID_BYTECODE;
+    }
+    if (vm_stream_reserve(s, ncommands)) {
+        return EXIT_OUT_OF_MEMORY;
+    }
+
+    for (uint32_t i = 0; i < ncommands; i++) {
+        struct vm_command *cmd = &s->commands[s->count];
+        unsigned id = get_byte(r);
+        uint32_t delta = get_varint(r);
+        uint32_t arg = 0, number = 0;
+
+        if (id == CMD_INVALID || id >= MAX_COMMANDS) {
+            return EXIT_INVALID_BYTECODE;
+        }
+
+        line += (delta >> 1) ^ -(delta & 1);
+        cmd->id = id;
+        cmd->line = line;
+        cmd->ntokens = 1;
+        cmd->tokens[0] = cmdid_to_str(id);
+
+        if (id == CMD_PUSH || id == CMD_POP) {
+            if ((arg = get_byte(r)) >= NSEGMENTS) {
+                return EXIT_INVALID_BYTECODE;
+            }
+            cmd->tokens[cmd->ntokens++] = segments[arg];
+        } else if (has_name(id)) {
+            if ((arg = get_varint(r)) >= nstrings) {
+                return EXIT_INVALID_BYTECODE;
+            }
+            cmd->tokens[cmd->ntokens++] = names[arg];
+        }
+        if (id == CMD_PUSH || id == CMD_POP || id == CMD_FUNCTION || id == CMD_CALL) {
+            if ((number = get_varint(r)) > MAX_NUMBER) {
+                return EXIT_INVALID_BYTECODE;
+            }
+            if ((cmd->tokens[cmd->ntokens++] = number_token(s, number, small)) == NULL) {
+                return EXIT_OUT_OF_MEMORY;
+            }
+        }
+        if (!r->ok) {
+            return EXIT_INVALID_BYTECODE;
+        }
+        s->count++;
+    }
+
+    return r->p == r->end ? 0 : EXIT_INVALID_BYTECODE;
+}
+
+int vm_bytecode_decode(const char *data, size_t len, const char *filename,
+                       struct vm_stream *s, char *errmsg)
+{
+    const unsigned char *bytes = (const unsigned char *) data;
+    struct reader r = { bytes + VMB_MAGIC_LEN, bytes + len, true };
+    const char **names = NULL;
+    uint32_t nstrings, strings_size, n = 0;
+    char *strings;
+    int rc = EXIT_INVALID_BYTECODE;
+
+    if (len < VMB_MAGIC_LEN || memcmp(data, VMB_MAGIC, VMB_MAGIC_LEN)) {
+        goto done;
+    }
+
+    nstrings = get_varint(&r);
+    strings_size = get_varint(&r);
+    if (!r.ok || strings_size > (size_t) (r.end - r.p) || nstrings > strings_size
+        || (strings_size && r.p[strings_size - 1] != '\0')) {
+        goto done;
+    }
+
+    // the names are kept as they are, for the tokens to point into
+    strings = vm_stream_alloc(s, strings_size + 1);
+    names = malloc((nstrings + 1) * sizeof(const char *));
+    if (strings == NULL || names == NULL) {
+        rc = EXIT_OUT_OF_MEMORY;
+        goto done;
+    }
+    memcpy(strings, r.p, strings_size);
+    r.p += strings_size;
+
+    for (char *p = strings; p < strings + strings_size; p += strlen(p) + 1) {
+        if (n == nstrings) {
+            goto done;
+        }
+        names[n++] = p;
+    }
+    if (n == nstrings) {
+        rc = read_commands(&r, names, nstrings, s);
+    }
+
+done:
+    free(names);
+
+    return rc ? error_format(errmsg, rc, filename) : 0;
+}
+
+int vm_bytecode_read(FILE *fp, const char *filename, struct vm_stream *s, char *errmsg)
+{
+    size_t len;
+    char *data = read_file(fp, &len);
+    int rc;
+
+    if (data == NULL) {
+        return error_format(errmsg, EXIT_OUT_OF_MEMORY);
+    }
+    rc = vm_bytecode_decode(data, len, filename, s, errmsg);
+    free(data);
+
+    return rc;
+}
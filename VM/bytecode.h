@@ -0,0 +1,60 @@
+#pragma once
+
+#include <stdio.h>
+
+#include "stream.h"
+
+/*
+ * Binary form of the commands of a .vm file (.vmb), written by vm -b. It is
+ * loaded straight into a vm_stream, without any text to scan, tokenize or
+ * parse numbers of, so cached or compiler-produced commands load an order of
+ * magnitude faster than their text.
+ *
+ * A file is
+ *
+ *     "VMB1"
+ *     varint nstrings, strings_size
+ *     char strings[strings_size]
+ *     varint ncommands
+ *     commands[ncommands]
+ *
+ * where strings holds the nstrings null terminated label and function names
+ * of the file, each once, and a command is
+ *
+ *     u8 id                                   its cmd_id
+ *     varint line                             zigzag encoded, relative to
+ *                                             the line of the one before
+ *     u8 segment, varint index                for push and pop
+ *     varint name                             for label, goto and if-goto
+ *     varint name, varint number              for function and call
+ *
+ * Names are indices in strings. Varints are unsigned, little-endian base
+ * 128: seven bits a byte, the top one set on all bytes but the last.
+ */
+
+#define VMB_EXTENSION ".vmb"
+
+
+/*
+ * Write the commands of s to fp, which must be open in binary mode. Only
+ * well formed commands can be encoded.
+ *
+ * \retval - 0 on success, else an exit code with its message in errmsg.
+ */
+int vm_bytecode_write(const struct vm_stream *s, FILE *fp, char *errmsg);
+
+/*
+ * Append the commands of the .vmb file in fp, which filename names, to s.
+ *
+ * \retval - 0 on success, else an exit code with its message in errmsg.
+ */
+int vm_bytecode_read(FILE *fp, const char *filename, struct vm_stream *s, char *errmsg);
+
+/*
+ * Append the commands of the len bytes of a .vmb file at data, which
+ * filename names, to s.
+ *
+ * \retval - 0 on success, else an exit code with its message in errmsg.
+ */
+int vm_bytecode_decode(const char *data, size_t len, const char *filename,
+                       struct vm_stream *s, char *errmsg);
@@ -0,0 +1,61 @@
+#include <string.h>
+
+#include "command.h"
+
+static const char *const cmd_names[MAX_COMMANDS] = {
+    [CMD_INVALID] = "", [CMD_PUSH] = "push", [CMD_POP] = "pop",
+    [CMD_ADD] = "add", [CMD_SUB] = "sub", [CMD_NEG] = "neg", [CMD_AND] = "and",
+    [CMD_OR] = "or", [CMD_NOT] = "not", [CMD_EQ] = "eq", [CMD_GT] = "gt",
+    [CMD_LT] = "lt", [CMD_LABEL] = "label", [CMD_GOTO] = "goto",
+    [CMD_IFGOTO] = "if-goto", [CMD_FUNCTION] = "function",
+    [CMD_RETURN] = "return", [CMD_CALL] = "call"
+};
+
+cmd_id str_to_cmdid(const char *s)
+{
+    cmd_id id = CMD_INVALID;
+
+    if (s == NULL) {
+    } else if (!strcmp(s, "push")) {
+        id = CMD_PUSH;
+    } else if (!strcmp(s, "pop")) {
+        id = CMD_POP;
+    } else if (!strcmp(s, "add")) {
+        id = CMD_ADD;
+    } else if (!strcmp(s, "sub")) {
+        id = CMD_SUB;
+    } else if (!strcmp(s, "neg")) {
+        id = CMD_NEG;
+    } else if (!strcmp(s, "and")) {
+        id = CMD_AND;
+    } else if (!strcmp(s, "or")) {
+        id = CMD_OR;
+    } else if (!strcmp(s, "not")) {
+        id = CMD_NOT;
+    } else if (!strcmp(s, "eq")) {
+        id = CMD_EQ;
+    } else if (!strcmp(s, "gt")) {
+        id = CMD_GT;
+    } else if (!strcmp(s, "lt")) {
+        id = CMD_LT;
+    } else if (!strcmp(s, "label")) {
+        id = CMD_LABEL;
+    } else if (!strcmp(s, "goto")) {
+        id = CMD_GOTO;
+    } else if (!strcmp(s, "if-goto")) {
+        id = CMD_IFGOTO;
+    } else if (!strcmp(s, "function")) {
+        id = CMD_FUNCTION;
+    } else if (!strcmp(s, "return")) {
+        id = CMD_RETURN;
+    } else if (!strcmp(s, "call")) {
+        id = CMD_CALL;
+    }
+
+    return id;
+}
+
+const char *cmdid_to_str(cmd_id id)
+{
+    return cmd_names[id];
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+/*
+ * The commands of the VM language, shared by everything that reads .vm files.
+ */
+
+typedef enum cmd_id {
+    CMD_INVALID = 0,
+    CMD_PUSH,
+    CMD_POP,
+    CMD_ADD,
+    CMD_SUB,
+    CMD_NEG,
+    CMD_AND,
+    CMD_OR,
+    CMD_NOT,
+    CMD_EQ,
+    CMD_GT,
+    CMD_LT,
+    CMD_LABEL,
+    CMD_GOTO,
+    CMD_IFGOTO,
+    CMD_FUNCTION,
+    CMD_RETURN,
+    CMD_CALL,
+    MAX_COMMANDS  /* their total count */
+} cmd_id;
+
+/*
+ * Map the first token of a command to its id.
+ *
+ * \retval - the command id, or CMD_INVALID if s is NULL or no command.
+ */
+cmd_id str_to_cmdid(const char *s);
+
+/*
+ * The first token of the command with the given id, e.g. "if-goto".
+ *
+ * \retval - the name, or "" for CMD_INVALID.
+ */
+const char *cmdid_to_str(cmd_id id);
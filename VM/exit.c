@@ -4,6 +4,8 @@
 #include "exit.h"
 
 
+const char *program_name = "VM Translator";
+
 const char *error_messages[] =
 {
     [EXIT_FILE_DOES_NOT_EXIST] = "%s does not exist",
@@ -11,22 +13,45 @@ const char *error_messages[] =
     [EXIT_CANNOT_OPEN_FILE] = "Can't open file %s",
     [EXIT_CANNOT_OPEN_FILE_OUT] = "Can't open file for writing %s",
     [EXIT_MANY_ARGS] = "One and only one file or dir operand is expected",
-    [EXIT_NO_FILES_FOUND] = "No VM files found in given directory",
+    [EXIT_NO_FILES_FOUND] = "No VM or Jack files found in given directory",
     [EXIT_INVALID_COMMAND] = "Line %u: %s: Invalid command",
+    [EXIT_SOCKET_ERROR] = "Can't listen on socket %s",
+    [EXIT_DAEMON_FAILED] = "No usable answer from daemon at %s",
+    [EXIT_INVALID_OPTION] = "Usage: vm [-b] [-c] [-f] [-g] [-i] [-m] [-r] [-t] [-j jobs] file|dir | vm -d [-s socket] [-j jobs]",
+    [EXIT_UNDEFINED_SYMBOL] = "Undefined label or function %s",
+    [EXIT_PROGRAM_TOO_LARGE] = "Program exceeds the limit of %u %s",
+    [EXIT_STEP_LIMIT] = "Stopped after the limit of %lu steps",
     [EXIT_OUT_OF_MEMORY] = "CRITICAL: Unable to allocate memory!",
+    [EXIT_JACK_SYNTAX] = "%s, line %u: %s",
+    [EXIT_INVALID_BYTECODE] = "%s is not a valid VM bytecode file",
 };
 
 
 void exit_program(enum exitcode code, ...)
 {
+    char msg[MAX_ERROR_LEN + 1];
     va_list arguments;
 
     va_start(arguments, code);
+    vsnprintf(msg, sizeof(msg), error_messages[code], arguments);
+    va_end(arguments);
 
-    printf("VM Translator: ERROR: ");
-    vfprintf(stdout, error_messages[code], arguments);
-    printf("\n");
+    exit_with_message(code, msg);
+}
 
-    va_end(arguments);
+void exit_with_message(enum exitcode code, const char *msg)
+{
+    printf("%s: ERROR: %s\n", program_name, msg);
     exit(code);
 }
+
+int error_format(char *msg, enum exitcode code, ...)
+{
+    va_list arguments;
+
+    va_start(arguments, code);
+    vsnprintf(msg, MAX_ERROR_LEN + 1, error_messages[code], arguments);
+    va_end(arguments);
+
+    return code;
+}
@@ -2,6 +2,11 @@
 
 #include <stdarg.h>
 
+/*
+ * Maximum length of a formatted error message.
+ */
+#define MAX_ERROR_LEN 511
+
 enum exitcode {
     /*
      * Exit code 1 represents that input file does not exist.
@@ -31,11 +36,65 @@ enum exitcode {
      * Exit code 7 represents that an invalid command has been encountered.
      */
     EXIT_INVALID_COMMAND = 7,
+    /*
+     * Exit code 8 represents that the daemon socket couldn't be set up.
+     */
+    EXIT_SOCKET_ERROR = 8,
+    /*
+     * Exit code 9 represents that talking to the daemon failed.
+     */
+    EXIT_DAEMON_FAILED = 9,
+    /*
+     * Exit code 10 represents that an invalid command line option was given.
+     */
+    EXIT_INVALID_OPTION = 10,
+    /*
+     * Exit code 11 represents that a label or function is used but never defined.
+     */
+    EXIT_UNDEFINED_SYMBOL = 11,
+    /*
+     * Exit code 12 represents that the program doesn't fit in some fixed limit.
+     */
+    EXIT_PROGRAM_TOO_LARGE = 12,
+    /*
+     * Exit code 13 represents that the interpreter ran for more steps than allowed.
+     */
+    EXIT_STEP_LIMIT = 13,
     /*
      * Exit code 15 represents that the program run out of memory.
      */
     EXIT_OUT_OF_MEMORY = 15,
+    /*
+     * Exit code 16 represents that a Jack class has a syntax error.
+     */
+    EXIT_JACK_SYNTAX = 16,
+    /*
+     * Exit code 17 represents that a .vmb file is truncated or malformed.
+     */
+    EXIT_INVALID_BYTECODE = 17,
 };
 
+/*
+ * Name of the program that error messages are reported by.
+ */
+extern const char *program_name;
+
 
+/**
+ * Print the error message that corresponds to code and terminate the program.
+ */
 void exit_program(enum exitcode code, ...);
+
+/**
+ * Print an already formatted error message and terminate the program.
+ */
+void exit_with_message(enum exitcode code, const char *msg);
+
+/**
+ * Format the error message that corresponds to code into msg, which must be
+ * able to hold MAX_ERROR_LEN + 1 chars. This is for code paths that must not
+ * terminate the program, e.g. the daemon workers.
+ *
+ * retval - code
+ */
+int error_format(char *msg, enum exitcode code, ...);
@@ -0,0 +1,246 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <libgen.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "files.h"
+#include "jack.h"
+#include "bytecode.h"
+#include "utils.h"
+#include "exit.h"
+
+
+char path_out[MAX_FNAME_CHARS+1];
+
+
+typedef char (*file_entry)[MAX_FILENAME_LEN+1];
+
+/*
+ * Whether the group of files of one stem has path with the extension ext
+ * instead of its own, e.g. Foo.jack for Foo.vm.
+ *
+ * \retval - its name, or NULL.
+ */
+static const char *find_sibling(const file_entry group[], int ngroup, const char *ext)
+{
+    for (int i = 0; i < ngroup; i++) {
+        if (!strcmp(strrchr(*group[i], '.'), ext)) {
+            return *group[i];
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Whether the file at path a was modified after the one at b.
+ */
+static bool is_newer(const char *a, const char *b)
+{
+    struct stat sa, sb;
+
+    if (stat(a, &sa) != 0 || stat(b, &sb) != 0) {
+        return false;
+    }
+    return sa.st_mtim.tv_sec > sb.st_mtim.tv_sec
+           || (sa.st_mtim.tv_sec == sb.st_mtim.tv_sec && sa.st_mtim.tv_nsec > sb.st_mtim.tv_nsec);
+}
+
+/*
+ * Whether path is the compiled form of another file of its group, the files
+ * of its stem, which is translated instead.
+ */
+static bool is_superseded(const file_entry group[], int ngroup, const char *path)
+{
+    const char *dot = strrchr(path, '.');
+    const char *other;
+
+    if (!strcmp(dot, JACK_EXTENSION)) {
+        return false;
+    }
+    if (find_sibling(group, ngroup, JACK_EXTENSION)) {
+        return true;
+    }
+    // a .vmb caches its .vm, until that changes
+    if (!strcmp(dot, VM_EXTENSION)) {
+        other = find_sibling(group, ngroup, VMB_EXTENSION);
+        return other && !is_newer(path, other);
+    }
+    other = find_sibling(group, ngroup, VM_EXTENSION);
+    return other && is_newer(other, path);
+}
+
+/*
+ * Order of two files by path without the extension.
+ */
+static int compare_stems(const void *a, const void *b)
+{
+    const char *pa = **(const file_entry *) a, *pb = **(const file_entry *) b;
+    size_t la = strrchr(pa, '.') - pa, lb = strrchr(pb, '.') - pb;
+    int cmp = strncmp(pa, pb, la < lb ? la : lb);
+
+    return cmp ? cmp : (la > lb) - (la < lb);
+}
+
+/*
+ * Remove the .vm and .vmb files that a .jack file of the directory compiles
+ * to, which are left over from the Java tools, and the stale one of each .vm
+ * and its .vmb. The sources are translated instead.
+ *
+ * \retval - the number of files left.
+ */
+static int drop_compiled(char files[][MAX_FILENAME_LEN+1], int num_files)
+{
+    file_entry *sorted = malloc(num_files * sizeof(file_entry));
+    bool *drop = malloc(num_files * sizeof(bool));
+    int kept = 0;
+
+    if (sorted == NULL || drop == NULL) {
+        exit_program(EXIT_OUT_OF_MEMORY);
+    }
+
+    // the files of a stem end up next to each other, whatever their number
+    for (int i = 0; i < num_files; i++) {
+        sorted[i] = &files[i];
+    }
+    qsort(sorted, num_files, sizeof(file_entry), compare_stems);
+
+    // decided for all first, as the .vm and .vmb of a file depend on each other
+    for (int first = 0, end; first < num_files; first = end) {
+        for (end = first + 1; end < num_files && !compare_stems(&sorted[first], &sorted[end]); end++) {
+        }
+        for (int i = first; i < end; i++) {
+            drop[sorted[i] - files] = is_superseded(sorted + first, end - first, *sorted[i]);
+        }
+    }
+    for (int i = 0; i < num_files; i++) {
+        if (!drop[i]) {
+            if (kept != i) {
+                strcpy(files[kept], files[i]);
+            }
+            kept++;
+        }
+    }
+
+    free(sorted);
+    free(drop);
+
+    return kept;
+}
+
+/*
+ * Append path to the growable array *files, of *allocated entries.
+ */
+static void add_file(char (**files)[MAX_FILENAME_LEN+1], int *num_files, int *allocated,
+                     const char *path)
+{
+    if (*num_files == *allocated) {
+        *allocated = *allocated ? 2 * *allocated : 64;
+        if ((*files = realloc(*files, *allocated * sizeof(**files))) == NULL) {
+            exit_program(EXIT_OUT_OF_MEMORY);
+        }
+    }
+    strcpy((*files)[(*num_files)++], path);
+}
+
+int files_to_translate(const char *path, char (**files)[MAX_FILENAME_LEN+1])
+{
+    int num_files = 0;
+    int allocated = 0;
+    bool is_dir = false;
+    struct stat path_stat;
+    char tmp[MAX_FNAME_CHARS+1];
+    char real_path[MAX_FNAME_CHARS+1] = {0};
+    char dir_name[MAX_FNAME_CHARS+1] = {0};
+    char base_name[MAX_FNAME_CHARS+1] = {0};
+
+    if (stat(path, &path_stat) != 0) {
+        exit_program(EXIT_FILE_DOES_NOT_EXIST, path);
+    } else if (S_ISREG(path_stat.st_mode)) {
+    } else if (S_ISDIR(path_stat.st_mode)) {
+        is_dir = true;
+    } else {
+        exit_program(EXIT_NOT_FILE_OR_DIR, path);
+    }
+
+    strcpy(real_path, realpath(path, tmp));
+    if (is_dir) {
+        strcpy(dir_name, real_path);
+    } else {
+        strcpy(dir_name, dirname(strcpy(tmp, real_path)));
+    }
+    strcpy(base_name, basename(strcpy(tmp, real_path)));
+
+    strcpy(path_out, dir_name);
+    strcat(path_out, "/");
+
+    *files = NULL;
+
+    if (is_dir) {
+        DIR *d;
+        struct dirent *dir;
+        char *dot, *slash;
+
+        if ((d = opendir(real_path))) {
+            while ((dir = readdir(d)) != NULL) {
+                dot = strrchr(dir->d_name, '.');
+
+                if (dir->d_type == DT_REG && dot
+                    && (!strcmp(dot, VM_EXTENSION) || !strcmp(dot, VMB_EXTENSION)
+                        || !strcmp(dot, JACK_EXTENSION))) {
+                    strcpy(tmp, dir_name);
+                    strcat(tmp, "/");
+                    add_file(files, &num_files, &allocated, strcat(tmp, dir->d_name));
+                }
+            }
+            closedir(d);
+        }
+        // only what is left counts, a module may have a .vm, a .vmb and a .jack
+        if (num_files) {
+            num_files = drop_compiled(*files, num_files);
+        }
+
+        slash = strrchr(dir_name, '/');
+        if (slash == NULL) {
+        }
+        strcat(path_out, slash+1);
+    } else {
+        add_file(files, &num_files, &allocated, path);
+
+        fname_remove_ext(strcpy(tmp, base_name));
+        strcat(path_out, tmp);
+    }
+
+    strcat(path_out, ".asm");
+
+    return num_files;
+}
+
+char *read_file(FILE *fp, size_t *length)
+{
+    char *buf = NULL;
+    size_t len = 0, size = 0, n;
+
+    do {
+        if (len + 1 >= size) {
+            size = size ? 2 * size : 4096;
+            char *p = realloc(buf, size);
+            if (p == NULL) {
+                free(buf);
+                return NULL;
+            }
+            buf = p;
+        }
+        n = fread(buf + len, 1, size - len - 1, fp);
+        len += n;
+    } while (n > 0);
+
+    buf[len] = '\0';
+    if (length) {
+        *length = len;
+    }
+
+    return buf;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stdio.h>
+
+#define MAX_FNAME_CHARS 150
+#define MAX_FILENAME_LEN 1000
+#define VM_EXTENSION ".vm"
+
+/* Full path of output file. */
+extern char path_out[MAX_FNAME_CHARS+1];
+
+
+/*
+ * If path is a directory put in the files array all filenames of regular files
+ * contained in this directory that end in ".vm", ".vmb" or ".jack", or put
+ * path in files if it is a regular file. A .vm or .vmb file is left out if
+ * the directory has the .jack file it is compiled from, and of a .vm file and
+ * its .vmb, only the .vmb is kept, unless the .vm is newer.
+ *
+ * The array is allocated, grows with the directory and must be freed by the
+ * caller. Every candidate is collected before any is left out.
+ *
+ * This function also sets the global path_out.
+ *
+ * \param path - path to be processed
+ * \param files - Set to the array of files found.
+ * \retval - Number of files that have been put in files array.
+ */
+int files_to_translate(const char *path, char (**files)[MAX_FILENAME_LEN+1]);
+
+/*
+ * Read the rest of fp into a null-terminated buffer, which the caller must
+ * free. If len isn't NULL it is set to the number of bytes read, for files
+ * that may hold null bytes.
+ *
+ * \retval - the buffer, or NULL if out of memory.
+ */
+char *read_file(FILE *fp, size_t *len);
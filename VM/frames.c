@@ -0,0 +1,288 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "frames.h"
+#include "exit.h"
+
+
+/*
+ * A function of the program, as a node of the call graph.
+ */
+struct node {
+    const char *name;
+    int nvars;
+    /* Its calls, calls[first_call] on, in the order of the body. */
+    unsigned first_call;
+    unsigned ncalls;
+    /* Whether it calls a function that isn't in the program. */
+    bool unknown_callee;
+    bool is_static;
+    /* Words past STACK_BASE its frame starts at. */
+    int offset;
+};
+
+struct call_graph {
+    struct node *nodes;
+    unsigned count;
+    unsigned allocated;
+    /* Name of the function each call is of, resolved to its node by targets. */
+    const char **callees;
+    int *targets;
+    unsigned ncalls;
+    unsigned calls_allocated;
+};
+
+
+static bool graph_add_node(struct call_graph *g, const char *name, int nvars)
+{
+    if (g->count == g->allocated) {
+        unsigned allocated = g->allocated ? 2 * g->allocated : 256;
+        struct node *nodes = realloc(g->nodes, allocated * sizeof(struct node));
+
+        if (nodes == NULL) {
+            return false;
+        }
+        g->nodes = nodes;
+        g->allocated = allocated;
+    }
+
+    struct node *node = &g->nodes[g->count++];
+
+    memset(node, 0, sizeof(*node));
+    node->name = name;
+    node->nvars = nvars;
+    node->first_call = g->ncalls;
+    // nothing to gain without locals
+    node->is_static = nvars > 0;
+
+    return true;
+}
+
+static bool graph_add_call(struct call_graph *g, const char *callee)
+{
+    if (g->ncalls == g->calls_allocated) {
+        unsigned allocated = g->calls_allocated ? 2 * g->calls_allocated : 1024;
+        const char **callees = realloc(g->callees, allocated * sizeof(const char *));
+
+        if (callees == NULL) {
+            return false;
+        }
+        g->callees = callees;
+        g->calls_allocated = allocated;
+    }
+    g->callees[g->ncalls++] = callee;
+    g->nodes[g->count - 1].ncalls++;
+
+    return true;
+}
+
+static int node_compare(const void *a, const void *b)
+{
+    return strcmp(((const struct node *) a)->name, ((const struct node *) b)->name);
+}
+
+/*
+ * Build the call graph of the functions in streams. Commands before the
+ * first function of a file belong to no function and are left out.
+ */
+static int graph_build(struct call_graph *g, int nfiles, const struct vm_stream streams[])
+{
+    for (int file = 0; file < nfiles; file++) {
+        bool in_function = false;
+
+        for (unsigned i = 0; i < streams[file].count; i++) {
+            const struct vm_command *cmd = &streams[file].commands[i];
+            int n = vm_command_number(cmd);
+
+            if (cmd->id == CMD_FUNCTION && n >= 0) {
+                if (!graph_add_node(g, cmd->tokens[1], n)) {
+                    return EXIT_OUT_OF_MEMORY;
+                }
+                in_function = true;
+            } else if (!in_function) {
+                continue;
+            } else if (cmd->id == CMD_CALL && n >= 0) {
+                if (!graph_add_call(g, cmd->tokens[1])) {
+                    return EXIT_OUT_OF_MEMORY;
+                }
+            } else if ((cmd->id == CMD_PUSH || cmd->id == CMD_POP) && !strcmp(cmd->tokens[1], "local")
+                       && n >= g->nodes[g->count - 1].nvars) {
+                // beyond the locals it declares, it reads its working stack
+                g->nodes[g->count - 1].is_static = false;
+            }
+        }
+    }
+
+    qsort(g->nodes, g->count, sizeof(struct node), node_compare);
+
+    if ((g->targets = malloc((g->ncalls + 1) * sizeof(int))) == NULL) {
+        return EXIT_OUT_OF_MEMORY;
+    }
+
+    for (unsigned i = 0; i < g->count; i++) {
+        struct node *node = &g->nodes[i];
+
+        // which of two functions of the same name is called can't be told
+        if (i > 0 && !strcmp(g->nodes[i - 1].name, node->name)) {
+            g->nodes[i - 1].unknown_callee = node->unknown_callee = true;
+        }
+
+        for (unsigned c = node->first_call; c < node->first_call + node->ncalls; c++) {
+            struct node key = { .name = g->callees[c] };
+            struct node *callee = bsearch(&key, g->nodes, g->count, sizeof(struct node), node_compare);
+
+            g->targets[c] = callee ? callee - g->nodes : -1;
+            node->unknown_callee |= callee == NULL;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Whether the function start may be active more than once at a time, i.e.
+ * whether it may lead back to itself or to code the program doesn't show.
+ * seen and stack must have room for all nodes.
+ */
+static bool may_reenter(const struct call_graph *g, int start, bool seen[], int stack[])
+{
+    unsigned top = 0;
+
+    memset(seen, 0, g->count * sizeof(bool));
+    stack[top++] = start;
+    seen[start] = true;
+
+    while (top > 0) {
+        const struct node *node = &g->nodes[stack[--top]];
+
+        if (node->unknown_callee) {
+            return true;
+        }
+        for (unsigned c = node->first_call; c < node->first_call + node->ncalls; c++) {
+            int target = g->targets[c];
+
+            if (target == start) {
+                return true;
+            }
+            if (target >= 0 && !seen[target]) {
+                seen[target] = true;
+                stack[top++] = target;
+            }
+        }
+    }
+
+    return false;
+}
+
+/*
+ * Place the frame of every function after those of all functions that may
+ * be active when it is called, i.e. after the frames of its callers, and
+ * theirs in turn. Functions on the stack take no room, so cycles through
+ * them settle, and static ones are never on a cycle.
+ */
+static void graph_place(struct call_graph *g)
+{
+    bool changed = true;
+
+    for (unsigned round = 0; changed && round <= g->count; round++) {
+        changed = false;
+
+        for (unsigned i = 0; i < g->count; i++) {
+            const struct node *node = &g->nodes[i];
+            int end = node->offset + (node->is_static ? node->nvars : 0);
+
+            for (unsigned c = node->first_call; c < node->first_call + node->ncalls; c++) {
+                if (g->targets[c] >= 0 && g->nodes[g->targets[c]].offset < end) {
+                    g->nodes[g->targets[c]].offset = end;
+                    changed = true;
+                }
+            }
+        }
+    }
+}
+
+int static_frames_build(struct static_frames *frames, int nfiles, const struct vm_stream streams[],
+                        char *errmsg)
+{
+    struct call_graph g;
+    bool *seen = NULL;
+    int *stack = NULL;
+    int rc;
+
+    memset(&g, 0, sizeof(g));
+    memset(frames, 0, sizeof(*frames));
+
+    if ((rc = graph_build(&g, nfiles, streams))) {
+        goto done;
+    }
+
+    seen = malloc((g.count + 1) * sizeof(bool));
+    stack = malloc((g.count + 1) * sizeof(int));
+    frames->frames = malloc((g.count + 1) * sizeof(struct static_frame));
+    if (seen == NULL || stack == NULL || frames->frames == NULL) {
+        rc = EXIT_OUT_OF_MEMORY;
+        goto done;
+    }
+
+    for (unsigned i = 0; i < g.count; i++) {
+        if (g.nodes[i].is_static && may_reenter(&g, i, seen, stack)) {
+            g.nodes[i].is_static = false;
+        }
+    }
+
+    graph_place(&g);
+
+    for (unsigned i = 0; i < g.count; i++) {
+        const struct node *node = &g.nodes[i];
+        unsigned end = node->offset + node->nvars;
+
+        // the rest keep the stack to themselves
+        if (!node->is_static || end > MAX_FRAMES_SIZE) {
+            continue;
+        }
+        if ((frames->frames[frames->count].name = strdup(node->name)) == NULL) {
+            rc = EXIT_OUT_OF_MEMORY;
+            goto done;
+        }
+        frames->frames[frames->count++].base = STACK_BASE + node->offset;
+        frames->size = end > frames->size ? end : frames->size;
+    }
+
+done:
+    free(g.nodes);
+    free(g.callees);
+    free(g.targets);
+    free(seen);
+    free(stack);
+
+    if (rc) {
+        static_frames_free(frames);
+        return error_format(errmsg, rc);
+    }
+    return 0;
+}
+
+static int frame_compare(const void *a, const void *b)
+{
+    return strcmp(((const struct static_frame *) a)->name, ((const struct static_frame *) b)->name);
+}
+
+int static_frames_lookup(const struct static_frames *frames, const char *name)
+{
+    struct static_frame key = { .name = (char *) name };
+    const struct static_frame *frame = bsearch(&key, frames->frames, frames->count,
+                                               sizeof(struct static_frame), frame_compare);
+
+    return frame ? frame->base : -1;
+}
+
+void static_frames_free(struct static_frames *frames)
+{
+    for (unsigned i = 0; i < frames->count; i++) {
+        free(frames->frames[i].name);
+    }
+    free(frames->frames);
+    memset(frames, 0, sizeof(*frames));
+}
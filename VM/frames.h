@@ -0,0 +1,52 @@
+#pragma once
+
+#include "stream.h"
+
+/*
+ * Static frame allocation (-f). A function that nothing it calls can lead
+ * back to is never active twice at a time, so its locals can live at fixed
+ * RAM addresses instead of on the stack. Functions that can't be active at
+ * the same time share addresses. The frames are put where the stack would
+ * start, which then starts right after them.
+ */
+
+/* RAM address the stack, and the static frames before it, start at. */
+#define STACK_BASE 256
+/* Most words of RAM the static frames may take from the stack. */
+#define MAX_FRAMES_SIZE 512
+
+
+struct static_frame {
+    char *name;
+    /* RAM address of local 0. */
+    int base;
+};
+
+struct static_frames {
+    /* The functions with a static frame, sorted by name. */
+    struct static_frame *frames;
+    unsigned count;
+    /* Words taken by all frames, starting at STACK_BASE. */
+    unsigned size;
+};
+
+
+/*
+ * Find the functions of streams, the commands of all files of a program,
+ * that can have static frames, and allocate the frames. A function keeps
+ * its locals on the stack if it may be recursive, directly or not, if it
+ * may call a function that isn't in the program, or if it accesses locals
+ * it doesn't declare.
+ *
+ * \retval - 0 on success, else the exit code of the error described by errmsg.
+ */
+int static_frames_build(struct static_frames *frames, int nfiles, const struct vm_stream streams[],
+                        char *errmsg);
+
+/*
+ * RAM address of local 0 of the function name, or -1 if its locals are on
+ * the stack.
+ */
+int static_frames_lookup(const struct static_frames *frames, const char *name);
+
+void static_frames_free(struct static_frames *frames);
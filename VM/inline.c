@@ -0,0 +1,424 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "inline.h"
+#include "mapper.h"
+#include "exit.h"
+
+/* Slots of the temp segment. */
+#define TEMP_SIZE 8
+
+
+/*
+ * A function of the program, as a candidate for inlining.
+ */
+struct function {
+    const char *name;
+    /* Index of the file defining it. */
+    int file;
+    /* Commands between the function command and the final return. */
+    const struct vm_command *body;
+    unsigned len;
+    int nvars;
+    /* One past the highest argument and temp index the body uses. */
+    int nargs;
+    int ntemps;
+    bool uses_static;
+    /* Whether the body sets this or that, which callers expect to be kept. */
+    bool sets_pointer[2];
+    bool inlinable;
+};
+
+struct functions {
+    struct function *fun;
+    unsigned len;
+    unsigned allocated;
+};
+
+
+/*
+ * Instructions of the code of an assembly template, labels aside. All of
+ * the templates used here are straight-line code, so this is also the
+ * number of cycles they take.
+ */
+static unsigned asm_cost(const char *template)
+{
+    unsigned n = 0;
+
+    for (const char *s = template; *s; s = strchr(s, '\n') + 1) {
+        if (*s != '(') {
+            n++;
+        }
+    }
+    return n;
+}
+
+/*
+ * Check whether the body of f can be inlined, and note the segments it uses.
+ * The stack depth is followed through the body, so that it takes no more
+ * values than it is given and leaves exactly the return value behind.
+ */
+static bool analyze(struct function *f)
+{
+    int depth = 0;
+
+    if (f->len > INLINE_MAX_COMMANDS) {
+        return false;
+    }
+
+    for (unsigned i = 0; i < f->len; i++) {
+        const struct vm_command *cmd = &f->body[i];
+        int n = vm_command_number(cmd);
+        const char *segment;
+
+        switch (cmd->id) {
+        case CMD_PUSH:
+        case CMD_POP:
+            if (n < 0 || (cmd->id == CMD_PUSH ? ++depth : --depth) < 0) {
+                return false;
+            }
+            segment = cmd->tokens[1];
+            if (!strcmp(segment, "argument")) {
+                f->nargs = n + 1 > f->nargs ? n + 1 : f->nargs;
+            } else if (!strcmp(segment, "local")) {
+                if (n >= f->nvars) {
+                    return false;
+                }
+            } else if (!strcmp(segment, "temp")) {
+                if (n >= TEMP_SIZE) {
+                    return false;
+                }
+                f->ntemps = n + 1 > f->ntemps ? n + 1 : f->ntemps;
+            } else if (!strcmp(segment, "static")) {
+                f->uses_static = true;
+            } else if (!strcmp(segment, "pointer")) {
+                if (n > 1) {
+                    return false;
+                }
+                f->sets_pointer[n] |= cmd->id == CMD_POP;
+            } else if (!strcmp(segment, "constant")) {
+                if (cmd->id == CMD_POP) {
+                    return false;
+                }
+            } else if (strcmp(segment, "this") && strcmp(segment, "that")) {
+                return false;
+            }
+            break;
+        case CMD_ADD:
+        case CMD_SUB:
+        case CMD_AND:
+        case CMD_OR:
+        case CMD_EQ:
+        case CMD_GT:
+        case CMD_LT:
+            if (cmd->ntokens != 1 || --depth < 1) {
+                return false;
+            }
+            break;
+        case CMD_NEG:
+        case CMD_NOT:
+            if (cmd->ntokens != 1 || depth < 1) {
+                return false;
+            }
+            break;
+        case CMD_IFGOTO:
+            depth--;
+            // fall through
+        case CMD_LABEL:
+        case CMD_GOTO:
+            if (cmd->ntokens != 2 || depth != 0) {
+                return false;
+            }
+            break;
+        default:
+            // calls, returns and invalid commands
+            return false;
+        }
+    }
+
+    return depth == 1;
+}
+
+static int function_compare(const void *a, const void *b)
+{
+    return strcmp(((const struct function *) a)->name, ((const struct function *) b)->name);
+}
+
+/*
+ * Add the functions defined in streams to funs, sorted by name. Functions
+ * defined more than once are never inlined.
+ */
+static int collect(struct functions *funs, int nfiles, struct vm_stream streams[])
+{
+    for (int file = 0; file < nfiles; file++) {
+        const struct vm_command *commands = streams[file].commands;
+        unsigned count = streams[file].count;
+
+        for (unsigned i = 0; i < count; i++) {
+            if (commands[i].id != CMD_FUNCTION || commands[i].ntokens != 3) {
+                continue;
+            }
+            if (funs->len == funs->allocated) {
+                unsigned allocated = funs->allocated ? 2 * funs->allocated : 256;
+                struct function *fun = realloc(funs->fun, allocated * sizeof(struct function));
+
+                if (fun == NULL) {
+                    return EXIT_OUT_OF_MEMORY;
+                }
+                funs->fun = fun;
+                funs->allocated = allocated;
+            }
+
+            struct function *f = &funs->fun[funs->len++];
+            unsigned end = i + 1;
+
+            while (end < count && commands[end].id != CMD_FUNCTION) {
+                end++;
+            }
+
+            memset(f, 0, sizeof(*f));
+            f->name = commands[i].tokens[1];
+            f->file = file;
+            f->body = &commands[i + 1];
+            f->nvars = vm_command_number(&commands[i]);
+            f->inlinable = f->nvars >= 0 && end > i + 1 && commands[end - 1].id == CMD_RETURN
+                           && commands[end - 1].ntokens == 1;
+            if (f->inlinable) {
+                f->len = end - i - 2;
+                f->inlinable = analyze(f);
+            }
+        }
+    }
+
+    qsort(funs->fun, funs->len, sizeof(struct function), function_compare);
+
+    for (unsigned i = 1; i < funs->len; i++) {
+        if (!strcmp(funs->fun[i - 1].name, funs->fun[i].name)) {
+            funs->fun[i - 1].inlinable = funs->fun[i].inlinable = false;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * The temp slots that the code from commands[start] to the next function
+ * may rely on across a call: those it pushes before popping them since the
+ * last call, or the last label, as a jump may come from anywhere.
+ */
+static unsigned temps_kept(const struct vm_command *commands, unsigned start, unsigned count)
+{
+    unsigned kept = 0;
+    unsigned written = 0;
+
+    for (unsigned i = start; i < count && commands[i].id != CMD_FUNCTION; i++) {
+        const struct vm_command *cmd = &commands[i];
+        int n = vm_command_number(cmd);
+
+        switch (cmd->id) {
+        case CMD_PUSH:
+        case CMD_POP:
+            if (n < 0 || n >= TEMP_SIZE || strcmp(cmd->tokens[1], "temp")) {
+                break;
+            }
+            if (cmd->id == CMD_POP) {
+                written |= 1u << n;
+            } else if (!(written & 1u << n)) {
+                kept |= 1u << n;
+            }
+            break;
+        case CMD_CALL:
+        case CMD_LABEL:
+            written = 0;
+            break;
+        default:
+            break;
+        }
+    }
+    return kept;
+}
+
+/*
+ * The function called by call, if it can be inlined there with nargs
+ * arguments, or NULL. The caller's kept temp slots must be left alone.
+ */
+static const struct function *inlinable_callee(const struct functions *funs,
+                                               const struct vm_command *call,
+                                               int file, int nargs, unsigned kept)
+{
+    struct function key = { .name = call->tokens[1] };
+    const struct function *f = bsearch(&key, funs->fun, funs->len,
+                                       sizeof(struct function), function_compare);
+
+    if (f == NULL || !f->inlinable || nargs < f->nargs) {
+        return NULL;
+    }
+    // test scripts and the VM interpreter tell the end of a program by it
+    if (!strcmp(f->name, "Sys.halt")) {
+        return NULL;
+    }
+    // statics belong to the file they are used in
+    if (f->uses_static && f->file != file) {
+        return NULL;
+    }
+    int temps = f->ntemps + nargs + f->nvars + f->sets_pointer[0] + f->sets_pointer[1];
+
+    if (temps > TEMP_SIZE || (kept & ((1u << temps) - 1))) {
+        return NULL;
+    }
+    return f;
+}
+
+/*
+ * Cycles saved by inlining f with nargs arguments: the call, return and
+ * initialization of locals, less the moving of arguments and pointers.
+ */
+static int cycles_saved(const struct function *f, int nargs)
+{
+    int saves = f->sets_pointer[0] + f->sets_pointer[1];
+    int call = asm_cost(ASM_CALL) + asm_cost(ASM_RETURN) + f->nvars * asm_cost(ASM_PUSH_CONST);
+    int inlined = nargs * asm_cost(ASM_POP_TEMP)
+                  + f->nvars * (asm_cost(ASM_PUSH_CONST) + asm_cost(ASM_POP_TEMP))
+                  + saves * (asm_cost(ASM_PUSH_POINTER) + asm_cost(ASM_POP_TEMP)
+                             + asm_cost(ASM_PUSH_TEMP) + asm_cost(ASM_POP_POINTER));
+
+    return call - inlined;
+}
+
+/*
+ * Append the body of f to out in place of call, which passes it nargs
+ * arguments. The temp slots f uses are left alone; its arguments, locals and
+ * the pointers it changes are kept in the ones after them. Labels are made
+ * unique to the call site, which is the site-th one inlined.
+ */
+static int expand(struct vm_stream *out, const struct vm_command *call, const struct function *f,
+                  int nargs, unsigned site)
+{
+    int args = f->ntemps;
+    int locals = args + nargs;
+    int saved[2];
+    int next = locals + f->nvars;
+    unsigned line = call->line;
+    char label[MAX_LINE_LEN + 1];
+    int rc;
+
+    for (int i = nargs - 1; i >= 0; i--) {
+        if ((rc = vm_stream_add(out, line, CMD_POP, "temp", args + i))) {
+            return rc;
+        }
+    }
+    for (int i = 0; i < f->nvars; i++) {
+        if ((rc = vm_stream_add(out, line, CMD_PUSH, "constant", 0))
+            || (rc = vm_stream_add(out, line, CMD_POP, "temp", locals + i))) {
+            return rc;
+        }
+    }
+    for (int p = 0; p < 2; p++) {
+        if (f->sets_pointer[p]) {
+            saved[p] = next++;
+            if ((rc = vm_stream_add(out, line, CMD_PUSH, "pointer", p))
+                || (rc = vm_stream_add(out, line, CMD_POP, "temp", saved[p]))) {
+                return rc;
+            }
+        }
+    }
+
+    for (unsigned i = 0; i < f->len; i++) {
+        const struct vm_command *cmd = &f->body[i];
+
+        if ((cmd->id == CMD_PUSH || cmd->id == CMD_POP) && !strcmp(cmd->tokens[1], "argument")) {
+            rc = vm_stream_add(out, line, cmd->id, "temp", args + vm_command_number(cmd));
+        } else if ((cmd->id == CMD_PUSH || cmd->id == CMD_POP) && !strcmp(cmd->tokens[1], "local")) {
+            rc = vm_stream_add(out, line, cmd->id, "temp", locals + vm_command_number(cmd));
+        } else if (cmd->id == CMD_LABEL || cmd->id == CMD_GOTO || cmd->id == CMD_IFGOTO) {
+            snprintf(label, sizeof(label), "%s$%s$%u", f->name, cmd->tokens[1], site);
+            rc = vm_stream_add(out, line, cmd->id, label, -1);
+        } else {
+            rc = vm_stream_push(out, line, cmd->ntokens, (const char **) cmd->tokens);
+        }
+        if (rc) {
+            return rc;
+        }
+    }
+
+    // the return value stays on top
+    for (int p = 0; p < 2; p++) {
+        if (f->sets_pointer[p]) {
+            if ((rc = vm_stream_add(out, line, CMD_PUSH, "temp", saved[p]))
+                || (rc = vm_stream_add(out, line, CMD_POP, "pointer", p))) {
+                return rc;
+            }
+        }
+    }
+
+    return 0;
+}
+
+int inline_calls(int nfiles, char filenames[][MAX_FILENAME_LEN+1], struct vm_stream streams[],
+                 FILE *report, char *errmsg)
+{
+    struct functions funs = { NULL, 0, 0 };
+    // the bodies are copied from the original streams, so keep them until done
+    struct vm_stream *inlined = calloc(nfiles, sizeof(struct vm_stream));
+    unsigned sites = 0;
+    int rc = 0;
+
+    if (inlined == NULL || (rc = collect(&funs, nfiles, streams))) {
+        free(inlined);
+        free(funs.fun);
+        return error_format(errmsg, EXIT_OUT_OF_MEMORY);
+    }
+
+    for (int file = 0; file < nfiles && !rc; file++) {
+        const char *caller = "";
+        unsigned kept = temps_kept(streams[file].commands, 0, streams[file].count);
+
+        vm_stream_init(&inlined[file]);
+
+        for (unsigned i = 0; i < streams[file].count && !rc; i++) {
+            const struct vm_command *cmd = &streams[file].commands[i];
+            const struct function *callee = NULL;
+            int nargs = vm_command_number(cmd);
+
+            if (cmd->id == CMD_FUNCTION && cmd->ntokens > 1) {
+                caller = cmd->tokens[1];
+                kept = temps_kept(streams[file].commands, i + 1, streams[file].count);
+            } else if (cmd->id == CMD_CALL && nargs >= 0) {
+                callee = inlinable_callee(&funs, cmd, file, nargs, kept);
+            }
+
+            if (callee == NULL) {
+                rc = vm_stream_push(&inlined[file], cmd->line, cmd->ntokens, (const char **) cmd->tokens);
+                continue;
+            }
+
+            rc = expand(&inlined[file], cmd, callee, nargs, sites++);
+            if (report) {
+                fprintf(report, "%s:%u: %s inlined into %s, ~%d cycles saved per call\n",
+                        filenames[file], cmd->line, callee->name, caller,
+                        cycles_saved(callee, nargs));
+            }
+        }
+    }
+
+    for (int file = 0; file < nfiles; file++) {
+        if (rc) {
+            vm_stream_free(&inlined[file]);
+        } else {
+            vm_stream_free(&streams[file]);
+            streams[file] = inlined[file];
+        }
+    }
+    free(inlined);
+    free(funs.fun);
+
+    if (rc) {
+        return error_format(errmsg, rc);
+    }
+    if (report) {
+        fprintf(report, "%u call sites inlined\n", sites);
+    }
+    return 0;
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stdio.h>
+
+#include "stream.h"
+#include "files.h"
+
+/*
+ * Whole-program inlining of small functions (-i). A call of a leaf function
+ * whose body is short enough is replaced by the body itself, with the
+ * arguments and locals of the callee moved to the temp segment. Temp is
+ * global, so a call is left alone if its caller may keep a temp value across
+ * a call, which the code of the Jack compiler never does.
+ */
+
+/* Most commands a function body may have to be inlined, return excluded. */
+#define INLINE_MAX_COMMANDS 16
+
+
+/*
+ * Inline the calls of small functions in streams, the commands of the files
+ * of a program in the order of filenames. A function is inlined if it:
+ *
+ * - calls nothing and has a single return, at its end,
+ * - keeps its stack empty at labels and jumps, so that its body leaves just
+ *   the return value behind,
+ * - uses no statics, unless called from its own file,
+ * - fits its arguments, locals and the this / that pointers it changes in
+ *   the temp slots it doesn't use itself,
+ * - and these slots hold nothing its caller may read after a call: a temp
+ *   slot the caller pushes before popping it, since its last call or label.
+ *
+ * Each call site inlined is reported to report, unless NULL, with the
+ * cycles it is estimated to save each time it runs.
+ *
+ * \retval - 0 on success, else the exit code of the error described by errmsg.
+ */
+int inline_calls(int nfiles, char filenames[][MAX_FILENAME_LEN+1], struct vm_stream streams[],
+                 FILE *report, char *errmsg);
@@ -0,0 +1,1058 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <ctype.h>
+
+#include "jack.h"
+#include "exit.h"
+
+/* Longest token, string constants included. */
+#define MAX_TOKEN_LEN 1023
+/* Largest integer constant. */
+#define MAX_INT 32767
+
+#define SYMBOLS "{}()[].,;+-*/&|<>=~"
+
+enum token_kind {
+    TOKEN_END,
+    TOKEN_KEYWORD,
+    TOKEN_SYMBOL,
+    TOKEN_INT,
+    TOKEN_STRING,
+    TOKEN_IDENTIFIER,
+    /* Not a token; tok tells what is wrong with it. */
+    TOKEN_INVALID,
+};
+
+static const char *const keywords[] = {
+    "class", "constructor", "function", "method", "field", "static", "var",
+    "int", "char", "boolean", "void", "true", "false", "null", "this", "let",
+    "do", "if", "else", "while", "return", NULL
+};
+
+struct lexer {
+    const char *filename;
+    const char *p;
+    unsigned line;
+    enum token_kind kind;
+    char tok[MAX_TOKEN_LEN + 1];
+    char *errmsg;
+};
+
+enum var_kind {
+    VAR_STATIC,
+    VAR_FIELD,
+    VAR_ARGUMENT,
+    VAR_LOCAL,
+    MAX_VAR_KINDS  /* their total count */
+};
+
+/* Segment each kind of variable lives in. */
+static const char *const segments[MAX_VAR_KINDS] = {
+    [VAR_STATIC] = "static", [VAR_FIELD] = "this",
+    [VAR_ARGUMENT] = "argument", [VAR_LOCAL] = "local"
+};
+
+struct symbol {
+    char name[JACK_MAX_NAME + 1];
+    char type[JACK_MAX_NAME + 1];
+    enum var_kind kind;
+    unsigned index;
+};
+
+/* The variables of a class or of a subroutine. */
+struct scope {
+    struct symbol *symbols;
+    unsigned count;
+    unsigned allocated;
+};
+
+struct compiler {
+    struct lexer lx;
+    const struct jack_signatures *sigs;
+    struct vm_stream *out;
+    char class_name[JACK_MAX_NAME + 1];
+    struct scope class_vars;
+    struct scope subroutine_vars;
+    /* Number of variables of each kind declared so far. */
+    unsigned nvars[MAX_VAR_KINDS];
+    /* Whether the subroutine being compiled is a constructor or a method. */
+    bool has_this;
+    /* Counters of the labels of if and while statements of the subroutine. */
+    unsigned if_labels;
+    unsigned while_labels;
+};
+
+static const struct {
+    const char *symbol;
+    cmd_id id;
+    /* The OS function that implements it, if any. */
+    const char *function;
+} operators[] = {
+    { "+", CMD_ADD, NULL }, { "-", CMD_SUB, NULL }, { "&", CMD_AND, NULL },
+    { "|", CMD_OR, NULL }, { "<", CMD_LT, NULL }, { ">", CMD_GT, NULL },
+    { "=", CMD_EQ, NULL }, { "*", CMD_CALL, "Math.multiply" },
+    { "/", CMD_CALL, "Math.divide" },
+};
+
+
+static int syntax_error(struct lexer *lx, const char *msg)
+{
+    // an invalid token is a better explanation than what was expected
+    if (lx->kind == TOKEN_INVALID) {
+        msg = lx->tok;
+    }
+    return error_format(lx->errmsg, EXIT_JACK_SYNTAX, lx->filename, lx->line, msg);
+}
+
+static void invalid(struct lexer *lx, const char *msg)
+{
+    lx->kind = TOKEN_INVALID;
+    strcpy(lx->tok, msg);
+}
+
+static bool is_keyword(const char *s)
+{
+    for (int i = 0; keywords[i]; i++) {
+        if (!strcmp(s, keywords[i])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Read the next token into lx->tok and its kind into lx->kind. String
+ * constants are stored without their quotes.
+ */
+static void next(struct lexer *lx)
+{
+    const char *p = lx->p;
+    size_t n = 0;
+
+    for (;;) {
+        while (isspace((unsigned char) *p)) {
+            lx->line += *p++ == '\n';
+        }
+        if (p[0] == '/' && p[1] == '/') {
+            while (*p && *p != '\n') {
+                p++;
+            }
+        } else if (p[0] == '/' && p[1] == '*') {
+            for (p += 2; *p && !(p[0] == '*' && p[1] == '/'); p++) {
+                lx->line += *p == '\n';
+            }
+            p += *p ? 2 : 0;
+        } else {
+            break;
+        }
+    }
+
+    if (*p == '\0') {
+        lx->kind = TOKEN_END;
+    } else if (isalpha((unsigned char) *p) || *p == '_') {
+        while ((isalnum((unsigned char) *p) || *p == '_') && n < MAX_TOKEN_LEN) {
+            lx->tok[n++] = *p++;
+        }
+        lx->tok[n] = '\0';
+        lx->kind = is_keyword(lx->tok) ? TOKEN_KEYWORD : TOKEN_IDENTIFIER;
+    } else if (isdigit((unsigned char) *p)) {
+        while (isdigit((unsigned char) *p) && n < MAX_TOKEN_LEN) {
+            lx->tok[n++] = *p++;
+        }
+        lx->tok[n] = '\0';
+        lx->kind = TOKEN_INT;
+    } else if (*p == '"') {
+        for (p++; *p && *p != '"' && *p != '\n' && n < MAX_TOKEN_LEN; p++) {
+            lx->tok[n++] = *p;
+        }
+        lx->tok[n] = '\0';
+        lx->kind = TOKEN_STRING;
+        if (*p == '"') {
+            p++;
+        } else {
+            invalid(lx, n == MAX_TOKEN_LEN ? "String constant too long" : "Unterminated string constant");
+        }
+    } else if (strchr(SYMBOLS, *p)) {
+        lx->tok[n++] = *p++;
+        lx->tok[n] = '\0';
+        lx->kind = TOKEN_SYMBOL;
+    } else {
+        invalid(lx, "Invalid character");
+    }
+
+    lx->p = p;
+}
+
+/*
+ * Whether the current token is the keyword or symbol tok.
+ */
+static bool is(const struct lexer *lx, const char *tok)
+{
+    return (lx->kind == TOKEN_KEYWORD || lx->kind == TOKEN_SYMBOL) && !strcmp(lx->tok, tok);
+}
+
+static bool accept(struct lexer *lx, const char *tok)
+{
+    if (!is(lx, tok)) {
+        return false;
+    }
+    next(lx);
+    return true;
+}
+
+static int expect(struct lexer *lx, const char *tok)
+{
+    char msg[64];
+
+    if (accept(lx, tok)) {
+        return 0;
+    }
+    snprintf(msg, sizeof(msg), "Expected %s", tok);
+    return syntax_error(lx, msg);
+}
+
+static int name(struct lexer *lx, char *dst)
+{
+    if (lx->kind != TOKEN_IDENTIFIER) {
+        return syntax_error(lx, "Expected a name");
+    }
+    if (strlen(lx->tok) > JACK_MAX_NAME) {
+        return syntax_error(lx, "Name too long");
+    }
+    strcpy(dst, lx->tok);
+    next(lx);
+    return 0;
+}
+
+/*
+ * int, char, boolean or a class name
+ */
+static int type_name(struct lexer *lx, char *dst)
+{
+    if (is(lx, "int") || is(lx, "char") || is(lx, "boolean")) {
+        strcpy(dst, lx->tok);
+        next(lx);
+        return 0;
+    }
+    return name(lx, dst);
+}
+
+static int emit(struct compiler *c, cmd_id id, const char *arg, int n)
+{
+    if (vm_stream_add(c->out, c->lx.line, id, arg, n)) {
+        return error_format(c->lx.errmsg, EXIT_OUT_OF_MEMORY);
+    }
+    return 0;
+}
+
+static int emit_label(struct compiler *c, cmd_id id, const char *prefix, unsigned n)
+{
+    char label[32];
+
+    sprintf(label, "%s%u", prefix, n);
+    return emit(c, id, label, -1);
+}
+
+static const struct symbol *scope_find(const struct scope *scope, const char *name)
+{
+    for (unsigned i = 0; i < scope->count; i++) {
+        if (!strcmp(scope->symbols[i].name, name)) {
+            return &scope->symbols[i];
+        }
+    }
+    return NULL;
+}
+
+static const struct symbol *lookup(const struct compiler *c, const char *name)
+{
+    const struct symbol *var = scope_find(&c->subroutine_vars, name);
+    return var ? var : scope_find(&c->class_vars, name);
+}
+
+static int declare(struct compiler *c, struct scope *scope, enum var_kind kind,
+                   const char *type, const char *name)
+{
+    char msg[JACK_MAX_NAME + 32];
+
+    if (scope_find(scope, name)) {
+        snprintf(msg, sizeof(msg), "Variable %s declared twice", name);
+        return syntax_error(&c->lx, msg);
+    }
+
+    if (scope->count == scope->allocated) {
+        scope->allocated = scope->allocated ? scope->allocated * 2 : 16;
+        struct symbol *p = realloc(scope->symbols, scope->allocated * sizeof(*p));
+        if (p == NULL) {
+            return error_format(c->lx.errmsg, EXIT_OUT_OF_MEMORY);
+        }
+        scope->symbols = p;
+    }
+
+    struct symbol *var = &scope->symbols[scope->count++];
+
+    strcpy(var->name, name);
+    strcpy(var->type, type);
+    var->kind = kind;
+    var->index = c->nvars[kind]++;
+
+    return 0;
+}
+
+/*
+ * Look up a variable that is used, which must be declared and, if it is a
+ * field, used where there is an object.
+ */
+static int variable(struct compiler *c, const char *name, const struct symbol **var)
+{
+    char msg[JACK_MAX_NAME + 32];
+
+    if ((*var = lookup(c, name)) == NULL) {
+        snprintf(msg, sizeof(msg), "Undefined variable %s", name);
+        return syntax_error(&c->lx, msg);
+    }
+    if ((*var)->kind == VAR_FIELD && !c->has_this) {
+        snprintf(msg, sizeof(msg), "Field %s used in a function", name);
+        return syntax_error(&c->lx, msg);
+    }
+    return 0;
+}
+
+static int push_variable(struct compiler *c, const struct symbol *var)
+{
+    return emit(c, CMD_PUSH, segments[var->kind], var->index);
+}
+
+/*
+ * type name (, name)* ;
+ */
+static int var_dec(struct compiler *c, struct scope *scope, enum var_kind kind)
+{
+    char type[JACK_MAX_NAME + 1];
+    char var_name[JACK_MAX_NAME + 1];
+    int rc;
+
+    if ((rc = type_name(&c->lx, type))) {
+        return rc;
+    }
+    do {
+        if ((rc = name(&c->lx, var_name)) || (rc = declare(c, scope, kind, type, var_name))) {
+            return rc;
+        }
+    } while (accept(&c->lx, ","));
+
+    return expect(&c->lx, ";");
+}
+
+static int expression(struct compiler *c);
+
+/*
+ * Expressions separated by commas, up to the ). Their number is put in n.
+ */
+static int expression_list(struct compiler *c, int *n)
+{
+    int rc;
+
+    *n = 0;
+    if (is(&c->lx, ")")) {
+        return 0;
+    }
+    do {
+        if ((rc = expression(c))) {
+            return rc;
+        }
+        (*n)++;
+    } while (accept(&c->lx, ","));
+
+    return 0;
+}
+
+static int compare_signatures(const void *a, const void *b)
+{
+    return strcmp(((const struct jack_signature *) a)->name,
+                  ((const struct jack_signature *) b)->name);
+}
+
+static bool knows_class(const struct jack_signatures *sigs, const char *class_name)
+{
+    for (unsigned i = 0; sigs && i < sigs->nclasses; i++) {
+        if (!strcmp(sigs->classes[i], class_name)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static const struct jack_signature *find_signature(const struct jack_signatures *sigs,
+                                                   const char *function)
+{
+    struct jack_signature key;
+
+    snprintf(key.name, sizeof(key.name), "%s", function);
+    return bsearch(&key, sigs->subroutines, sigs->count, sizeof(key), compare_signatures);
+}
+
+/*
+ * Check a call with nargs arguments, this included, of function, a
+ * subroutine of a scanned class.
+ */
+static int check_call(struct compiler *c, const struct jack_signature *sig,
+                      const char *function, int nargs)
+{
+    char msg[2 * JACK_MAX_NAME + 64];
+    int nparams;
+
+    if (sig == NULL) {
+        snprintf(msg, sizeof(msg), "Undefined subroutine %s", function);
+        return syntax_error(&c->lx, msg);
+    }
+
+    nparams = sig->nparams + (sig->kind == JACK_METHOD);
+    if (nargs != nparams) {
+        snprintf(msg, sizeof(msg), "Wrong number of arguments to %s", function);
+        return syntax_error(&c->lx, msg);
+    }
+    return 0;
+}
+
+/*
+ * The rest of a subroutine call whose first name has been read:
+ * sub(args), Class.sub(args) or var.sub(args)
+ */
+static int call(struct compiler *c, const char *first)
+{
+    char sub[JACK_MAX_NAME + 1];
+    char function[2 * JACK_MAX_NAME + 2];
+    char msg[2 * JACK_MAX_NAME + 64];
+    const struct symbol *var;
+    const struct jack_signature *sig = NULL;
+    const char *class_name = first;
+    bool known, method;
+    int nargs = 0, n;
+    int rc;
+
+    if (accept(&c->lx, ".")) {
+        if ((rc = name(&c->lx, sub))) {
+            return rc;
+        }
+        if (lookup(c, first)) {
+            // a method of the object in the variable
+            if ((rc = variable(c, first, &var))) {
+                return rc;
+            }
+            if (!strcmp(var->type, "int") || !strcmp(var->type, "char")
+                || !strcmp(var->type, "boolean")) {
+                snprintf(msg, sizeof(msg), "%s is not an object", first);
+                return syntax_error(&c->lx, msg);
+            }
+            if ((rc = push_variable(c, var))) {
+                return rc;
+            }
+            nargs = 1;
+            class_name = var->type;
+        }
+        sprintf(function, "%s.%s", class_name, sub);
+        if ((known = knows_class(c->sigs, class_name))) {
+            sig = find_signature(c->sigs, function);
+        }
+        if (sig && (sig->kind == JACK_METHOD) != (nargs == 1)) {
+            snprintf(msg, sizeof(msg), nargs ? "%s is not a method" : "Method %s called without an object",
+                     function);
+            return syntax_error(&c->lx, msg);
+        }
+    } else {
+        sprintf(function, "%s.%s", c->class_name, first);
+        // a method of this, unless the scan says otherwise
+        if ((known = c->sigs != NULL)) {
+            sig = find_signature(c->sigs, function);
+        }
+        method = known ? sig && sig->kind == JACK_METHOD : c->has_this;
+        if (method) {
+            if (!c->has_this) {
+                snprintf(msg, sizeof(msg), "Method %s called from a function", function);
+                return syntax_error(&c->lx, msg);
+            }
+            if ((rc = emit(c, CMD_PUSH, "pointer", 0))) {
+                return rc;
+            }
+            nargs = 1;
+        }
+    }
+
+    if ((rc = expect(&c->lx, "(")) || (rc = expression_list(c, &n))
+        || (rc = expect(&c->lx, ")"))) {
+        return rc;
+    }
+    if (known && (rc = check_call(c, sig, function, nargs + n))) {
+        return rc;
+    }
+
+    return emit(c, CMD_CALL, function, nargs + n);
+}
+
+static int string_constant(struct compiler *c)
+{
+    char s[MAX_TOKEN_LEN + 1];
+    int rc;
+
+    strcpy(s, c->lx.tok);
+    next(&c->lx);
+
+    if ((rc = emit(c, CMD_PUSH, "constant", strlen(s)))
+        || (rc = emit(c, CMD_CALL, "String.new", 1))) {
+        return rc;
+    }
+    for (char *p = s; *p; p++) {
+        if ((rc = emit(c, CMD_PUSH, "constant", (unsigned char) *p))
+            || (rc = emit(c, CMD_CALL, "String.appendChar", 2))) {
+            return rc;
+        }
+    }
+    return 0;
+}
+
+static int term(struct compiler *c)
+{
+    struct lexer *lx = &c->lx;
+    char first[JACK_MAX_NAME + 1];
+    const struct symbol *var;
+    int rc;
+
+    if (lx->kind == TOKEN_INT) {
+        long i = strtol(lx->tok, NULL, 10);
+
+        if (strlen(lx->tok) > 5 || i > MAX_INT) {
+            return syntax_error(lx, "Integer constant too large");
+        }
+        next(lx);
+        return emit(c, CMD_PUSH, "constant", i);
+    } else if (lx->kind == TOKEN_STRING) {
+        return string_constant(c);
+    } else if (accept(lx, "true")) {
+        if ((rc = emit(c, CMD_PUSH, "constant", 0))) {
+            return rc;
+        }
+        return emit(c, CMD_NOT, NULL, -1);
+    } else if (accept(lx, "false") || accept(lx, "null")) {
+        return emit(c, CMD_PUSH, "constant", 0);
+    } else if (is(lx, "this")) {
+        if (!c->has_this) {
+            return syntax_error(lx, "this used in a function");
+        }
+        next(lx);
+        return emit(c, CMD_PUSH, "pointer", 0);
+    } else if (accept(lx, "(")) {
+        if ((rc = expression(c))) {
+            return rc;
+        }
+        return expect(lx, ")");
+    } else if (accept(lx, "-")) {
+        if ((rc = term(c))) {
+            return rc;
+        }
+        return emit(c, CMD_NEG, NULL, -1);
+    } else if (accept(lx, "~")) {
+        if ((rc = term(c))) {
+            return rc;
+        }
+        return emit(c, CMD_NOT, NULL, -1);
+    } else if (lx->kind != TOKEN_IDENTIFIER) {
+        return syntax_error(lx, "Expected a term");
+    }
+
+    if ((rc = name(lx, first))) {
+        return rc;
+    }
+    if (is(lx, "(") || is(lx, ".")) {
+        return call(c, first);
+    }
+    if ((rc = variable(c, first, &var)) || (rc = push_variable(c, var))) {
+        return rc;
+    }
+    if (!accept(lx, "[")) {
+        return 0;
+    }
+
+    // var[i]
+    if ((rc = expression(c)) || (rc = expect(lx, "]")) || (rc = emit(c, CMD_ADD, NULL, -1))
+        || (rc = emit(c, CMD_POP, "pointer", 1))) {
+        return rc;
+    }
+    return emit(c, CMD_PUSH, "that", 0);
+}
+
+/*
+ * term (op term)*, evaluated from left to right as Jack has no precedence.
+ */
+static int expression(struct compiler *c)
+{
+    int rc;
+
+    if ((rc = term(c))) {
+        return rc;
+    }
+
+    for (;;) {
+        unsigned op;
+
+        for (op = 0; op < sizeof(operators) / sizeof(operators[0]); op++) {
+            if (c->lx.kind == TOKEN_SYMBOL && !strcmp(c->lx.tok, operators[op].symbol)) {
+                break;
+            }
+        }
+        if (op == sizeof(operators) / sizeof(operators[0])) {
+            return 0;
+        }
+
+        next(&c->lx);
+        if ((rc = term(c))) {
+            return rc;
+        }
+        if (operators[op].function) {
+            rc = emit(c, CMD_CALL, operators[op].function, 2);
+        } else {
+            rc = emit(c, operators[op].id, NULL, -1);
+        }
+        if (rc) {
+            return rc;
+        }
+    }
+}
+
+static int statements(struct compiler *c);
+
+/*
+ * { statements }
+ */
+static int block(struct compiler *c)
+{
+    int rc;
+
+    if ((rc = expect(&c->lx, "{")) || (rc = statements(c))) {
+        return rc;
+    }
+    return expect(&c->lx, "}");
+}
+
+/*
+ * ( expression )
+ */
+static int condition(struct compiler *c)
+{
+    int rc;
+
+    if ((rc = expect(&c->lx, "(")) || (rc = expression(c))) {
+        return rc;
+    }
+    return expect(&c->lx, ")");
+}
+
+static int let_statement(struct compiler *c)
+{
+    char var_name[JACK_MAX_NAME + 1];
+    const struct symbol *var;
+    bool indexed;
+    int rc;
+
+    if ((rc = name(&c->lx, var_name)) || (rc = variable(c, var_name, &var))) {
+        return rc;
+    }
+
+    // the address of var[i] is computed first, and kept on the stack
+    if ((indexed = accept(&c->lx, "["))) {
+        if ((rc = push_variable(c, var)) || (rc = expression(c))
+            || (rc = expect(&c->lx, "]")) || (rc = emit(c, CMD_ADD, NULL, -1))) {
+            return rc;
+        }
+    }
+
+    if ((rc = expect(&c->lx, "=")) || (rc = expression(c)) || (rc = expect(&c->lx, ";"))) {
+        return rc;
+    }
+
+    if (!indexed) {
+        return emit(c, CMD_POP, segments[var->kind], var->index);
+    }
+    if ((rc = emit(c, CMD_POP, "temp", 0)) || (rc = emit(c, CMD_POP, "pointer", 1))
+        || (rc = emit(c, CMD_PUSH, "temp", 0))) {
+        return rc;
+    }
+    return emit(c, CMD_POP, "that", 0);
+}
+
+static int if_statement(struct compiler *c)
+{
+    unsigned n = c->if_labels++;
+    int rc;
+
+    if ((rc = condition(c)) || (rc = emit_label(c, CMD_IFGOTO, "IF_TRUE", n))
+        || (rc = emit_label(c, CMD_GOTO, "IF_FALSE", n))
+        || (rc = emit_label(c, CMD_LABEL, "IF_TRUE", n)) || (rc = block(c))) {
+        return rc;
+    }
+
+    if (!accept(&c->lx, "else")) {
+        return emit_label(c, CMD_LABEL, "IF_FALSE", n);
+    }
+    if ((rc = emit_label(c, CMD_GOTO, "IF_END", n))
+        || (rc = emit_label(c, CMD_LABEL, "IF_FALSE", n)) || (rc = block(c))) {
+        return rc;
+    }
+    return emit_label(c, CMD_LABEL, "IF_END", n);
+}
+
+static int while_statement(struct compiler *c)
+{
+    unsigned n = c->while_labels++;
+    int rc;
+
+    if ((rc = emit_label(c, CMD_LABEL, "WHILE_EXP", n)) || (rc = condition(c))
+        || (rc = emit(c, CMD_NOT, NULL, -1)) || (rc = emit_label(c, CMD_IFGOTO, "WHILE_END", n))
+        || (rc = block(c)) || (rc = emit_label(c, CMD_GOTO, "WHILE_EXP", n))) {
+        return rc;
+    }
+    return emit_label(c, CMD_LABEL, "WHILE_END", n);
+}
+
+static int do_statement(struct compiler *c)
+{
+    char first[JACK_MAX_NAME + 1];
+    int rc;
+
+    if ((rc = name(&c->lx, first)) || (rc = call(c, first)) || (rc = expect(&c->lx, ";"))) {
+        return rc;
+    }
+    // the value returned is dropped
+    return emit(c, CMD_POP, "temp", 0);
+}
+
+static int return_statement(struct compiler *c)
+{
+    int rc;
+
+    if (is(&c->lx, ";")) {
+        // void subroutines return 0 all the same
+        rc = emit(c, CMD_PUSH, "constant", 0);
+    } else {
+        rc = expression(c);
+    }
+    if (rc || (rc = expect(&c->lx, ";"))) {
+        return rc;
+    }
+    return emit(c, CMD_RETURN, NULL, -1);
+}
+
+/*
+ * Statements up to the first token that can't start one.
+ */
+static int statements(struct compiler *c)
+{
+    struct lexer *lx = &c->lx;
+    int rc;
+
+    for (;;) {
+        if (accept(lx, "let")) {
+            rc = let_statement(c);
+        } else if (accept(lx, "if")) {
+            rc = if_statement(c);
+        } else if (accept(lx, "while")) {
+            rc = while_statement(c);
+        } else if (accept(lx, "do")) {
+            rc = do_statement(c);
+        } else if (accept(lx, "return")) {
+            rc = return_statement(c);
+        } else {
+            return 0;
+        }
+        if (rc) {
+            return rc;
+        }
+    }
+}
+
+/*
+ * (constructor|function|method) (void|type) name ( parameters ) { var* statements }
+ */
+static int subroutine(struct compiler *c)
+{
+    struct lexer *lx = &c->lx;
+    char sub[JACK_MAX_NAME + 1];
+    char type[JACK_MAX_NAME + 1];
+    char function[2 * JACK_MAX_NAME + 2];
+    bool constructor = is(lx, "constructor"), method = is(lx, "method");
+    int rc;
+
+    next(lx);
+
+    c->subroutine_vars.count = 0;
+    c->nvars[VAR_ARGUMENT] = method; // argument 0 of a method is this
+    c->nvars[VAR_LOCAL] = 0;
+    c->has_this = constructor || method;
+    c->if_labels = 0;
+    c->while_labels = 0;
+
+    if (!accept(lx, "void") && (rc = type_name(lx, type))) {
+        return rc;
+    }
+    if ((rc = name(lx, sub)) || (rc = expect(lx, "("))) {
+        return rc;
+    }
+
+    if (!is(lx, ")")) {
+        do {
+            char param[JACK_MAX_NAME + 1];
+
+            if ((rc = type_name(lx, type)) || (rc = name(lx, param))
+                || (rc = declare(c, &c->subroutine_vars, VAR_ARGUMENT, type, param))) {
+                return rc;
+            }
+        } while (accept(lx, ","));
+    }
+
+    if ((rc = expect(lx, ")")) || (rc = expect(lx, "{"))) {
+        return rc;
+    }
+    while (accept(lx, "var")) {
+        if ((rc = var_dec(c, &c->subroutine_vars, VAR_LOCAL))) {
+            return rc;
+        }
+    }
+
+    sprintf(function, "%s.%s", c->class_name, sub);
+    if ((rc = emit(c, CMD_FUNCTION, function, c->nvars[VAR_LOCAL]))) {
+        return rc;
+    }
+
+    if (constructor) {
+        if ((rc = emit(c, CMD_PUSH, "constant", c->nvars[VAR_FIELD]))
+            || (rc = emit(c, CMD_CALL, "Memory.alloc", 1))
+            || (rc = emit(c, CMD_POP, "pointer", 0))) {
+            return rc;
+        }
+    } else if (method) {
+        if ((rc = emit(c, CMD_PUSH, "argument", 0)) || (rc = emit(c, CMD_POP, "pointer", 0))) {
+            return rc;
+        }
+    }
+
+    if ((rc = statements(c))) {
+        return rc;
+    }
+    return expect(lx, "}");
+}
+
+/*
+ * class name { (static|field)* subroutine* }
+ */
+static int class_dec(struct compiler *c)
+{
+    struct lexer *lx = &c->lx;
+    int rc;
+
+    if ((rc = expect(lx, "class")) || (rc = name(lx, c->class_name)) || (rc = expect(lx, "{"))) {
+        return rc;
+    }
+
+    for (;;) {
+        if (accept(lx, "static")) {
+            rc = var_dec(c, &c->class_vars, VAR_STATIC);
+        } else if (accept(lx, "field")) {
+            rc = var_dec(c, &c->class_vars, VAR_FIELD);
+        } else {
+            break;
+        }
+        if (rc) {
+            return rc;
+        }
+    }
+
+    while (is(lx, "constructor") || is(lx, "function") || is(lx, "method")) {
+        if ((rc = subroutine(c))) {
+            return rc;
+        }
+    }
+
+    if ((rc = expect(lx, "}"))) {
+        return rc;
+    }
+    if (lx->kind != TOKEN_END) {
+        return syntax_error(lx, "Expected the end of the file");
+    }
+    return 0;
+}
+
+void jack_signatures_init(struct jack_signatures *sigs)
+{
+    memset(sigs, 0, sizeof(*sigs));
+}
+
+void jack_signatures_free(struct jack_signatures *sigs)
+{
+    free(sigs->subroutines);
+    free(sigs->classes);
+    jack_signatures_init(sigs);
+}
+
+void jack_signatures_sort(struct jack_signatures *sigs)
+{
+    qsort(sigs->subroutines, sigs->count, sizeof(struct jack_signature), compare_signatures);
+}
+
+static int add_class(struct lexer *lx, struct jack_signatures *sigs, const char *class_name)
+{
+    char msg[JACK_MAX_NAME + 32];
+
+    if (knows_class(sigs, class_name)) {
+        snprintf(msg, sizeof(msg), "Class %s declared twice", class_name);
+        return syntax_error(lx, msg);
+    }
+
+    if (sigs->nclasses == sigs->classes_allocated) {
+        sigs->classes_allocated = sigs->classes_allocated ? sigs->classes_allocated * 2 : 16;
+        char (*p)[JACK_MAX_NAME + 1] = realloc(sigs->classes, sigs->classes_allocated * sizeof(*p));
+        if (p == NULL) {
+            return error_format(lx->errmsg, EXIT_OUT_OF_MEMORY);
+        }
+        sigs->classes = p;
+    }
+    strcpy(sigs->classes[sigs->nclasses++], class_name);
+
+    return 0;
+}
+
+/*
+ * Add the signature of a subroutine of the class whose signatures start at
+ * first.
+ */
+static int add_signature(struct lexer *lx, struct jack_signatures *sigs, unsigned first,
+                         const struct jack_signature *sig)
+{
+    char msg[2 * JACK_MAX_NAME + 32];
+
+    for (unsigned i = first; i < sigs->count; i++) {
+        if (!strcmp(sigs->subroutines[i].name, sig->name)) {
+            snprintf(msg, sizeof(msg), "Subroutine %s declared twice", sig->name);
+            return syntax_error(lx, msg);
+        }
+    }
+
+    if (sigs->count == sigs->allocated) {
+        sigs->allocated = sigs->allocated ? sigs->allocated * 2 : 64;
+        struct jack_signature *p = realloc(sigs->subroutines, sigs->allocated * sizeof(*p));
+        if (p == NULL) {
+            return error_format(lx->errmsg, EXIT_OUT_OF_MEMORY);
+        }
+        sigs->subroutines = p;
+    }
+    sigs->subroutines[sigs->count++] = *sig;
+
+    return 0;
+}
+
+/*
+ * Skip a block, from its { to the matching }.
+ */
+static int skip_block(struct lexer *lx)
+{
+    unsigned depth = 1;
+    int rc;
+
+    if ((rc = expect(lx, "{"))) {
+        return rc;
+    }
+    while (depth) {
+        if (lx->kind == TOKEN_END || lx->kind == TOKEN_INVALID) {
+            return syntax_error(lx, "Expected }");
+        }
+        if (is(lx, "{")) {
+            depth++;
+        } else if (is(lx, "}")) {
+            depth--;
+        }
+        next(lx);
+    }
+    return 0;
+}
+
+int jack_scan(const char *text, const char *filename, struct jack_signatures *sigs, char *errmsg)
+{
+    struct lexer lx = { .filename = filename, .p = text, .line = 1, .errmsg = errmsg };
+    char class_name[JACK_MAX_NAME + 1];
+    char sub[JACK_MAX_NAME + 1];
+    char type[JACK_MAX_NAME + 1];
+    char param[JACK_MAX_NAME + 1];
+    unsigned first = sigs->count;
+    int rc;
+
+    next(&lx);
+    if ((rc = expect(&lx, "class")) || (rc = name(&lx, class_name)) || (rc = expect(&lx, "{"))
+        || (rc = add_class(&lx, sigs, class_name))) {
+        return rc;
+    }
+
+    // variable declarations up to the first subroutine
+    while (!is(&lx, "constructor") && !is(&lx, "function") && !is(&lx, "method")
+           && !is(&lx, "}")) {
+        if (lx.kind == TOKEN_END || lx.kind == TOKEN_INVALID) {
+            return syntax_error(&lx, "Expected }");
+        }
+        next(&lx);
+    }
+
+    while (!accept(&lx, "}")) {
+        struct jack_signature sig = { .nparams = 0 };
+
+        if (accept(&lx, "constructor")) {
+            sig.kind = JACK_CONSTRUCTOR;
+        } else if (accept(&lx, "function")) {
+            sig.kind = JACK_FUNCTION;
+        } else if (accept(&lx, "method")) {
+            sig.kind = JACK_METHOD;
+        } else {
+            return syntax_error(&lx, "Expected a subroutine");
+        }
+
+        if ((!accept(&lx, "void") && (rc = type_name(&lx, type)))
+            || (rc = name(&lx, sub)) || (rc = expect(&lx, "("))) {
+            return rc;
+        }
+        if (!is(&lx, ")")) {
+            do {
+                if ((rc = type_name(&lx, type)) || (rc = name(&lx, param))) {
+                    return rc;
+                }
+                sig.nparams++;
+            } while (accept(&lx, ","));
+        }
+        if ((rc = expect(&lx, ")"))) {
+            return rc;
+        }
+
+        sprintf(sig.name, "%s.%s", class_name, sub);
+        if ((rc = add_signature(&lx, sigs, first, &sig)) || (rc = skip_block(&lx))) {
+            return rc;
+        }
+    }
+
+    return 0;
+}
+
+int jack_compile(const char *text, const char *filename, const struct jack_signatures *sigs,
+                 struct vm_stream *out, char *errmsg)
+{
+    struct compiler c = {
+        .lx = { .filename = filename, .p = text, .line = 1, .errmsg = errmsg },
+        .sigs = sigs,
+        .out = out,
+    };
+    int rc;
+
+    next(&c.lx);
+    rc = class_dec(&c);
+
+    free(c.class_vars.symbols);
+    free(c.subroutine_vars.symbols);
+
+    return rc;
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include "stream.h"
+
+/*
+ * Compiler of the Jack language of projects/09 to 12. Rather than writing
+ * .vm files, it appends the VM commands of a class to a vm_stream, which the
+ * translator turns into assembly right away (see translate_commands()).
+ */
+
+#define JACK_EXTENSION ".jack"
+
+/* Longest name of a class, subroutine or variable. */
+#define JACK_MAX_NAME 63
+
+
+enum jack_subroutine_kind {
+    JACK_CONSTRUCTOR,
+    JACK_FUNCTION,
+    JACK_METHOD,
+};
+
+struct jack_signature {
+    /* Class.subroutine */
+    char name[2 * JACK_MAX_NAME + 2];
+    enum jack_subroutine_kind kind;
+    unsigned nparams;
+};
+
+/*
+ * The classes of a program and the signatures of their subroutines, which is
+ * all that compiling a class needs to know of the others. Filled in by
+ * jack_scan() and sorted by jack_signatures_sort(), after which it is only
+ * read, so that classes can be compiled in parallel.
+ */
+struct jack_signatures {
+    struct jack_signature *subroutines;
+    unsigned count;
+    unsigned allocated;
+    char (*classes)[JACK_MAX_NAME + 1];
+    unsigned nclasses;
+    unsigned classes_allocated;
+};
+
+
+void jack_signatures_init(struct jack_signatures *sigs);
+
+void jack_signatures_free(struct jack_signatures *sigs);
+
+/*
+ * Add the class in text, the contents of filename, and the signatures of its
+ * subroutines to sigs. Only declarations are parsed; the bodies of the
+ * subroutines are skipped.
+ *
+ * \retval - 0 on success, else the exit code of the error described by errmsg.
+ */
+int jack_scan(const char *text, const char *filename, struct jack_signatures *sigs, char *errmsg);
+
+/*
+ * Prepare sigs for lookups, once all classes have been scanned.
+ */
+void jack_signatures_sort(struct jack_signatures *sigs);
+
+/*
+ * Compile the class in text, the contents of filename, appending its VM
+ * commands to out. errmsg must be able to hold MAX_ERROR_LEN + 1 chars.
+ *
+ * If sigs is given, calls to the classes in it are checked against their
+ * signatures, and sub() within a class calls a function or a method of this
+ * according to its declaration. Without it, sub() is taken to be a method,
+ * unless called from a function.
+ *
+ * \retval - 0 on success, else the exit code of the error described by errmsg.
+ */
+int jack_compile(const char *text, const char *filename, const struct jack_signatures *sigs,
+                 struct vm_stream *out, char *errmsg);
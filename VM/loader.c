@@ -0,0 +1,427 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+
+#include "loader.h"
+#include "command.h"
+#include "stream.h"
+#include "bytecode.h"
+#include "batch.h"
+#include "jack.h"
+#include "utils.h"
+#include "exit.h"
+
+/*
+ * A label or function name, along with the instruction index it is defined
+ * at or used by.
+ */
+struct symbol {
+    char *name;
+    unsigned index;
+};
+
+struct symbols {
+    struct symbol *sym;
+    unsigned len;
+    unsigned allocated;
+};
+
+struct loader {
+    struct vm_program *prog;
+    unsigned allocated;
+    struct symbols defs;
+    struct symbols refs;
+    /* Function being loaded, which scopes its labels. */
+    char current_fun[MAX_LINE_LEN+1];
+    /* RAM address of each static variable of the current file, or 0. */
+    int statics[VM_STATIC_LAST - VM_STATIC_FIRST + 1];
+    int next_static;
+};
+
+
+static bool symbols_add(struct symbols *syms, const char *fun, const char *name,
+                        unsigned index)
+{
+    if (syms->len == syms->allocated) {
+        unsigned allocated = syms->allocated ? 2 * syms->allocated : 256;
+        struct symbol *sym = realloc(syms->sym, allocated * sizeof(struct symbol));
+
+        if (sym == NULL) {
+            return false;
+        }
+        syms->sym = sym;
+        syms->allocated = allocated;
+    }
+
+    size_t len = (fun ? strlen(fun) + 1 : 0) + strlen(name) + 1;
+    char *s = malloc(len);
+
+    if (s == NULL) {
+        return false;
+    }
+    if (fun) {
+        sprintf(s, "%s$%s", fun, name);
+    } else {
+        strcpy(s, name);
+    }
+
+    syms->sym[syms->len].name = s;
+    syms->sym[syms->len].index = index;
+    syms->len++;
+
+    return true;
+}
+
+static void symbols_free(struct symbols *syms)
+{
+    for (unsigned i = 0; i < syms->len; i++) {
+        free(syms->sym[i].name);
+    }
+    free(syms->sym);
+}
+
+static int symbol_compare(const void *a, const void *b)
+{
+    return strcmp(((const struct symbol *) a)->name, ((const struct symbol *) b)->name);
+}
+
+/*
+ * Append an instruction to the program.
+ *
+ * \retval - 0 on success, else an exit code.
+ */
+static int emit(struct loader *ld, enum vm_op op, int reg, int n, int arg)
+{
+    struct vm_program *prog = ld->prog;
+
+    if (prog->len == ld->allocated) {
+        unsigned allocated = ld->allocated ? 2 * ld->allocated : 4096;
+        struct vm_inst *code = realloc(prog->code, allocated * sizeof(struct vm_inst));
+
+        if (code == NULL) {
+            return EXIT_OUT_OF_MEMORY;
+        }
+        prog->code = code;
+        ld->allocated = allocated;
+    }
+
+    prog->code[prog->len].op = op;
+    prog->code[prog->len].reg = reg;
+    prog->code[prog->len].n = n;
+    prog->code[prog->len].arg = arg;
+    prog->len++;
+
+    return 0;
+}
+
+/*
+ * Parse a non negative number that is at most max.
+ */
+static bool parse_number(const char *s, int max, int *value)
+{
+    char *endptr = NULL;
+    errno = 0;
+    long v = strtol(s, &endptr, 10);
+
+    if (s == endptr || errno != 0 || *endptr || v < 0 || v > max) {
+        return false;
+    }
+    *value = v;
+
+    return true;
+}
+
+/*
+ * Find the instruction for push or pop on the given segment.
+ *
+ * \retval - 0 on success, else an exit code.
+ */
+static int load_push_pop(struct loader *ld, bool push, const char *segment,
+                         const char *index)
+{
+    int i;
+
+    if (!parse_number(index, 32767, &i)) {
+        return EXIT_INVALID_COMMAND;
+    }
+
+    if (!strcmp(segment, "constant")) {
+        return push ? emit(ld, OP_PUSH_CONST, 0, 0, i) : EXIT_INVALID_COMMAND;
+    }
+
+    enum vm_op ram_op = push ? OP_PUSH_RAM : OP_POP_RAM;
+    enum vm_op seg_op = push ? OP_PUSH_SEG : OP_POP_SEG;
+
+    if (!strcmp(segment, "local")) {
+        return emit(ld, seg_op, VM_LCL, 0, i);
+    } else if (!strcmp(segment, "argument")) {
+        return emit(ld, seg_op, VM_ARG, 0, i);
+    } else if (!strcmp(segment, "this")) {
+        return emit(ld, seg_op, VM_THIS, 0, i);
+    } else if (!strcmp(segment, "that")) {
+        return emit(ld, seg_op, VM_THAT, 0, i);
+    } else if (!strcmp(segment, "temp")) {
+        return i < VM_TEMP_SIZE ? emit(ld, ram_op, 0, 0, VM_TEMP + i) : EXIT_INVALID_COMMAND;
+    } else if (!strcmp(segment, "pointer")) {
+        return i < 2 ? emit(ld, ram_op, 0, 0, VM_THIS + i) : EXIT_INVALID_COMMAND;
+    } else if (!strcmp(segment, "static")) {
+        if (i > VM_STATIC_LAST - VM_STATIC_FIRST) {
+            return EXIT_INVALID_COMMAND;
+        }
+        // allocated in order of first use, as the assembler does for variables
+        if (!ld->statics[i]) {
+            if (ld->next_static > VM_STATIC_LAST) {
+                return EXIT_PROGRAM_TOO_LARGE;
+            }
+            ld->statics[i] = ld->next_static++;
+        }
+        return emit(ld, ram_op, 0, 0, ld->statics[i]);
+    }
+
+    return EXIT_INVALID_COMMAND;
+}
+
+/*
+ * Load a single command, already split into tokens.
+ *
+ * \retval - 0 on success, else an exit code.
+ */
+static int load_command(struct loader *ld, int ntokens, const char *tokens[])
+{
+    static const int nargs[MAX_COMMANDS] = {
+        [CMD_PUSH] = 3, [CMD_POP] = 3,
+        [CMD_ADD] = 1, [CMD_SUB] = 1, [CMD_NEG] = 1, [CMD_AND] = 1, [CMD_OR] = 1,
+        [CMD_NOT] = 1, [CMD_EQ] = 1, [CMD_GT] = 1, [CMD_LT] = 1,
+        [CMD_LABEL] = 2, [CMD_GOTO] = 2, [CMD_IFGOTO] = 2,
+        [CMD_FUNCTION] = 3, [CMD_RETURN] = 1, [CMD_CALL] = 3,
+    };
+    static const enum vm_op ops[MAX_COMMANDS] = {
+        [CMD_ADD] = OP_ADD, [CMD_SUB] = OP_SUB, [CMD_NEG] = OP_NEG,
+        [CMD_AND] = OP_AND, [CMD_OR] = OP_OR, [CMD_NOT] = OP_NOT,
+        [CMD_EQ] = OP_EQ, [CMD_GT] = OP_GT, [CMD_LT] = OP_LT,
+        [CMD_GOTO] = OP_GOTO, [CMD_IFGOTO] = OP_IFGOTO, [CMD_RETURN] = OP_RETURN,
+    };
+    cmd_id cmdid = str_to_cmdid(tokens[0]);
+    unsigned here = ld->prog->len;
+    int n;
+
+    if (cmdid == CMD_INVALID || ntokens != nargs[cmdid]) {
+        return EXIT_INVALID_COMMAND;
+    }
+
+    switch (cmdid) {
+    case CMD_PUSH:
+    case CMD_POP:
+        return load_push_pop(ld, cmdid == CMD_PUSH, tokens[1], tokens[2]);
+    case CMD_LABEL:
+        if (!symbols_add(&ld->defs, ld->current_fun, tokens[1], here)) {
+            return EXIT_OUT_OF_MEMORY;
+        }
+        return 0;
+    case CMD_GOTO:
+    case CMD_IFGOTO:
+        if (!symbols_add(&ld->refs, ld->current_fun, tokens[1], here)) {
+            return EXIT_OUT_OF_MEMORY;
+        }
+        return emit(ld, ops[cmdid], 0, 0, 0);
+    case CMD_FUNCTION:
+        if (!parse_number(tokens[2], 32767, &n)) {
+            return EXIT_INVALID_COMMAND;
+        }
+        strcpy(ld->current_fun, tokens[1]);
+        if (!symbols_add(&ld->defs, NULL, tokens[1], here)) {
+            return EXIT_OUT_OF_MEMORY;
+        }
+        return emit(ld, OP_FUNCTION, 0, 0, n);
+    case CMD_CALL:
+        if (!parse_number(tokens[2], 32767, &n)) {
+            return EXIT_INVALID_COMMAND;
+        }
+        if (!strcmp(tokens[1], "Sys.halt")) {
+            return emit(ld, OP_HALT, 0, 0, 0);
+        }
+        if (!symbols_add(&ld->refs, NULL, tokens[1], here)) {
+            return EXIT_OUT_OF_MEMORY;
+        }
+        return emit(ld, OP_CALL, 0, n, 0);
+    default:
+        return emit(ld, ops[cmdid], 0, 0, 0);
+    }
+}
+
+/*
+ * Describe the error rc of loading the command at line_num, whose text is
+ * line, in errmsg.
+ */
+static int load_error(struct loader *ld, int rc, unsigned line_num, const char *line, char *errmsg)
+{
+    switch (rc) {
+    case EXIT_INVALID_COMMAND:
+        return error_format(errmsg, rc, line_num, line);
+    case EXIT_PROGRAM_TOO_LARGE:
+        if (ld->prog->len >= MAX_VM_INSTRUCTIONS - 1) {
+            return error_format(errmsg, rc, (unsigned) MAX_VM_INSTRUCTIONS, "instructions");
+        }
+        return error_format(errmsg, rc, (unsigned) (VM_STATIC_LAST - VM_STATIC_FIRST + 1),
+                            "static variables");
+    default:
+        return error_format(errmsg, rc);
+    }
+}
+
+/*
+ * Load the commands of a file, read into a stream.
+ */
+static int load_commands(struct loader *ld, const struct vm_stream *commands, char *errmsg)
+{
+    int rc = 0;
+
+    for (unsigned i = 0; i < commands->count && !rc; i++) {
+        const struct vm_command *cmd = &commands->commands[i];
+
+        // a command is at most one instruction; keep a slot for the final OP_HALT
+        if (ld->prog->len >= MAX_VM_INSTRUCTIONS - 1) {
+            rc = EXIT_PROGRAM_TOO_LARGE;
+        } else {
+            rc = load_command(ld, cmd->ntokens, (const char **) cmd->tokens);
+        }
+        if (rc) {
+            char line[MAX_LINE_LEN + 1];
+
+            vm_command_format(cmd, line);
+            rc = load_error(ld, rc, cmd->line, line, errmsg);
+        }
+    }
+
+    return rc;
+}
+
+/*
+ * Read the commands of a .vm or .vmb file into commands, or the source of a
+ * Jack class into text, to be compiled by jack_batch() along with the others.
+ */
+static int read_source(const char *filename, struct vm_stream *commands, char **text,
+                       char *errmsg)
+{
+    int rc = 0;
+    FILE *fp = fopen(filename, "r");
+
+    if (fp == NULL) {
+        return error_format(errmsg, EXIT_CANNOT_OPEN_FILE, filename);
+    }
+
+    if (fname_has_ext(filename, JACK_EXTENSION)) {
+        if ((*text = read_file(fp, NULL)) == NULL) {
+            rc = error_format(errmsg, EXIT_OUT_OF_MEMORY);
+        }
+    } else if (fname_has_ext(filename, VMB_EXTENSION)) {
+        rc = vm_bytecode_read(fp, filename, commands, errmsg);
+    } else {
+        rc = vm_stream_read(fp, commands, errmsg);
+    }
+    fclose(fp);
+
+    return rc;
+}
+
+/*
+ * Point every jump and call at the instruction its label or function is
+ * defined at.
+ */
+static int resolve(struct loader *ld, char *errmsg)
+{
+    struct vm_program *prog = ld->prog;
+    struct symbol key = { (char *) "Sys.init", 0 };
+    struct symbol *def;
+
+    qsort(ld->defs.sym, ld->defs.len, sizeof(struct symbol), symbol_compare);
+
+    for (unsigned i = 0; i < ld->refs.len; i++) {
+        struct vm_inst *inst = &prog->code[ld->refs.sym[i].index];
+
+        def = bsearch(&ld->refs.sym[i], ld->defs.sym, ld->defs.len,
+                      sizeof(struct symbol), symbol_compare);
+        if (def == NULL) {
+            return error_format(errmsg, EXIT_UNDEFINED_SYMBOL, ld->refs.sym[i].name);
+        }
+
+        inst->arg = def->index;
+        if (inst->op == OP_GOTO && def->index == ld->refs.sym[i].index) {
+            inst->op = OP_HALT;
+        }
+    }
+
+    def = bsearch(&key, ld->defs.sym, ld->defs.len, sizeof(struct symbol), symbol_compare);
+    prog->entry = def ? (int) def->index : -1;
+
+    return 0;
+}
+
+int vm_load(struct vm_program *prog, int nfiles,
+            char filenames[][MAX_FILENAME_LEN+1], char *errmsg)
+{
+    struct loader ld = { .prog = prog, .next_static = VM_STATIC_FIRST };
+    struct vm_stream *streams = calloc(nfiles + 1, sizeof(struct vm_stream));
+    char **texts = calloc(nfiles + 1, sizeof(char *));
+    int rc = 0;
+
+    prog->code = NULL;
+    prog->len = 0;
+    prog->entry = -1;
+    strcpy(ld.current_fun, "OutOfFunction");
+
+    if (streams == NULL || texts == NULL) {
+        free(streams);
+        free(texts);
+        return error_format(errmsg, EXIT_OUT_OF_MEMORY);
+    }
+
+    for (int i = 0; i < nfiles; i++) {
+        vm_stream_init(&streams[i]);
+    }
+    for (int i = 0; i < nfiles && !rc; i++) {
+        rc = read_source(filenames[i], &streams[i], &texts[i], errmsg);
+    }
+    // the Jack classes are compiled as vm does, knowing each other's signatures
+    if (!rc) {
+        rc = jack_batch(nfiles, filenames, texts, 0, streams, errmsg);
+    }
+    for (int i = 0; i < nfiles && !rc; i++) {
+        // static variables are private to their file
+        memset(ld.statics, 0, sizeof(ld.statics));
+        rc = load_commands(&ld, &streams[i], errmsg);
+    }
+
+    for (int i = 0; i < nfiles; i++) {
+        vm_stream_free(&streams[i]);
+        free(texts[i]);
+    }
+    free(streams);
+    free(texts);
+
+    if (!rc && (rc = emit(&ld, OP_HALT, 0, 0, 0)) != 0) {
+        error_format(errmsg, rc);
+    }
+
+    if (!rc) {
+        rc = resolve(&ld, errmsg);
+    }
+
+    symbols_free(&ld.defs);
+    symbols_free(&ld.refs);
+
+    if (rc) {
+        vm_unload(prog);
+    }
+
+    return rc;
+}
+
+void vm_unload(struct vm_program *prog)
+{
+    free(prog->code);
+    prog->code = NULL;
+    prog->len = 0;
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "files.h"
+
+/*
+ * Loads .vm files into a compact instruction array that can be executed
+ * directly, without translating to Hack first. Segments are resolved to the
+ * register or RAM address they live at, labels and functions to instruction
+ * indices, so running a program needs no string handling at all.
+ */
+
+/* Words of Hack RAM; addresses wrap around it. */
+#define VM_RAM_SIZE 32768
+/*
+ * Return addresses are instruction indices kept on the VM stack, so they
+ * must fit in a word.
+ */
+#define MAX_VM_INSTRUCTIONS 65535
+
+/* RAM addresses the VM segments are mapped to. */
+#define VM_SP       0
+#define VM_LCL      1
+#define VM_ARG      2
+#define VM_THIS     3
+#define VM_THAT     4
+#define VM_TEMP     5
+#define VM_TEMP_SIZE 8
+#define VM_STATIC_FIRST 16
+#define VM_STATIC_LAST  255
+#define VM_STACK_BASE   256
+
+enum vm_op {
+    OP_PUSH_CONST,   /* push arg */
+    OP_PUSH_RAM,     /* push RAM[arg]: static, temp and pointer */
+    OP_PUSH_SEG,     /* push RAM[RAM[reg] + arg]: local, argument, this, that */
+    OP_POP_RAM,
+    OP_POP_SEG,
+    OP_ADD,
+    OP_SUB,
+    OP_NEG,
+    OP_AND,
+    OP_OR,
+    OP_NOT,
+    OP_EQ,
+    OP_GT,
+    OP_LT,
+    OP_GOTO,         /* arg is the target index */
+    OP_IFGOTO,
+    OP_CALL,         /* arg is the target index, n the number of arguments */
+    OP_FUNCTION,     /* arg is the number of locals */
+    OP_RETURN,
+    OP_HALT,
+    MAX_OPS  /* their total count */
+};
+
+struct vm_inst {
+    uint8_t op;
+    uint8_t reg;
+    uint16_t n;
+    int32_t arg;
+};
+
+struct vm_program {
+    struct vm_inst *code;
+    /* Number of instructions, the last of which is always OP_HALT. */
+    unsigned len;
+    /* Index of Sys.init, or -1 if the program doesn't define it. */
+    int entry;
+};
+
+
+/*
+ * Load the given .vm, .vmb and .jack files into prog, as if they were a
+ * single program. The Jack classes are compiled first, as by vm.
+ *
+ * Calls to Sys.halt and jumps to themselves become OP_HALT, since both
+ * stand for the end of a Hack program.
+ *
+ * \retval - 0 on success, else an exit code with its message in errmsg.
+ */
+int vm_load(struct vm_program *prog, int nfiles,
+            char filenames[][MAX_FILENAME_LEN+1], char *errmsg);
+
+/*
+ * Free the instructions of a loaded program.
+ */
+void vm_unload(struct vm_program *prog);
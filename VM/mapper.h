@@ -1,7 +1,7 @@
 #pragma once
 
 #define ASM_BOOTSTRAP  \
-    "@256\n"           \
+    "@%d\n"            \
     "D=A\n"            \
     "@SP\n"            \
     "M=D\n"
@@ -22,13 +22,32 @@
     "A=A-1\n"           \
     "M=D\n"
 
-// local, argument, this, that
-#define ASM_PUSH_LATT \
+/*
+ * Addressing of local, argument, this and that, which leaves the address of
+ * segment[i] in A. ASM_LATT_ADDR works for any offset but clobbers D. Small
+ * offsets are reached from the base, ASM_LATT_ADDR_0, and an ASM_INC_A chain
+ * after ASM_LATT_ADDR_1 instead, which is shorter and leaves D alone.
+ */
+#define ASM_LATT_ADDR \
     "@%d\n"           \
     "D=A\n"           \
     "@%s\n"           \
-    "A=M\n"           \
-    "A=D+A\n"         \
+    "A=D+M\n"
+
+#define ASM_LATT_ADDR_0 \
+    "@%s\n"             \
+    "A=M\n"
+
+#define ASM_LATT_ADDR_1 \
+    "@%s\n"             \
+    "A=M+1\n"
+
+#define ASM_INC_A \
+    "A=A+1\n"
+
+// local, argument, this, that; takes the addressing code
+#define ASM_PUSH_LATT \
+    "%s"              \
     "D=M\n"           \
     "@SP\n"           \
     "AM=M+1\n"        \
@@ -36,10 +55,7 @@
     "M=D\n"
 
 #define ASM_PUSH_TEMP \
-    "@5\n"            \
-    "D=A\n"           \
     "@%d\n"           \
-    "A=D+A\n"         \
     "D=M\n"           \
     "@SP\n"           \
     "AM=M+1\n"        \
@@ -61,34 +77,41 @@
     "@%s.%d\n"          \
     "M=D\n"
 
+/*
+ * The address and the value are added up in D, from which either gives the
+ * other back, so no register is needed to hold the address.
+ */
 #define ASM_POP_LATT \
     "@%s\n"          \
     "D=M\n"          \
-    "@%d\n"           \
+    "@%d\n"          \
     "D=D+A\n"        \
-    "@R13\n"         \
-    "M=D\n"          \
     "@SP\n"          \
     "AM=M-1\n"       \
-    "D=M\n"          \
-    "@R13\n"         \
-    "A=M\n"          \
+    "D=D+M\n"        \
+    "A=D-M\n"        \
+    "M=D-A\n"
+
+// small offsets only, takes the addressing code
+#define ASM_POP_LATT_NEAR \
+    "@SP\n"              \
+    "AM=M-1\n"           \
+    "D=M\n"              \
+    "%s"                 \
     "M=D\n"
 
 #define ASM_POP_TEMP \
-    "@5\n"           \
-    "D=A\n"          \
-    "@%d\n"          \
-    "D=D+A\n"        \
-    "@R13\n"         \
-    "M=D\n"          \
     "@SP\n"          \
     "AM=M-1\n"       \
     "D=M\n"          \
-    "@R13\n"         \
-    "A=M\n"          \
+    "@%d\n"          \
     "M=D\n"
 
+// a local of a static frame, set to 0 on entry
+#define ASM_CLEAR_DIRECT \
+    "@%d\n"              \
+    "M=0\n"
+
 #define ASM_POP_POINTER \
     "@SP\n"             \
     "AM=M-1\n"          \
@@ -177,6 +200,39 @@
     "M=0\n"         \
     "(LT_LBL_%d)\n"
 
+/*
+ * Shared comparison routines (-r). Rather than inlining ASM_EQ and friends,
+ * a comparison jumps to the one routine of its kind with the return address
+ * in D. The routine replaces the two topmost values with -1 or 0 and jumps
+ * back through R15.
+ */
+#define ASM_CMP_CALL \
+    "@%s_RET_%d\n"   \
+    "D=A\n"          \
+    "@CMP$%s\n"      \
+    "0;JMP\n"        \
+    "(%s_RET_%d)\n"
+
+#define ASM_CMP_ROUTINE \
+    "(CMP$%s)\n"        \
+    "@R15\n"            \
+    "M=D\n"             \
+    "@SP\n"             \
+    "AM=M-1\n"          \
+    "D=M\n"             \
+    "A=A-1\n"           \
+    "D=M-D\n"           \
+    "M=-1\n"            \
+    "@CMP$%s_TRUE\n"    \
+    "D;%s\n"            \
+    "@SP\n"             \
+    "A=M-1\n"           \
+    "M=0\n"             \
+    "(CMP$%s_TRUE)\n"   \
+    "@R15\n"            \
+    "A=M\n"             \
+    "0;JMP\n"
+
 #define ASM_LABEL   \
     "(%s$%s)\n"
 
@@ -191,14 +247,29 @@
     "@%s$%s\n"      \
     "D=D;JNE\n"
 
+/*
+ * A comparison fused with the if-goto that consumes its result. x - y is
+ * jumped on directly instead of being turned into a boolean first, with the
+ * condition of the comparison or its negation, e.g. JGE for lt followed by
+ * not.
+ */
+#define ASM_CMP_IFGOTO \
+    "@SP\n"            \
+    "AM=M-1\n"         \
+    "D=M\n"            \
+    "@SP\n"            \
+    "AM=M-1\n"         \
+    "D=M-D\n"          \
+    "@%s$%s\n"         \
+    "D;%s\n"
+
 #define ASM_RETURN \
     "@LCL\n"       \
     "D=M\n"        \
     "@R13\n"       \
     "M=D\n"        \
     "@5\n"         \
-    "D=D-A\n"      \
-    "A=D\n"        \
+    "A=D-A\n"      \
     "D=M\n"        \
     "@R14\n"       \
     "M=D\n"        \
@@ -208,8 +279,7 @@
     "@ARG\n"       \
     "A=M\n"        \
     "M=D\n"        \
-    "@ARG\n"       \
-    "D=M+1\n"      \
+    "D=A+1\n"      \
     "@SP\n"        \
     "M=D\n"        \
     "@R13\n"       \
@@ -284,3 +354,358 @@
     "@%s\n"              \
     "0;JMP\n"            \
     "(RETURN_LABEL$%d)\n"
+
+/*
+ * Tail calls (-t). A call right before a return jumps to the shared routine
+ * with the number of arguments in R13 and the callee in D, instead of
+ * pushing a frame of its own. The routine moves the arguments down to ARG,
+ * followed by the frame of the caller's caller, unless it is in place
+ * already, and jumps to the callee, which returns straight to that caller.
+ */
+#define ASM_TAIL_CALL \
+    "@%d\n"           \
+    "D=A\n"           \
+    "@R13\n"          \
+    "M=D\n"           \
+    "@%s\n"           \
+    "D=A\n"           \
+    "@TAIL$CALL\n"    \
+    "0;JMP\n"
+
+#define ASM_TAIL_CALL_ROUTINE \
+    "(TAIL$CALL)\n"           \
+    "@R14\n"                  \
+    "M=D\n"                   \
+    "@SP\n"                   \
+    "D=M\n"                   \
+    "@R13\n"                  \
+    "D=D-M\n"                 \
+    "@R15\n"                  \
+    "M=D\n"                   \
+    "@ARG\n"                  \
+    "D=M\n"                   \
+    "@R13\n"                  \
+    "D=D+M\n"                 \
+    "@5\n"                    \
+    "D=D+A\n"                 \
+    "@LCL\n"                  \
+    "D=D-M\n"                 \
+    "@TAIL$MOVE\n"            \
+    "D;JEQ\n"                 \
+    "@LCL\n"                  \
+    "D=M\n"                   \
+    "@5\n"                    \
+    "A=D-A\n"                 \
+    "D=M\n"                   \
+    "@SP\n"                   \
+    "A=M\n"                   \
+    "M=D\n"                   \
+    "@LCL\n"                  \
+    "D=M\n"                   \
+    "@4\n"                    \
+    "A=D-A\n"                 \
+    "D=M\n"                   \
+    "@SP\n"                   \
+    "A=M+1\n"                 \
+    "M=D\n"                   \
+    "@LCL\n"                  \
+    "D=M\n"                   \
+    "@3\n"                    \
+    "A=D-A\n"                 \
+    "D=M\n"                   \
+    "@SP\n"                   \
+    "A=M+1\n"                 \
+    "A=A+1\n"                 \
+    "M=D\n"                   \
+    "@LCL\n"                  \
+    "D=M\n"                   \
+    "@2\n"                    \
+    "A=D-A\n"                 \
+    "D=M\n"                   \
+    "@SP\n"                   \
+    "A=M+1\n"                 \
+    "A=A+1\n"                 \
+    "A=A+1\n"                 \
+    "M=D\n"                   \
+    "@LCL\n"                  \
+    "A=M-1\n"                 \
+    "D=M\n"                   \
+    "@SP\n"                   \
+    "A=M+1\n"                 \
+    "A=A+1\n"                 \
+    "A=A+1\n"                 \
+    "A=A+1\n"                 \
+    "M=D\n"                   \
+    "@5\n"                    \
+    "D=A\n"                   \
+    "@R13\n"                  \
+    "M=D+M\n"                 \
+    "@ARG\n"                  \
+    "D=M\n"                   \
+    "@R13\n"                  \
+    "D=D+M\n"                 \
+    "@LCL\n"                  \
+    "M=D\n"                   \
+    "(TAIL$MOVE)\n"           \
+    "@ARG\n"                  \
+    "D=M\n"                   \
+    "@SP\n"                   \
+    "M=D\n"                   \
+    "(TAIL$COPY)\n"           \
+    "@R13\n"                  \
+    "MD=M-1\n"                \
+    "@TAIL$JUMP\n"            \
+    "D;JLT\n"                 \
+    "@R15\n"                  \
+    "AM=M+1\n"                \
+    "A=A-1\n"                 \
+    "D=M\n"                   \
+    "@SP\n"                   \
+    "AM=M+1\n"                \
+    "A=A-1\n"                 \
+    "M=D\n"                   \
+    "@TAIL$COPY\n"            \
+    "0;JMP\n"                 \
+    "(TAIL$JUMP)\n"           \
+    "@LCL\n"                  \
+    "D=M\n"                   \
+    "@SP\n"                   \
+    "M=D\n"                   \
+    "@R14\n"                  \
+    "A=M\n"                   \
+    "0;JMP\n"
+
+/*
+ * Multiplication by a constant (-m), in place of a call of Math.multiply.
+ * The constant is never pushed. x is loaded into D and the product built
+ * from the bits of the constant, highest first: doubling D for each bit and
+ * adding x, kept in R13, for each 1.
+ */
+#define ASM_MUL_LOAD \
+    "@SP\n"          \
+    "A=M-1\n"        \
+    "D=M\n"
+
+#define ASM_MUL_SAVE \
+    "@R13\n"         \
+    "M=D\n"
+
+#define ASM_MUL_ZERO \
+    "D=0\n"
+
+#define ASM_MUL_DOUBLE \
+    "A=D\n"            \
+    "D=D+A\n"
+
+#define ASM_MUL_ADD \
+    "@R13\n"        \
+    "D=D+M\n"
+
+#define ASM_MUL_STORE \
+    "@SP\n"           \
+    "A=M-1\n"         \
+    "M=D\n"
+
+/*
+ * Division by a power of two (-m), in place of a call of Math.divide. The
+ * divisor goes in R13 and the return address in D for the shared routine,
+ * which replaces the dividend on top of the stack with the quotient. It
+ * adds up the bits of |x| from the divisor up, each shifted down, and
+ * negates the sum if x is negative, which truncates towards 0 like
+ * Math.divide. RAM[SP] holds what is left of |x|, RAM[SP+1] the bit of the
+ * quotient the current one of |x| is worth, and R14 x.
+ */
+#define ASM_DIV_POW2_CALL \
+    "@%d\n"               \
+    "D=A\n"               \
+    "@R13\n"              \
+    "M=D\n"               \
+    "@DIV_RET_%d\n"       \
+    "D=A\n"               \
+    "@DIV$POW2\n"         \
+    "0;JMP\n"             \
+    "(DIV_RET_%d)\n"
+
+#define ASM_DIV_POW2_ROUTINE \
+    "(DIV$POW2)\n"           \
+    "@R15\n"                 \
+    "M=D\n"                  \
+    "@SP\n"                  \
+    "A=M-1\n"                \
+    "D=M\n"                  \
+    "@R14\n"                 \
+    "M=D\n"                  \
+    "@DIV$POW2_ABS\n"        \
+    "D;JGE\n"                \
+    "D=-D\n"                 \
+    "(DIV$POW2_ABS)\n"       \
+    "@R13\n"                 \
+    "A=-M\n"                 \
+    "D=D&A\n"                \
+    "@SP\n"                  \
+    "A=M\n"                  \
+    "M=D\n"                  \
+    "A=A-1\n"                \
+    "M=0\n"                  \
+    "@SP\n"                  \
+    "A=M+1\n"                \
+    "M=1\n"                  \
+    "(DIV$POW2_LOOP)\n"      \
+    "@SP\n"                  \
+    "A=M\n"                  \
+    "D=M\n"                  \
+    "@DIV$POW2_SIGN\n"       \
+    "D;JEQ\n"                \
+    "@R13\n"                 \
+    "D=M\n"                  \
+    "@SP\n"                  \
+    "A=M\n"                  \
+    "D=D&M\n"                \
+    "M=M-D\n"                \
+    "@DIV$POW2_NEXT\n"       \
+    "D;JEQ\n"                \
+    "@SP\n"                  \
+    "A=M+1\n"                \
+    "D=M\n"                  \
+    "A=A-1\n"                \
+    "A=A-1\n"                \
+    "M=D+M\n"                \
+    "(DIV$POW2_NEXT)\n"      \
+    "@SP\n"                  \
+    "A=M+1\n"                \
+    "D=M\n"                  \
+    "M=D+M\n"                \
+    "@R13\n"                 \
+    "D=M\n"                  \
+    "M=D+M\n"                \
+    "@DIV$POW2_LOOP\n"       \
+    "0;JMP\n"                \
+    "(DIV$POW2_SIGN)\n"      \
+    "@R14\n"                 \
+    "D=M\n"                  \
+    "@DIV$POW2_RET\n"        \
+    "D;JGE\n"                \
+    "@SP\n"                  \
+    "A=M-1\n"                \
+    "M=-M\n"                 \
+    "(DIV$POW2_RET)\n"       \
+    "@R15\n"                 \
+    "A=M\n"                  \
+    "0;JMP\n"
+
+/*
+ * Templates for stack caching mode (-c). There the topmost stack value may be
+ * kept in the D register instead of RAM, in which case SP points right past
+ * the second topmost value. See tos_cached in vm.c.
+ */
+
+/* Move the cached value to RAM, which makes it a regular stack value. */
+#define ASM_SPILL_D \
+    "@SP\n"         \
+    "AM=M+1\n"      \
+    "A=A-1\n"       \
+    "M=D\n"
+
+/* Load a value into D, which becomes the cached top of stack. */
+#define ASM_LOAD_CONST \
+    "@%d\n"            \
+    "D=A\n"
+
+#define ASM_LOAD_STATIC \
+    "@%s.%d\n"          \
+    "D=M\n"
+
+// local, argument, this, that; takes the addressing code
+#define ASM_LOAD_LATT \
+    "%s"              \
+    "D=M\n"
+
+// temp and pointer, whose address is known at translation time
+#define ASM_LOAD_DIRECT \
+    "@%d\n"             \
+    "D=M\n"
+
+/* Store the cached value, which is thereby popped. */
+#define ASM_STORE_STATIC \
+    "@%s.%d\n"           \
+    "M=D\n"
+
+// the same trick as ASM_POP_LATT
+#define ASM_STORE_LATT \
+    "@R13\n"           \
+    "M=D\n"            \
+    "@%s\n"            \
+    "D=M\n"            \
+    "@%d\n"            \
+    "D=D+A\n"          \
+    "@R13\n"           \
+    "D=D+M\n"          \
+    "A=D-M\n"          \
+    "M=D-A\n"
+
+// small offsets only, takes the addressing code
+#define ASM_STORE_LATT_NEAR \
+    "%s"                   \
+    "M=D\n"
+
+#define ASM_STORE_DIRECT \
+    "@%d\n"              \
+    "M=D\n"
+
+/* Multiplication by a constant with x in RAM, whose product is left cached. */
+#define ASM_CACHED_MUL_POP \
+    "@SP\n"                \
+    "AM=M-1\n"             \
+    "D=M\n"
+
+/* Operations with their right (or only) operand cached. */
+#define ASM_CACHED_ADD \
+    "@SP\n"            \
+    "AM=M-1\n"         \
+    "D=D+M\n"
+
+#define ASM_CACHED_SUB \
+    "@SP\n"            \
+    "AM=M-1\n"         \
+    "D=M-D\n"
+
+#define ASM_CACHED_AND \
+    "@SP\n"            \
+    "AM=M-1\n"         \
+    "D=D&M\n"
+
+#define ASM_CACHED_OR \
+    "@SP\n"           \
+    "AM=M-1\n"        \
+    "D=D|M\n"
+
+#define ASM_CACHED_NEG \
+    "D=-D\n"
+
+#define ASM_CACHED_NOT \
+    "D=!D\n"
+
+// comparisons; the jump is one of JEQ, JGT and JLT
+#define ASM_CACHED_CMP      \
+    "@SP\n"                 \
+    "AM=M-1\n"              \
+    "D=M-D\n"               \
+    "@%s_TRUE_%d\n"         \
+    "D;%s\n"                \
+    "D=0\n"                 \
+    "@%s_END_%d\n"          \
+    "0;JMP\n"               \
+    "(%s_TRUE_%d)\n"        \
+    "D=-1\n"                \
+    "(%s_END_%d)\n"
+
+#define ASM_CACHED_IFGOTO \
+    "@%s$%s\n"            \
+    "D;JNE\n"
+
+#define ASM_CACHED_CMP_IFGOTO \
+    "@SP\n"                   \
+    "AM=M-1\n"                \
+    "D=M-D\n"                 \
+    "@%s$%s\n"                \
+    "D;%s\n"
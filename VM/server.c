@@ -0,0 +1,154 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "server.h"
+#include "vm.h"
+#include "stream.h"
+#include "bytecode.h"
+#include "jack.h"
+#include "batch.h"
+#include "inline.h"
+#include "frames.h"
+#include "files.h"
+#include "utils.h"
+#include "exit.h"
+#include "ipc.h"
+#include "threadpool.h"
+
+
+/*
+ * Parse or compile every file of a request into streams, and run the whole
+ * program passes the request asks for on them, as vm does. The report of
+ * the inliner goes to report, the static frames of -f to frames.
+ *
+ * \retval - 0 on success, else the exit code of the error described by errmsg.
+ */
+static int load_request(const struct ipc_request *req, char filenames[][MAX_FILENAME_LEN+1],
+                        struct vm_stream streams[], char *texts[], FILE *report,
+                        struct static_frames *frames, char *errmsg)
+{
+    int nfiles = req->nfiles;
+    int status = 0;
+
+    for (int i = 0; i < nfiles && !status; i++) {
+        const struct ipc_file *file = &req->files[i];
+
+        if (strlen(file->name) > MAX_FILENAME_LEN) {
+            return error_format(errmsg, EXIT_CANNOT_OPEN_FILE, file->name);
+        }
+        strcpy(filenames[i], file->name);
+
+        if (fname_has_ext(file->name, JACK_EXTENSION)) {
+            texts[i] = file->data;
+        } else if (fname_has_ext(file->name, VMB_EXTENSION)) {
+            status = vm_bytecode_decode(file->data, file->len, file->name, &streams[i], errmsg);
+        } else {
+            status = vm_stream_parse(file->data, file->len, &streams[i], errmsg);
+        }
+    }
+
+    // a worker compiles its classes alone, the other workers have requests of their own
+    if (!status) {
+        status = jack_batch(nfiles, filenames, texts, 1, streams, errmsg);
+    }
+    if (!status && (req->flags & VM_REQ_INLINE)) {
+        status = inline_calls(nfiles, filenames, streams, report, errmsg);
+    }
+    // after inlining, which leaves fewer calls to constrain the frames
+    if (!status && (req->flags & VM_REQ_FRAMES)) {
+        status = static_frames_build(frames, nfiles, streams, errmsg);
+        translator_static_frames(frames);
+    }
+
+    return status;
+}
+
+/*
+ * Translate all files of a request, in the order given, into one program.
+ * The translator state lives in thread-local storage, so the worker thread
+ * itself is the context and no extra one is needed. Whatever vm would have
+ * printed besides the program, i.e. the report of -i, is sent back in the
+ * message of a successful response.
+ */
+static void handle_request(__attribute__((unused)) void *ctx,
+                           const struct ipc_request *req,
+                           struct ipc_response *resp)
+{
+    int nfiles = req->nfiles;
+    char errmsg[MAX_ERROR_LEN + 1];
+    char asm_output[MAX_ASM_OUT + 1];
+    char (*filenames)[MAX_FILENAME_LEN+1] = malloc((nfiles + 1) * sizeof(*filenames));
+    struct vm_stream *streams = calloc(nfiles + 1, sizeof(struct vm_stream));
+    char **texts = calloc(nfiles + 1, sizeof(char *));
+    FILE *fp_out = open_memstream(&resp->out, &resp->out_len);
+    FILE *report = open_memstream(&resp->msg, &resp->msg_len);
+    struct static_frames frames = { NULL, 0, 0 };
+
+    if (filenames == NULL || streams == NULL || texts == NULL || fp_out == NULL
+        || report == NULL) {
+        resp->status = error_format(errmsg, EXIT_OUT_OF_MEMORY);
+        goto done;
+    }
+
+    for (int i = 0; i < nfiles; i++) {
+        vm_stream_init(&streams[i]);
+    }
+    translator_reset(req->flags & ~(VM_REQ_INLINE | VM_REQ_FRAMES));
+
+    resp->status = load_request(req, filenames, streams, texts, report, &frames, errmsg);
+    if (resp->status) {
+        goto done;
+    }
+
+    bootstrap_code(asm_output);
+    fputs(asm_output, fp_out);
+
+    for (int i = 0; i < nfiles && !resp->status; i++) {
+        resp->status = translate_commands(&streams[i], filenames[i], fp_out, errmsg);
+    }
+    if (!resp->status) {
+        resp->status = routines_code(fp_out, errmsg);
+    }
+
+done:
+    if (fp_out) {
+        fclose(fp_out); // this finalizes resp->out and resp->out_len
+    }
+    if (report) {
+        fclose(report);
+    }
+    if (resp->status) {
+        free(resp->msg);
+        resp->msg = strdup(errmsg);
+        resp->msg_len = resp->msg ? strlen(resp->msg) : 0;
+    }
+
+    if (streams) {
+        for (int i = 0; i < nfiles; i++) {
+            vm_stream_free(&streams[i]);
+        }
+    }
+    free(streams);
+    free(texts); // the sources are those of the request
+    free(filenames);
+    static_frames_free(&frames);
+}
+
+void vm_serve(const char *socket_path, int njobs)
+{
+    int fd = ipc_listen(socket_path);
+
+    if (fd < 0) {
+        exit_program(EXIT_SOCKET_ERROR, socket_path);
+    }
+
+    ThreadPool pool = threadpool_create(njobs, NULL, NULL);
+
+    if (pool == NULL) {
+        exit_program(EXIT_OUT_OF_MEMORY);
+    }
+
+    ipc_serve(fd, socket_path, IPC_TOOL_VM, pool, handle_request);
+    threadpool_destroy(pool);
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stdlib.h>
+
+#include "ipc.h"
+
+/*
+ * The VM translator can run as a daemon that translates programs sent to it
+ * by the thin client (vmc) over a local socket, which saves paying for
+ * process startup on every invocation.
+ */
+
+/*
+ * The socket used by both ends, unless VM_SOCKET_ENV says otherwise, called
+ * VM_SOCKET_NAME in the directory of ipc_socket_path().
+ */
+#define VM_SOCKET_NAME "nand2tetris-vm.sock"
+#define VM_SOCKET_ENV "VM_DAEMON_SOCKET"
+
+/*
+ * Flags of a request besides the VM_OPT_* options of the translator, for the
+ * passes over the whole program.
+ */
+/* Inline small functions (-i). */
+#define VM_REQ_INLINE 0x100
+/* Give functions that can't recurse static frames (-f). */
+#define VM_REQ_FRAMES 0x200
+
+/*
+ * Path of the daemon socket according to the environment.
+ */
+static inline const char *server_socket_path(void)
+{
+    const char *path = getenv(VM_SOCKET_ENV);
+    return path && *path ? path : ipc_socket_path(VM_SOCKET_NAME);
+}
+
+/*
+ * Listen on socket_path and serve requests on njobs worker threads (one per
+ * CPU if njobs < 1) until SIGINT or SIGTERM is received.
+ */
+void vm_serve(const char *socket_path, int njobs);
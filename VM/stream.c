@@ -0,0 +1,236 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "stream.h"
+#include "files.h"
+#include "utils.h"
+#include "scan.h"
+#include "exit.h"
+
+/* Chars of a chunk of token storage. */
+#define STRINGS_CHUNK 4096
+
+/*
+ * Tokens are packed into chunks that are never moved, so that commands can
+ * point into them while the stream grows.
+ */
+struct vm_strings {
+    struct vm_strings *next;
+    size_t used;
+    size_t size;
+    char data[];
+};
+
+
+void vm_stream_init(struct vm_stream *s)
+{
+    s->commands = NULL;
+    s->count = 0;
+    s->allocated = 0;
+    s->strings = NULL;
+}
+
+int vm_command_number(const struct vm_command *cmd)
+{
+    char *endptr = NULL;
+    long n;
+
+    if (cmd->ntokens != 3) {
+        return -1;
+    }
+    errno = 0;
+    n = strtol(cmd->tokens[2], &endptr, 10);
+    if (endptr == cmd->tokens[2] || *endptr || errno != 0 || n < 0 || n > 32767) {
+        return -1;
+    }
+    return n;
+}
+
+void vm_stream_free(struct vm_stream *s)
+{
+    struct vm_strings *next;
+
+    for (struct vm_strings *chunk = s->strings; chunk; chunk = next) {
+        next = chunk->next;
+        free(chunk);
+    }
+    free(s->commands);
+    vm_stream_init(s);
+}
+
+char *vm_stream_alloc(struct vm_stream *s, size_t size)
+{
+    struct vm_strings *chunk = s->strings;
+
+    if (chunk == NULL || chunk->size - chunk->used < size) {
+        size_t chunk_size = size > STRINGS_CHUNK ? size : STRINGS_CHUNK;
+
+        if ((chunk = malloc(sizeof(*chunk) + chunk_size)) == NULL) {
+            return NULL;
+        }
+        chunk->next = s->strings;
+        chunk->used = 0;
+        chunk->size = chunk_size;
+        s->strings = chunk;
+    }
+
+    char *p = chunk->data + chunk->used;
+    chunk->used += size;
+
+    return p;
+}
+
+/*
+ * Copy str into the storage of s.
+ *
+ * \retval - the copy, or NULL if out of memory.
+ */
+static const char *stream_string(struct vm_stream *s, const char *str)
+{
+    size_t len = strlen(str) + 1;
+    char *copy = vm_stream_alloc(s, len);
+
+    return copy ? memcpy(copy, str, len) : NULL;
+}
+
+int vm_stream_reserve(struct vm_stream *s, unsigned count)
+{
+    if (s->allocated - s->count < count) {
+        unsigned allocated = s->allocated ? s->allocated : 256;
+
+        while (allocated - s->count < count) {
+            allocated *= 2;
+        }
+
+        struct vm_command *commands = realloc(s->commands, allocated * sizeof(*commands));
+
+        if (commands == NULL) {
+            return EXIT_OUT_OF_MEMORY;
+        }
+        s->commands = commands;
+        s->allocated = allocated;
+    }
+    return 0;
+}
+
+/*
+ * Make room for one more command at the end of s.
+ *
+ * \retval - the command, or NULL if out of memory.
+ */
+static struct vm_command *stream_next(struct vm_stream *s)
+{
+    return vm_stream_reserve(s, 1) ? NULL : &s->commands[s->count];
+}
+
+int vm_stream_add(struct vm_stream *s, unsigned line, cmd_id id, const char *arg, int n)
+{
+    struct vm_command *cmd = stream_next(s);
+    char number[16];
+
+    if (cmd == NULL) {
+        return EXIT_OUT_OF_MEMORY;
+    }
+
+    cmd->id = id;
+    cmd->line = line;
+    cmd->ntokens = 1;
+    // the names of the commands are literals already
+    cmd->tokens[0] = cmdid_to_str(id);
+
+    if (arg && (cmd->tokens[cmd->ntokens++] = stream_string(s, arg)) == NULL) {
+        return EXIT_OUT_OF_MEMORY;
+    }
+    if (n >= 0) {
+        sprintf(number, "%d", n);
+        if ((cmd->tokens[cmd->ntokens++] = stream_string(s, number)) == NULL) {
+            return EXIT_OUT_OF_MEMORY;
+        }
+    }
+
+    s->count++;
+    return 0;
+}
+
+int vm_stream_push(struct vm_stream *s, unsigned line, int ntokens, const char *tokens[ntokens])
+{
+    struct vm_command *cmd = stream_next(s);
+
+    if (cmd == NULL) {
+        return EXIT_OUT_OF_MEMORY;
+    }
+
+    cmd->id = str_to_cmdid(tokens[0]);
+    cmd->line = line;
+    cmd->ntokens = ntokens;
+    for (int i = 0; i < ntokens; i++) {
+        if ((cmd->tokens[i] = stream_string(s, tokens[i])) == NULL) {
+            return EXIT_OUT_OF_MEMORY;
+        }
+    }
+
+    s->count++;
+    return 0;
+}
+
+void vm_command_format(const struct vm_command *cmd, char line[MAX_LINE_LEN + 1])
+{
+    *line = '\0';
+    for (int j = 0; j < cmd->ntokens; j++) {
+        snprintf(line + strlen(line), MAX_LINE_LEN + 1 - strlen(line),
+                 j ? " %s" : "%s", cmd->tokens[j]);
+    }
+}
+
+int vm_stream_parse(const char *text, size_t len, struct vm_stream *s, char *errmsg)
+{
+    char line[MAX_LINE_LEN + 1];
+    char *tokens[MAX_TOKENS + 1] = {NULL};
+    struct scanner sc;
+    struct scan_span span;
+    int rc = 0;
+
+    if (scanner_init(&sc, text, len)) {
+        return error_format(errmsg, EXIT_OUT_OF_MEMORY);
+    }
+
+    while (!rc && scanner_next(&sc, &span)) {
+        size_t n = span.len < MAX_LINE_LEN ? span.len : MAX_LINE_LEN;
+        int ntokens;
+
+        memcpy(line, span.text, n);
+        line[n] = '\0';
+
+        // no command has that many tokens or chars, so keep the line as one to report
+        if (span.len > MAX_LINE_LEN
+            || (ntokens = s_tokenize(line, tokens, MAX_TOKENS+1, " \t")) > MAX_TOKENS) {
+            memcpy(line, span.text, n);
+            ntokens = 1;
+            tokens[0] = line;
+        }
+        if (vm_stream_push(s, span.line, ntokens, (const char **) tokens)) {
+            rc = error_format(errmsg, EXIT_OUT_OF_MEMORY);
+        }
+    }
+
+    scanner_free(&sc);
+
+    return rc;
+}
+
+int vm_stream_read(FILE *fp, struct vm_stream *s, char *errmsg)
+{
+    size_t len;
+    char *text = read_file(fp, &len);
+    int rc;
+
+    if (text == NULL) {
+        return error_format(errmsg, EXIT_OUT_OF_MEMORY);
+    }
+    rc = vm_stream_parse(text, len, s, errmsg);
+    free(text);
+
+    return rc;
+}
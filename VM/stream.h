@@ -0,0 +1,106 @@
+#pragma once
+
+#include <stdio.h>
+
+#include "command.h"
+
+/*
+ * An in-memory stream of VM commands, as produced by the Jack compiler. Each
+ * command is kept in the tokenized form the translator's parsers take, so
+ * translating a stream needs no text to be written or read back.
+ */
+
+/* Number of tokens of the command with the most tokens (out of all cmds). */
+#define MAX_TOKENS 3
+/* Longest line of a .vm file. */
+#define MAX_LINE_LEN 200
+
+struct vm_command {
+    cmd_id id;
+    int ntokens;
+    const char *tokens[MAX_TOKENS];
+    /* Line of the source the command was generated from. */
+    unsigned line;
+};
+
+/* Storage of the tokens of a stream, see vm_stream_add(). */
+struct vm_strings;
+
+struct vm_stream {
+    struct vm_command *commands;
+    unsigned count;
+    unsigned allocated;
+    struct vm_strings *strings;
+};
+
+
+void vm_stream_init(struct vm_stream *s);
+
+/*
+ * The number of a push, pop, function or call command, e.g. 7 of
+ * "push constant 7".
+ *
+ * \retval - the number, or -1 if cmd has no valid one.
+ */
+int vm_command_number(const struct vm_command *cmd);
+
+/*
+ * Free the commands of s and their tokens, leaving s empty.
+ */
+void vm_stream_free(struct vm_stream *s);
+
+/*
+ * Append the command id with its argument arg, unless NULL, and its number
+ * n, unless negative, e.g. "push constant 7" or "label LOOP". The tokens are
+ * copied, so arg may be a temporary.
+ *
+ * \retval - 0 on success, else EXIT_OUT_OF_MEMORY.
+ */
+int vm_stream_add(struct vm_stream *s, unsigned line, cmd_id id, const char *arg, int n);
+
+/*
+ * Append a command as given by its tokens, which are copied. Unlike with
+ * vm_stream_add(), they need not make a valid command; translating it will
+ * report it instead.
+ *
+ * \retval - 0 on success, else EXIT_OUT_OF_MEMORY.
+ */
+int vm_stream_push(struct vm_stream *s, unsigned line, int ntokens, const char *tokens[ntokens]);
+
+/*
+ * Make room for count more commands at the end of s, so that they can be
+ * filled in directly, at s->commands[s->count++].
+ *
+ * \retval - 0 on success, else EXIT_OUT_OF_MEMORY.
+ */
+int vm_stream_reserve(struct vm_stream *s, unsigned count);
+
+/*
+ * Storage for size chars that lives as long as the commands of s, for
+ * tokens that are built in place.
+ *
+ * \retval - the storage, or NULL if out of memory.
+ */
+char *vm_stream_alloc(struct vm_stream *s, size_t size);
+
+/*
+ * Write the tokens of cmd back as the line of text they came from, as
+ * error messages show it.
+ */
+void vm_command_format(const struct vm_command *cmd, char line[MAX_LINE_LEN + 1]);
+
+/*
+ * Append the commands of the .vm file in fp to s. errmsg must be able to
+ * hold MAX_ERROR_LEN + 1 chars.
+ *
+ * \retval - 0 on success, else the exit code of the error described by errmsg.
+ */
+int vm_stream_read(FILE *fp, struct vm_stream *s, char *errmsg);
+
+/*
+ * Append the commands of the len chars of .vm text at text to s, as
+ * vm_stream_read() does.
+ *
+ * \retval - 0 on success, else the exit code of the error described by errmsg.
+ */
+int vm_stream_parse(const char *text, size_t len, struct vm_stream *s, char *errmsg);
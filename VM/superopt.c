@@ -0,0 +1,1298 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <ctype.h>
+#include <unistd.h>
+
+#include "hack_standard.h"
+#include "mapper.h"
+#include "exit.h"
+
+/*
+ * Superoptimizer of the assembly templates of mapper.h. Each template is
+ * parsed into Hack instructions, and every window of a few consecutive
+ * instructions is tried against all shorter sequences over the comp and
+ * dest space of the Hack CPU, shortest first. A replacement is kept if the
+ * whole template then does the same as the original on random machine
+ * states, and if a symbolic run of both proves it.
+ *
+ * "The same" is up to what the code after a template may rely on: SP and
+ * the RAM below it, the segment pointers and whatever else the template
+ * writes, D for the stack caching templates, which leave the top of stack
+ * there, and A for the ones that end with a jump through it. R13-R15 and
+ * the RAM right past SP are scratch, unless the template hands values over
+ * in them.
+ *
+ * Templates with branches of their own, like the comparisons, are reported
+ * and skipped.
+ */
+
+#define USAGE "Usage: superopt [-n length] [-t tests] [template]"
+
+/* Most instructions and chars of a template. */
+#define MAX_CODE 64
+#define MAX_TEXT 2047
+/* Most parameters of a template, i.e. symbols it is instantiated with. */
+#define MAX_PARAMS 3
+#define MAX_ARGS 4
+/* Most distinct A-instruction operands of a template. */
+#define MAX_OPERANDS 16
+#define MAX_NAME 31
+/* Longest replacement of a window searched for (-n). */
+#define MAX_LENGTH 4
+#define DEFAULT_LENGTH 3
+/* Number of random machine states candidates are run on (-t). */
+#define MAX_TESTS 256
+#define DEFAULT_TESTS 64
+/* Tests the states of the search are told apart by. */
+#define FINGERPRINT_TESTS 4
+#define SEEN_SIZE (1 << 20)
+/* Words past SP a template may clobber. */
+#define STACK_SLACK 64
+#define MAX_WRITES (MAX_CODE + MAX_LENGTH)
+
+#define ADDR(x) ((uint16_t) (x) & (HACK_RAM_SIZE - 1))
+
+/*
+ * The machine states templates run in. ARG is followed by the arguments,
+ * the saved frame of the caller, i.e. 5 words, and LCL, which is followed
+ * by the locals and the working stack up to SP. THIS and THAT point
+ * anywhere from past the registers to the keyboard, so that segment
+ * offsets don't wrap around.
+ */
+#define ARG_MIN 256
+#define ARG_MAX 1024
+#define MAX_NARGS 255
+#define MAX_WORKING 255
+#define POINTER_MIN 16
+#define POINTER_MAX SYM_KBD
+
+/* What a template leaves for the code after it, besides RAM. */
+#define LIVE_D   0x1
+#define LIVE_R13 0x2
+
+struct param {
+    const char *name;
+    int lo, hi;
+};
+
+struct template {
+    const char *name;
+    const char *format;
+    /*
+     * Strings the conversions of format are replaced with, in order. An
+     * argument with conversions of its own, e.g. the addressing code of a
+     * segment, takes the arguments after it.
+     */
+    const char *args[MAX_ARGS];
+    struct param params[MAX_PARAMS];
+    unsigned live;
+};
+
+static const struct template templates[] = {
+    { "push constant", ASM_PUSH_CONST, { "K" }, { { "K", 0, INT16_MAX } }, 0 },
+    { "push static", ASM_PUSH_STATIC, { "Foo", "K" }, { { "Foo.K", 16, 255 } }, 0 },
+    { "push local 0", ASM_PUSH_LATT, { ASM_LATT_ADDR_0, "LCL" }, { { 0 } }, 0 },
+    { "push local 1", ASM_PUSH_LATT, { ASM_LATT_ADDR_1, "LCL" }, { { 0 } }, 0 },
+    { "push local", ASM_PUSH_LATT, { ASM_LATT_ADDR, "K", "LCL" }, { { "K", 0, 255 } }, 0 },
+    { "push that", ASM_PUSH_LATT, { ASM_LATT_ADDR, "K", "THAT" }, { { "K", 0, 255 } }, 0 },
+    { "push temp", ASM_PUSH_TEMP, { "K" }, { { "K", 5, 12 } }, 0 },
+    { "push pointer", ASM_PUSH_POINTER, { "THIS" }, { { 0 } }, 0 },
+    { "pop static", ASM_POP_STATIC, { "Foo", "K" }, { { "Foo.K", 16, 255 } }, 0 },
+    { "pop local 0", ASM_POP_LATT_NEAR, { ASM_LATT_ADDR_0, "LCL" }, { { 0 } }, 0 },
+    { "pop local 1", ASM_POP_LATT_NEAR, { ASM_LATT_ADDR_1, "LCL" }, { { 0 } }, 0 },
+    { "pop local", ASM_POP_LATT, { "LCL", "K" }, { { "K", 0, 255 } }, 0 },
+    { "pop that", ASM_POP_LATT, { "THAT", "K" }, { { "K", 0, 255 } }, 0 },
+    { "pop temp", ASM_POP_TEMP, { "K" }, { { "K", 5, 12 } }, 0 },
+    { "pop pointer", ASM_POP_POINTER, { "THIS" }, { { 0 } }, 0 },
+    { "add", ASM_ADD, { 0 }, { { 0 } }, 0 },
+    { "sub", ASM_SUB, { 0 }, { { 0 } }, 0 },
+    { "neg", ASM_NEG, { 0 }, { { 0 } }, 0 },
+    { "and", ASM_AND, { 0 }, { { 0 } }, 0 },
+    { "or", ASM_OR, { 0 }, { { 0 } }, 0 },
+    { "not", ASM_NOT, { 0 }, { { 0 } }, 0 },
+    { "eq", ASM_EQ, { "0", "0" }, { { 0 } }, 0 },
+    { "gt", ASM_GT, { "0", "0" }, { { 0 } }, 0 },
+    { "lt", ASM_LT, { "0", "0" }, { { 0 } }, 0 },
+    { "if-goto", ASM_IFGOTO, { "Foo", "L" }, { { 0 } }, 0 },
+    { "call", ASM_CALL, { "R", "N", "f", "R" },
+      { { "RETURN_LABEL$R", 0, INT16_MAX }, { "N", 0, MAX_NARGS }, { "f", 0, INT16_MAX } }, 0 },
+    { "return", ASM_RETURN, { 0 }, { { 0 } }, 0 },
+    { "clear local (-f)", ASM_CLEAR_DIRECT, { "K" }, { { "K", 256, 767 } }, 0 },
+    { "tail call (-t)", ASM_TAIL_CALL, { "N", "f" },
+      { { "N", 0, MAX_NARGS }, { "f", 0, INT16_MAX }, { "TAIL$CALL", 0, INT16_MAX } },
+      LIVE_D | LIVE_R13 },
+    { "divide (-m)", ASM_DIV_POW2_CALL, { "K", "R", "R" },
+      { { "K", 1, 16384 }, { "DIV_RET_R", 0, INT16_MAX }, { "DIV$POW2", 0, INT16_MAX } },
+      LIVE_D | LIVE_R13 },
+    { "spill (-c)", ASM_SPILL_D, { 0 }, { { 0 } }, 0 },
+    { "load constant (-c)", ASM_LOAD_CONST, { "K" }, { { "K", 0, INT16_MAX } }, LIVE_D },
+    { "load static (-c)", ASM_LOAD_STATIC, { "Foo", "K" }, { { "Foo.K", 16, 255 } }, LIVE_D },
+    { "load local 1 (-c)", ASM_LOAD_LATT, { ASM_LATT_ADDR_1, "LCL" }, { { 0 } }, LIVE_D },
+    { "load local (-c)", ASM_LOAD_LATT, { ASM_LATT_ADDR, "K", "LCL" }, { { "K", 0, 255 } }, LIVE_D },
+    { "load temp (-c)", ASM_LOAD_DIRECT, { "K" }, { { "K", 5, 12 } }, LIVE_D },
+    { "store static (-c)", ASM_STORE_STATIC, { "Foo", "K" }, { { "Foo.K", 16, 255 } }, 0 },
+    { "store local 1 (-c)", ASM_STORE_LATT_NEAR, { ASM_LATT_ADDR_1, "LCL" }, { { 0 } }, 0 },
+    { "store local (-c)", ASM_STORE_LATT, { "LCL", "K" }, { { "K", 0, 255 } }, 0 },
+    { "store temp (-c)", ASM_STORE_DIRECT, { "K" }, { { "K", 5, 12 } }, 0 },
+    { "add (-c)", ASM_CACHED_ADD, { 0 }, { { 0 } }, LIVE_D },
+    { "sub (-c)", ASM_CACHED_SUB, { 0 }, { { 0 } }, LIVE_D },
+    { "and (-c)", ASM_CACHED_AND, { 0 }, { { 0 } }, LIVE_D },
+    { "or (-c)", ASM_CACHED_OR, { 0 }, { { 0 } }, LIVE_D },
+    { "neg (-c)", ASM_CACHED_NEG, { 0 }, { { 0 } }, LIVE_D },
+    { "not (-c)", ASM_CACHED_NOT, { 0 }, { { 0 } }, LIVE_D },
+};
+
+#define NUM_TEMPLATES (sizeof(templates) / sizeof(templates[0]))
+
+/* The mnemonics of the comp field, as made up by the assembler. */
+static const char *comp_names[] = {
+    "0", "1", "-1", "D", "A", "!D", "!A", "-D", "-A", "D+1", "A+1", "D-1", "A-1",
+    "D+A", "D-A", "A-D", "D&A", "D|A",
+    "M", "!M", "-M", "M+1", "M-1", "D+M", "D-M", "M-D", "D&M", "D|M",
+};
+
+#define NUM_COMPS (sizeof(comp_names) / sizeof(comp_names[0]))
+
+static const char *dest_names[] = { "", "M", "D", "MD", "A", "AM", "AD", "AMD" };
+
+
+struct operand {
+    char name[MAX_NAME + 1];
+    /* Index of the parameter it is, or -1 for a number. */
+    int param;
+    int16_t value;
+};
+
+struct inst {
+    bool is_a;
+    /* A-instruction: index of its operand. */
+    unsigned operand;
+    /* C-instruction: the a bit and comp field, as in comp_encode(), and dest. */
+    unsigned comp;
+    unsigned dest;
+};
+
+struct program {
+    struct inst code[MAX_CODE];
+    unsigned len;
+};
+
+/* A template, as parsed. */
+struct subject {
+    const struct template *tmpl;
+    struct operand operands[MAX_OPERANDS];
+    unsigned noperands;
+    /* The code up to the final jump through A, if any. */
+    struct program orig;
+    bool jumps;
+    /* The label the code ends with, if any. */
+    char label[MAX_NAME + 1];
+};
+
+/* A random machine state, with values for the parameters of a template. */
+struct test {
+    int16_t *ram;
+    int16_t a, d;
+    int16_t param[MAX_PARAMS];
+};
+
+/* A machine state, as the RAM of its test plus the words written since. */
+struct cstate {
+    int16_t a, d;
+    unsigned nw;
+    uint16_t addr[MAX_WRITES];
+    int16_t val[MAX_WRITES];
+};
+
+/*
+ * What the code after a window relies on in the state the window leaves,
+ * on one test: the registers and RAM it reads before writing them, or that
+ * it leaves untouched for after the template.
+ */
+struct live {
+    bool a, d;
+    unsigned nreads;
+    uint16_t reads[MAX_CODE];
+    int16_t values[MAX_CODE];
+    unsigned nwrites;
+    uint16_t writes[MAX_CODE];
+    /* SP at the end of the template. */
+    uint16_t sp;
+};
+
+
+static unsigned comp_encode(const char *name)
+{
+    int a;
+    comp_id id = str_to_compid(name, &a);
+
+    return id == COMP_INVALID ? ~0u : (unsigned) (a << 6 | id);
+}
+
+static const char *comp_name(unsigned comp)
+{
+    for (unsigned i = 0; i < NUM_COMPS; i++) {
+        if (comp_encode(comp_names[i]) == comp) {
+            return comp_names[i];
+        }
+    }
+    return "?";
+}
+
+/*
+ * Replace the conversions of format with the arguments args[*next] on,
+ * recursively, and append the result to out, which has room for end - out
+ * chars.
+ */
+static char *instantiate(char *out, char *end, const char *format,
+                         const char *const args[], unsigned *next)
+{
+    while (*format && out < end) {
+        if (format[0] == '%' && (format[1] == 'd' || format[1] == 's') && *next < MAX_ARGS
+            && args[*next]) {
+            const char *arg = args[(*next)++];
+
+            out = instantiate(out, end, arg, args, next);
+            format += 2;
+        } else {
+            *out++ = *format++;
+        }
+    }
+    *out = '\0';
+    return out;
+}
+
+static int add_operand(struct subject *sub, const char *name)
+{
+    const struct template *tmpl = sub->tmpl;
+    struct operand op;
+    bool number = *name != '\0';
+
+    for (const char *s = name; *s; s++) {
+        number &= isdigit((unsigned char) *s) != 0;
+    }
+
+    memset(&op, 0, sizeof(op));
+    snprintf(op.name, sizeof(op.name), "%s", name);
+    op.param = -1;
+    if (number) {
+        op.value = atoi(name);
+    } else if (predef_lookup(name) >= 0) {
+        op.value = predef_lookup(name);
+    } else {
+        for (unsigned i = 0; i < MAX_PARAMS && tmpl->params[i].name; i++) {
+            if (!strcmp(tmpl->params[i].name, name)) {
+                op.param = i;
+            }
+        }
+        if (op.param < 0) {
+            return -1;
+        }
+    }
+
+    for (unsigned i = 0; i < sub->noperands; i++) {
+        if (sub->operands[i].param == op.param && (op.param >= 0 || sub->operands[i].value == op.value)) {
+            return i;
+        }
+    }
+    if (sub->noperands == MAX_OPERANDS) {
+        return -1;
+    }
+    sub->operands[sub->noperands] = op;
+    return sub->noperands++;
+}
+
+/*
+ * Parse the code of tmpl into sub.
+ *
+ * \retval - NULL on success, else why the template can't be searched.
+ */
+static const char *parse(struct subject *sub, const struct template *tmpl)
+{
+    char text[MAX_TEXT + 1];
+    unsigned next = 0;
+    struct program *prog = &sub->orig;
+
+    bool unknown = false;
+
+    memset(sub, 0, sizeof(*sub));
+    sub->tmpl = tmpl;
+    instantiate(text, text + MAX_TEXT, tmpl->format, tmpl->args, &next);
+
+    for (char *line = strtok(text, "\n"); line; line = strtok(NULL, "\n")) {
+        struct inst *inst = &prog->code[prog->len];
+
+        if (sub->jumps || *sub->label) {
+            // only a label may follow the final jump
+            if (*line != '(' || *sub->label) {
+                return "it branches";
+            }
+        }
+        if (*line == '(') {
+            snprintf(sub->label, sizeof(sub->label), "%s", line);
+            continue;
+        }
+        if (prog->len == MAX_CODE) {
+            return "it is too long";
+        }
+
+        memset(inst, 0, sizeof(*inst));
+        if (*line == '@') {
+            int op = add_operand(sub, line + 1);
+
+            // branches are the likelier reason to give up, so look for them first
+            unknown |= op < 0;
+            inst->is_a = true;
+            inst->operand = op < 0 ? 0 : op;
+            prog->len++;
+            continue;
+        }
+
+        char *eq = strchr(line, '=');
+        char *semi = strchr(line, ';');
+        const char *comp = eq ? eq + 1 : line;
+
+        if (eq) {
+            *eq = '\0';
+        }
+        if (semi) {
+            *semi = '\0';
+            if (strcmp(comp, "0") || str_to_jumpid(semi + 1) != JMP_JMP || eq) {
+                return "it branches";
+            }
+            sub->jumps = true;
+            continue;
+        }
+        inst->comp = comp_encode(comp);
+        inst->dest = str_to_destid(eq ? line : NULL);
+        if (inst->comp == ~0u || inst->dest == (unsigned) DEST_INVALID) {
+            return "it has an invalid instruction";
+        }
+        prog->len++;
+    }
+
+    return unknown ? "it has a symbol of unknown value" : NULL;
+}
+
+static void print_program(const struct subject *sub, const struct program *prog)
+{
+    for (unsigned i = 0; i < prog->len; i++) {
+        const struct inst *inst = &prog->code[i];
+
+        if (inst->is_a) {
+            printf("    @%s\n", sub->operands[inst->operand].name);
+        } else {
+            printf("    %s%s%s\n", dest_names[inst->dest], inst->dest ? "=" : "", comp_name(inst->comp));
+        }
+    }
+    if (sub->jumps) {
+        printf("    0;JMP\n");
+    }
+    if (*sub->label) {
+        printf("    %s\n", sub->label);
+    }
+}
+
+
+/*
+ * Concrete execution, on the tests.
+ */
+
+static uint64_t rng_state = 0x9e3779b97f4a7c15ull;
+
+static uint64_t rng_next(void)
+{
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545f4914f6cdd1dull;
+}
+
+static int rng_range(int lo, int hi)
+{
+    return lo + (int) (rng_next() % (uint64_t) (hi - lo + 1));
+}
+
+/* A random word, with a bias to the ones arithmetic tends to go wrong on. */
+static int16_t rng_word(void)
+{
+    static const int16_t special[] = { 0, 1, -1, INT16_MAX, INT16_MIN };
+    uint64_t r = rng_next();
+
+    return r % 8 ? (int16_t) (r >> 32) : special[(r >> 8) % 5];
+}
+
+/*
+ * Set up ntests random machine states. Some of them have THIS and THAT point
+ * into the stack and the frame, which code must not take for granted to
+ * be apart.
+ */
+static bool make_tests(struct test tests[], unsigned ntests)
+{
+    for (unsigned t = 0; t < ntests; t++) {
+        int16_t *ram = malloc(HACK_RAM_SIZE * sizeof(int16_t));
+
+        if (ram == NULL) {
+            return false;
+        }
+        for (unsigned i = 0; i < HACK_RAM_SIZE; i++) {
+            ram[i] = rng_word();
+        }
+
+        int arg = rng_range(ARG_MIN, ARG_MAX);
+        int lcl = arg + 5 + (t % 16 == 15 ? rng_range(0, MAX_NARGS) : rng_range(0, 5));
+        int sp = lcl + (t % 16 == 14 ? rng_range(0, MAX_WORKING) : rng_range(0, 20));
+
+        ram[0] = sp;
+        ram[1] = lcl;
+        ram[2] = arg;
+        ram[3] = rng_range(POINTER_MIN, POINTER_MAX);
+        ram[4] = rng_range(POINTER_MIN, POINTER_MAX);
+        switch (t % 8) {
+        case 1: ram[4] = sp - 1; break;
+        case 2: ram[3] = lcl; break;
+        case 3: ram[4] = sp; break;
+        case 4: ram[3] = arg; break;
+        case 5: ram[3] = ram[4]; break;
+        }
+
+        tests[t].ram = ram;
+        tests[t].a = rng_word();
+        tests[t].d = rng_word();
+    }
+    return true;
+}
+
+/* Pick the values of the parameters of tmpl, some of them at their bounds. */
+static void set_params(struct test tests[], unsigned ntests, const struct template *tmpl)
+{
+    for (unsigned t = 0; t < ntests; t++) {
+        for (unsigned i = 0; i < MAX_PARAMS && tmpl->params[i].name; i++) {
+            const struct param *p = &tmpl->params[i];
+
+            tests[t].param[i] = t == 1 ? p->lo : t == 2 ? p->hi : rng_range(p->lo, p->hi);
+        }
+    }
+}
+
+static void c_init(struct cstate *s, const struct test *test)
+{
+    s->a = test->a;
+    s->d = test->d;
+    s->nw = 0;
+}
+
+static int16_t c_read(const struct test *test, const struct cstate *s, uint16_t addr)
+{
+    for (unsigned i = 0; i < s->nw; i++) {
+        if (s->addr[i] == addr) {
+            return s->val[i];
+        }
+    }
+    return test->ram[addr];
+}
+
+static void c_write(struct cstate *s, uint16_t addr, int16_t val)
+{
+    for (unsigned i = 0; i < s->nw; i++) {
+        if (s->addr[i] == addr) {
+            s->val[i] = val;
+            return;
+        }
+    }
+    s->addr[s->nw] = addr;
+    s->val[s->nw++] = val;
+}
+
+static void c_step(const struct subject *sub, const struct test *test, struct cstate *s,
+                   const struct inst *inst)
+{
+    if (inst->is_a) {
+        const struct operand *op = &sub->operands[inst->operand];
+
+        s->a = op->param >= 0 ? test->param[op->param] : op->value;
+        return;
+    }
+
+    uint16_t addr = ADDR(s->a);
+    int16_t y = inst->comp & 0x40 ? c_read(test, s, addr) : s->a;
+    int16_t out = hack_alu(inst->comp & 0x3f, s->d, y);
+
+    // the write to M goes to where A pointed before
+    if (inst->dest & DEST_M) {
+        c_write(s, addr, out);
+    }
+    if (inst->dest & DEST_A) {
+        s->a = out;
+    }
+    if (inst->dest & DEST_D) {
+        s->d = out;
+    }
+}
+
+static void c_run(const struct subject *sub, const struct test *test, struct cstate *s,
+                  const struct inst code[], unsigned len)
+{
+    for (unsigned i = 0; i < len; i++) {
+        c_step(sub, test, s, &code[i]);
+    }
+}
+
+/* Whether RAM at addr is of no use after the template, whose final SP is sp. */
+static bool c_dead(const struct subject *sub, uint16_t addr, uint16_t sp)
+{
+    if (addr >= 13 && addr <= 15) {
+        return addr != 13 || !(sub->tmpl->live & LIVE_R13);
+    }
+    return ADDR(addr - sp) < STACK_SLACK;
+}
+
+static bool in_list(const uint16_t list[], unsigned n, uint16_t addr)
+{
+    for (unsigned i = 0; i < n; i++) {
+        if (list[i] == addr) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Run the rest of a program, code, from the state s a window leaves, and
+ * note what it relies on in live.
+ */
+static void c_track(const struct subject *sub, const struct test *test, struct cstate *s,
+                    const struct inst code[], unsigned len, struct live *live)
+{
+    bool a_set = false, d_set = false;
+
+    memset(live, 0, sizeof(*live));
+
+    for (unsigned i = 0; i < len; i++) {
+        const struct inst *inst = &code[i];
+
+        if (!inst->is_a) {
+            bool uses_y = !(inst->comp & 0x08);
+            bool reads_m = uses_y && (inst->comp & 0x40);
+            uint16_t addr = ADDR(s->a);
+
+            live->a |= !a_set && (uses_y || (inst->dest & DEST_M));
+            live->d |= !d_set && !(inst->comp & 0x20);
+            if (reads_m && !in_list(live->writes, live->nwrites, addr)
+                && !in_list(live->reads, live->nreads, addr)) {
+                live->values[live->nreads] = c_read(test, s, addr);
+                live->reads[live->nreads++] = addr;
+            }
+            if ((inst->dest & DEST_M) && !in_list(live->writes, live->nwrites, addr)) {
+                live->writes[live->nwrites++] = addr;
+            }
+            d_set |= (inst->dest & DEST_D) != 0;
+        }
+        a_set |= inst->is_a || (inst->dest & DEST_A);
+        c_step(sub, test, s, inst);
+    }
+
+    live->a |= !a_set && sub->jumps;
+    live->d |= !d_set && (sub->tmpl->live & LIVE_D);
+    live->sp = ADDR(c_read(test, s, 0));
+}
+
+static bool c_written_or_dead(const struct subject *sub, const struct live *live, uint16_t addr)
+{
+    return in_list(live->writes, live->nwrites, addr) || c_dead(sub, addr, live->sp);
+}
+
+/*
+ * Whether the template ends the same with the state s after a window as
+ * with the state orig the original window leaves.
+ */
+static bool c_same(const struct subject *sub, const struct test *test, const struct cstate *s,
+                   const struct cstate *orig, const struct live *live)
+{
+    if ((live->a && s->a != orig->a) || (live->d && s->d != orig->d)) {
+        return false;
+    }
+    for (unsigned i = 0; i < live->nreads; i++) {
+        if (c_read(test, s, live->reads[i]) != live->values[i]) {
+            return false;
+        }
+    }
+    for (unsigned i = 0; i < s->nw; i++) {
+        if (s->val[i] != c_read(test, orig, s->addr[i]) && !c_written_or_dead(sub, live, s->addr[i])) {
+            return false;
+        }
+    }
+    for (unsigned i = 0; i < orig->nw; i++) {
+        if (orig->val[i] != c_read(test, s, orig->addr[i])
+            && !c_written_or_dead(sub, live, orig->addr[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+/*
+ * Symbolic execution. Values are linear combinations, modulo 2^16, of atoms:
+ * variables with a range, the initial RAM at some address and the ands of
+ * other values. Two values are known to be equal if they are the same
+ * combination, and two addresses to be apart if their difference can't be
+ * a multiple of the RAM size over the ranges of its atoms. Anything that
+ * can't be told either way fails the proof.
+ */
+
+#define MAX_TERMS 8
+#define MAX_ATOMS 4096
+
+struct lin {
+    int16_t c;
+    unsigned n;
+    /* Sorted. */
+    unsigned atom[MAX_TERMS];
+    int16_t coef[MAX_TERMS];
+};
+
+enum atom_kind { ATOM_VAR, ATOM_MEM, ATOM_AND };
+
+struct atom {
+    enum atom_kind kind;
+    /* ATOM_MEM: the address. ATOM_AND: the operands. */
+    struct lin x, y;
+    long long lo, hi;
+};
+
+struct symbolic {
+    struct atom atoms[MAX_ATOMS];
+    unsigned natoms;
+    /* Whether the terms or atoms ran out, or RAM couldn't be told apart. */
+    bool failed;
+    /* SP, LCL, ARG, THIS and THAT. */
+    struct lin ram0[5];
+    struct lin param[MAX_PARAMS];
+    struct lin a0, d0;
+};
+
+struct sstate {
+    struct lin a, d;
+    unsigned nw;
+    /* All writes, in order. */
+    struct lin addr[MAX_WRITES], val[MAX_WRITES];
+};
+
+enum alias { ALIAS_NO, ALIAS_YES, ALIAS_MAYBE };
+
+
+static struct lin lin_const(int16_t c)
+{
+    struct lin x;
+
+    memset(&x, 0, sizeof(x));
+    x.c = c;
+    return x;
+}
+
+static struct lin lin_atom(unsigned atom)
+{
+    struct lin x = lin_const(0);
+
+    x.n = 1;
+    x.atom[0] = atom;
+    x.coef[0] = 1;
+    return x;
+}
+
+/* x + k * y */
+static struct lin lin_combine(struct symbolic *sym, const struct lin *x, const struct lin *y, int k)
+{
+    struct lin r = lin_const((int16_t) (x->c + k * y->c));
+    unsigned i = 0, j = 0;
+
+    while (i < x->n || j < y->n) {
+        unsigned atom;
+        int16_t coef;
+
+        if (j == y->n || (i < x->n && x->atom[i] < y->atom[j])) {
+            atom = x->atom[i];
+            coef = x->coef[i++];
+        } else if (i == x->n || y->atom[j] < x->atom[i]) {
+            atom = y->atom[j];
+            coef = (int16_t) (k * y->coef[j++]);
+        } else {
+            atom = x->atom[i];
+            coef = (int16_t) (x->coef[i++] + k * y->coef[j++]);
+        }
+        if (coef == 0) {
+            continue;
+        }
+        if (r.n == MAX_TERMS) {
+            sym->failed = true;
+            break;
+        }
+        r.atom[r.n] = atom;
+        r.coef[r.n++] = coef;
+    }
+    return r;
+}
+
+// !x == -x - 1
+static struct lin lin_not(struct symbolic *sym, const struct lin *x)
+{
+    struct lin minus_1 = lin_const(-1);
+
+    return lin_combine(sym, &minus_1, x, -1);
+}
+
+static int lin_compare(const struct lin *x, const struct lin *y)
+{
+    if (x->c != y->c || x->n != y->n) {
+        return x->c != y->c ? x->c - y->c : (int) x->n - (int) y->n;
+    }
+    for (unsigned i = 0; i < x->n; i++) {
+        if (x->atom[i] != y->atom[i]) {
+            return x->atom[i] < y->atom[i] ? -1 : 1;
+        }
+        if (x->coef[i] != y->coef[i]) {
+            return x->coef[i] - y->coef[i];
+        }
+    }
+    return 0;
+}
+
+static bool lin_eq(const struct lin *x, const struct lin *y)
+{
+    return !lin_compare(x, y);
+}
+
+static unsigned sym_atom(struct symbolic *sym, enum atom_kind kind, const struct lin *x,
+                         const struct lin *y, long long lo, long long hi)
+{
+    if (kind != ATOM_VAR) {
+        for (unsigned i = 0; i < sym->natoms; i++) {
+            const struct atom *atom = &sym->atoms[i];
+
+            if (atom->kind == kind && lin_eq(&atom->x, x) && lin_eq(&atom->y, y)) {
+                return i;
+            }
+        }
+    }
+    if (sym->natoms == MAX_ATOMS) {
+        sym->failed = true;
+        return 0;
+    }
+
+    struct atom *atom = &sym->atoms[sym->natoms];
+
+    atom->kind = kind;
+    atom->x = *x;
+    atom->y = *y;
+    atom->lo = lo;
+    atom->hi = hi;
+    return sym->natoms++;
+}
+
+static struct lin sym_var(struct symbolic *sym, long long lo, long long hi)
+{
+    struct lin none = lin_const(0);
+
+    return lin_atom(sym_atom(sym, ATOM_VAR, &none, &none, lo, hi));
+}
+
+static struct lin sym_and(struct symbolic *sym, const struct lin *x, const struct lin *y)
+{
+    if (x->n == 0 && y->n == 0) {
+        return lin_const(x->c & y->c);
+    }
+    if ((x->n == 0 && x->c == 0) || (y->n == 0 && y->c == -1) || lin_eq(x, y)) {
+        return *x;
+    }
+    if ((y->n == 0 && y->c == 0) || (x->n == 0 && x->c == -1)) {
+        return *y;
+    }
+    // and commutes
+    if (lin_compare(x, y) > 0) {
+        const struct lin *t = x;
+
+        x = y;
+        y = t;
+    }
+    return lin_atom(sym_atom(sym, ATOM_AND, x, y, INT16_MIN, INT16_MAX));
+}
+
+static struct lin sym_alu(struct symbolic *sym, unsigned comp, struct lin x, struct lin y)
+{
+    struct lin out;
+
+    if (comp & 0x20) x = lin_const(0);
+    if (comp & 0x10) x = lin_not(sym, &x);
+    if (comp & 0x08) y = lin_const(0);
+    if (comp & 0x04) y = lin_not(sym, &y);
+    out = comp & 0x02 ? lin_combine(sym, &x, &y, 1) : sym_and(sym, &x, &y);
+    if (comp & 0x01) out = lin_not(sym, &out);
+
+    return out;
+}
+
+static enum alias sym_alias(struct symbolic *sym, const struct lin *x, const struct lin *y)
+{
+    struct lin diff = lin_combine(sym, x, y, -1);
+    long long lo = diff.c, hi = diff.c;
+
+    if (diff.n == 0) {
+        return ADDR(diff.c) ? ALIAS_NO : ALIAS_YES;
+    }
+    for (unsigned i = 0; i < diff.n; i++) {
+        const struct atom *atom = &sym->atoms[diff.atom[i]];
+        long long a = diff.coef[i] * atom->lo, b = diff.coef[i] * atom->hi;
+
+        lo += a < b ? a : b;
+        hi += a < b ? b : a;
+    }
+
+    // the first multiple of the RAM size from lo on
+    long long m = lo >= 0 ? (lo + HACK_RAM_SIZE - 1) / HACK_RAM_SIZE : -(-lo / HACK_RAM_SIZE);
+
+    return m * HACK_RAM_SIZE > hi ? ALIAS_NO : ALIAS_MAYBE;
+}
+
+static struct lin sym_read(struct symbolic *sym, const struct sstate *s, struct lin addr)
+{
+    for (unsigned i = s->nw; i-- > 0;) {
+        enum alias alias = sym_alias(sym, &s->addr[i], &addr);
+
+        if (alias == ALIAS_YES) {
+            return s->val[i];
+        }
+        if (alias == ALIAS_MAYBE) {
+            sym->failed = true;
+            return lin_const(0);
+        }
+    }
+
+    if (addr.n == 0) {
+        addr.c = ADDR(addr.c);
+        if (addr.c < 5) {
+            return sym->ram0[addr.c];
+        }
+    }
+
+    struct lin none = lin_const(0);
+
+    return lin_atom(sym_atom(sym, ATOM_MEM, &addr, &none, INT16_MIN, INT16_MAX));
+}
+
+static void sym_step(struct symbolic *sym, const struct subject *sub, struct sstate *s,
+                     const struct inst *inst)
+{
+    if (inst->is_a) {
+        const struct operand *op = &sub->operands[inst->operand];
+
+        s->a = op->param >= 0 ? sym->param[op->param] : lin_const(op->value);
+        return;
+    }
+
+    struct lin y = inst->comp & 0x40 ? sym_read(sym, s, s->a) : s->a;
+    struct lin out = sym_alu(sym, inst->comp & 0x3f, s->d, y);
+
+    if (inst->dest & DEST_M) {
+        s->addr[s->nw] = s->a;
+        s->val[s->nw++] = out;
+    }
+    if (inst->dest & DEST_A) {
+        s->a = out;
+    }
+    if (inst->dest & DEST_D) {
+        s->d = out;
+    }
+}
+
+static void sym_run(struct symbolic *sym, const struct subject *sub, struct sstate *s,
+                    const struct program *prog)
+{
+    s->a = sym->a0;
+    s->d = sym->d0;
+    s->nw = 0;
+    for (unsigned i = 0; i < prog->len && !sym->failed; i++) {
+        sym_step(sym, sub, s, &prog->code[i]);
+    }
+}
+
+static bool sym_dead(struct symbolic *sym, const struct subject *sub, const struct lin *addr,
+                     const struct lin *sp)
+{
+    struct lin diff = lin_combine(sym, addr, sp, -1);
+
+    if (addr->n == 0 && ADDR(addr->c) >= 13 && ADDR(addr->c) <= 15) {
+        return ADDR(addr->c) != 13 || !(sub->tmpl->live & LIVE_R13);
+    }
+    return diff.n == 0 && ADDR(diff.c) < STACK_SLACK;
+}
+
+static bool sym_same_at(struct symbolic *sym, const struct subject *sub, const struct sstate *ref,
+                        const struct sstate *s, const struct lin *addr, const struct lin *sp)
+{
+    if (sym_dead(sym, sub, addr, sp)) {
+        return true;
+    }
+
+    struct lin x = sym_read(sym, ref, *addr);
+    struct lin y = sym_read(sym, s, *addr);
+
+    return !sym->failed && lin_eq(&x, &y);
+}
+
+/*
+ * Prove that prog does what the template of sub does, on any state of the
+ * kind described at ARG_MIN.
+ */
+static bool verify(const struct subject *sub, const struct program *prog)
+{
+    static struct symbolic sym;
+    static struct sstate ref, s;
+    const struct template *tmpl = sub->tmpl;
+    bool same = true;
+
+    sym.natoms = 0;
+    sym.failed = false;
+
+    struct lin arg = sym_var(&sym, ARG_MIN, ARG_MAX);
+    struct lin nargs = sym_var(&sym, 0, MAX_NARGS);
+    struct lin working = sym_var(&sym, 0, MAX_WORKING);
+    struct lin five = lin_const(5);
+
+    sym.ram0[2] = arg;
+    sym.ram0[1] = lin_combine(&sym, &arg, &nargs, 1);
+    sym.ram0[1] = lin_combine(&sym, &sym.ram0[1], &five, 1);
+    sym.ram0[0] = lin_combine(&sym, &sym.ram0[1], &working, 1);
+    sym.ram0[3] = sym_var(&sym, POINTER_MIN, POINTER_MAX);
+    sym.ram0[4] = sym_var(&sym, POINTER_MIN, POINTER_MAX);
+    for (unsigned i = 0; i < MAX_PARAMS && tmpl->params[i].name; i++) {
+        sym.param[i] = sym_var(&sym, tmpl->params[i].lo, tmpl->params[i].hi);
+    }
+    sym.a0 = sym_var(&sym, INT16_MIN, INT16_MAX);
+    sym.d0 = sym_var(&sym, INT16_MIN, INT16_MAX);
+
+    sym_run(&sym, sub, &ref, &sub->orig);
+    sym_run(&sym, sub, &s, prog);
+
+    struct lin zero = lin_const(0);
+    struct lin sp = sym_read(&sym, &ref, zero);
+
+    if (sub->jumps && !lin_eq(&ref.a, &s.a)) {
+        return false;
+    }
+    if ((tmpl->live & LIVE_D) && !lin_eq(&ref.d, &s.d)) {
+        return false;
+    }
+    for (unsigned i = 0; i < ref.nw && same; i++) {
+        same = sym_same_at(&sym, sub, &ref, &s, &ref.addr[i], &sp);
+    }
+    for (unsigned i = 0; i < s.nw && same; i++) {
+        same = sym_same_at(&sym, sub, &ref, &s, &s.addr[i], &sp);
+    }
+    return same && !sym.failed;
+}
+
+
+/*
+ * The search of a shorter replacement for a window of the code.
+ */
+
+struct seen {
+    uint64_t key;
+    unsigned generation;
+};
+
+struct search {
+    const struct subject *sub;
+    const struct test *tests;
+    unsigned ntests;
+    /* The instructions replacements are made of. */
+    struct inst alphabet[MAX_OPERANDS + NUM_COMPS * 7];
+    unsigned nalphabet;
+    /* The code found so far, and the window [start, end) of it replaced. */
+    struct program cur;
+    unsigned start, end;
+    /* Per test, the states before and after the window, and what's live. */
+    struct cstate *pre, *post;
+    struct live *live;
+    /* The replacement at hand, of length len, and its states. */
+    struct inst cand[MAX_LENGTH];
+    unsigned len;
+    struct cstate path[MAX_LENGTH + 1][FINGERPRINT_TESTS];
+    /* The states searched from, by fingerprint, for the current generation. */
+    struct seen *seen;
+    unsigned generation;
+    unsigned nseen;
+    /* Replacements that passed the tests but not the proof. */
+    unsigned unproven;
+};
+
+static uint64_t mix(uint64_t h, uint64_t x)
+{
+    h ^= x + 0x9e3779b97f4a7c15ull + (h << 6) + (h >> 2);
+    return h;
+}
+
+static uint64_t fingerprint(const struct cstate states[], unsigned depth)
+{
+    uint64_t h = depth;
+
+    for (unsigned t = 0; t < FINGERPRINT_TESTS; t++) {
+        const struct cstate *s = &states[t];
+        uint64_t writes = 0;
+
+        h = mix(h, (uint16_t) s->a | (uint64_t) (uint16_t) s->d << 16);
+        // the order of the writes doesn't matter
+        for (unsigned i = 0; i < s->nw; i++) {
+            writes += mix(s->addr[i], (uint16_t) s->val[i]) * 0xff51afd7ed558ccdull;
+        }
+        h = mix(h, writes);
+    }
+    return h;
+}
+
+/* Note the states as searched from, and return whether they were already. */
+static bool seen_before(struct search *se, uint64_t key)
+{
+    // too many to keep track of; search again rather than miss anything
+    if (se->nseen >= SEEN_SIZE / 4 * 3) {
+        return false;
+    }
+    for (uint64_t i = key & (SEEN_SIZE - 1);; i = (i + 1) & (SEEN_SIZE - 1)) {
+        struct seen *slot = &se->seen[i];
+
+        if (slot->generation != se->generation) {
+            slot->generation = se->generation;
+            slot->key = key;
+            se->nseen++;
+            return false;
+        }
+        if (slot->key == key) {
+            return true;
+        }
+    }
+}
+
+/* Check the replacement in cand on all tests, then prove it. */
+static bool try_candidate(struct search *se)
+{
+    const struct subject *sub = se->sub;
+
+    for (unsigned t = 0; t < se->ntests; t++) {
+        struct cstate s;
+        const struct cstate *after = &s;
+
+        if (t == 0) {
+            after = &se->path[se->len][0];
+        } else {
+            s = se->pre[t];
+            c_run(sub, &se->tests[t], &s, se->cand, se->len);
+        }
+        if (!c_same(sub, &se->tests[t], after, &se->post[t], &se->live[t])) {
+            return false;
+        }
+    }
+
+    static struct program prog;
+
+    prog.len = 0;
+    for (unsigned i = 0; i < se->start; i++) {
+        prog.code[prog.len++] = se->cur.code[i];
+    }
+    for (unsigned i = 0; i < se->len; i++) {
+        prog.code[prog.len++] = se->cand[i];
+    }
+    for (unsigned i = se->end; i < se->cur.len; i++) {
+        prog.code[prog.len++] = se->cur.code[i];
+    }
+    if (!verify(sub, &prog)) {
+        se->unproven++;
+        return false;
+    }
+    se->cur = prog;
+    return true;
+}
+
+static bool search_from(struct search *se, unsigned depth)
+{
+    if (depth == se->len) {
+        return try_candidate(se);
+    }
+
+    // the last instruction is only run on the first test before the rest
+    unsigned ntests = depth + 1 == se->len ? 1 : FINGERPRINT_TESTS;
+
+    for (unsigned i = 0; i < se->nalphabet; i++) {
+        se->cand[depth] = se->alphabet[i];
+        for (unsigned t = 0; t < ntests; t++) {
+            se->path[depth + 1][t] = se->path[depth][t];
+            c_step(se->sub, &se->tests[t], &se->path[depth + 1][t], &se->cand[depth]);
+        }
+        if (ntests > 1 && seen_before(se, fingerprint(se->path[depth + 1], depth + 1))) {
+            continue;
+        }
+        if (search_from(se, depth + 1)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Replace the first window of se->cur that has a shorter equivalent. */
+static bool improve(struct search *se, unsigned maxlen)
+{
+    const struct subject *sub = se->sub;
+    unsigned width = maxlen + 1 < se->cur.len ? maxlen + 1 : se->cur.len;
+
+    for (se->start = 0; se->start + width <= se->cur.len; se->start++) {
+        se->end = se->start + width;
+
+        for (unsigned t = 0; t < se->ntests; t++) {
+            struct cstate rest;
+
+            c_init(&se->pre[t], &se->tests[t]);
+            c_run(sub, &se->tests[t], &se->pre[t], se->cur.code, se->start);
+            se->post[t] = se->pre[t];
+            c_run(sub, &se->tests[t], &se->post[t], &se->cur.code[se->start], width);
+            rest = se->post[t];
+            c_track(sub, &se->tests[t], &rest, &se->cur.code[se->end], se->cur.len - se->end,
+                    &se->live[t]);
+        }
+        for (unsigned t = 0; t < FINGERPRINT_TESTS; t++) {
+            se->path[0][t] = se->pre[t];
+        }
+
+        for (se->len = 0; se->len < width; se->len++) {
+            se->generation++;
+            se->nseen = 0;
+            if (search_from(se, 0)) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+static void superoptimize(const struct template *tmpl, struct test tests[], unsigned ntests,
+                          unsigned maxlen)
+{
+    static struct subject sub;
+    static struct search se;
+    const char *why = parse(&sub, tmpl);
+
+    if (why) {
+        printf("%s: skipped, %s\n", tmpl->name, why);
+        return;
+    }
+    if (!verify(&sub, &sub.orig)) {
+        printf("%s: skipped, can't be reasoned about symbolically\n", tmpl->name);
+        return;
+    }
+    set_params(tests, ntests, tmpl);
+
+    struct seen *seen = se.seen;
+    struct cstate *pre = se.pre, *post = se.post;
+    struct live *live = se.live;
+    unsigned generation = se.generation;
+
+    memset(&se, 0, sizeof(se));
+    se.seen = seen;
+    se.pre = pre;
+    se.post = post;
+    se.live = live;
+    se.generation = generation;
+    if (se.seen == NULL) {
+        se.seen = calloc(SEEN_SIZE, sizeof(struct seen));
+        se.pre = calloc(MAX_TESTS, sizeof(struct cstate));
+        se.post = calloc(MAX_TESTS, sizeof(struct cstate));
+        se.live = calloc(MAX_TESTS, sizeof(struct live));
+        if (se.seen == NULL || se.pre == NULL || se.post == NULL || se.live == NULL) {
+            exit_program(EXIT_OUT_OF_MEMORY);
+        }
+    }
+    se.sub = &sub;
+    se.tests = tests;
+    se.ntests = ntests;
+    se.cur = sub.orig;
+
+    for (unsigned i = 0; i < sub.noperands; i++) {
+        se.alphabet[se.nalphabet++] = (struct inst) { .is_a = true, .operand = i };
+    }
+    for (unsigned c = 0; c < NUM_COMPS; c++) {
+        for (unsigned dest = DEST_M; dest <= DEST_AMD; dest++) {
+            se.alphabet[se.nalphabet++] = (struct inst) { .comp = comp_encode(comp_names[c]), .dest = dest };
+        }
+    }
+
+    while (improve(&se, maxlen)) {
+    }
+
+    unsigned n = sub.orig.len + sub.jumps;
+
+    if (se.cur.len == sub.orig.len) {
+        printf("%s: %u instructions, no shorter equivalent found", tmpl->name, n);
+    } else {
+        printf("%s: %u instructions, %u found", tmpl->name, n, se.cur.len + sub.jumps);
+    }
+    if (se.unproven) {
+        printf(" (%u candidates passed the tests but not the proof)", se.unproven);
+    }
+    printf("\n");
+    if (se.cur.len < sub.orig.len) {
+        print_program(&sub, &se.cur);
+    }
+    fflush(stdout);
+}
+
+int main(int argc, char *argv[])
+{
+    static struct test tests[MAX_TESTS];
+    unsigned maxlen = DEFAULT_LENGTH;
+    unsigned ntests = DEFAULT_TESTS;
+    const char *name = NULL;
+    int opt;
+
+    program_name = "superopt";
+
+    while ((opt = getopt(argc, argv, "n:t:")) != -1) {
+        switch (opt) {
+        case 'n':
+            maxlen = atoi(optarg);
+            if (maxlen < 1 || maxlen > MAX_LENGTH) {
+                exit_with_message(EXIT_INVALID_OPTION, USAGE);
+            }
+            break;
+        case 't':
+            ntests = atoi(optarg);
+            if (ntests < FINGERPRINT_TESTS || ntests > MAX_TESTS) {
+                exit_with_message(EXIT_INVALID_OPTION, USAGE);
+            }
+            break;
+        default:
+            exit_with_message(EXIT_INVALID_OPTION, USAGE);
+        }
+    }
+
+    if (argc - optind > 1) {
+        exit_program(EXIT_MANY_ARGS);
+    }
+    name = argv[optind];
+
+    if (!make_tests(tests, ntests)) {
+        exit_program(EXIT_OUT_OF_MEMORY);
+    }
+
+    for (unsigned i = 0; i < NUM_TEMPLATES; i++) {
+        if (name == NULL || strstr(templates[i].name, name)) {
+            superoptimize(&templates[i], tests, ntests, maxlen);
+        }
+    }
+
+    for (unsigned t = 0; t < ntests; t++) {
+        free(tests[t].ram);
+    }
+    return 0;
+}
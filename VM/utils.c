@@ -1,39 +1,27 @@
 #include <string.h>
-#include <ctype.h>
 
 #include "utils.h"
 
 int s_tokenize(char *s, char *tokens[], int max_toks, const char *delims)
 {
     int i;
+    char *saveptr = NULL;
 
     /* sanity checks */
     if (s  == NULL || tokens == NULL || delims == NULL
     || !*s || !*delims || max_toks < 1)
         return 0;
 
-    tokens[0] = strtok(s, delims);
+    tokens[0] = strtok_r(s, delims, &saveptr);
     if (tokens[0] == NULL)
         return 0;
 
-    for (i = 1; i < max_toks && (tokens[i] = strtok(NULL, delims)) != NULL; i++) {
+    for (i = 1; i < max_toks && (tokens[i] = strtok_r(NULL, delims, &saveptr)) != NULL; i++) {
     }
 
     return i;
 }
 
-bool s_is_empty(const char *s) {
-    if (s == NULL) {
-        return true;
-    }
-
-    while (isspace(*s)) {
-        s++;
-    }
-
-    return *s == '\0' ? true : false;
-}
-
 char *fname_remove_ext(char *s) {
     char *last_dot = strrchr(s, '.');
 
@@ -42,3 +30,9 @@ char *fname_remove_ext(char *s) {
     }
     return s;
 }
+
+bool fname_has_ext(const char *s, const char *ext) {
+    const char *last_dot = strrchr(s, '.');
+
+    return last_dot != NULL && !strcmp(last_dot, ext);
+}
@@ -3,13 +3,6 @@
 #include <stdbool.h>
 
 
-/*
- * Check whether or not the given string is consisted of whitespace only.
- *
- * \retval - true if string is only whitespace or NULL, else false.
- */
-bool s_is_empty(const char *s);
-
 /*
  * Tokenize a c-string, into variable size tokens.
  *
@@ -26,3 +19,8 @@ int s_tokenize(char *s, char *tokens[], int max_toks, const char *delims);
  * Expect a mutable c-string as input.
  */
 char *fname_remove_ext(char *s);
+
+/*
+ * Check whether the given filename / path ends in the extension ext, e.g. ".vm".
+ */
+bool fname_has_ext(const char *s, const char *ext);
@@ -3,145 +3,271 @@
 #include <string.h>
 #include <ctype.h>
 #include <errno.h>
+#include <unistd.h>
 #include <libgen.h>
-#include <dirent.h>
-#include <sys/stat.h>
 
+#include "vm.h"
+#include "command.h"
+#include "stream.h"
+#include "jack.h"
+#include "bytecode.h"
+#include "batch.h"
+#include "inline.h"
+#include "frames.h"
+#include "files.h"
+#include "server.h"
+#include "filereader.h"
+#include "srcmap.h"
 #include "mapper.h"
 #include "utils.h"
 #include "exit.h"
 
-#define MAX_LINE_LEN 200
-/* Max chars of generated assembly output for a single line/command. */
-#define MAX_ASM_OUT  2000
-/* Number of tokens of the command with the most tokens (out of all cmds). */
-#define MAX_TOKENS 3
-#define MAX_FNAME_CHARS 150
-/* Max number of vm files that VM translator can handle */
-#define MAX_FILES 100
-#define MAX_FILENAME_LEN 1000
-#define VM_EXTENSION ".vm"
-
 #define PRINT_TO_FILE 1
+/* The output is written in a few writes of this size. */
+#define OUTPUT_BUFFER_SIZE (1 << 20)
+
+/* RAM addresses of the temp and pointer segments. */
+#define TEMP_BASE     5
+#define TEMP_SIZE     8
+#define POINTER_BASE  3
+/*
+ * Largest offsets into local, argument, this and that reached with a chain
+ * of A=A+1 rather than an addition. Beyond them the generic code is shorter:
+ * pushes compute the address in 3 instructions, pops take 9 and cached
+ * stores 10.
+ */
+#define MAX_PUSH_CHAIN   2
+#define MAX_POP_CHAIN    3
+#define MAX_STORE_CHAIN  7
 
-unsigned eq_label_counter = 0;
-unsigned gt_label_counter = 0;
-unsigned lt_label_counter = 0;
-unsigned return_label_counter = 0;
+/*
+ * The translator state below is per thread, so that the daemon can run
+ * independent translations on its workers.
+ */
+
+__thread unsigned eq_label_counter = 0;
+__thread unsigned gt_label_counter = 0;
+__thread unsigned lt_label_counter = 0;
+__thread unsigned return_label_counter = 0;
+__thread unsigned div_label_counter = 0;
+/* Whether a tail call was emitted, which jumps to the shared routine. */
+__thread bool tail_call_used = false;
 
 /* Name of current file being processed without extension. */
-char fname_noext[MAX_FNAME_CHARS+1];
-/* Full path of output file. */
-char path_out[MAX_FNAME_CHARS+1];
+__thread char fname_noext[MAX_FNAME_CHARS+1];
 /* Name of current function that is being processed. */
-char current_fun[MAX_FNAME_CHARS+1];
-
-
-typedef enum cmd_id {
-    CMD_INVALID = 0,
-    CMD_PUSH,
-    CMD_POP,
-    CMD_ADD,
-    CMD_SUB,
-    CMD_NEG,
-    CMD_AND,
-    CMD_OR,
-    CMD_NOT,
-    CMD_EQ,
-    CMD_GT,
-    CMD_LT,
-    CMD_LABEL,
-    CMD_GOTO,
-    CMD_IFGOTO,
-    CMD_FUNCTION,
-    CMD_RETURN,
-    CMD_CALL,
-    MAX_COMMANDS  /* their total count */
-} cmd_id;
-
-cmd_id str_to_cmdid(const char *s)
-{
-    cmd_id id = CMD_INVALID;
-
-    if (s == NULL) {
-    } else if (!strcmp(s, "push")) {
-        id = CMD_PUSH;
-    } else if (!strcmp(s, "pop")) {
-        id = CMD_POP;
-    } else if (!strcmp(s, "add")) {
-        id = CMD_ADD;
-    } else if (!strcmp(s, "sub")) {
-        id = CMD_SUB;
-    } else if (!strcmp(s, "neg")) {
-        id = CMD_NEG;
-    } else if (!strcmp(s, "and")) {
-        id = CMD_AND;
-    } else if (!strcmp(s, "or")) {
-        id = CMD_OR;
-    } else if (!strcmp(s, "not")) {
-        id = CMD_NOT;
-    } else if (!strcmp(s, "eq")) {
-        id = CMD_EQ;
-    } else if (!strcmp(s, "gt")) {
-        id = CMD_GT;
-    } else if (!strcmp(s, "lt")) {
-        id = CMD_LT;
-    } else if (!strcmp(s, "label")) {
-        id = CMD_LABEL;
-    } else if (!strcmp(s, "goto")) {
-        id = CMD_GOTO;
-    } else if (!strcmp(s, "if-goto")) {
-        id = CMD_IFGOTO;
-    } else if (!strcmp(s, "function")) {
-        id = CMD_FUNCTION;
-    } else if (!strcmp(s, "return")) {
-        id = CMD_RETURN;
-    } else if (!strcmp(s, "call")) {
-        id = CMD_CALL;
-    }
-
-    return id;
+__thread char current_fun[MAX_FNAME_CHARS+1];
+/* VM_OPT_* flags the current program is translated with. */
+__thread unsigned translator_options = 0;
+/*
+ * In stack caching mode (VM_OPT_CACHE_TOS) the topmost stack value may be
+ * kept in the D register instead of RAM. This tells whether it currently is,
+ * in which case SP points right past the second topmost value.
+ *
+ * Values only stay cached within a basic block. Labels, jumps, calls,
+ * returns and function entries always see the whole stack in RAM.
+ */
+__thread bool tos_cached = false;
+/*
+ * A comparison that has been read but not translated yet, or CMD_INVALID.
+ * If an if-goto follows, possibly after a not, the two are fused and the
+ * boolean is never computed. Anything else gets the comparison translated
+ * first, see translate_command().
+ */
+__thread cmd_id pending_cmp = CMD_INVALID;
+/* Whether the result of the pending comparison is negated by a not. */
+__thread bool pending_not = false;
+/*
+ * With VM_OPT_TAIL_CALL, a call that has been read but not translated yet,
+ * or NULL, which becomes a tail call if a return follows. Its tokens belong
+ * to the stream being translated.
+ */
+__thread const char *const *pending_call = NULL;
+/*
+ * With VM_OPT_REDUCE_MATH, a push of a constant that has been read but not
+ * translated yet, or NULL, and the push of the other operand if it came
+ * second, or NULL. Neither is translated as such if a multiplication or
+ * division by the constant follows, see reduce_math().
+ */
+__thread const char *const *pending_const = NULL;
+__thread const char *const *pending_operand = NULL;
+/* Static frames of the program, or NULL if all locals are on the stack. */
+__thread const struct static_frames *static_frames = NULL;
+/* RAM address of local 0 of the current function, or -1 if on the stack. */
+__thread int frame_base = -1;
+/*
+ * Map of the output to the commands it comes from, being built, or NULL, and
+ * the number of lines written to the output so far.
+ */
+__thread struct source_map *source_map = NULL;
+__thread unsigned asm_lines = 0;
+
+
+typedef bool (*parser_ptr)(int, const char **, char *);
+
+
+bool parser_invalid(__attribute__((unused)) int nargs,
+                    __attribute__((unused)) const char *args[nargs],
+                    __attribute__((unused)) char *output)
+{
+    return false;
 }
 
 /*
- * Strip a line from comments and remove trailing whitespace.
+ * Register holding the base address of a local, argument, this or that
+ * segment, or NULL for any other segment.
  */
-char *strip_comments(char *s)
+static const char *latt_base(const char *segment)
 {
-    // sanity checks
-    if (s == NULL) {
-        return NULL;
-    } else if (!*s) {
-        return s;
+    if (!strcmp(segment, "local")) {
+        return "LCL";
+    } else if (!strcmp(segment, "argument")) {
+        return "ARG";
+    } else if (!strcmp(segment, "this")) {
+        return "THIS";
+    } else if (!strcmp(segment, "that")) {
+        return "THAT";
     }
+    return NULL;
+}
 
-    char *s2 = s;
-    char *last_char = s;
-
-    for (; *s2; s2++) {
-        if (*s2 == '/' && *(s2+1) == '/') {
-            *s2 = '\0';
-            break;
-        } else if (!isspace(*s2)) {
-            last_char = s2;
+/*
+ * Write the code that puts the address of base[i] in A. Offsets up to
+ * max_chain keep D intact, larger ones clobber it.
+ */
+static char *latt_address(char *output, const char *base, int i, int max_chain)
+{
+    if (i == 0) {
+        sprintf(output, ASM_LATT_ADDR_0, base);
+    } else if (i <= max_chain) {
+        sprintf(output, ASM_LATT_ADDR_1, base);
+        while (--i) {
+            strcat(output, ASM_INC_A);
         }
+    } else {
+        sprintf(output, ASM_LATT_ADDR, i, base);
     }
+    return output;
+}
 
-    if (*last_char) {
-        *(last_char + 1) = '\0';
+/*
+ * Write the code that moves a cached top of stack back to RAM, if there is
+ * one, and return a pointer past that code, where more can be appended.
+ */
+static char *tos_flush(char *output)
+{
+    *output = '\0';
+    if (tos_cached) {
+        output += sprintf(output, ASM_SPILL_D);
+        tos_cached = false;
     }
+    return output;
+}
 
-    return s;
+/*
+ * Stack caching counterpart of parser_push. The old top is spilled, if need
+ * be, and the pushed value is left in D.
+ */
+static bool cached_push(const char *segment, int i, char *output)
+{
+    char load[MAX_ASM_OUT+1];
+    char addr[MAX_ASM_OUT+1];
+    const char *base;
+
+    if (!strcmp(segment, "constant")) {
+        sprintf(load, ASM_LOAD_CONST, i);
+    } else if (!strcmp(segment, "static")) {
+        sprintf(load, ASM_LOAD_STATIC, fname_noext, i);
+    } else if (frame_base >= 0 && !strcmp(segment, "local")) {
+        sprintf(load, ASM_LOAD_DIRECT, frame_base + i);
+    } else if ((base = latt_base(segment))) {
+        sprintf(load, ASM_LOAD_LATT, latt_address(addr, base, i, MAX_PUSH_CHAIN));
+    } else if (!strcmp(segment, "temp")) {
+        if (i >= TEMP_SIZE) {
+            return false;
+        }
+        sprintf(load, ASM_LOAD_DIRECT, TEMP_BASE + i);
+    } else if (!strcmp(segment, "pointer")) {
+        if (i > 1) {
+            return false;
+        }
+        sprintf(load, ASM_LOAD_DIRECT, POINTER_BASE + i);
+    } else {
+        return false;
+    }
+
+    strcpy(tos_flush(output), load);
+    tos_cached = true;
+
+    return true;
 }
 
-typedef bool (*parser_ptr)(int, const char **, char *);
+/*
+ * Stack caching counterpart of parser_pop. Only used when the top of stack is
+ * cached, which is then stored straight from D.
+ */
+static bool cached_pop(const char *segment, int i, char *output)
+{
+    char addr[MAX_ASM_OUT+1];
+    const char *base;
+
+    if (!strcmp(segment, "static")) {
+        sprintf(output, ASM_STORE_STATIC, fname_noext, i);
+    } else if (frame_base >= 0 && !strcmp(segment, "local")) {
+        sprintf(output, ASM_STORE_DIRECT, frame_base + i);
+    } else if ((base = latt_base(segment))) {
+        if (i <= MAX_STORE_CHAIN) {
+            sprintf(output, ASM_STORE_LATT_NEAR, latt_address(addr, base, i, MAX_STORE_CHAIN));
+        } else {
+            sprintf(output, ASM_STORE_LATT, base, i);
+        }
+    } else if (!strcmp(segment, "temp")) {
+        if (i >= TEMP_SIZE) {
+            return false;
+        }
+        sprintf(output, ASM_STORE_DIRECT, TEMP_BASE + i);
+    } else if (!strcmp(segment, "pointer")) {
+        if (i > 1) {
+            return false;
+        }
+        sprintf(output, ASM_STORE_DIRECT, POINTER_BASE + i);
+    } else {
+        return false;
+    }
 
+    tos_cached = false;
 
-bool parser_invalid(__attribute__((unused)) int nargs,
-                    __attribute__((unused)) const char *args[nargs],
-                    __attribute__((unused)) char *output)
+    return true;
+}
+
+/*
+ * Emit code for an operation that has a variant working on a cached top of
+ * stack, leaving its result cached. Without a cached operand there is
+ * nothing to gain, so the regular variant is used.
+ */
+static void cached_op(const char *regular, const char *cached, char *output)
 {
-    return false;
+    strcpy(output, tos_cached ? cached : regular);
+}
+
+/*
+ * Emit a comparison, either the regular template with its label counter, the
+ * cached variant or a call of the shared routine.
+ */
+static void cached_cmp(const char *regular, const char *name, const char *jump,
+                       unsigned *counter, char *output)
+{
+    if (translator_options & VM_OPT_SHARED_CMP) {
+        // the routine takes its operands from RAM
+        output = tos_flush(output);
+        sprintf(output, ASM_CMP_CALL, name, *counter, name, name, *counter);
+    } else if (tos_cached) {
+        sprintf(output, ASM_CACHED_CMP, name, *counter, jump, name, *counter,
+                name, *counter, name, *counter);
+    } else {
+        sprintf(output, regular, *counter, *counter);
+    }
+    (*counter)++;
 }
 
 bool parser_push(int nargs, const char *args[nargs], char *output)
@@ -151,29 +277,32 @@ bool parser_push(int nargs, const char *args[nargs], char *output)
     }
 
     char *endptr = NULL;
+    errno = 0;
     int i = strtol(args[2], &endptr, 10);
+    char addr[MAX_ASM_OUT+1];
+    const char *base;
 
     if (args[2] == endptr || errno != 0 || !args[2] || *endptr || i < 0) {
         return false; // not a number
     }
 
+    if (translator_options & VM_OPT_CACHE_TOS) {
+        return cached_push(args[1], i, output);
+    }
+
     if (!strcmp(args[1], "constant")) {
         sprintf(output, ASM_PUSH_CONST, i);
     } else if (!strcmp(args[1], "static")) {
         sprintf(output, ASM_PUSH_STATIC, fname_noext, i);
-    } else if (!strcmp(args[1], "local")) {
-        sprintf(output, ASM_PUSH_LATT, i, "LCL");
-    } else if (!strcmp(args[1], "argument")) {
-        sprintf(output, ASM_PUSH_LATT, i, "ARG");
-    } else if (!strcmp(args[1], "this")) {
-        sprintf(output, ASM_PUSH_LATT, i, "THIS");
-    } else if (!strcmp(args[1], "that")) {
-        sprintf(output, ASM_PUSH_LATT, i, "THAT");
+    } else if (frame_base >= 0 && !strcmp(args[1], "local")) {
+        sprintf(output, ASM_PUSH_TEMP, frame_base + i);
+    } else if ((base = latt_base(args[1]))) {
+        sprintf(output, ASM_PUSH_LATT, latt_address(addr, base, i, MAX_PUSH_CHAIN));
     } else if (!strcmp(args[1], "temp")) {
-        if (i < 1 || i > 8) {
+        if (i >= TEMP_SIZE) {
             return false;
         }
-        sprintf(output, ASM_PUSH_TEMP, i);
+        sprintf(output, ASM_PUSH_TEMP, TEMP_BASE + i);
     } else if (!strcmp(args[1], "pointer")) {
         if (i == 0) {
             sprintf(output, ASM_PUSH_POINTER, "THIS");
@@ -196,27 +325,34 @@ bool parser_pop(int nargs, const char *args[nargs], char *output)
     }
 
     char *endptr = NULL;
+    errno = 0;
     int i = strtol(args[2], &endptr, 10);
+    char addr[MAX_ASM_OUT+1];
+    const char *base;
 
     if (args[2] == endptr || errno != 0 || !args[2] || *endptr || i < 0) {
         return false; // not a number
     }
 
+    if (tos_cached) {
+        return cached_pop(args[1], i, output);
+    }
+
     if (!strcmp(args[1], "static")) {
         sprintf(output, ASM_POP_STATIC, fname_noext, i);
-    } else if (!strcmp(args[1], "local")) {
-        sprintf(output, ASM_POP_LATT, "LCL", i);
-    } else if (!strcmp(args[1], "argument")) {
-        sprintf(output, ASM_POP_LATT, "ARG", i);
-    } else if (!strcmp(args[1], "this")) {
-        sprintf(output, ASM_POP_LATT, "THIS", i);
-    } else if (!strcmp(args[1], "that")) {
-        sprintf(output, ASM_POP_LATT, "THAT", i);
+    } else if (frame_base >= 0 && !strcmp(args[1], "local")) {
+        sprintf(output, ASM_POP_TEMP, frame_base + i);
+    } else if ((base = latt_base(args[1]))) {
+        if (i <= MAX_POP_CHAIN) {
+            sprintf(output, ASM_POP_LATT_NEAR, latt_address(addr, base, i, MAX_POP_CHAIN));
+        } else {
+            sprintf(output, ASM_POP_LATT, base, i);
+        }
     } else if (!strcmp(args[1], "temp")) {
-        if (i > 8) {
+        if (i >= TEMP_SIZE) {
             return false;
         }
-        sprintf(output, ASM_POP_TEMP, i);
+        sprintf(output, ASM_POP_TEMP, TEMP_BASE + i);
     } else if (!strcmp(args[1], "pointer")) {
         if (i == 0) {
             sprintf(output, ASM_POP_POINTER, "THIS");
@@ -237,7 +373,7 @@ bool parser_add(int nargs, __attribute__((unused)) const char *args[nargs], char
     if (nargs != 1) {
         return false;
     }
-    strcpy(output, ASM_ADD);
+    cached_op(ASM_ADD, ASM_CACHED_ADD, output);
     return true;
 }
 
@@ -246,7 +382,7 @@ bool parser_sub(int nargs, __attribute__((unused)) const char *args[nargs], char
     if (nargs != 1) {
         return false;
     }
-    strcpy(output, ASM_SUB);
+    cached_op(ASM_SUB, ASM_CACHED_SUB, output);
     return true;
 }
 
@@ -255,7 +391,7 @@ bool parser_neg(int nargs, __attribute__((unused)) const char *args[nargs], char
     if (nargs != 1) {
         return false;
     }
-    strcpy(output, ASM_NEG);
+    cached_op(ASM_NEG, ASM_CACHED_NEG, output);
     return true;
 }
 
@@ -264,7 +400,7 @@ bool parser_and(int nargs, __attribute__((unused)) const char *args[nargs], char
     if (nargs != 1) {
         return false;
     }
-    strcpy(output, ASM_AND);
+    cached_op(ASM_AND, ASM_CACHED_AND, output);
     return true;
 }
 
@@ -273,7 +409,7 @@ bool parser_or(int nargs, __attribute__((unused)) const char *args[nargs], char
     if (nargs != 1) {
         return false;
     }
-    strcpy(output, ASM_OR);
+    cached_op(ASM_OR, ASM_CACHED_OR, output);
     return true;
 }
 
@@ -282,7 +418,7 @@ bool parser_not(int nargs, __attribute__((unused)) const char *args[nargs], char
     if (nargs != 1) {
         return false;
     }
-    strcpy(output, ASM_NOT);
+    cached_op(ASM_NOT, ASM_CACHED_NOT, output);
     return true;
 }
 
@@ -291,8 +427,7 @@ bool parser_eq(int nargs, __attribute__((unused)) const char *args[nargs], char
     if (nargs != 1) {
         return false;
     }
-    sprintf(output, ASM_EQ, eq_label_counter, eq_label_counter);
-    eq_label_counter++;
+    cached_cmp(ASM_EQ, "EQ", "JEQ", &eq_label_counter, output);
     return true;
 }
 
@@ -301,8 +436,7 @@ bool parser_gt(int nargs, __attribute__((unused)) const char *args[nargs], char
     if (nargs != 1) {
         return false;
     }
-    sprintf(output, ASM_GT, gt_label_counter, gt_label_counter);
-    gt_label_counter++;
+    cached_cmp(ASM_GT, "GT", "JGT", &gt_label_counter, output);
     return true;
 }
 
@@ -311,8 +445,7 @@ bool parser_lt(int nargs, __attribute__((unused)) const char *args[nargs], char
     if (nargs != 1) {
         return false;
     }
-    sprintf(output, ASM_LT, lt_label_counter, lt_label_counter);
-    lt_label_counter++;
+    cached_cmp(ASM_LT, "LT", "JLT", &lt_label_counter, output);
     return true;
 }
 
@@ -321,7 +454,7 @@ bool parser_label(int nargs, const char *args[nargs], char *output)
     if (nargs != 2) {
         return false;
     }
-    sprintf(output, ASM_LABEL, current_fun, args[1]);
+    sprintf(tos_flush(output), ASM_LABEL, current_fun, args[1]);
     return true;
 }
 
@@ -330,7 +463,7 @@ bool parser_goto(int nargs, const char *args[nargs], char *output)
     if (nargs != 2) {
         return false;
     }
-    sprintf(output, ASM_GOTO, current_fun, args[1]);
+    sprintf(tos_flush(output), ASM_GOTO, current_fun, args[1]);
     return true;
 }
 
@@ -339,7 +472,12 @@ bool parser_ifgoto(int nargs, const char *args[nargs], char *output)
     if (nargs != 2) {
         return false;
     }
-    sprintf(output, ASM_IFGOTO, current_fun, args[1]);
+    if (tos_cached) {
+        sprintf(output, ASM_CACHED_IFGOTO, current_fun, args[1]);
+        tos_cached = false;
+    } else {
+        sprintf(output, ASM_IFGOTO, current_fun, args[1]);
+    }
     return true;
 }
 
@@ -350,6 +488,7 @@ bool parser_function(int nargs, const char *args[nargs], char *output)
     }
 
     char *endptr = NULL;
+    errno = 0;
     int nvars = strtol(args[2], &endptr, 10);
     char tmp_output[MAX_ASM_OUT+1];
 
@@ -358,13 +497,19 @@ bool parser_function(int nargs, const char *args[nargs], char *output)
     }
 
     strcpy(current_fun, args[1]);
+    frame_base = static_frames ? static_frames_lookup(static_frames, args[1]) : -1;
 
+    output = tos_flush(output);
     strcpy(output, "(");
     strcat(output, args[1]);
     strcat(output, ")\n");
 
     for (int i = 0; i < nvars; i++) {
-        parser_push(3, (const char *[]) { "push", "constant", "0" }, tmp_output);
+        if (frame_base >= 0) {
+            sprintf(tmp_output, ASM_CLEAR_DIRECT, frame_base + i);
+        } else {
+            parser_push(3, (const char *[]) { "push", "constant", "0" }, tmp_output);
+        }
         strncat(output, tmp_output, MAX_ASM_OUT);
         output[MAX_ASM_OUT] = '\0';
     }
@@ -379,13 +524,14 @@ bool parser_call(int nargs, const char *args[nargs], char *output)
     }
 
     char *endptr = NULL;
+    errno = 0;
     int i = strtol(args[2], &endptr, 10);
 
     if (args[2] == endptr || errno != 0 || !args[2] || *endptr || i < 0) {
         return false; // not a number
     }
 
-    sprintf(output, ASM_CALL, return_label_counter, i, args[1], return_label_counter);
+    sprintf(tos_flush(output), ASM_CALL, return_label_counter, i, args[1], return_label_counter);
     return_label_counter++;
 
     return true;
@@ -396,99 +542,509 @@ bool parser_return(int nargs, __attribute__((unused)) const char *args[nargs], c
     if (nargs != 1) {
         return false;
     }
-    sprintf(output, ASM_RETURN);
+    sprintf(tos_flush(output), ASM_RETURN);
     return true;
 }
 
 void bootstrap_code(char *output)
 {
     char tmp_output[MAX_ASM_OUT+1];
-    sprintf(output, ASM_BOOTSTRAP);
+    sprintf(output, ASM_BOOTSTRAP, STACK_BASE + (static_frames ? (int) static_frames->size : 0));
     parser_call(3, (const char *[]) { "call", "Sys.init", "0" }, tmp_output);
     strncat(output, tmp_output, MAX_ASM_OUT);
+
+    // Sys.init never returns, so nothing falls through into the routines
+    if (translator_options & VM_OPT_SHARED_CMP) {
+        static const char *const cmps[][2] = { { "EQ", "JEQ" }, { "GT", "JGT" }, { "LT", "JLT" } };
+
+        for (unsigned i = 0; i < sizeof(cmps) / sizeof(cmps[0]); i++) {
+            sprintf(tmp_output, ASM_CMP_ROUTINE, cmps[i][0], cmps[i][0], cmps[i][1], cmps[i][0]);
+            strncat(output, tmp_output, MAX_ASM_OUT - strlen(output));
+        }
+    }
     output[MAX_ASM_OUT] = '\0';
 }
 
+static const parser_ptr parser_fn[MAX_COMMANDS] = {
+    [CMD_INVALID] = parser_invalid, [CMD_PUSH] = parser_push,
+    [CMD_POP] = parser_pop, [CMD_ADD] = parser_add, [CMD_SUB] = parser_sub,
+    [CMD_NEG] = parser_neg, [CMD_AND] = parser_and, [CMD_OR] = parser_or,
+    [CMD_NOT] = parser_not, [CMD_EQ] = parser_eq, [CMD_GT] = parser_gt,
+    [CMD_LT] = parser_lt, [CMD_LABEL] = parser_label, [CMD_GOTO] = parser_goto,
+    [CMD_IFGOTO] = parser_ifgoto, [CMD_FUNCTION] = parser_function,
+    [CMD_RETURN] = parser_return, [CMD_CALL] = parser_call
+};
+
+void translator_reset(unsigned options)
+{
+    translator_options = options;
+    tos_cached = false;
+    pending_cmp = CMD_INVALID;
+    pending_not = false;
+    pending_call = NULL;
+    pending_const = NULL;
+    pending_operand = NULL;
+    static_frames = NULL;
+    frame_base = -1;
+    source_map = NULL;
+    asm_lines = 0;
+    eq_label_counter = 0;
+    gt_label_counter = 0;
+    lt_label_counter = 0;
+    return_label_counter = 0;
+    div_label_counter = 0;
+    tail_call_used = false;
+    strcpy(current_fun, "OutOfFunction");
+}
+
+void translator_static_frames(const struct static_frames *frames)
+{
+    static_frames = frames;
+}
+
+void translator_source_map(struct source_map *map, unsigned lines)
+{
+    source_map = map;
+    asm_lines = lines;
+}
+
 /*
- * If path is a directory put in files array all filenames of regular files
- * contained in this directory that end in ".vm", or put path in files if it
- * is a regular file.
- *
- * This function also sets the global path_out.
- *
- * \param path - path to be processed
- * \param maxfiles - Maximum number of files to store in files array.
- * \retval - Number of files that have been put in files array.
+ * Set the name statics are qualified with, the name of the file translated.
  */
-int files_to_translate(const char *path, char files[][MAX_FILENAME_LEN+1], int maxfiles)
-{
-    int num_files = 0;
-    bool is_dir = false;
-    struct stat path_stat;
-    char tmp[MAX_FNAME_CHARS+1];
-    char real_path[MAX_FNAME_CHARS+1] = {0};
-    char dir_name[MAX_FNAME_CHARS+1] = {0};
-    char base_name[MAX_FNAME_CHARS+1] = {0};
-
-    if (stat(path, &path_stat) != 0) {
-        exit_program(EXIT_FILE_DOES_NOT_EXIST, path);
-    } else if (S_ISREG(path_stat.st_mode)) {
-    } else if (S_ISDIR(path_stat.st_mode)) {
-        is_dir = true;
+static void set_file_name(const char *filename)
+{
+    char tmp[MAX_FILENAME_LEN + 1];
+
+    snprintf(tmp, sizeof(tmp), "%s", filename);
+    snprintf(fname_noext, sizeof(fname_noext), "%s", basename(tmp));
+    fname_remove_ext(fname_noext);
+}
+
+/*
+ * Jump of an if-goto fused with the comparison id, taken if the comparison
+ * holds, or if it doesn't when negated.
+ */
+static const char *fused_jump(cmd_id id, bool negated)
+{
+    switch (id) {
+    case CMD_EQ:
+        return negated ? "JNE" : "JEQ";
+    case CMD_GT:
+        return negated ? "JLE" : "JGT";
+    default:
+        return negated ? "JGE" : "JLT";
+    }
+}
+
+/*
+ * Write code to the output, counting its lines for the source map.
+ */
+static void emit(const char *code, FILE *fp_output)
+{
+    if (source_map) {
+        for (const char *p = code; (p = strchr(p, '\n')) != NULL; p++) {
+            asm_lines++;
+        }
+    }
+    fputs(code, fp_output);
+}
+
+/*
+ * Translate the pending comparison, and its not, if any, to the regular
+ * code that leaves a boolean on the stack.
+ */
+static void cmp_flush(FILE *fp_output)
+{
+    char asm_output[MAX_ASM_OUT + 1];
+
+    if (pending_cmp == CMD_INVALID) {
+        return;
+    }
+    parser_fn[pending_cmp](1, (const char *[]) { cmdid_to_str(pending_cmp) }, asm_output);
+    emit(asm_output, fp_output);
+    if (pending_not) {
+        parser_not(1, (const char *[]) { "not" }, asm_output);
+        emit(asm_output, fp_output);
+    }
+    pending_cmp = CMD_INVALID;
+    pending_not = false;
+}
+
+/*
+ * Translate the pending call as a regular one.
+ */
+static void call_flush(FILE *fp_output)
+{
+    char asm_output[MAX_ASM_OUT + 1];
+
+    if (pending_call == NULL) {
+        return;
+    }
+    parser_call(3, (const char **) pending_call, asm_output);
+    emit(asm_output, fp_output);
+    pending_call = NULL;
+}
+
+/*
+ * Translate the pending push of a constant, and of the operand after it, as
+ * regular ones.
+ */
+static void const_flush(FILE *fp_output)
+{
+    char asm_output[MAX_ASM_OUT + 1];
+
+    if (pending_const == NULL) {
+        return;
+    }
+    parser_push(3, (const char **) pending_const, asm_output);
+    emit(asm_output, fp_output);
+    if (pending_operand) {
+        parser_push(3, (const char **) pending_operand, asm_output);
+        emit(asm_output, fp_output);
+    }
+    pending_const = NULL;
+    pending_operand = NULL;
+}
+
+/*
+ * Write the code that multiplies the top of stack by c.
+ */
+static void mul_const(int c, char *output)
+{
+    // highest bit of a constant
+    int bit = 14;
+
+    *output = '\0';
+    if (c == 1) {
+        return;
+    }
+
+    if (!tos_cached) {
+        strcpy(output, translator_options & VM_OPT_CACHE_TOS ? ASM_CACHED_MUL_POP : ASM_MUL_LOAD);
+    }
+    if (c == 0) {
+        strcat(output, ASM_MUL_ZERO);
+        bit = 0;
+    }
+    while (!(c >> bit & 1) && bit > 0) {
+        bit--;
+    }
+    // x is only added again for 1s below the highest one
+    if (c & ((1 << bit) - 1)) {
+        strcat(output, ASM_MUL_SAVE);
+    }
+    while (--bit >= 0) {
+        strcat(output, ASM_MUL_DOUBLE);
+        if (c >> bit & 1) {
+            strcat(output, ASM_MUL_ADD);
+        }
+    }
+
+    if (translator_options & VM_OPT_CACHE_TOS) {
+        tos_cached = true;
     } else {
-        exit_program(EXIT_NOT_FILE_OR_DIR, path);
+        strcat(output, ASM_MUL_STORE);
     }
+}
 
-    strcpy(real_path, realpath(path, tmp));
-    if (is_dir) {
-        strcpy(dir_name, real_path);
+/*
+ * Translate a call of Math.multiply with the pending constant as an operand,
+ * or of Math.divide with it as a power of two divisor, without the call.
+ *
+ * \retval - false if the call has to be made after all.
+ */
+static bool reduce_math(int ntokens, const char *tokens[ntokens], FILE *fp_output)
+{
+    char asm_output[MAX_ASM_OUT + 1];
+    int c = atoi(pending_const[2]);
+
+    // larger constants don't fit an A-instruction, let the assembler say so
+    if (ntokens != 3 || strcmp(tokens[2], "2") || c > 32767) {
+        return false;
+    }
+
+    if (!strcmp(tokens[1], "Math.multiply")) {
+        // the product is the same either way round
+        if (pending_operand) {
+            parser_push(3, (const char **) pending_operand, asm_output);
+            emit(asm_output, fp_output);
+        }
+        mul_const(c, asm_output);
+    } else if (!strcmp(tokens[1], "Math.divide") && !pending_operand && c > 0 && !(c & (c - 1))) {
+        *asm_output = '\0';
+        if (c > 1) {
+            sprintf(tos_flush(asm_output), ASM_DIV_POW2_CALL, c, div_label_counter, div_label_counter);
+            div_label_counter++;
+        }
     } else {
-        strcpy(dir_name, dirname(strcpy(tmp, real_path)));
-    }
-    strcpy(base_name, basename(strcpy(tmp, real_path)));
-
-    strcpy(path_out, dir_name);
-    strcat(path_out, "/");
-
-    if (is_dir) {
-        DIR *d;
-        struct dirent *dir;
-        char *dot, *slash;
-
-        if ((d = opendir(real_path))) {
-            while ((dir = readdir(d)) != NULL) {
-                dot = strrchr(dir->d_name, '.');
-
-                if (dir->d_type == DT_REG && dot && !strcmp(dot, VM_EXTENSION)) {
-                    strcpy(tmp, dir_name);
-                    strcat(tmp, "/");
-                    strcpy(files[num_files++], strcat(tmp, dir->d_name));
-                    if (num_files == maxfiles) {
-                        break;
-                    }
-                }
+        return false;
+    }
+    emit(asm_output, fp_output);
+    pending_const = NULL;
+    pending_operand = NULL;
+
+    return true;
+}
+
+/*
+ * Whether a push or call with the given tokens has a valid number, which a
+ * pending one must have, as it is only translated once the next command has
+ * been read.
+ */
+static bool valid_number(int ntokens, const char *tokens[ntokens])
+{
+    char *endptr = NULL;
+
+    if (ntokens != 3) {
+        return false;
+    }
+    errno = 0;
+    int n = strtol(tokens[2], &endptr, 10);
+
+    return endptr != tokens[2] && errno == 0 && !*endptr && n >= 0;
+}
+
+/*
+ * Translate a command, fusing comparisons with the if-goto they feed, calls
+ * with the return that follows them and constants with the multiplication
+ * or division they are an operand of.
+ *
+ * \retval - false if the command is invalid.
+ */
+static bool translate_command(cmd_id id, int ntokens, const char *tokens[ntokens], FILE *fp_output)
+{
+    char asm_output[MAX_ASM_OUT + 1];
+
+    if (pending_cmp != CMD_INVALID && ntokens == 1 && id == CMD_NOT) {
+        pending_not = !pending_not;
+        return true;
+    }
+    if (pending_cmp != CMD_INVALID && ntokens == 2 && id == CMD_IFGOTO) {
+        sprintf(asm_output, tos_cached ? ASM_CACHED_CMP_IFGOTO : ASM_CMP_IFGOTO,
+                current_fun, tokens[1], fused_jump(pending_cmp, pending_not));
+        emit(asm_output, fp_output);
+        tos_cached = false;
+        pending_cmp = CMD_INVALID;
+        pending_not = false;
+        return true;
+    }
+
+    if (pending_call && ntokens == 1 && id == CMD_RETURN) {
+        // the return of the callee will do for this function too
+        sprintf(tos_flush(asm_output), ASM_TAIL_CALL, atoi(pending_call[2]), pending_call[1]);
+        emit(asm_output, fp_output);
+        pending_call = NULL;
+        tail_call_used = true;
+        return true;
+    }
+
+    if (pending_const && id == CMD_CALL && reduce_math(ntokens, tokens, fp_output)) {
+        return true;
+    }
+    if (pending_const && !pending_operand && id == CMD_PUSH && valid_number(ntokens, tokens)
+        && (latt_base(tokens[1]) || !strcmp(tokens[1], "static"))) {
+        pending_operand = tokens;
+        return true;
+    }
+
+    cmp_flush(fp_output);
+    call_flush(fp_output);
+    const_flush(fp_output);
+
+    if (ntokens == 1 && (id == CMD_EQ || id == CMD_GT || id == CMD_LT)) {
+        pending_cmp = id;
+        return true;
+    }
+    if ((translator_options & VM_OPT_TAIL_CALL) && id == CMD_CALL && valid_number(ntokens, tokens)) {
+        pending_call = tokens;
+        return true;
+    }
+    if ((translator_options & VM_OPT_REDUCE_MATH) && id == CMD_PUSH && valid_number(ntokens, tokens)
+        && !strcmp(tokens[1], "constant")) {
+        pending_const = tokens;
+        return true;
+    }
+    if (!parser_fn[id](ntokens, tokens, asm_output)) {
+        return false;
+    }
+    emit(asm_output, fp_output);
+
+    return true;
+}
+
+/*
+ * Translate what is still pending at the end of a file, and leave the whole
+ * stack in RAM, since the next file may start anywhere.
+ */
+static void translate_end(FILE *fp_output)
+{
+    char asm_output[MAX_ASM_OUT + 1];
+
+    cmp_flush(fp_output);
+    call_flush(fp_output);
+    const_flush(fp_output);
+    tos_flush(asm_output);
+    emit(asm_output, fp_output);
+}
+
+int translate_commands(const struct vm_stream *commands, const char *filename,
+                       FILE *fp_output, char *errmsg)
+{
+    set_file_name(filename);
+
+    for (unsigned i = 0; i < commands->count; i++) {
+        const struct vm_command *cmd = &commands->commands[i];
+
+        // what the command is translated to starts on the next line, if anywhere
+        if (source_map && srcmap_add(source_map, asm_lines + 1, filename, cmd->line,
+                                     cmd->id == CMD_FUNCTION && cmd->ntokens > 1
+                                     ? cmd->tokens[1] : current_fun)) {
+            return error_format(errmsg, EXIT_OUT_OF_MEMORY);
+        }
+        if (!translate_command(cmd->id, cmd->ntokens, (const char **) cmd->tokens, fp_output)) {
+            char line[MAX_LINE_LEN + 1];
+
+            vm_command_format(cmd, line);
+            return error_format(errmsg, EXIT_INVALID_COMMAND, cmd->line, line);
+        }
+    }
+
+    translate_end(fp_output);
+
+    return 0;
+}
+
+int routines_code(FILE *fp_output, char *errmsg)
+{
+    // a profiler shouldn't put them down to the last command of the program
+    if (source_map && srcmap_add(source_map, asm_lines + 1, "", 0, "")) {
+        return error_format(errmsg, EXIT_OUT_OF_MEMORY);
+    }
+    if (tail_call_used) {
+        emit(ASM_TAIL_CALL_ROUTINE, fp_output);
+    }
+    // each division it reduced has a return label of its own
+    if (div_label_counter) {
+        emit(ASM_DIV_POW2_ROUTINE, fp_output);
+    }
+    return 0;
+}
+
+/*
+ * Read all of filenames at once, and parse the .vm and .vmb files into their
+ * streams as soon as each is read. The sources of the Jack classes are left
+ * in texts, for jack_batch(), and must be freed by the caller.
+ *
+ * \retval - 0 on success, else the exit code of the first file, in the order
+ *           given, that failed, with its message in errmsg.
+ */
+static int read_sources(int nfiles, char filenames[][MAX_FILENAME_LEN+1],
+                        struct vm_stream streams[], char *texts[], char *errmsg)
+{
+    const char *paths[nfiles + 1];
+    struct file_contents file;
+    FileReader reader;
+    int failed = nfiles;
+    int status = 0;
+
+    for (int i = 0; i < nfiles; i++) {
+        paths[i] = filenames[i];
+        texts[i] = NULL;
+    }
+    if ((reader = file_reader_start(nfiles, paths)) == NULL) {
+        return error_format(errmsg, EXIT_OUT_OF_MEMORY);
+    }
+
+    while (file_reader_next(reader, &file)) {
+        const char *filename = filenames[file.index];
+        char file_errmsg[MAX_ERROR_LEN + 1];
+        int rc = 0;
+
+        if (file.data == NULL) {
+            rc = error_format(file_errmsg, file.error == ENOMEM ? EXIT_OUT_OF_MEMORY
+                                           : EXIT_CANNOT_OPEN_FILE, filename);
+        } else if (file.index > failed) {
+            free(file.data); // not worth parsing, the error is an earlier file's
+        } else if (fname_has_ext(filename, JACK_EXTENSION)) {
+            texts[file.index] = file.data;
+        } else {
+            if (fname_has_ext(filename, VMB_EXTENSION)) {
+                rc = vm_bytecode_decode(file.data, file.len, filename,
+                                        &streams[file.index], file_errmsg);
+            } else {
+                rc = vm_stream_parse(file.data, file.len, &streams[file.index], file_errmsg);
             }
-            closedir(d);
+            free(file.data);
         }
 
-        slash = strrchr(dir_name, '/');
-        if (slash == NULL) {
+        if (rc && file.index < failed) {
+            failed = file.index;
+            status = rc;
+            strcpy(errmsg, file_errmsg);
         }
-        strcat(path_out, slash+1);
-    } else {
-        strcpy(files[0], path);
-        num_files = 1;
+    }
+
+    file_reader_destroy(reader);
+
+    return status;
+}
 
-        fname_remove_ext(strcpy(tmp, base_name));
-        strcat(path_out, tmp);
+/*
+ * Write the commands of each of filenames that isn't bytecode already to a
+ * .vmb file next to it.
+ */
+static int encode_files(int nfiles, char filenames[][MAX_FILENAME_LEN+1],
+                        const struct vm_stream streams[], char *errmsg)
+{
+    for (int i = 0; i < nfiles; i++) {
+        char path[MAX_FILENAME_LEN + sizeof(VMB_EXTENSION)];
+        FILE *fp_output;
+        int status;
+
+        if (fname_has_ext(filenames[i], VMB_EXTENSION)) {
+            continue;
+        }
+        fname_remove_ext(strcpy(path, filenames[i]));
+        strcat(path, VMB_EXTENSION);
+
+        if ((fp_output = fopen(path, "wb")) == NULL) {
+            return error_format(errmsg, EXIT_CANNOT_OPEN_FILE_OUT, path);
+        }
+        status = vm_bytecode_write(&streams[i], fp_output, errmsg);
+        if (fclose(fp_output) && !status) {
+            status = error_format(errmsg, EXIT_CANNOT_OPEN_FILE_OUT, path);
+        }
+        if (status) {
+            remove(path); // a truncated file would be taken for the cache
+            return status;
+        }
     }
 
-    strcat(path_out, ".asm");
+    return 0;
+}
 
-    return num_files;
+/*
+ * The number of lines of the file at path, which the output is appended to,
+ * or 0 if there is no such file.
+ */
+static unsigned count_lines(const char *path)
+{
+    FILE *fp = fopen(path, "r");
+    unsigned lines = 0;
+    int c;
+
+    if (fp == NULL) {
+        return 0;
+    }
+    while ((c = getc(fp)) != EOF) {
+        lines += c == '\n';
+    }
+    fclose(fp);
+
+    return lines;
 }
 
-int main(int argc, const char *argv[])
+int main(int argc, char *argv[])
 {
     /*
      * Number of files to be processed.
@@ -497,103 +1053,214 @@ int main(int argc, const char *argv[])
     /*
      * Names of files to be processed.
      */
-    char filenames[MAX_FILES][1000+1];
+    char (*filenames)[MAX_FILENAME_LEN+1];
     /*
-     * Holds current line read.
+     * Commands of the files, compiled from those that are Jack classes.
      */
-    char line[MAX_LINE_LEN + 1];
-    char tmp_line[MAX_LINE_LEN + 1];
+    struct vm_stream *streams;
     /*
-     * Indicates current file line that is being processed.
+     * Sources of the Jack classes among the files.
      */
-    unsigned line_num = 0;
+    char **texts;
     /*
-     * Holds the generated assembly code for the current line read.
+     * Holds the generated bootstrap code.
      */
     char asm_output[MAX_ASM_OUT + 1];
     /*
-     * To be filled with command tokens.
+     * Buffer of the output file.
+     */
+    static char output_buffer[OUTPUT_BUFFER_SIZE];
+    char errmsg[MAX_ERROR_LEN + 1];
+    /*
+     * VM_OPT_* flags given on the command line.
+     */
+    unsigned options = 0;
+    /*
+     * Run as a daemon serving requests of the thin client instead.
+     */
+    bool daemon = false;
+    /*
+     * Encode the files to .vmb bytecode instead of translating them.
+     */
+    bool encode = false;
+    /*
+     * Inline small functions, which needs the whole program in memory.
+     */
+    bool inline_small = false;
+    /*
+     * Give functions that can't recurse static frames, which also needs the
+     * whole program, and those frames.
+     */
+    bool use_frames = false;
+    struct static_frames frames = { NULL, 0, 0 };
+    /*
+     * Write the source map of the output next to it, and that map.
+     */
+    bool write_map = false;
+    struct source_map map;
+    /*
+     * Path of the socket the daemon listens on.
      */
-    char *tokens[MAX_TOKENS + 1] = {NULL};
+    const char *socket_path = server_socket_path();
     /*
-     * Number of tokens of current line / command.
+     * Number of daemon workers, or of threads Jack classes are compiled on;
+     * 0 means one per CPU.
      */
-    int ntokens;
-    FILE *fp_input, *fp_output;
+    int njobs = 0;
+    int opt;
+    FILE *fp_output;
+
+    while ((opt = getopt(argc, argv, "bcfgimrtds:j:")) != -1) {
+        switch (opt) {
+        case 'b':
+            encode = true;
+            break;
+        case 'c':
+            options |= VM_OPT_CACHE_TOS;
+            break;
+        case 'f':
+            use_frames = true;
+            break;
+        case 'g':
+            write_map = true;
+            break;
+        case 'i':
+            inline_small = true;
+            break;
+        case 'm':
+            options |= VM_OPT_REDUCE_MATH;
+            break;
+        case 'r':
+            options |= VM_OPT_SHARED_CMP;
+            break;
+        case 't':
+            options |= VM_OPT_TAIL_CALL;
+            break;
+        case 'd':
+            daemon = true;
+            break;
+        case 's':
+            socket_path = optarg;
+            break;
+        case 'j':
+            njobs = atoi(optarg);
+            break;
+        default:
+            exit_program(EXIT_INVALID_OPTION);
+        }
+    }
 
-    if (argc != 2) {
-        exit_program(EXIT_MANY_ARGS);
+    if (daemon) {
+        if (optind != argc) {
+            exit_program(EXIT_INVALID_OPTION);
+        }
+        vm_serve(socket_path, njobs);
+        return 0;
     }
 
-    strcpy(current_fun, "OutOfFunction");
+    if (argc - optind != 1) {
+        exit_program(EXIT_MANY_ARGS);
+    }
 
-    parser_ptr parser_fn[MAX_COMMANDS] = {
-        [CMD_INVALID] = parser_invalid, [CMD_PUSH] = parser_push,
-        [CMD_POP] = parser_pop, [CMD_ADD] = parser_add, [CMD_SUB] = parser_sub,
-        [CMD_NEG] = parser_neg, [CMD_AND] = parser_and, [CMD_OR] = parser_or,
-        [CMD_NOT] = parser_not, [CMD_EQ] = parser_eq, [CMD_GT] = parser_gt,
-        [CMD_LT] = parser_lt, [CMD_LABEL] = parser_label, [CMD_GOTO] = parser_goto,
-        [CMD_IFGOTO] = parser_ifgoto, [CMD_FUNCTION] = parser_function,
-        [CMD_RETURN] = parser_return, [CMD_CALL] = parser_call
-    };
+    translator_reset(options);
 
-    num_files = files_to_translate(argv[1], filenames, MAX_FILES);
+    num_files = files_to_translate(argv[optind], &filenames);
 
     if (num_files == 0) {
         exit_program(EXIT_NO_FILES_FOUND, path_out);
     }
 
+    streams = malloc(num_files * sizeof(struct vm_stream));
+    texts = malloc(num_files * sizeof(char *));
+    if (streams == NULL || texts == NULL) {
+        exit_program(EXIT_OUT_OF_MEMORY);
+    }
+    for (int i = 0; i < num_files; i++) {
+        vm_stream_init(&streams[i]);
+    }
+
+    int status = read_sources(num_files, filenames, streams, texts, errmsg);
+
+    if (!status) {
+        status = jack_batch(num_files, filenames, texts, njobs, streams, errmsg);
+    }
+    for (int i = 0; i < num_files; i++) {
+        free(texts[i]);
+    }
+    free(texts);
+    if (!status && encode) {
+        status = encode_files(num_files, filenames, streams, errmsg);
+        for (int i = 0; i < num_files; i++) {
+            vm_stream_free(&streams[i]);
+        }
+        if (!status) {
+            free(streams);
+            free(filenames);
+            return 0;
+        }
+    }
+    if (!status && inline_small) {
+        status = inline_calls(num_files, filenames, streams, stdout, errmsg);
+    }
+    // after inlining, which leaves fewer calls to constrain the frames
+    if (!status && use_frames) {
+        status = static_frames_build(&frames, num_files, streams, errmsg);
+        translator_static_frames(&frames);
+    }
+    if (status) {
+        exit_with_message(status, errmsg);
+    }
+
     bootstrap_code(asm_output);
 
+    if (write_map) {
+        srcmap_init(&map);
+        translator_source_map(&map, count_lines(path_out));
+    }
+
     #if PRINT_TO_FILE
         if ((fp_output = fopen(path_out, "a")) == NULL) {
             exit_program(EXIT_CANNOT_OPEN_FILE_OUT, path_out);
         }
-        fprintf(fp_output, asm_output);
     #else
-        printf(asm_output);
+        fp_output = stdout;
     #endif
 
-    for (int i = 0; i < num_files; i++) {
-        if ((fp_input = fopen(filenames[i], "r")) == NULL) {
-            exit_program(EXIT_CANNOT_OPEN_FILE, filenames[i]);
-        }
-
-        basename(strcpy(fname_noext, filenames[i]));
-        fname_remove_ext(fname_noext);
-
-        while (fgets(line, sizeof(line), fp_input)) {
-            line_num++;
-
-            strip_comments(line);
-
-            if (s_is_empty(line)) {
-                continue; // skip empty lines
-            }
+    setvbuf(fp_output, output_buffer, _IOFBF, sizeof(output_buffer));
+    emit(asm_output, fp_output);
 
-            strcpy(tmp_line, line);
-            ntokens = s_tokenize(tmp_line, tokens, MAX_TOKENS+1, " ");
-            // ntokens should be at least 1 because we have skipped empty lines
-            cmd_id cmdid = str_to_cmdid(tokens[0]);
-            bool valid = parser_fn[cmdid](ntokens, (const char **) tokens, asm_output);
-
-            if (!valid) {
-                exit_program(EXIT_INVALID_COMMAND, line_num, line);
-            }
+    // in the order of files_to_translate, whichever class finished first
+    for (int i = 0; i < num_files; i++) {
+        status = translate_commands(&streams[i], filenames[i], fp_output, errmsg);
+        vm_stream_free(&streams[i]);
 
-            #if PRINT_TO_FILE
-                fprintf(fp_output, asm_output);
-            #else
-                printf(asm_output);
-            #endif
+        if (status) {
+            exit_with_message(status, errmsg);
         }
-
-        fclose(fp_input);
+    }
+    if ((status = routines_code(fp_output, errmsg))) {
+        exit_with_message(status, errmsg);
     }
 
     #if PRINT_TO_FILE
         fclose(fp_output);
     #endif
 
+    if (write_map) {
+        char map_path[MAX_FNAME_CHARS + sizeof(SRCMAP_EXTENSION)];
+        FILE *fp_map;
+
+        sprintf(map_path, "%s%s", path_out, SRCMAP_EXTENSION);
+        if ((fp_map = fopen(map_path, "wb")) == NULL || srcmap_write(&map, fp_map)
+            || fclose(fp_map)) {
+            exit_program(EXIT_CANNOT_OPEN_FILE_OUT, map_path);
+        }
+        srcmap_free(&map);
+    }
+
+    static_frames_free(&frames);
+    free(streams);
+    free(filenames);
+
     return 0;
 }
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <stdio.h>
+
+#include "stream.h"
+#include "frames.h"
+#include "srcmap.h"
+
+/* Max chars of generated assembly output for a single line/command. */
+#define MAX_ASM_OUT  2000
+
+/*
+ * Translator options, see translator_reset().
+ */
+/* Keep the top of stack in the D register within basic blocks (-c). */
+#define VM_OPT_CACHE_TOS 0x1
+/*
+ * Call one shared routine per kind of comparison instead of inlining eq, gt
+ * and lt (-r). Each comparison takes 4 instructions of ROM instead of 12,
+ * for 7 more executed ones.
+ */
+#define VM_OPT_SHARED_CMP 0x2
+/*
+ * Turn a call followed by a return into a jump that reuses the frame of the
+ * caller (-t), so that tail recursion runs in constant stack space.
+ */
+#define VM_OPT_TAIL_CALL 0x4
+/*
+ * Replace calls of Math.multiply with a constant operand, and of Math.divide
+ * by a power of two, with code of their own (-m): an addition chain for the
+ * former, a shared routine that needs no call frame for the latter.
+ */
+#define VM_OPT_REDUCE_MATH 0x8
+
+
+/*
+ * Put the translator in its initial state, ready for a new program that is
+ * to be translated with the given VM_OPT_* options.
+ */
+void translator_reset(unsigned options);
+
+/*
+ * Keep the locals of the functions in frames at their fixed addresses, and
+ * start the stack past them, until the next translator_reset(). frames must
+ * outlive the translation.
+ */
+void translator_static_frames(const struct static_frames *frames);
+
+/*
+ * Record in map where the code of each command translated from now on
+ * starts, by line of the output, which has lines lines already, until the
+ * next translator_reset(). map must outlive the translation.
+ */
+void translator_source_map(struct source_map *map, unsigned lines);
+
+/*
+ * Generate the code that sets up the stack and calls Sys.init, followed by
+ * the shared routines of VM_OPT_SHARED_CMP, if set.
+ */
+void bootstrap_code(char *output);
+
+/*
+ * Translate the commands generated from the file filename, e.g. by the Jack
+ * compiler, into fp_output. Errors are reported by the line of the command.
+ *
+ * \retval - 0 on success, else the exit code of the error described by errmsg.
+ */
+int translate_commands(const struct vm_stream *commands, const char *filename,
+                       FILE *fp_output, char *errmsg);
+
+/*
+ * Write the shared routines the code translated since translator_reset()
+ * turned out to need into fp_output, after all of that code: that of
+ * VM_OPT_TAIL_CALL, if a tail call was emitted, and that of
+ * VM_OPT_REDUCE_MATH, if a division by a power of two was reduced.
+ *
+ * \retval - 0 on success, else the exit code of the error described by errmsg.
+ */
+int routines_code(FILE *fp_output, char *errmsg);
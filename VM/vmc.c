@@ -0,0 +1,135 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "vm.h"
+#include "files.h"
+#include "server.h"
+#include "exit.h"
+#include "ipc.h"
+
+/*
+ * Thin client of the VM translator daemon (see server.h). It takes the
+ * translator's file or directory argument and its -c, -f, -i, -m, -r and -t
+ * options, lets the daemon do the work and then behaves exactly as the
+ * translator would have: same output file, messages and exit codes.
+ *
+ * The response of the daemon only carries the program, so -b and -g, which
+ * write .vmb files and a source map, take the translator itself. The daemon
+ * picks the number of threads, so there is no -j either.
+ */
+
+#define USAGE "Usage: vmc [-c] [-f] [-i] [-m] [-r] [-t] file|dir"
+
+
+int main(int argc, char *argv[])
+{
+    /*
+     * Number of files to be processed.
+     */
+    int num_files;
+    /*
+     * Names of files to be processed.
+     */
+    char (*filenames)[MAX_FILENAME_LEN+1];
+    struct ipc_file *files;
+    struct ipc_request req;
+    struct ipc_response resp;
+    const char *socket_path = server_socket_path();
+    char errmsg[MAX_ERROR_LEN + 1];
+    FILE *fp_output;
+    /*
+     * VM_OPT_* and VM_REQ_* flags, handed over to the daemon with the request.
+     */
+    unsigned options = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "bcfgimrt")) != -1) {
+        switch (opt) {
+        case 'c':
+            options |= VM_OPT_CACHE_TOS;
+            break;
+        case 'f':
+            options |= VM_REQ_FRAMES;
+            break;
+        case 'i':
+            options |= VM_REQ_INLINE;
+            break;
+        case 'm':
+            options |= VM_OPT_REDUCE_MATH;
+            break;
+        case 'r':
+            options |= VM_OPT_SHARED_CMP;
+            break;
+        case 't':
+            options |= VM_OPT_TAIL_CALL;
+            break;
+        case 'b':
+        case 'g':
+            sprintf(errmsg, "vmc can't write the files of -%c, run vm -%c instead", opt, opt);
+            exit_with_message(EXIT_INVALID_OPTION, errmsg);
+            break;
+        default:
+            exit_with_message(EXIT_INVALID_OPTION, USAGE);
+        }
+    }
+
+    if (argc - optind != 1) {
+        exit_program(EXIT_MANY_ARGS);
+    }
+
+    num_files = files_to_translate(argv[optind], &filenames);
+
+    if (num_files == 0) {
+        exit_program(EXIT_NO_FILES_FOUND, path_out);
+    }
+
+    // the daemon refuses bigger requests, which must not look like it failing
+    if (num_files > IPC_MAX_FILES) {
+        exit_program(EXIT_PROGRAM_TOO_LARGE, (unsigned) IPC_MAX_FILES, "files");
+    }
+    if ((files = malloc(num_files * sizeof(struct ipc_file))) == NULL) {
+        exit_program(EXIT_OUT_OF_MEMORY);
+    }
+    for (int i = 0; i < num_files; i++) {
+        if (ipc_read_file(filenames[i], &files[i]) != 0) {
+            exit_program(EXIT_CANNOT_OPEN_FILE, filenames[i]);
+        }
+    }
+
+    req.tool = IPC_TOOL_VM;
+    req.flags = options;
+    req.nfiles = num_files;
+    req.files = files;
+
+    int fd = ipc_connect(socket_path);
+
+    if (fd < 0 || ipc_call(fd, &req, &resp) != 0) {
+        exit_program(EXIT_DAEMON_FAILED, socket_path);
+    }
+    close(fd);
+
+    if (resp.status) {
+        exit_with_message(resp.status, resp.msg);
+    }
+
+    // only now, so that a failed request leaves no empty or partial output
+    if ((fp_output = fopen(path_out, "a")) == NULL) {
+        exit_program(EXIT_CANNOT_OPEN_FILE_OUT, path_out);
+    }
+    fwrite(resp.out, 1, resp.out_len, fp_output);
+    fclose(fp_output);
+    // e.g. the report of -i
+    fwrite(resp.msg, 1, resp.msg_len, stdout);
+
+    for (int i = 0; i < num_files; i++) {
+        free(files[i].name);
+        free(files[i].data);
+    }
+    free(files);
+    free(filenames);
+    free(resp.out);
+    free(resp.msg);
+
+    return 0;
+}
@@ -0,0 +1,301 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+
+#include "loader.h"
+#include "files.h"
+#include "exit.h"
+
+/*
+ * Native interpreter of VM programs. It loads .vm files once (see loader.h)
+ * and runs them on a Hack sized RAM with 16-bit arithmetic, instead of going
+ * through the translator, the assembler and a CPU emulator.
+ *
+ * Programs that define Sys.init are started the way the translator's
+ * bootstrap code does. Others run from their first command, on whatever RAM
+ * was set up with -s.
+ */
+
+#define USAGE "Usage: vmi [-n steps] [-s addr=value]... [-p addr[:count]]... file|dir"
+
+/* Max number of -s and -p options. */
+#define MAX_RAM_OPTS 100
+
+#define WORD(x) ((int16_t) (x))
+#define ADDR(x) ((uint16_t) (x) & (VM_RAM_SIZE - 1))
+
+struct ram_range {
+    unsigned addr;
+    unsigned count;
+};
+
+
+/*
+ * Run prog until it halts or max_steps instructions have been executed.
+ *
+ * Dispatch is threaded through a table of label addresses, so that each
+ * instruction jumps straight to the next one's handler.
+ *
+ * \retval - number of instructions executed.
+ */
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+static unsigned long run(const struct vm_program *prog, int16_t *ram,
+                         unsigned long max_steps)
+{
+    static const void *handlers[MAX_OPS] = {
+        [OP_PUSH_CONST] = &&push_const,
+        [OP_PUSH_RAM] = &&push_ram,
+        [OP_PUSH_SEG] = &&push_seg,
+        [OP_POP_RAM] = &&pop_ram,
+        [OP_POP_SEG] = &&pop_seg,
+        [OP_ADD] = &&add,
+        [OP_SUB] = &&sub,
+        [OP_NEG] = &&neg,
+        [OP_AND] = &&and,
+        [OP_OR] = &&or,
+        [OP_NOT] = &&not,
+        [OP_EQ] = &&eq,
+        [OP_GT] = &&gt,
+        [OP_LT] = &&lt,
+        [OP_GOTO] = &&jump,
+        [OP_IFGOTO] = &&ifgoto,
+        [OP_CALL] = &&call,
+        [OP_FUNCTION] = &&function,
+        [OP_RETURN] = &&ret,
+        [OP_HALT] = &&halt,
+    };
+    const struct vm_inst *code = prog->code;
+    const struct vm_inst *ip = code;
+    unsigned long steps = 0;
+    int16_t *sp;
+    uint16_t frame;
+
+#define SP ram[VM_SP]
+#define TOP ram[ADDR(SP - 1)]
+#define NEXT() do {                             \
+        if (++steps > max_steps) goto halt;     \
+        goto *handlers[ip->op];                 \
+    } while (0)
+#define BINARY(expr) do {                       \
+        SP = WORD(SP - 1);                      \
+        int16_t y = ram[ADDR(SP)];              \
+        sp = &TOP;                              \
+        *sp = WORD(expr);                       \
+        ip++;                                   \
+        NEXT();                                 \
+    } while (0)
+#define PUSH(v) do {                            \
+        ram[ADDR(SP)] = (v);                    \
+        SP = WORD(SP + 1);                      \
+    } while (0)
+
+    if (prog->entry >= 0) {
+        // bootstrap: SP = 256, call Sys.init 0 returning to the final halt
+        SP = VM_STACK_BASE;
+        PUSH(WORD(prog->len - 1));
+        PUSH(ram[VM_LCL]);
+        PUSH(ram[VM_ARG]);
+        PUSH(ram[VM_THIS]);
+        PUSH(ram[VM_THAT]);
+        ram[VM_ARG] = WORD(SP - 5);
+        ram[VM_LCL] = SP;
+        ip = &code[prog->entry];
+    }
+
+    NEXT();
+
+push_const:
+    PUSH(WORD(ip->arg));
+    ip++;
+    NEXT();
+push_ram:
+    PUSH(ram[ip->arg]);
+    ip++;
+    NEXT();
+push_seg:
+    PUSH(ram[ADDR(ram[ip->reg] + ip->arg)]);
+    ip++;
+    NEXT();
+pop_ram:
+    SP = WORD(SP - 1);
+    ram[ip->arg] = ram[ADDR(SP)];
+    ip++;
+    NEXT();
+pop_seg:
+    SP = WORD(SP - 1);
+    ram[ADDR(ram[ip->reg] + ip->arg)] = ram[ADDR(SP)];
+    ip++;
+    NEXT();
+add:
+    BINARY(*sp + y);
+sub:
+    BINARY(*sp - y);
+and:
+    BINARY(*sp & y);
+or:
+    BINARY(*sp | y);
+eq:
+    BINARY(*sp == y ? -1 : 0);
+// by the sign of the 16-bit difference, as the translated code (D=M-D; D;JGT)
+gt:
+    BINARY(WORD(*sp - y) > 0 ? -1 : 0);
+lt:
+    BINARY(WORD(*sp - y) < 0 ? -1 : 0);
+neg:
+    TOP = WORD(-TOP);
+    ip++;
+    NEXT();
+not:
+    TOP = WORD(~TOP);
+    ip++;
+    NEXT();
+jump:
+    ip = &code[ip->arg];
+    NEXT();
+ifgoto:
+    SP = WORD(SP - 1);
+    ip = ram[ADDR(SP)] ? &code[ip->arg] : ip + 1;
+    NEXT();
+call:
+    PUSH(WORD(ip - code + 1));
+    PUSH(ram[VM_LCL]);
+    PUSH(ram[VM_ARG]);
+    PUSH(ram[VM_THIS]);
+    PUSH(ram[VM_THAT]);
+    ram[VM_ARG] = WORD(SP - 5 - ip->n);
+    ram[VM_LCL] = SP;
+    ip = &code[ip->arg];
+    NEXT();
+function:
+    for (int i = 0; i < ip->arg; i++) {
+        PUSH(0);
+    }
+    ip++;
+    NEXT();
+ret:
+    frame = ram[VM_LCL];
+    ip = &code[(uint16_t) ram[ADDR(frame - 5)] % prog->len];
+    ram[ADDR(ram[VM_ARG])] = ram[ADDR(SP - 1)];
+    SP = WORD(ram[VM_ARG] + 1);
+    ram[VM_THAT] = ram[ADDR(frame - 1)];
+    ram[VM_THIS] = ram[ADDR(frame - 2)];
+    ram[VM_ARG] = ram[ADDR(frame - 3)];
+    ram[VM_LCL] = ram[ADDR(frame - 4)];
+    NEXT();
+halt:
+    return steps;
+
+#undef SP
+#undef TOP
+#undef NEXT
+#undef BINARY
+#undef PUSH
+}
+#pragma GCC diagnostic pop
+
+static bool parse_range(const char *s, struct ram_range *range)
+{
+    char *endptr;
+
+    range->addr = strtoul(s, &endptr, 10);
+    range->count = 1;
+    if (*endptr == ':') {
+        range->count = strtoul(endptr + 1, &endptr, 10);
+    }
+
+    return endptr != s && !*endptr && range->addr + range->count <= VM_RAM_SIZE;
+}
+
+int main(int argc, char *argv[])
+{
+    /*
+     * Number of files to be processed.
+     */
+    int num_files;
+    /*
+     * Names of files to be processed.
+     */
+    char (*filenames)[MAX_FILENAME_LEN+1];
+    char errmsg[MAX_ERROR_LEN + 1];
+    /*
+     * RAM words to set before (-s) and print after (-p) the run.
+     */
+    struct ram_range sets[MAX_RAM_OPTS], prints[MAX_RAM_OPTS];
+    int16_t values[MAX_RAM_OPTS];
+    int nsets = 0, nprints = 0;
+    unsigned long max_steps = (unsigned long) -1;
+    struct vm_program prog;
+    static int16_t ram[VM_RAM_SIZE];
+    char *eq;
+    int opt;
+
+    program_name = "VM Interpreter";
+
+    while ((opt = getopt(argc, argv, "n:s:p:")) != -1) {
+        switch (opt) {
+        case 'n':
+            max_steps = strtoul(optarg, NULL, 10);
+            break;
+        case 's':
+            eq = strchr(optarg, '=');
+            if (eq == NULL || nsets == MAX_RAM_OPTS) {
+                exit_with_message(EXIT_INVALID_OPTION, USAGE);
+            }
+            *eq = '\0';
+            if (!parse_range(optarg, &sets[nsets])) {
+                exit_with_message(EXIT_INVALID_OPTION, USAGE);
+            }
+            values[nsets++] = WORD(atoi(eq + 1));
+            break;
+        case 'p':
+            if (nprints == MAX_RAM_OPTS || !parse_range(optarg, &prints[nprints++])) {
+                exit_with_message(EXIT_INVALID_OPTION, USAGE);
+            }
+            break;
+        default:
+            exit_with_message(EXIT_INVALID_OPTION, USAGE);
+        }
+    }
+
+    if (argc - optind != 1) {
+        exit_program(EXIT_MANY_ARGS);
+    }
+
+    num_files = files_to_translate(argv[optind], &filenames);
+
+    if (num_files == 0) {
+        exit_program(EXIT_NO_FILES_FOUND, path_out);
+    }
+
+    int rc = vm_load(&prog, num_files, filenames, errmsg);
+    free(filenames);
+    if (rc) {
+        exit_with_message(rc, errmsg);
+    }
+
+    for (int i = 0; i < nsets; i++) {
+        for (unsigned a = 0; a < sets[i].count; a++) {
+            ram[sets[i].addr + a] = values[i];
+        }
+    }
+
+    unsigned long steps = run(&prog, ram, max_steps);
+
+    for (int i = 0; i < nprints; i++) {
+        for (unsigned a = 0; a < prints[i].count; a++) {
+            printf("RAM[%u]=%d\n", prints[i].addr + a, ram[prints[i].addr + a]);
+        }
+    }
+
+    vm_unload(&prog);
+
+    if (steps > max_steps) {
+        exit_program(EXIT_STEP_LIMIT, max_steps);
+    }
+
+    return 0;
+}
@@ -0,0 +1,86 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "asm_malloc.h"
+
+
+#define ARENA_CHUNK_SIZE (64 * 1024)
+#define ARENA_ALIGN 8  // enough for everything the assembler stores
+
+
+struct chunk {
+    struct chunk *next;
+    size_t size;
+    size_t used;
+    char data[];
+};
+
+struct arena {
+    struct chunk *chunks; // the chunk currently allocated from is first
+};
+
+
+static struct chunk *chunk_new(size_t size)
+{
+    struct chunk *chunk = asm_malloc(sizeof(struct chunk) + size);
+
+    chunk->next = NULL;
+    chunk->size = size;
+    chunk->used = 0;
+
+    return chunk;
+}
+
+Arena arena_init(void)
+{
+    Arena arena = asm_malloc(sizeof(struct arena));
+    arena->chunks = chunk_new(ARENA_CHUNK_SIZE);
+    return arena;
+}
+
+void *arena_alloc(Arena arena, size_t size)
+{
+    struct chunk *chunk = arena->chunks;
+
+    size = (size + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1);
+
+    if (chunk->used + size > chunk->size) {
+        chunk = chunk_new(size > ARENA_CHUNK_SIZE ? size : ARENA_CHUNK_SIZE);
+        chunk->next = arena->chunks;
+        arena->chunks = chunk;
+    }
+
+    void *ptr = chunk->data + chunk->used;
+    chunk->used += size;
+
+    return ptr;
+}
+
+char *arena_strdup(Arena arena, const char *s)
+{
+    size_t len = strlen(s) + 1;
+    return memcpy(arena_alloc(arena, len), s, len);
+}
+
+void arena_reset(Arena arena)
+{
+    struct chunk *chunk = arena->chunks;
+    struct chunk *tmp = NULL;
+
+    // keep the oldest chunk, which is the last one in the list
+    for (; chunk->next != NULL; chunk = tmp) {
+        tmp = chunk->next;
+        free(chunk);
+    }
+
+    chunk->used = 0;
+    arena->chunks = chunk;
+}
+
+void arena_destroy(Arena arena)
+{
+    arena_reset(arena);
+    free(arena->chunks);
+    free(arena);
+}
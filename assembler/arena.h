@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stddef.h>
+
+/*
+ * A region based allocator. Memory is handed out from big chunks and is only
+ * ever given back all at once, which turns the many small allocations done
+ * while assembling a program into a handful of mallocs.
+ */
+
+typedef struct arena *Arena;
+
+
+/**
+ * Create an empty arena. If this fails, the program will terminate.
+ */
+Arena arena_init(void);
+
+/**
+ * Allocate size bytes from the arena, aligned to 8 bytes.
+ * If this fails, the program will terminate.
+ */
+void *arena_alloc(Arena arena, size_t size);
+
+/**
+ * Copy a string into the arena.
+ */
+char *arena_strdup(Arena arena, const char *s);
+
+/**
+ * Release everything allocated from the arena so far. The first chunk is kept
+ * around, so that an arena that is reset between runs rarely calls malloc.
+ */
+void arena_reset(Arena arena);
+
+/**
+ * Free the arena along with everything allocated from it.
+ */
+void arena_destroy(Arena arena);
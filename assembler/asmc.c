@@ -0,0 +1,73 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "server.h"
+#include "exit.h"
+#include "ipc.h"
+
+/*
+ * Thin client of the assembler daemon (see server.h). It takes a single file,
+ * lets the daemon do the work and then behaves exactly as the assembler would
+ * have on that file: same output, messages and exit codes.
+ *
+ * A request carries a program and its response the machine code, to stdout,
+ * so the modes that write files of their own, batch mode with several files
+ * or a directory, objects (-c) and source maps (-g), take the assembler
+ * itself.
+ */
+
+#define USAGE "Usage: asmc file.asm (for several files, a directory, -c or -g run the assembler)"
+
+
+int main(int argc, const char *argv[])
+{
+    struct stat path_stat;
+    struct ipc_file file;
+    struct ipc_request req;
+    struct ipc_response resp;
+    const char *socket_path = server_socket_path();
+
+    if (argc < 2) {
+        exit_program(EXIT_MANY_FILES);
+    }
+    if (argc > 2 || argv[1][0] == '-') {
+        exit_with_message(EXIT_INVALID_OPTION, USAGE);
+    }
+
+    if (stat(argv[1], &path_stat) != 0) {
+        exit_program(EXIT_FILE_DOES_NOT_EXIST, argv[1]);
+    }
+    if (!S_ISREG(path_stat.st_mode)) {
+        exit_program(EXIT_NOT_REGULAR_FILE, argv[1]);
+    }
+    if (ipc_read_file(argv[1], &file) != 0) {
+        exit_program(EXIT_CANNOT_OPEN_FILE, argv[1]);
+    }
+
+    req.tool = IPC_TOOL_ASM;
+    req.flags = 0;
+    req.nfiles = 1;
+    req.files = &file;
+
+    int fd = ipc_connect(socket_path);
+
+    if (fd < 0 || ipc_call(fd, &req, &resp) != 0) {
+        exit_program(EXIT_DAEMON_FAILED, socket_path);
+    }
+    close(fd);
+
+    if (resp.status) {
+        exit_with_message(resp.status, resp.msg);
+    }
+
+    fwrite(resp.out, 1, resp.out_len, stdout);
+
+    free(resp.out);
+    free(resp.msg);
+    free(file.name);
+    free(file.data);
+
+    return 0;
+}
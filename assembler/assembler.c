@@ -8,9 +8,16 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 
+#include "assembler.h"
+#include "batch.h"
+#include "server.h"
 #include "symbol_table.h"
+#include "object.h"
+#include "scan.h"
+#include "srcmap.h"
 #include "hack_standard.h"
 #include "asm_malloc.h"
+#include "arena.h"
 #include "exit.h"
 
 
@@ -18,26 +25,6 @@
 #define MAX_LABEL_LEN 198
 #define INIT_MEMORY_ALLOC 400
 
-#define OPCODE_STR "%c%c%c%c%c%c%c%c%c%c%c%c%c%c%c%c"
-
-#define OPCODE_TO_BINARY(opcode) \
-  (opcode & 0x8000 ? '1' : '0'), \
-  (opcode & 0x4000 ? '1' : '0'), \
-  (opcode & 0x2000 ? '1' : '0'), \
-  (opcode & 0x1000 ? '1' : '0'), \
-  (opcode & 0x0800 ? '1' : '0'), \
-  (opcode & 0x0400 ? '1' : '0'), \
-  (opcode & 0x0200 ? '1' : '0'), \
-  (opcode & 0x0100 ? '1' : '0'), \
-  (opcode & 0x0080 ? '1' : '0'), \
-  (opcode & 0x0040 ? '1' : '0'), \
-  (opcode & 0x0020 ? '1' : '0'), \
-  (opcode & 0x0010 ? '1' : '0'), \
-  (opcode & 0x0008 ? '1' : '0'), \
-  (opcode & 0x0004 ? '1' : '0'), \
-  (opcode & 0x0002 ? '1' : '0'), \
-  (opcode & 0x0001 ? '1' : '0')
-
 #define INST_TO_OPCODE(inst, opcode)   \
     do {                               \
         (opcode) |= (7 << 13);         \
@@ -92,8 +79,52 @@ typedef struct generic_inst {
         a_inst a;
     } inst;
     inst_id id;
+    /*
+     * Line of the source the instruction is on.
+     */
+    unsigned line;
 } generic_inst;
 
+/*
+ * State that survives between consecutive assemble() runs, so that a daemon
+ * worker doesn't have to rebuild it for every program.
+ */
+struct asm_context {
+    /*
+     * Holds the labels and variables of the current program.
+     */
+    SymbolTable symtab;
+    /*
+     * Maps the symbols an object imports to their index, when assembling
+     * to an object.
+     */
+    SymbolTable imports;
+    /*
+     * Backs the symbol names of A-instructions of the current program.
+     */
+    Arena arena;
+    /*
+     * A buffer keeping all valid instructions after reading them from the file.
+     */
+    generic_inst *instructions;
+    /*
+     * This indicates for how many instructions we have allocated memory.
+     * Initially we allocate INIT_MEMORY_ALLOC memory and later, whenever we
+     * hit this limit and need to store more instructions in memory we double
+     * this value.
+     */
+    unsigned allocated_mem;
+    /*
+     * Number of instructions of the current program.
+     */
+    unsigned count;
+    /*
+     * The text of the current program, read whole for the scanner.
+     */
+    char *text;
+    size_t text_allocated;
+};
+
 
 
 /*
@@ -121,34 +152,30 @@ FILE *file_open_or_bail(const char *filename, const char *mode)
 }
 
 /*
- * Strip a line from comments and remove *all* whitespace.
- * Comments are indicated by two adjacent / characters.
+ * Copy the significant text of a line to s, which must hold MAX_LINE_LEN + 1
+ * chars, without any of the whitespace within.
  *
- * E.g. "  A  = M  // comment " becomes "A=M"
+ * E.g. "A  = M" becomes "A=M"
+ *
+ * retval - false if it doesn't fit, in which case s holds as much as does.
  */
-char *strip_comments_and_whitespace(char *s) {
-    // sanity checks
-    if (s == NULL) {
-        return NULL;
-    } else if (!*s) {
-        return s;
-    }
-
-    char s_new[strlen(s) + 1];
-    int i = 0;
+static bool copy_without_whitespace(char *s, const struct scan_span *span)
+{
+    size_t i = 0;
 
-    for (char *s2 = s; *s2; s2++) {
-        if (*s2 == '/' && *(s2+1) == '/') {
-            break; // a comment starts from this point on; skip rest of the line
-        } else if (!isspace(*s2)) {
-            s_new[i++] = *s2;
+    for (size_t j = 0; j < span->len; j++) {
+        if (isspace((unsigned char) span->text[j])) {
+            continue;
+        }
+        if (i == MAX_LINE_LEN) {
+            s[i] = '\0';
+            return false;
         }
+        s[i++] = span->text[j];
     }
-    s_new[i] = '\0';
+    s[i] = '\0';
 
-    strcpy(s, s_new); // this is safe because s_new is smaller than s
-
-    return s;
+    return true;
 }
 
 /**
@@ -180,21 +207,10 @@ bool is_label(const char *line, char *label)
     return true;
 }
 
-/**
- * Populate some predefined symbols in the symbol table.
- */
-void populate_predefined_symbols(SymbolTable table)
-{
-    for (int i = 0; i < NUM_PREDEFINED_SYMS; i++) {
-        struct predef_symbol s = predef_symbols[i];
-        symtab_add(table, s.name, s.address);
-    }
-}
-
 /*
  * Parse an A-instruction and determine if it is valid or not. Store the
- * operand (the after @ part) either as string or as a hack address in the
- * instruction. Invalid instructions are those that the operand begins with
+ * operand (the after @ part) either as string allocated from arena or as a
+ * hack address in the instruction. Invalid instructions are those that the operand begins with
  * digit(s) but contains other characters as well. All other instructions are
  * valid. Return true when instruction is valid, else false.
  *
@@ -202,27 +218,23 @@ void populate_predefined_symbols(SymbolTable table)
  * Return true for "@5439", "@LOOP", "@SYMBOL123", "@L99P"
  * Return false for "@1ABC", "@1234LOOP"
  */
-bool parse_A_instruction(const char *line, a_inst *inst)
+bool parse_A_instruction(const char *line, a_inst *inst, Arena arena)
 {
-    // +1 in malloc not needed because we don't store 1st char
-    inst->operand.symbol = asm_malloc(strlen(line));
-    char *s = inst->operand.symbol;
-    strcpy(s, line+1);
-
+    const char *s = line + 1;
     char *endptr = NULL;
+    errno = 0;
     hack_addr result = strtol(s, &endptr, 10);
 
     if (s == endptr) {
         // operand is a symbol
+        inst->operand.symbol = arena_strdup(arena, s);
         inst->resolved = false;
         return true;
     } else if (errno == 0 && *endptr != 0) {
         // operand is invalid; begins with digit(s) but continues with other chars
-        free(inst->operand.symbol);
         return false;
     } else {
         // operand is a number
-        free(inst->operand.symbol);
         inst->operand.address = result;
         inst->resolved = true;
     }
@@ -240,12 +252,13 @@ void parse_C_instruction(char *line, c_inst *inst)
     char *dest = NULL;
     char *comp = NULL;
     char *jmp = NULL;
+    char *saveptr = NULL;
     int a;
 
-    tmp = strtok(line, ";");
-    jmp = strtok(NULL, "");
-    dest = strtok(tmp, "=");
-    comp = strtok(NULL, "");
+    tmp = strtok_r(line, ";", &saveptr);
+    jmp = strtok_r(NULL, "", &saveptr);
+    dest = strtok_r(tmp, "=", &saveptr);
+    comp = strtok_r(NULL, "", &saveptr);
 
     if (comp == NULL) {
         comp = dest;
@@ -259,40 +272,72 @@ void parse_C_instruction(char *line, c_inst *inst)
 }
 
 
-int main(int argc, const char *argv[])
+AsmContext asm_context_init(void)
 {
-    if (argc != 2) {
-        exit_program(EXIT_MANY_FILES);
-    }
+    AsmContext ctx = asm_malloc(sizeof(struct asm_context));
+
+    ctx->symtab = symtab_init();
+    ctx->imports = symtab_init();
+    ctx->arena = arena_init();
+    ctx->instructions = NULL;
+    ctx->allocated_mem = 0;
+    ctx->count = 0;
+    ctx->text = NULL;
+    ctx->text_allocated = 0;
+
+    return ctx;
+}
 
+void asm_context_destroy(AsmContext ctx)
+{
+    symtab_destroy(ctx->symtab);
+    symtab_destroy(ctx->imports);
+    arena_destroy(ctx->arena);
+    free(ctx->instructions);
+    free(ctx->text);
+    free(ctx);
+}
+
+/*
+ * Read all of fp into ctx->text, null terminated.
+ *
+ * retval - the number of bytes read.
+ */
+static size_t read_text(AsmContext ctx, FILE *fp)
+{
+    size_t len = 0, n;
+
+    do {
+        if (len + 1 >= ctx->text_allocated) {
+            ctx->text_allocated = ctx->text_allocated ? ctx->text_allocated * 2 : 1 << 16;
+            ctx->text = asm_realloc(ctx->text, ctx->text_allocated);
+        }
+        n = fread(ctx->text + len, 1, ctx->text_allocated - len - 1, fp);
+        len += n;
+    } while (n > 0);
+
+    ctx->text[len] = '\0';
+
+    return len;
+}
+
+/*
+ * Add the label or instruction on line line_num, already stripped of comments
+ * and whitespace, to the program read so far, which has *count instructions.
+ *
+ * retval - 0 on success, else the exit code that corresponds to the error.
+ */
+static int read_line(AsmContext ctx, char *line, unsigned line_num, unsigned *count, char *errmsg)
+{
     /*
      * Indicates number of current instruction.
      * This counts only real instructions, not empty lines, comments nor labels.
      */
-    unsigned instruction_num = 0;
-    /*
-     * Indicates current file line that is being processed.
-     */
-    unsigned line_num = 0;
+    unsigned instruction_num = *count;
     /*
      * Holds current instruction.
      */
     generic_inst inst;
-    /*
-     * A buffer keeping all valid instructions after reading them from the file.
-     */
-    generic_inst *instructions = NULL;
-    /*
-     * This indicates for how many instructions we have allocated memory.
-     * Initially we allocate INIT_MEMORY_ALLOC memory and later, whenever we
-     * hit this limit and need to store more instructions in memory we double
-     * this value.
-     */
-    unsigned allocated_mem = 0;
-    /*
-     * Holds current line read.
-     */
-    char line[MAX_LINE_LEN + 1];
     char tmp_line[MAX_LINE_LEN + 1];
     /*
      * Used to temporarily store the label of the current instruction, if
@@ -300,72 +345,112 @@ int main(int argc, const char *argv[])
      */
     char label[MAX_LABEL_LEN + 1];
 
-    FILE *fp = file_open_or_bail(argv[1], "r");
-
-    SymbolTable symtab = symtab_init();
-    populate_predefined_symbols(symtab);
+    if (is_label(line, label)) {
+        if (!isalpha(*label)) {
+            return error_format(errmsg, EXIT_INVALID_LABEL, line_num, line);
+        }
+        if (symtab_lookup(ctx->symtab, label) != SYMBOL_NOT_FOUND) {
+            return error_format(errmsg, EXIT_SYMBOL_ALREADY_EXISTS, line_num, line);
+        }
+        symtab_add(ctx->symtab, label, instruction_num);
+        return 0;
+    }
 
-    /* First pass */
+    if (instruction_num > MAX_INSTRUCTION) {
+        return error_format(errmsg, EXIT_TOO_MANY_INSTRUCTIONS, MAX_INSTRUCTION + 1);
+    }
 
-    while (fgets(line, sizeof(line), fp)) {
-        line_num++;
-        if (instruction_num > MAX_INSTRUCTION) {
-            exit_program(EXIT_TOO_MANY_INSTRUCTIONS, MAX_INSTRUCTION + 1);
+    if (*line == '@') {
+        if (!parse_A_instruction(line, &inst.inst.a, ctx->arena)) {
+            return error_format(errmsg, EXIT_INVALID_A_INST, line_num, line);
+        }
+        inst.id = INST_A;
+    } else {
+        strcpy(tmp_line, line); // safe because they have same lengths
+        parse_C_instruction(tmp_line, &inst.inst.c);
+
+        if (inst.inst.c.dest == DEST_INVALID) {
+            return error_format(errmsg, EXIT_INVALID_C_DEST, line_num, line);
+        } else if (inst.inst.c.comp == COMP_INVALID) {
+            return error_format(errmsg, EXIT_INVALID_C_COMP, line_num, line);
+        } else if (inst.inst.c.jump == JMP_INVALID) {
+            return error_format(errmsg, EXIT_INVALID_C_JUMP, line_num, line);
         }
 
-        strip_comments_and_whitespace(line);
+        inst.id = INST_C;
+    }
 
-        if (!*line) {
-            continue; // skip empty lines
-        }
+    if (instruction_num == ctx->allocated_mem) {
+        // We need more memory for storing instructions.
+        // Double what we already have or make our first allocation of default value.
+        unsigned tmp = ctx->allocated_mem ? ctx->allocated_mem * 2 : INIT_MEMORY_ALLOC;
+        ctx->allocated_mem = tmp > MAX_INSTRUCTION + 1 ? MAX_INSTRUCTION + 1 : tmp;
+        ctx->instructions = asm_realloc(ctx->instructions,
+                                        ctx->allocated_mem * sizeof(generic_inst));
+    }
 
-        if (is_label(line, label)) {
-            if (!isalpha(*label)) {
-                exit_program(EXIT_INVALID_LABEL, line_num, line);
-            }
-            if (symtab_lookup(symtab, label) != SYMBOL_NOT_FOUND) {
-                exit_program(EXIT_SYMBOL_ALREADY_EXISTS, line_num, line);
-            }
-            symtab_add(symtab, label, instruction_num);
-            continue;
-        }
+    inst.line = line_num;
+    ctx->instructions[instruction_num++] = inst;
+    *count = instruction_num;
 
-        if (*line == '@') {
-            if (!parse_A_instruction(line, &inst.inst.a)) {
-                exit_program(EXIT_INVALID_A_INST, line_num, line);
-            }
-            inst.id = INST_A;
-        } else {
-            strcpy(tmp_line, line); // safe because they have same lengths
-            parse_C_instruction(tmp_line, &inst.inst.c);
-
-            if (inst.inst.c.dest == DEST_INVALID) {
-                exit_program(EXIT_INVALID_C_DEST, line_num, line);
-            } else if (inst.inst.c.comp == COMP_INVALID) {
-                exit_program(EXIT_INVALID_C_COMP, line_num, line);
-            } else if (inst.inst.c.jump == JMP_INVALID) {
-                exit_program(EXIT_INVALID_C_JUMP, line_num, line);
-            }
+    return 0;
+}
 
-            inst.id = INST_C;
-        }
+/*
+ * First pass: read the program from fp_in into ctx->instructions, and its
+ * labels into ctx->symtab.
+ *
+ * \param count - set to the number of instructions read
+ * retval - 0 on success, else the exit code that corresponds to the error.
+ */
+static int read_program(AsmContext ctx, FILE *fp_in, unsigned *count, char *errmsg)
+{
+    /*
+     * Holds current line read.
+     */
+    char line[MAX_LINE_LEN + 1];
+    struct scanner sc;
+    struct scan_span span;
+    size_t len = read_text(ctx, fp_in);
+    int rc = 0;
 
-        if (instruction_num == allocated_mem) {
-            // We need more memory for storing instructions.
-            // Double what we already have or make our first allocation of default value.
-            unsigned tmp = allocated_mem ? allocated_mem * 2 : INIT_MEMORY_ALLOC;
-            allocated_mem = tmp > MAX_INSTRUCTION ? MAX_INSTRUCTION : tmp;
-            instructions = asm_realloc(instructions, allocated_mem * sizeof(generic_inst));
-        }
+    symtab_clear(ctx->symtab);
+    arena_reset(ctx->arena);
+    *count = 0;
 
-        instructions[instruction_num++] = inst;
+    if (scanner_init(&sc, ctx->text, len)) {
+        exit_program(EXIT_OUT_OF_MEMORY);
     }
 
-    fclose(fp);
+    /* First pass */
+
+    while (!rc && scanner_next(&sc, &span)) {
+        if (!copy_without_whitespace(line, &span)) {
+            // too long to be anything valid
+            rc = error_format(errmsg, *line == '@' ? EXIT_INVALID_A_INST
+                                      : *line == '(' ? EXIT_INVALID_LABEL
+                                      : EXIT_INVALID_C_COMP, span.line, line);
+        } else {
+            rc = read_line(ctx, line, span.line, count, errmsg);
+        }
+    }
 
-    // Reduce allocated memory to the amount of memory that we really need for
-    // storing all instructions read.
-    instructions = asm_realloc(instructions, instruction_num * sizeof(generic_inst));
+    scanner_free(&sc);
+    ctx->count = *count;
+
+    return rc;
+}
+
+int assemble(AsmContext ctx, FILE *fp_in, FILE *fp_out, char *errmsg)
+{
+    SymbolTable symtab = ctx->symtab;
+    unsigned instruction_num;
+    generic_inst inst;
+    int rc = read_program(ctx, fp_in, &instruction_num, errmsg);
+
+    if (rc) {
+        return rc;
+    }
 
     /* Second pass */
 
@@ -373,12 +458,11 @@ int main(int argc, const char *argv[])
 
     for (unsigned i = 0; i < instruction_num; i++) {
         op = 0;
-        inst = instructions[i];
+        inst = ctx->instructions[i];
 
         if (inst.id == INST_A) {
             if (! inst.inst.a.resolved) {
                 op = symtab_resolve(symtab, inst.inst.a.operand.symbol);
-                free(inst.inst.a.operand.symbol);
             } else {
                 op = inst.inst.a.operand.address;
             }
@@ -386,11 +470,198 @@ int main(int argc, const char *argv[])
             INST_TO_OPCODE(inst.inst.c, op);
         }
 
-        printf(OPCODE_STR"\n", OPCODE_TO_BINARY(op));
+        fprintf(fp_out, OPCODE_STR"\n", OPCODE_TO_BINARY(op));
+    }
+
+    return 0;
+}
+
+int assemble_source_map(AsmContext ctx, const char *asm_map_path, const char *rom_map_path,
+                        char *errmsg)
+{
+    struct source_map asm_map, rom_map;
+    FILE *fp = fopen(asm_map_path, "rb");
+    int rc;
+
+    if (fp == NULL) {
+        return error_format(errmsg, EXIT_CANNOT_OPEN_FILE, asm_map_path);
+    }
+    rc = srcmap_read(&asm_map, fp);
+    fclose(fp);
+
+    if (rc) {
+        return error_format(errmsg, EXIT_INVALID_SOURCE_MAP, asm_map_path);
+    }
+
+    // the instruction at each address has the location of its line
+    srcmap_init(&rom_map);
+    for (unsigned i = 0; i < ctx->count; i++) {
+        const struct srcmap_entry *entry = srcmap_lookup(&asm_map, ctx->instructions[i].line);
+
+        if (entry && srcmap_add(&rom_map, i, asm_map.strings + entry->file, entry->line,
+                                asm_map.strings + entry->function)) {
+            exit_program(EXIT_OUT_OF_MEMORY);
+        }
+    }
+
+    if ((fp = fopen(rom_map_path, "wb")) == NULL) {
+        rc = error_format(errmsg, EXIT_CANNOT_OPEN_FILE, rom_map_path);
+    } else {
+        rc = srcmap_write(&rom_map, fp);
+        if (fclose(fp) || rc) {
+            rc = error_format(errmsg, EXIT_CANNOT_OPEN_FILE, rom_map_path);
+        }
+    }
+
+    srcmap_free(&asm_map);
+    srcmap_free(&rom_map);
+
+    return rc;
+}
+
+static void export_label(const char *name, hack_addr address, void *obj)
+{
+    object_add_export(obj, name, address);
+}
+
+int assemble_object(AsmContext ctx, FILE *fp_in, FILE *fp_out, char *errmsg)
+{
+    struct hack_object obj;
+    unsigned instruction_num;
+    generic_inst inst;
+    int rc = read_program(ctx, fp_in, &instruction_num, errmsg);
+
+    if (rc) {
+        return rc;
+    }
+
+    object_init(&obj);
+    symtab_clear(ctx->imports);
+    symtab_foreach(ctx->symtab, export_label, &obj);
+
+    for (unsigned i = 0; i < instruction_num; i++) {
+        opcode op = 0;
+        hack_addr address;
+
+        inst = ctx->instructions[i];
+
+        if (inst.id == INST_C) {
+            INST_TO_OPCODE(inst.inst.c, op);
+            object_add_word(&obj, op);
+        } else if (inst.inst.a.resolved) {
+            object_add_word(&obj, inst.inst.a.operand.address);
+        } else if ((address = symtab_lookup(ctx->symtab, inst.inst.a.operand.symbol)) != SYMBOL_NOT_FOUND) {
+            // labels move along with the module, predefined symbols stay put
+            object_add_word(&obj, address);
+            if (predef_lookup(inst.inst.a.operand.symbol) == SYMBOL_NOT_FOUND) {
+                object_add_reloc(&obj, OBJECT_LOCAL);
+            }
+        } else {
+            const char *symbol = inst.inst.a.operand.symbol;
+            hack_addr import = symtab_lookup(ctx->imports, symbol);
+
+            if (import == SYMBOL_NOT_FOUND) {
+                import = object_add_import(&obj, symbol);
+                symtab_add(ctx->imports, symbol, import);
+            }
+            object_add_word(&obj, 0);
+            object_add_reloc(&obj, import);
+        }
+    }
+
+    object_write(&obj, fp_out);
+    object_free(&obj);
+
+    return 0;
+}
+
+
+int main(int argc, char *argv[])
+{
+    /*
+     * Run as a daemon serving requests of the thin client instead.
+     */
+    bool daemon = false;
+    /*
+     * Path of the socket the daemon listens on.
+     */
+    const char *socket_path = server_socket_path();
+    /*
+     * Assemble to relocatable objects, for hacklink, instead of programs.
+     */
+    bool object = false;
+    /*
+     * Compose the source map of each program from the one vm -g wrote for
+     * its source.
+     */
+    bool source_map = false;
+    /*
+     * Number of daemon or batch workers; 0 means one per CPU.
+     */
+    int njobs = 0;
+    char errmsg[MAX_ERROR_LEN + 1];
+    int opt;
+
+    while ((opt = getopt(argc, argv, "cdgs:j:")) != -1) {
+        switch (opt) {
+        case 'c':
+            object = true;
+            break;
+        case 'd':
+            daemon = true;
+            break;
+        case 'g':
+            source_map = true;
+            break;
+        case 's':
+            socket_path = optarg;
+            break;
+        case 'j':
+            njobs = atoi(optarg);
+            break;
+        default:
+            exit_program(EXIT_INVALID_OPTION);
+        }
+    }
+
+    if (daemon) {
+        if (optind != argc || source_map) {
+            exit_program(EXIT_INVALID_OPTION);
+        }
+        asm_serve(socket_path, njobs);
+        return 0;
+    }
+
+    if (argc - optind < 1) {
+        exit_program(EXIT_MANY_FILES);
+    }
+
+    // objects are linked from any address, which a map can't know yet
+    if (object && source_map) {
+        exit_program(EXIT_INVALID_OPTION);
+    }
+
+    // Several operands or a directory are assembled in batch mode, each into
+    // its own .hack file. A single file is still assembled to stdout. Objects
+    // are binary, and maps go next to their programs, so they always go to
+    // files of their own.
+    struct stat path_stat;
+    if (object || source_map || argc - optind > 1
+     || (stat(argv[optind], &path_stat) == 0 && S_ISDIR(path_stat.st_mode))) {
+        return assemble_batch(argc - optind, argv + optind, njobs, object, source_map);
     }
 
-    symtab_destroy(symtab);
-    free(instructions);
+    FILE *fp = file_open_or_bail(argv[optind], "r");
+    AsmContext ctx = asm_context_init();
+
+    int status = assemble(ctx, fp, stdout, errmsg);
+
+    fclose(fp);
+    asm_context_destroy(ctx);
+
+    if (status) {
+        exit_with_message(status, errmsg);
+    }
 
     return 0;
 }
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <stdio.h>
+
+
+typedef struct asm_context *AsmContext;
+
+
+/**
+ * Allocate the state needed by assemble(). A context may be reused for
+ * assembling any number of programs, one at a time.
+ */
+AsmContext asm_context_init(void);
+
+/**
+ * Free a context returned by asm_context_init().
+ */
+void asm_context_destroy(AsmContext ctx);
+
+/**
+ * Assemble the program read from fp_in and write its machine code to fp_out.
+ *
+ * On failure nothing is guaranteed about what has been written to fp_out and
+ * errmsg, which must hold MAX_ERROR_LEN + 1 chars, describes the error.
+ *
+ * retval - 0 on success, else the exit code that corresponds to the error.
+ */
+int assemble(AsmContext ctx, FILE *fp_in, FILE *fp_out, char *errmsg);
+
+/**
+ * Assemble the module read from fp_in into a relocatable object (see
+ * object.h), written to fp_out, which must be open in binary mode. Its labels
+ * are exported and the symbols it uses but doesn't define are imported,
+ * rather than allocated as variables.
+ *
+ * retval - 0 on success, else the exit code that corresponds to the error.
+ */
+int assemble_object(AsmContext ctx, FILE *fp_in, FILE *fp_out, char *errmsg);
+
+/**
+ * Compose the source map at asm_map_path, which vm -g writes along with the
+ * .asm program assembled last and which is keyed by its lines, into the map
+ * of its machine code, keyed by ROM address, and write it to rom_map_path
+ * (see srcmap.h).
+ *
+ * retval - 0 on success, else the exit code that corresponds to the error.
+ */
+int assemble_source_map(AsmContext ctx, const char *asm_map_path, const char *rom_map_path,
+                        char *errmsg);
+
+/*
+ * Check whether the given path corresponds to a regular file and if that's
+ * the case try to open the file using fopen.
+ */
+FILE *file_open_or_bail(const char *filename, const char *mode);
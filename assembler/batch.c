@@ -0,0 +1,283 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "batch.h"
+#include "assembler.h"
+#include "object.h"
+#include "asm_malloc.h"
+#include "exit.h"
+#include "threadpool.h"
+#include "filereader.h"
+#include "srcmap.h"
+
+
+#define ASM_EXTENSION ".asm"
+#define HACK_EXTENSION ".hack"
+/* Programs are written in a few writes of this size. */
+#define OUTPUT_BUFFER_SIZE (1 << 18)
+
+/*
+ * One file of the batch. status and errmsg are filled in by the worker that
+ * assembled it and are reported by the main thread, once all are done.
+ */
+struct batch_file {
+    char *path;
+    bool object;
+    bool source_map;
+    /* The source, once it has been read. */
+    char *text;
+    size_t len;
+    int status;
+    char errmsg[MAX_ERROR_LEN + 1];
+};
+
+/*
+ * What a worker keeps across the files it assembles.
+ */
+struct worker {
+    AsmContext ctx;
+    char out_buffer[OUTPUT_BUFFER_SIZE];
+};
+
+struct batch {
+    struct batch_file *files;
+    unsigned count;
+    unsigned allocated;
+};
+
+
+static void batch_add(struct batch *batch, const char *path, int status, const char *errmsg)
+{
+    if (batch->count == batch->allocated) {
+        batch->allocated = batch->allocated ? batch->allocated * 2 : 16;
+        batch->files = asm_realloc(batch->files, batch->allocated * sizeof(struct batch_file));
+    }
+
+    struct batch_file *file = &batch->files[batch->count++];
+
+    file->path = asm_malloc(strlen(path) + 1);
+    strcpy(file->path, path);
+    file->object = false;
+    file->source_map = false;
+    file->text = NULL;
+    file->len = 0;
+    file->status = status;
+    strcpy(file->errmsg, errmsg);
+}
+
+static bool has_extension(const char *path, const char *ext)
+{
+    const char *dot = strrchr(path, '.');
+    return dot != NULL && !strcmp(dot, ext);
+}
+
+static int compare_files(const void *a, const void *b)
+{
+    return strcmp(((const struct batch_file *) a)->path,
+                  ((const struct batch_file *) b)->path);
+}
+
+/*
+ * Add path to the batch, or all .asm files under it if it is a directory.
+ * Paths that can't be assembled are added along with the error, so that
+ * they are reported in order with the rest. Symbolic links found in a
+ * directory are followed to files, but not to directories, which may lead
+ * back up the tree and have the walk loop.
+ */
+static void collect_files(struct batch *batch, const char *path, bool explicit)
+{
+    char errmsg[MAX_ERROR_LEN + 1];
+    struct stat path_stat, link_stat;
+    bool linked = !explicit && lstat(path, &link_stat) == 0 && S_ISLNK(link_stat.st_mode);
+
+    if (stat(path, &path_stat) != 0) {
+        int status = error_format(errmsg, EXIT_FILE_DOES_NOT_EXIST, path);
+        batch_add(batch, path, status, errmsg);
+    } else if (S_ISREG(path_stat.st_mode)) {
+        // files named on the command line are taken whatever their extension
+        if (explicit || has_extension(path, ASM_EXTENSION)) {
+            batch_add(batch, path, 0, "");
+        }
+    } else if (S_ISDIR(path_stat.st_mode) && !linked) {
+        DIR *d = opendir(path);
+        struct dirent *dir;
+        unsigned first = batch->count;
+
+        if (d == NULL) {
+            int status = error_format(errmsg, EXIT_CANNOT_OPEN_FILE, path);
+            batch_add(batch, path, status, errmsg);
+            return;
+        }
+
+        while ((dir = readdir(d)) != NULL) {
+            if (!strcmp(dir->d_name, ".") || !strcmp(dir->d_name, "..")) {
+                continue;
+            }
+            char child[strlen(path) + strlen(dir->d_name) + 2];
+            sprintf(child, "%s/%s", path, dir->d_name);
+            collect_files(batch, child, false);
+        }
+        closedir(d);
+
+        // readdir order is arbitrary; report in a predictable one
+        qsort(batch->files + first, batch->count - first,
+              sizeof(struct batch_file), compare_files);
+    } else if (explicit) {
+        int status = error_format(errmsg, EXIT_NOT_REGULAR_FILE, path);
+        batch_add(batch, path, status, errmsg);
+    }
+}
+
+/*
+ * Assemble a single file of the batch, already read, with the worker's
+ * context.
+ */
+static void assemble_file(void *ctx, void *arg)
+{
+    struct worker *worker = ctx;
+    struct batch_file *file = arg;
+    const char *extension = file->object ? OBJECT_EXTENSION : HACK_EXTENSION;
+    size_t len = strlen(file->path);
+    char path_out[len + strlen(extension) + 1];
+    FILE *fp_in, *fp_out;
+
+    strcpy(path_out, file->path);
+    if (has_extension(path_out, ASM_EXTENSION)) {
+        path_out[len - strlen(ASM_EXTENSION)] = '\0';
+    }
+    strcat(path_out, extension);
+
+    if ((fp_in = fmemopen(file->text, file->len, "r")) == NULL) {
+        file->status = error_format(file->errmsg, EXIT_OUT_OF_MEMORY);
+    } else if ((fp_out = fopen(path_out, file->object ? "wb" : "w")) == NULL) {
+        file->status = error_format(file->errmsg, EXIT_CANNOT_OPEN_FILE, path_out);
+        fclose(fp_in);
+    } else {
+        setvbuf(fp_out, worker->out_buffer, _IOFBF, OUTPUT_BUFFER_SIZE);
+
+        if (file->object) {
+            file->status = assemble_object(worker->ctx, fp_in, fp_out, file->errmsg);
+        } else {
+            file->status = assemble(worker->ctx, fp_in, fp_out, file->errmsg);
+        }
+
+        fclose(fp_in);
+        fclose(fp_out);
+
+        if (file->status) {
+            remove(path_out); // don't leave half a program behind
+        } else if (file->source_map) {
+            char asm_map_path[len + strlen(SRCMAP_EXTENSION) + 1];
+            char rom_map_path[sizeof(path_out) + strlen(SRCMAP_EXTENSION)];
+
+            strcat(strcpy(asm_map_path, file->path), SRCMAP_EXTENSION);
+            strcat(strcpy(rom_map_path, path_out), SRCMAP_EXTENSION);
+            file->status = assemble_source_map(worker->ctx, asm_map_path, rom_map_path,
+                                               file->errmsg);
+        }
+    }
+
+    free(file->text);
+    file->text = NULL;
+}
+
+static void *worker_init(void)
+{
+    struct worker *worker = asm_malloc(sizeof(struct worker));
+
+    worker->ctx = asm_context_init();
+
+    return worker;
+}
+
+static void worker_free(void *ctx)
+{
+    struct worker *worker = ctx;
+
+    asm_context_destroy(worker->ctx);
+    free(worker);
+}
+
+int assemble_batch(int npaths, char *paths[], int njobs, bool object, bool source_map)
+{
+    struct batch batch = { NULL, 0, 0 };
+    int status = 0;
+
+    for (int i = 0; i < npaths; i++) {
+        collect_files(&batch, paths[i], true);
+    }
+
+    // the files that can be assembled, all read at once
+    const char **sources = asm_malloc((batch.count + 1) * sizeof(const char *));
+    struct batch_file **files = asm_malloc((batch.count + 1) * sizeof(struct batch_file *));
+    int nsources = 0;
+
+    for (unsigned i = 0; i < batch.count; i++) {
+        if (batch.files[i].status == 0) {
+            sources[nsources] = batch.files[i].path;
+            files[nsources++] = &batch.files[i];
+        }
+    }
+
+    ThreadPool pool = threadpool_create(njobs, worker_init, worker_free);
+    FileReader reader = file_reader_start(nsources, sources);
+    struct file_contents contents;
+
+    if (pool == NULL || reader == NULL) {
+        exit_program(EXIT_OUT_OF_MEMORY);
+    }
+
+    // each file is assembled as soon as it has been read
+    while (file_reader_next(reader, &contents)) {
+        struct batch_file *file = files[contents.index];
+
+        if (contents.data == NULL) {
+            file->status = error_format(file->errmsg, contents.error == ENOMEM
+                                        ? EXIT_OUT_OF_MEMORY : EXIT_CANNOT_OPEN_FILE, file->path);
+            continue;
+        }
+        file->object = object;
+        file->source_map = source_map;
+        file->text = contents.data;
+        file->len = contents.len;
+        if (threadpool_submit(pool, assemble_file, file) != 0) {
+            exit_program(EXIT_OUT_OF_MEMORY);
+        }
+    }
+
+    file_reader_destroy(reader);
+    threadpool_destroy(pool);
+    free(sources);
+    free(files);
+
+    for (unsigned i = 0; i < batch.count; i++) {
+        struct batch_file *file = &batch.files[i];
+
+        if (file->status) {
+            char msg[strlen(file->path) + MAX_ERROR_LEN + 3];
+
+            // messages that already name the file don't need it twice
+            if (strstr(file->errmsg, file->path)) {
+                strcpy(msg, file->errmsg);
+            } else {
+                sprintf(msg, "%s: %s", file->path, file->errmsg);
+            }
+            error_print(msg);
+
+            if (!status) {
+                status = file->status;
+            }
+        }
+        free(file->path);
+    }
+
+    free(batch.files);
+
+    return status;
+}
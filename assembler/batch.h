@@ -0,0 +1,17 @@
+#pragma once
+
+#include <stdbool.h>
+
+/**
+ * Assemble every file in paths on njobs worker threads (one per CPU if
+ * njobs < 1). Directories are searched recursively for .asm files. Each
+ * program is written to a .hack file next to its source, or, if object is
+ * set, to a relocatable .hobj object. With source_map, the map of each
+ * program is composed from that of its source, X.asm.map, into X.hack.map.
+ *
+ * Errors are reported per file and don't stop the rest of the batch.
+ *
+ * retval - 0 if all files were assembled, else the exit code of the first
+ *          file that failed.
+ */
+int assemble_batch(int npaths, char *paths[], int njobs, bool object, bool source_map);
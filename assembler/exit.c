@@ -4,12 +4,16 @@
 #include "exit.h"
 
 
+const char *program_name = "Assembler";
+
 const char *error_messages[] =
 {
     [EXIT_FILE_DOES_NOT_EXIST] = "%s does not exist",
     [EXIT_NOT_REGULAR_FILE] = "%s is not a regular file",
     [EXIT_CANNOT_OPEN_FILE] = "Can't open file %s",
-    [EXIT_MANY_FILES] = "One and only one file operand is expected",
+    [EXIT_MANY_FILES] = "At least one file operand is expected",
+    [EXIT_SOCKET_ERROR] = "Can't listen on socket %s",
+    [EXIT_DAEMON_FAILED] = "No usable answer from daemon at %s",
     [EXIT_TOO_MANY_INSTRUCTIONS] = "File contains too many instructions. "
                                    "Only a maximum of %u instructions can be translated.",
     [EXIT_SYMBOL_ALREADY_EXISTS] = "Line %u: %s : Symbol is already defined",
@@ -18,20 +22,46 @@ const char *error_messages[] =
     [EXIT_INVALID_C_DEST] = "Line %u: %s : Invalid destination part of C-instruction",
     [EXIT_INVALID_C_COMP] = "Line %u: %s : Ivalid compare part of C-instruction",
     [EXIT_INVALID_C_JUMP] = "Line %u: %s : Invalid jump part of C-instruction",
+    [EXIT_INVALID_OPTION] = "Usage: assembler [-c | -g] [-j jobs] file... | assembler -d [-s socket] [-j jobs]",
     [EXIT_OUT_OF_MEMORY] = "CRITICAL: Unable to allocate memory!",
+    [EXIT_INVALID_HACK_WORD] = "Line %u: %s : Not a 16 bit binary machine instruction",
+    [EXIT_STEP_LIMIT] = "Stopped after the limit of %lu steps",
+    [EXIT_INVALID_OBJECT] = "%s is not a valid object file",
+    [EXIT_DUPLICATE_SYMBOL] = "%s: Symbol %s is already defined by another object",
+    [EXIT_INVALID_SOURCE_MAP] = "%s is not a valid source map",
 };
 
 
 void exit_program(enum exitcode code, ...)
 {
+    char msg[MAX_ERROR_LEN + 1];
     va_list arguments;
 
     va_start(arguments, code);
+    vsnprintf(msg, sizeof(msg), error_messages[code], arguments);
+    va_end(arguments);
 
-    printf("Assembler: ERROR: ");
-    vfprintf(stdout, error_messages[code], arguments);
-    printf("\n");
+    exit_with_message(code, msg);
+}
 
-    va_end(arguments);
+void exit_with_message(enum exitcode code, const char *msg)
+{
+    error_print(msg);
     exit(code);
 }
+
+void error_print(const char *msg)
+{
+    printf("%s: ERROR: %s\n", program_name, msg);
+}
+
+int error_format(char *msg, enum exitcode code, ...)
+{
+    va_list arguments;
+
+    va_start(arguments, code);
+    vsnprintf(msg, MAX_ERROR_LEN + 1, error_messages[code], arguments);
+    va_end(arguments);
+
+    return code;
+}
@@ -2,6 +2,11 @@
 
 #include <stdarg.h>
 
+/*
+ * Maximum length of a formatted error message.
+ */
+#define MAX_ERROR_LEN 511
+
 enum exitcode {
     /*
      * Exit code 1 represents that given file does not exist.
@@ -16,9 +21,17 @@ enum exitcode {
      */
     EXIT_CANNOT_OPEN_FILE = 3,
     /*
-     * Exit code 4 represents that more than 1 input files have been provided.
+     * Exit code 4 represents that no input file has been provided.
      */
     EXIT_MANY_FILES = 4,
+    /*
+     * Exit code 5 represents that the daemon socket couldn't be set up.
+     */
+    EXIT_SOCKET_ERROR = 5,
+    /*
+     * Exit code 6 represents that talking to the daemon failed.
+     */
+    EXIT_DAEMON_FAILED = 6,
     /*
      * Exit code 7 represents that file contains too many instructions to be translated.
      */
@@ -47,11 +60,62 @@ enum exitcode {
      * Exit code 13 represents that the jump part of a C-instruction is invalid.
      */
     EXIT_INVALID_C_JUMP = 13,
+    /*
+     * Exit code 14 represents that an invalid command line option was given.
+     */
+    EXIT_INVALID_OPTION = 14,
     /*
      * Exit code 15 represents that the program run out of memory.
      */
     EXIT_OUT_OF_MEMORY = 15,
+    /*
+     * Exit code 16 represents that a line of a .hack file is not a machine instruction.
+     */
+    EXIT_INVALID_HACK_WORD = 16,
+    /*
+     * Exit code 17 represents that a program was stopped after the maximum number of steps.
+     */
+    EXIT_STEP_LIMIT = 17,
+    /*
+     * Exit code 18 represents that a file is not a well formed object file.
+     */
+    EXIT_INVALID_OBJECT = 18,
+    /*
+     * Exit code 19 represents that two objects being linked define the same symbol.
+     */
+    EXIT_DUPLICATE_SYMBOL = 19,
+    /*
+     * Exit code 20 represents that a file is not a well formed source map.
+     */
+    EXIT_INVALID_SOURCE_MAP = 20,
 };
 
+/*
+ * Name of the program that error messages are reported by.
+ */
+extern const char *program_name;
+
 
+/**
+ * Print the error message that corresponds to code and terminate the program.
+ */
 void exit_program(enum exitcode code, ...);
+
+/**
+ * Print an already formatted error message and terminate the program.
+ */
+void exit_with_message(enum exitcode code, const char *msg);
+
+/**
+ * Print an already formatted error message without terminating the program.
+ */
+void error_print(const char *msg);
+
+/**
+ * Format the error message that corresponds to code into msg, which must be
+ * able to hold MAX_ERROR_LEN + 1 chars. This is for code paths that must not
+ * terminate the program, e.g. the daemon workers.
+ *
+ * retval - code
+ */
+int error_format(char *msg, enum exitcode code, ...);
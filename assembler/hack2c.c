@@ -0,0 +1,520 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "rom.h"
+#include "hack_standard.h"
+#include "exit.h"
+
+/*
+ * Ahead-of-time translator of Hack ROM images to C. The generated program
+ * runs the ROM natively once compiled with the system C compiler:
+ *
+ *     hack2c Pong.hack > pong.c && cc -O2 -o pong pong.c && ./pong
+ *
+ * Each instruction becomes a C statement on the A and D registers, kept in
+ * local variables, and a Hack sized RAM. Jumps whose target is known at
+ * translation time (the A register was loaded by an A-instruction in the same
+ * basic block) become plain gotos.
+ *
+ * A single function for the whole ROM takes C compilers ages to optimize
+ * for the ROM sizes VM programs reach, so the ROM is split in regions of
+ * REGION_SIZE words, one function each. A region returns the address to
+ * continue at whenever control leaves it, through a jump to another region
+ * or a computed jump, e.g. a VM return. It is then entered again through a
+ * switch over its labels. Addresses that start no block, which only computed
+ * jumps can reach, are interpreted one instruction at a time until one that
+ * does is reached.
+ *
+ * The generated program stops at a jump to itself, the usual way of ending
+ * a Hack program, when it runs past the end of the ROM, or when it reaches
+ * the address given with -h, e.g. that of Sys.halt, whose loop is no plain
+ * jump to itself, or, as hackx -n does, after the number of steps given with
+ * -n, since many programs, such as games, never stop by themselves. It then
+ * prints what it was asked to and exits with EXIT_STEP_LIMIT. Its arguments
+ * are RAM words to set before the run, as addr=value, and to print after it,
+ * as addr[:count].
+ *
+ * Steps are counted per straight run of code, which first checks that it
+ * fits in the steps left. One that doesn't leaves its region, and the steps
+ * left, fewer than its length and so none of them a jump, are interpreted
+ * one by one. The program thus stops at exactly the step hackx does.
+ */
+
+#define USAGE "Usage: hack2c [-n steps] [-h addr] file.hack"
+
+/* Longest C expression generated for a comp field. */
+#define MAX_EXPR_LEN 128
+
+/* Number of ROM words translated into a single C function. */
+#define REGION_SIZE 512
+
+/*
+ * C expressions for the comp fields that have a mnemonic, with %s standing
+ * for the A or M operand. The rest go through alu() at run time.
+ */
+static const char *comp_exprs[64] = {
+    [COMP_0] = "0",
+    [COMP_1] = "1",
+    [COMP_MINUS_1] = "-1",
+    [COMP_D] = "D",
+    [COMP_A] = "%s",
+    [COMP_NOT_D] = "~D",
+    [COMP_NOT_A] = "~%s",
+    [COMP_MINUS_D] = "-D",
+    [COMP_MINUS_A] = "-%s",
+    [COMP_D_PLUS_1] = "D + 1",
+    [COMP_A_PLUS_1] = "%s + 1",
+    [COMP_D_MINUS_1] = "D - 1",
+    [COMP_A_MINUS_1] = "%s - 1",
+    [COMP_D_PLUS_A] = "D + %s",
+    [COMP_D_MINUS_A] = "D - %s",
+    [COMP_A_MINUS_D] = "%s - D",
+    [COMP_D_AND_A] = "D & %s",
+    [COMP_D_OR_A] = "D | %s",
+};
+
+/* Jump conditions on the ALU output t, by jump field. */
+static const char *jump_conds[8] = {
+    [JMP_JGT] = "t > 0",
+    [JMP_JEQ] = "t == 0",
+    [JMP_JGE] = "t >= 0",
+    [JMP_JLT] = "t < 0",
+    [JMP_JNE] = "t != 0",
+    [JMP_JLE] = "t <= 0",
+};
+
+static const char prologue[] =
+    "#include <stdio.h>\n"
+    "#include <stdlib.h>\n"
+    "#include <string.h>\n"
+    "#include <stdint.h>\n"
+    "\n"
+    "#define RAM_SIZE 32768\n"
+    "#define M ram[(uint16_t) A & (RAM_SIZE - 1)]\n"
+    "\n"
+    "/* Address returned by a region once the program has stopped. */\n"
+    "#define HALT 0xffff\n"
+    "\n"
+    "#define LEAVE(pc) do { a_reg = A; d_reg = D; steps = n; return (pc); } while (0)\n"
+    "/* Leave at the start of a straight run that needs more steps than are left. */\n"
+    "#define SHORT(pc) do { short_of_steps = 1; LEAVE(pc); } while (0)\n"
+    "\n"
+    "static int16_t ram[RAM_SIZE];\n"
+    "/* A and D while no region runs. */\n"
+    "static int16_t a_reg, d_reg;\n"
+    "/* Instructions run so far, if counted, likewise. */\n"
+    "static unsigned long steps;\n"
+    "static int short_of_steps;\n"
+    "\n"
+    "static inline int16_t alu(unsigned comp, int16_t x, int16_t y)\n"
+    "{\n"
+    "    int16_t out;\n"
+    "\n"
+    "    if (comp & 0x20) x = 0;\n"
+    "    if (comp & 0x10) x = ~x;\n"
+    "    if (comp & 0x08) y = 0;\n"
+    "    if (comp & 0x04) y = ~y;\n"
+    "    out = comp & 0x02 ? (int16_t) (x + y) : (x & y);\n"
+    "    if (comp & 0x01) out = ~out;\n"
+    "\n"
+    "    return out;\n"
+    "}\n"
+    "\n"
+    "static inline int jumps(unsigned jump, int16_t out)\n"
+    "{\n"
+    "    return ((jump & 4) && out < 0) || ((jump & 2) && out == 0) || ((jump & 1) && out > 0);\n"
+    "}\n"
+    "\n";
+
+static const char interpreter[] =
+    "/* Run the single instruction at pc, which starts no block. */\n"
+    "static uint16_t step(uint16_t pc)\n"
+    "{\n"
+    "    uint16_t w = rom[pc];\n"
+    "    int16_t A = a_reg, D = d_reg, t;\n"
+    "\n"
+    "    steps++;\n"
+    "    if (!(w & 0x8000)) {\n"
+    "        a_reg = w;\n"
+    "        return pc + 1;\n"
+    "    }\n"
+    "    t = alu((w >> 6) & 0x3f, D, w & 0x1000 ? M : A);\n"
+    "    if (w & 0x08) M = t;\n"
+    "    if (w & 0x20) a_reg = t;\n"
+    "    if (w & 0x10) d_reg = t;\n"
+    "\n"
+    "    return jumps(w & 7, t) ? (uint16_t) A & (RAM_SIZE - 1) : pc + 1;\n"
+    "}\n"
+    "\n";
+
+static const char epilogue[] =
+    "/* Run the program, and tell whether it was stopped by the step limit. */\n"
+    "static int run(void)\n"
+    "{\n"
+    "    uint16_t pc = 0;\n"
+    "\n"
+    "    while (pc < ROM_SIZE && steps < STEP_LIMIT) {\n"
+    "        pc = regions[pc / REGION_SIZE](pc);\n"
+    "        while (short_of_steps && steps < STEP_LIMIT) {\n"
+    "            pc = step(pc);\n"
+    "        }\n"
+    "    }\n"
+    "    return pc < ROM_SIZE;\n"
+    "}\n"
+    "\n"
+    "int main(int argc, char *argv[])\n"
+    "{\n"
+    "    for (int i = 1; i < argc; i++) {\n"
+    "        char *eq = strchr(argv[i], '=');\n"
+    "\n"
+    "        if (eq) {\n"
+    "            ram[strtoul(argv[i], NULL, 10) & (RAM_SIZE - 1)] = (int16_t) atoi(eq + 1);\n"
+    "        }\n"
+    "    }\n"
+    "\n"
+    "    int limited = run();\n"
+    "\n"
+    "    for (int i = 1; i < argc; i++) {\n"
+    "        char *end;\n"
+    "        unsigned long addr = strtoul(argv[i], &end, 10);\n"
+    "        unsigned long count = *end == ':' ? strtoul(end + 1, NULL, 10) : 1;\n"
+    "\n"
+    "        if (*end == '=') {\n"
+    "            continue;\n"
+    "        }\n"
+    "        for (; count-- && addr < RAM_SIZE; addr++) {\n"
+    "            printf(\"RAM[%lu]=%d\\n\", addr, ram[addr]);\n"
+    "        }\n"
+    "    }\n"
+    "\n"
+    "    if (limited) {\n"
+    "        fprintf(stderr, \"%s: Stopped after the limit of %lu steps\\n\", argv[0], STEP_LIMIT);\n"
+    "        return EXIT_STEP_LIMIT;\n"
+    "    }\n"
+    "\n"
+    "    return 0;\n"
+    "}\n";
+
+struct translation {
+    const uint16_t *rom;
+    unsigned len;
+    /* Instructions that get a C label, because some jump may land there. */
+    bool *label;
+    /* Whether some jump has a target that is only known at run time. */
+    bool computed;
+    /* Address the program stops at, or -1. */
+    long halt;
+    /* Number of steps the program stops after, or 0 if it isn't counted. */
+    unsigned long max_steps;
+};
+
+
+/*
+ * Find the jump targets of the ROM, tracking the value of A through each
+ * basic block. Since every label ends a block, and forgets what A holds,
+ * this repeats until no new label turns up. Regions start with a label too.
+ */
+static void find_labels(struct translation *tr)
+{
+    bool changed = true;
+
+    for (unsigned i = 0; i < tr->len; i += REGION_SIZE) {
+        tr->label[i] = true;
+    }
+    if (tr->halt >= 0 && tr->halt < tr->len) {
+        tr->label[tr->halt] = true;
+    }
+
+    while (changed) {
+        bool known = false;
+        unsigned a = 0;
+
+        changed = false;
+
+        for (unsigned i = 0; i < tr->len; i++) {
+            uint16_t word = tr->rom[i];
+
+            if (tr->label[i]) {
+                known = false;
+            }
+            if (!(word & HACK_C_INST)) {
+                known = true;
+                a = word;
+                continue;
+            }
+
+            if (hack_jump(word) != JMP_NULL) {
+                if (!known) {
+                    changed |= !tr->computed;
+                    tr->computed = true;
+                } else if (a < tr->len && !tr->label[a]) {
+                    tr->label[a] = true;
+                    changed = true;
+                }
+            }
+            if (hack_dest(word) & DEST_A) {
+                known = false;
+            }
+        }
+
+        // A computed jump may land on any address the program loads into A.
+        if (tr->computed) {
+            for (unsigned i = 0; i < tr->len; i++) {
+                uint16_t word = tr->rom[i];
+
+                if (!(word & HACK_C_INST) && word < tr->len && !tr->label[word]) {
+                    tr->label[word] = true;
+                    changed = true;
+                }
+            }
+        }
+    }
+}
+
+/*
+ * Write the statements of a C-instruction. known tells whether A holds the
+ * constant a at this point.
+ */
+static void emit_c_inst(FILE *out, const struct translation *tr, unsigned i,
+                        bool known, unsigned a)
+{
+    uint16_t word = tr->rom[i];
+    unsigned comp = hack_comp(word);
+    unsigned dest = hack_dest(word);
+    unsigned jump = hack_jump(word);
+    char m[MAX_EXPR_LEN], expr[2 * MAX_EXPR_LEN];
+
+    if (known) {
+        sprintf(m, "ram[%u]", a);
+    } else {
+        strcpy(m, "M");
+    }
+
+    const char *y = word & HACK_A_BIT ? m : "A";
+
+    if (comp_exprs[comp]) {
+        sprintf(expr, comp_exprs[comp], y);
+    } else {
+        sprintf(expr, "alu(%u, D, %s)", comp, y);
+    }
+
+    // a single destination and no jump need no temporary
+    if (jump == JMP_NULL && (dest == DEST_M || dest == DEST_D || dest == DEST_A)) {
+        fprintf(out, "    %s = (int16_t) (%s);\n",
+                dest == DEST_M ? m : dest == DEST_D ? "D" : "A", expr);
+        return;
+    }
+    if (jump == JMP_NULL && dest == DEST_NULL) {
+        return; // no effect
+    }
+
+    fprintf(out, "    t = (int16_t) (%s);\n", expr);
+
+    // a jump goes to the value A had before this instruction
+    bool save_a = jump != JMP_NULL && !known && (dest & DEST_A);
+    if (save_a) {
+        fprintf(out, "    o = A;\n");
+    }
+    if (dest & DEST_M) {
+        fprintf(out, "    %s = t;\n", m);
+    }
+    if (dest & DEST_A) {
+        fprintf(out, "    A = t;\n");
+    }
+    if (dest & DEST_D) {
+        fprintf(out, "    D = t;\n");
+    }
+
+    if (jump == JMP_NULL) {
+        return;
+    }
+
+    fprintf(out, "    ");
+    if (jump != JMP_JMP) {
+        fprintf(out, "if (%s) ", jump_conds[jump]);
+    }
+
+    if (!known) {
+        fprintf(out, "LEAVE((uint16_t) %s & (RAM_SIZE - 1));\n", save_a ? "o" : "A");
+    } else if (a >= tr->len) {
+        fprintf(out, "LEAVE(HALT); /* past the end of the ROM */\n");
+    } else if (jump == JMP_JMP && i > 0 && a == i - 1 && tr->rom[i-1] == a) {
+        fprintf(out, "LEAVE(HALT);\n");
+    } else if (a / REGION_SIZE != i / REGION_SIZE) {
+        fprintf(out, "LEAVE(%u);\n", a);
+    } else {
+        fprintf(out, "goto L_%u;\n", a);
+    }
+}
+
+/*
+ * The number of instructions from i that run one after the other for sure:
+ * up to the next label, the next jump or end, whichever comes first.
+ */
+static unsigned straight_run(const struct translation *tr, unsigned i, unsigned end)
+{
+    unsigned n = 0;
+
+    while (i < end) {
+        uint16_t word = tr->rom[i++];
+
+        n++;
+        if (((word & HACK_C_INST) && hack_jump(word) != JMP_NULL) || tr->label[i]) {
+            break;
+        }
+    }
+    return n;
+}
+
+/*
+ * Write the function of the region that starts at first.
+ */
+static void emit_region(FILE *out, const struct translation *tr, unsigned first)
+{
+    unsigned end = first + REGION_SIZE < tr->len ? first + REGION_SIZE : tr->len;
+    bool known = false;
+    unsigned a = 0;
+
+    fprintf(out, "static uint16_t region_%u(uint16_t pc)\n{\n", first / REGION_SIZE);
+    fprintf(out, "    register int16_t A = a_reg, D = d_reg;\n");
+    fprintf(out, "    unsigned long n = steps;\n");
+    fprintf(out, "    int16_t t, o;\n");
+    fprintf(out, "    (void) t;\n");
+    fprintf(out, "    (void) o;\n\n");
+
+    fprintf(out, "    switch (pc) {\n");
+    for (unsigned i = first; i < end; i++) {
+        if (tr->label[i]) {
+            fprintf(out, "    case %u: goto L_%u;\n", i, i);
+        }
+    }
+    fprintf(out, "    }\n");
+    fprintf(out, "    return step(pc);\n\n");
+
+    for (unsigned i = first; i < end; i++) {
+        uint16_t word = tr->rom[i];
+
+        if (tr->label[i]) {
+            fprintf(out, "L_%u:\n", i);
+            known = false;
+        }
+        if (i == tr->halt) {
+            fprintf(out, "    LEAVE(HALT);\n");
+        }
+        if (tr->max_steps && (tr->label[i] || (i > first && (tr->rom[i-1] & HACK_C_INST)
+                                                && hack_jump(tr->rom[i-1]) != JMP_NULL))) {
+            unsigned run = straight_run(tr, i, end);
+
+            fprintf(out, "    if (n + %u > STEP_LIMIT) SHORT(%u);\n", run, i);
+            fprintf(out, "    n += %u;\n", run);
+        }
+
+        if (!(word & HACK_C_INST)) {
+            fprintf(out, "    A = %u;\n", word);
+            known = true;
+            a = word;
+            continue;
+        }
+
+        emit_c_inst(out, tr, i, known, a);
+
+        if (hack_dest(word) & DEST_A) {
+            known = false;
+        }
+    }
+    fprintf(out, "    LEAVE(%u);\n", end);
+    fprintf(out, "}\n\n");
+}
+
+static void translate(FILE *out, const char *filename, const struct translation *tr)
+{
+    fprintf(out, "/* Generated by hack2c from %s. */\n\n", filename);
+    fputs(prologue, out);
+    fprintf(out, "#define ROM_SIZE %u\n", tr->len);
+    fprintf(out, "#define REGION_SIZE %u\n", REGION_SIZE);
+    fprintf(out, "#define STEP_LIMIT %luUL\n", tr->max_steps ? tr->max_steps : (unsigned long) -1);
+    fprintf(out, "#define EXIT_STEP_LIMIT %d\n\n", EXIT_STEP_LIMIT);
+
+    fprintf(out, "static const uint16_t rom[ROM_SIZE] = {");
+    for (unsigned i = 0; i < tr->len; i++) {
+        fprintf(out, "%s%u,", i % 12 ? " " : "\n    ", tr->rom[i]);
+    }
+    fprintf(out, "\n};\n\n");
+
+    fputs(interpreter, out);
+
+    for (unsigned i = 0; i < tr->len; i += REGION_SIZE) {
+        emit_region(out, tr, i);
+    }
+
+    fprintf(out, "static uint16_t (*const regions[])(uint16_t) = {\n");
+    for (unsigned i = 0; i < tr->len; i += REGION_SIZE) {
+        fprintf(out, "    region_%u,\n", i / REGION_SIZE);
+    }
+    fprintf(out, "};\n\n");
+
+    fputs(epilogue, out);
+}
+
+int main(int argc, char *argv[])
+{
+    static uint16_t rom[HACK_ROM_SIZE];
+    char errmsg[MAX_ERROR_LEN + 1];
+    struct translation tr = { .rom = rom, .halt = -1 };
+    char *endptr;
+    int opt;
+
+    program_name = "hack2c";
+
+    while ((opt = getopt(argc, argv, "n:h:")) != -1) {
+        switch (opt) {
+        case 'n':
+            tr.max_steps = strtoul(optarg, &endptr, 10);
+            if (endptr == optarg || *endptr || tr.max_steps == 0) {
+                exit_with_message(EXIT_INVALID_OPTION, USAGE);
+            }
+            break;
+        case 'h':
+            tr.halt = strtol(optarg, &endptr, 10);
+            if (endptr == optarg || *endptr || tr.halt < 0 || tr.halt > MAX_HACK_ADDRESS) {
+                exit_with_message(EXIT_INVALID_OPTION, USAGE);
+            }
+            break;
+        default:
+            exit_with_message(EXIT_INVALID_OPTION, USAGE);
+        }
+    }
+
+    if (argc - optind != 1) {
+        exit_with_message(EXIT_INVALID_OPTION, USAGE);
+    }
+
+    const char *filename = argv[optind];
+    FILE *fp = fopen(filename, "r");
+
+    if (fp == NULL) {
+        exit_program(EXIT_CANNOT_OPEN_FILE, filename);
+    }
+
+    int status = rom_load(fp, rom, &tr.len, errmsg);
+    fclose(fp);
+
+    if (status) {
+        exit_with_message(status, errmsg);
+    }
+
+    tr.label = calloc(tr.len + 1, sizeof(bool));
+    if (tr.label == NULL) {
+        exit_program(EXIT_OUT_OF_MEMORY);
+    }
+
+    find_labels(&tr);
+    translate(stdout, filename, &tr);
+
+    free(tr.label);
+
+    return 0;
+}
@@ -2,6 +2,8 @@
 
 #include <inttypes.h>
 #include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
 
 
 #define MAX_HACK_ADDRESS INT16_MAX
@@ -53,19 +55,40 @@ typedef enum sym_id {
 } sym_id;
 
 typedef struct predef_symbol {
-    char name[50+1];
+    const char *name;
     hack_addr address;
 } predef_symbol;
 
+/*
+ * Kept sorted by name, so that predef_lookup() can binary search it.
+ */
 static const predef_symbol predef_symbols[NUM_PREDEFINED_SYMS] = {
-    {"R0", SYM_R0}, {"R1", SYM_R1}, {"R2", SYM_R2}, {"R3", SYM_R3}, {"R4", SYM_R4},
-    {"R5", SYM_R5}, {"R6", SYM_R6}, {"R7", SYM_R7}, {"R8", SYM_R9}, {"R9", SYM_R9},
-    {"R10", SYM_R10}, {"R11", SYM_R11}, {"R12", SYM_R12}, {"R13", SYM_R13},
-    {"R14", SYM_R14}, {"R15", SYM_R15}, {"SCREEN", SYM_SCREEN}, {"KBD", SYM_KBD},
-    {"SP", SYM_SP}, {"LCL", SYM_LCL}, {"ARG", SYM_ARG}, {"THIS", SYM_THIS},
-    {"THAT", SYM_THAT},
+    {"ARG", SYM_ARG}, {"KBD", SYM_KBD}, {"LCL", SYM_LCL},
+    {"R0", SYM_R0}, {"R1", SYM_R1}, {"R10", SYM_R10}, {"R11", SYM_R11},
+    {"R12", SYM_R12}, {"R13", SYM_R13}, {"R14", SYM_R14}, {"R15", SYM_R15},
+    {"R2", SYM_R2}, {"R3", SYM_R3}, {"R4", SYM_R4}, {"R5", SYM_R5},
+    {"R6", SYM_R6}, {"R7", SYM_R7}, {"R8", SYM_R8}, {"R9", SYM_R9},
+    {"SCREEN", SYM_SCREEN}, {"SP", SYM_SP}, {"THAT", SYM_THAT},
+    {"THIS", SYM_THIS},
 };
 
+static inline int predef_compare(const void *name, const void *symbol)
+{
+    return strcmp(name, ((const predef_symbol *) symbol)->name);
+}
+
+/*
+ * Look a symbol up in the predefined symbols.
+ *
+ * retval - The symbol's address, or -1 if it isn't a predefined symbol.
+ */
+static inline hack_addr predef_lookup(const char *name)
+{
+    const predef_symbol *s = bsearch(name, predef_symbols, NUM_PREDEFINED_SYMS,
+                                     sizeof(predef_symbol), predef_compare);
+    return s ? s->address : -1;
+}
+
 
 typedef enum jump_id {
     JMP_INVALID= -1,
@@ -253,3 +276,86 @@ static inline jump_id str_to_jumpid(const char *s)
 
     return id;
 }
+
+
+/*
+ * Decoding of machine instructions, as loaded from .hack files.
+ *
+ * A C-instruction is 111a cccc ccdd djjj. Its dest and jump fields are bit
+ * sets, with the values of dest_id and jump_id, and its comp field drives
+ * the ALU control bits zx, nx, zy, ny, f and no, in that order.
+ */
+#define HACK_C_INST  0x8000
+#define HACK_A_BIT   0x1000
+
+/*
+ * Printing of machine instructions as the lines of a .hack file:
+ *
+ *     printf(OPCODE_STR"\n", OPCODE_TO_BINARY(op));
+ */
+#define OPCODE_STR "%c%c%c%c%c%c%c%c%c%c%c%c%c%c%c%c"
+
+#define OPCODE_TO_BINARY(opcode) \
+  (opcode & 0x8000 ? '1' : '0'), \
+  (opcode & 0x4000 ? '1' : '0'), \
+  (opcode & 0x2000 ? '1' : '0'), \
+  (opcode & 0x1000 ? '1' : '0'), \
+  (opcode & 0x0800 ? '1' : '0'), \
+  (opcode & 0x0400 ? '1' : '0'), \
+  (opcode & 0x0200 ? '1' : '0'), \
+  (opcode & 0x0100 ? '1' : '0'), \
+  (opcode & 0x0080 ? '1' : '0'), \
+  (opcode & 0x0040 ? '1' : '0'), \
+  (opcode & 0x0020 ? '1' : '0'), \
+  (opcode & 0x0010 ? '1' : '0'), \
+  (opcode & 0x0008 ? '1' : '0'), \
+  (opcode & 0x0004 ? '1' : '0'), \
+  (opcode & 0x0002 ? '1' : '0'), \
+  (opcode & 0x0001 ? '1' : '0')
+
+/* Number of words of the ROM and the RAM. */
+#define HACK_ROM_SIZE  (MAX_HACK_ADDRESS + 1)
+#define HACK_RAM_SIZE  (MAX_HACK_ADDRESS + 1)
+
+static inline unsigned hack_comp(uint16_t word)
+{
+    return (word >> 6) & 0x3f;
+}
+
+static inline unsigned hack_dest(uint16_t word)
+{
+    return (word >> 3) & 7;
+}
+
+static inline unsigned hack_jump(uint16_t word)
+{
+    return word & 7;
+}
+
+/*
+ * Compute what the Hack ALU outputs for x (D) and y (A or M). This covers
+ * every comp field, including the ones that have no mnemonic.
+ */
+static inline int16_t hack_alu(unsigned comp, int16_t x, int16_t y)
+{
+    int16_t out;
+
+    if (comp & 0x20) x = 0;
+    if (comp & 0x10) x = ~x;
+    if (comp & 0x08) y = 0;
+    if (comp & 0x04) y = ~y;
+    out = comp & 0x02 ? (int16_t) (x + y) : (x & y);
+    if (comp & 0x01) out = ~out;
+
+    return out;
+}
+
+/*
+ * Whether the jump field makes the CPU jump for the given ALU output.
+ */
+static inline bool hack_jumps(unsigned jump, int16_t out)
+{
+    return ((jump & JMP_JLT) && out < 0)
+        || ((jump & JMP_JEQ) && out == 0)
+        || ((jump & JMP_JGT) && out > 0);
+}
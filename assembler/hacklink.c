@@ -0,0 +1,148 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "object.h"
+#include "symbol_table.h"
+#include "hack_standard.h"
+#include "exit.h"
+
+/*
+ * Linker of the relocatable objects written by assembler -c:
+ *
+ *     assembler -c Main.asm Lib.asm && hacklink Main.hobj Lib.hobj > Prog.hack
+ *
+ * The objects are laid out in the ROM in the order given, so the one with
+ * the entry point comes first. Their exports are collected before any import
+ * is resolved, and the imports no object exports are allocated as variables
+ * in the order the objects use them first, so that the program is the same
+ * as that of assembling the concatenation of the modules. Only the modules
+ * that changed need to be assembled again before linking.
+ */
+
+#define USAGE "Usage: hacklink [-o file.hack] object..."
+
+
+/*
+ * Read the object at path into obj, or exit.
+ */
+static void read_object(struct hack_object *obj, const char *path)
+{
+    char errmsg[MAX_ERROR_LEN + 1];
+    FILE *fp = fopen(path, "rb");
+    int status;
+
+    if (fp == NULL) {
+        exit_program(EXIT_CANNOT_OPEN_FILE, path);
+    }
+    status = object_read(obj, fp, path, errmsg);
+    fclose(fp);
+
+    if (status) {
+        exit_with_message(status, errmsg);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    const char *output = NULL;
+    FILE *fp_out = stdout;
+    int opt;
+
+    program_name = "hacklink";
+
+    while ((opt = getopt(argc, argv, "o:")) != -1) {
+        switch (opt) {
+        case 'o':
+            output = optarg;
+            break;
+        default:
+            exit_with_message(EXIT_INVALID_OPTION, USAGE);
+        }
+    }
+
+    int nobjects = argc - optind;
+    char **paths = argv + optind;
+
+    if (nobjects < 1) {
+        exit_with_message(EXIT_INVALID_OPTION, USAGE);
+    }
+
+    struct hack_object *objects = calloc(nobjects, sizeof(struct hack_object));
+    uint32_t *bases = calloc(nobjects, sizeof(uint32_t));
+    SymbolTable symtab = symtab_init();
+    uint32_t len = 0;
+
+    if (objects == NULL || bases == NULL) {
+        exit_program(EXIT_OUT_OF_MEMORY);
+    }
+
+    for (int i = 0; i < nobjects; i++) {
+        read_object(&objects[i], paths[i]);
+        bases[i] = len;
+        len += objects[i].len;
+        if (len > HACK_ROM_SIZE) {
+            exit_program(EXIT_TOO_MANY_INSTRUCTIONS, MAX_INSTRUCTION + 1);
+        }
+    }
+
+    for (int i = 0; i < nobjects; i++) {
+        const struct hack_object *obj = &objects[i];
+
+        for (uint32_t e = 0; e < obj->nexports; e++) {
+            const char *name = obj->strings + obj->exports[e].name;
+
+            if (symtab_lookup(symtab, name) != SYMBOL_NOT_FOUND) {
+                exit_program(EXIT_DUPLICATE_SYMBOL, paths[i], name);
+            }
+            symtab_add(symtab, name, bases[i] + obj->exports[e].address);
+        }
+    }
+
+    for (int i = 0; i < nobjects; i++) {
+        struct hack_object *obj = &objects[i];
+        hack_addr *addresses = malloc((obj->nimports + 1) * sizeof(hack_addr));
+
+        if (addresses == NULL) {
+            exit_program(EXIT_OUT_OF_MEMORY);
+        }
+        // in order of first use, as the assembler would allocate them
+        for (uint32_t s = 0; s < obj->nimports; s++) {
+            addresses[s] = symtab_resolve(symtab, obj->strings + obj->imports[s]);
+        }
+        for (uint32_t r = 0; r < obj->nrelocs; r++) {
+            const struct object_reloc *reloc = &obj->relocs[r];
+
+            if (reloc->symbol == OBJECT_LOCAL) {
+                obj->code[reloc->offset] += bases[i];
+            } else {
+                obj->code[reloc->offset] = addresses[reloc->symbol];
+            }
+        }
+        free(addresses);
+    }
+
+    if (output && (fp_out = fopen(output, "w")) == NULL) {
+        exit_program(EXIT_CANNOT_OPEN_FILE, output);
+    }
+
+    for (int i = 0; i < nobjects; i++) {
+        for (uint32_t w = 0; w < objects[i].len; w++) {
+            uint16_t op = objects[i].code[w];
+
+            fprintf(fp_out, OPCODE_STR"\n", OPCODE_TO_BINARY(op));
+        }
+        object_free(&objects[i]);
+    }
+
+    if (fp_out != stdout) {
+        fclose(fp_out);
+    }
+    symtab_destroy(symtab);
+    free(objects);
+    free(bases);
+
+    return 0;
+}
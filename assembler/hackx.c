@@ -0,0 +1,249 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+
+#include "jit.h"
+#include "rom.h"
+#include "hack_standard.h"
+#include "exit.h"
+
+/*
+ * Executor of .hack ROM images. Programs start out interpreted; blocks that
+ * run HOT_BLOCK times are compiled to native code (see jit.h), so that long
+ * running programs spend their time there. Unlike hack2c, this needs no C
+ * compiler, and runs any ROM as it is.
+ *
+ * A program stops at a jump to itself, when it runs past the end of the ROM
+ * or when it reaches the address given with -h, e.g. that of Sys.halt.
+ */
+
+#define USAGE "Usage: hackx [-i] [-n steps] [-h addr] [-s addr=value]... [-p addr[:count]]... file.hack"
+
+/* Max number of -s and -p options. */
+#define MAX_RAM_OPTS 100
+
+/* Number of times a block is interpreted before it gets compiled. */
+#define HOT_BLOCK 8
+
+struct ram_range {
+    unsigned addr;
+    unsigned count;
+};
+
+struct executor {
+    const uint16_t *rom;
+    unsigned len;
+    long halt;
+    /* NULL when interpreting only. */
+    struct jit *jit;
+    /* Number of times each block was interpreted. */
+    uint8_t hits[HACK_ROM_SIZE];
+};
+
+
+/*
+ * Interpret from pc to the end of its basic block, i.e. the next C-instruction
+ * that has a jump, or until the budget runs out. This is the only code that
+ * accesses the memory mapped I/O area, where the screen and the keyboard are
+ * plain memory for now.
+ *
+ * \retval - where to go on, with JIT_HALT if the program jumped to itself.
+ */
+static uint32_t interpret(const struct executor *x, struct jit_regs *regs, uint16_t pc)
+{
+    int16_t *ram = regs->ram;
+
+    while (pc < x->len && pc != x->halt && regs->budget) {
+        uint16_t word = x->rom[pc];
+
+        regs->budget--;
+
+        if (!(word & HACK_C_INST)) {
+            regs->a = word;
+            pc++;
+            continue;
+        }
+
+        uint16_t addr = (uint16_t) regs->a & MAX_HACK_ADDRESS;
+        int16_t y = word & HACK_A_BIT ? ram[addr] : (int16_t) regs->a;
+        int16_t out = hack_alu(hack_comp(word), (int16_t) regs->d, y);
+        unsigned dest = hack_dest(word);
+        unsigned jump = hack_jump(word);
+
+        if (dest & DEST_M) {
+            ram[addr] = out;
+        }
+        if (dest & DEST_A) {
+            regs->a = out;
+        }
+        if (dest & DEST_D) {
+            regs->d = out;
+        }
+
+        if (jump == JMP_NULL) {
+            pc++;
+        } else if (!hack_jumps(jump, out)) {
+            return pc + 1;
+        } else if (pc > 0 && addr == pc - 1 && x->rom[addr] == addr) {
+            return addr | JIT_HALT;
+        } else {
+            return addr;
+        }
+    }
+
+    return pc;
+}
+
+/*
+ * Run the program until it stops or the budget runs out.
+ *
+ * \retval - whether the program stopped.
+ */
+static bool run(struct executor *x, struct jit_regs *regs)
+{
+    uint16_t pc = 0;
+    uint32_t next;
+
+    for (;;) {
+        if (pc >= x->len || pc == x->halt) {
+            return true;
+        }
+        if (!regs->budget) {
+            return false;
+        }
+
+        if (x->jit && !jit_compiled(x->jit, pc) && ++x->hits[pc] >= HOT_BLOCK) {
+            jit_compile(x->jit, pc);
+        }
+
+        if (x->jit && jit_compiled(x->jit, pc)) {
+            next = jit_run(x->jit, regs, pc);
+            if (next & (JIT_IO | JIT_BUDGET)) {
+                next = interpret(x, regs, JIT_PC(next));
+            }
+        } else {
+            next = interpret(x, regs, pc);
+        }
+
+        if (next & JIT_HALT) {
+            return true;
+        }
+        pc = JIT_PC(next);
+    }
+}
+
+static bool parse_range(const char *s, struct ram_range *range)
+{
+    char *endptr;
+
+    range->addr = strtoul(s, &endptr, 10);
+    range->count = 1;
+    if (*endptr == ':') {
+        range->count = strtoul(endptr + 1, &endptr, 10);
+    }
+
+    return endptr != s && !*endptr && range->addr + range->count <= HACK_RAM_SIZE;
+}
+
+int main(int argc, char *argv[])
+{
+    static uint16_t rom[HACK_ROM_SIZE];
+    static int16_t ram[HACK_RAM_SIZE];
+    static struct executor x = { .rom = rom, .halt = -1 };
+    char errmsg[MAX_ERROR_LEN + 1];
+    /*
+     * RAM words to set before (-s) and print after (-p) the run.
+     */
+    struct ram_range sets[MAX_RAM_OPTS], prints[MAX_RAM_OPTS];
+    int16_t values[MAX_RAM_OPTS];
+    int nsets = 0, nprints = 0;
+    unsigned long max_steps = (unsigned long) -1;
+    bool interpret_only = false;
+    char *endptr, *eq;
+    int opt;
+
+    program_name = "hackx";
+
+    while ((opt = getopt(argc, argv, "in:h:s:p:")) != -1) {
+        switch (opt) {
+        case 'i':
+            interpret_only = true;
+            break;
+        case 'n':
+            max_steps = strtoul(optarg, NULL, 10);
+            break;
+        case 'h':
+            x.halt = strtol(optarg, &endptr, 10);
+            if (endptr == optarg || *endptr || x.halt < 0 || x.halt > MAX_HACK_ADDRESS) {
+                exit_with_message(EXIT_INVALID_OPTION, USAGE);
+            }
+            break;
+        case 's':
+            eq = strchr(optarg, '=');
+            if (eq == NULL || nsets == MAX_RAM_OPTS) {
+                exit_with_message(EXIT_INVALID_OPTION, USAGE);
+            }
+            *eq = '\0';
+            if (!parse_range(optarg, &sets[nsets])) {
+                exit_with_message(EXIT_INVALID_OPTION, USAGE);
+            }
+            values[nsets++] = (int16_t) atoi(eq + 1);
+            break;
+        case 'p':
+            if (nprints == MAX_RAM_OPTS || !parse_range(optarg, &prints[nprints++])) {
+                exit_with_message(EXIT_INVALID_OPTION, USAGE);
+            }
+            break;
+        default:
+            exit_with_message(EXIT_INVALID_OPTION, USAGE);
+        }
+    }
+
+    if (argc - optind != 1) {
+        exit_with_message(EXIT_INVALID_OPTION, USAGE);
+    }
+
+    FILE *fp = fopen(argv[optind], "r");
+
+    if (fp == NULL) {
+        exit_program(EXIT_CANNOT_OPEN_FILE, argv[optind]);
+    }
+
+    int status = rom_load(fp, rom, &x.len, errmsg);
+    fclose(fp);
+
+    if (status) {
+        exit_with_message(status, errmsg);
+    }
+
+    // without a usable JIT, everything is interpreted
+    if (!interpret_only && jit_supported()) {
+        x.jit = jit_create(rom, x.len, x.halt);
+    }
+
+    for (int i = 0; i < nsets; i++) {
+        for (unsigned a = 0; a < sets[i].count; a++) {
+            ram[sets[i].addr + a] = values[i];
+        }
+    }
+
+    struct jit_regs regs = { .ram = ram, .budget = max_steps };
+    bool stopped = run(&x, &regs);
+
+    for (int i = 0; i < nprints; i++) {
+        for (unsigned a = 0; a < prints[i].count; a++) {
+            printf("RAM[%u]=%d\n", prints[i].addr + a, ram[prints[i].addr + a]);
+        }
+    }
+
+    jit_destroy(x.jit);
+
+    if (!stopped) {
+        exit_program(EXIT_STEP_LIMIT, max_steps);
+    }
+
+    return 0;
+}
@@ -0,0 +1,670 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+
+#include "jit.h"
+#include "hack_standard.h"
+
+#if defined(__x86_64__) && defined(__linux__)
+
+#include <sys/mman.h>
+
+/*
+ * Size of the code buffer. When it is full, all code is thrown away and
+ * compiled again as it runs.
+ */
+#define CODE_SIZE (8 << 20)
+
+/* Longest block, in instructions. */
+#define MAX_BLOCK_LEN 64
+/* Upper bound of the code of one instruction, and of a block's entry. */
+#define MAX_INST_CODE 160
+#define MAX_ENTRY_CODE 64
+
+/* x86-64 registers, by encoding. */
+enum reg {
+    RAX = 0, RCX = 1, RDX = 2, RBX = 3, RSI = 6, RDI = 7,
+    R12 = 12, R13 = 13, R14 = 14, R15 = 15,
+};
+
+/*
+ * Registers of compiled code. SCRATCH_* are free between instructions. The
+ * others live in callee-saved registers, so that the trampoline only needs
+ * to save them once.
+ */
+#define REG_A       R12
+#define REG_D       R13
+#define REG_RAM     RBX
+#define REG_BLOCKS  R14
+#define REG_BUDGET  R15
+
+/* Opcodes of the 32-bit register to register operations used. */
+#define OP_ADD  0x01
+#define OP_OR   0x09
+#define OP_AND  0x21
+#define OP_SUB  0x29
+#define OP_XOR  0x31
+#define OP_MOV  0x89
+#define OP_TEST 0x85
+
+/* Extensions of opcode 0xf7. */
+#define EXT_NOT 2
+#define EXT_NEG 3
+
+/* Second opcode byte of the jcc rel32 that skips a jump, by jump field. */
+static const uint8_t skip_jcc[8] = {
+    [JMP_JGT] = 0x8e,  // jle
+    [JMP_JEQ] = 0x85,  // jne
+    [JMP_JGE] = 0x8c,  // jl
+    [JMP_JLT] = 0x8d,  // jge
+    [JMP_JNE] = 0x84,  // je
+    [JMP_JLE] = 0x8f,  // jg
+};
+
+/* A jump to a block that wasn't compiled when the jump was. */
+struct patch {
+    uint32_t offset;
+    int32_t next;
+};
+
+struct jit {
+    const uint16_t *rom;
+    unsigned len;
+    long halt;
+
+    uint8_t *code;
+    size_t used;
+    /* Bytes taken by the trampoline and the exit stub, which stay. */
+    size_t stubs;
+    uint8_t *exit;
+    uint32_t (*enter)(struct jit_regs *regs, void *block);
+
+    void *blocks[HACK_ROM_SIZE];
+
+    /* Jumps waiting for the block at each address, as lists of patches. */
+    int32_t pending[HACK_ROM_SIZE];
+    struct patch *patches;
+    unsigned npatches;
+    unsigned max_patches;
+};
+
+
+static inline void emit8(struct jit *jit, uint8_t b)
+{
+    jit->code[jit->used++] = b;
+}
+
+static inline void emit32(struct jit *jit, uint32_t v)
+{
+    memcpy(jit->code + jit->used, &v, 4);
+    jit->used += 4;
+}
+
+/* Displacement of a rel32 ending at the end of the code so far. */
+static inline void emit_rel32(struct jit *jit, const uint8_t *target)
+{
+    emit32(jit, (uint32_t) (target - (jit->code + jit->used + 4)));
+}
+
+static void emit_rex(struct jit *jit, bool w, unsigned reg, unsigned base)
+{
+    uint8_t rex = 0x40 | (w << 3) | ((reg >> 3) << 2) | (base >> 3);
+
+    if (rex != 0x40) {
+        emit8(jit, rex);
+    }
+}
+
+/* op dst, src on 32-bit registers. */
+static void emit_op_rr(struct jit *jit, uint8_t op, unsigned dst, unsigned src)
+{
+    emit_rex(jit, false, src, dst);
+    emit8(jit, op);
+    emit8(jit, 0xc0 | (src & 7) << 3 | (dst & 7));
+}
+
+static void emit_mov_rr(struct jit *jit, unsigned dst, unsigned src)
+{
+    if (dst != src) {
+        emit_op_rr(jit, OP_MOV, dst, src);
+    }
+}
+
+static void emit_unary(struct jit *jit, unsigned ext, unsigned reg)
+{
+    emit_rex(jit, false, 0, reg);
+    emit8(jit, 0xf7);
+    emit8(jit, 0xc0 | ext << 3 | (reg & 7));
+}
+
+/* add reg, imm8, which also subtracts with negative values. */
+static void emit_add_imm8(struct jit *jit, unsigned reg, int8_t imm)
+{
+    emit_rex(jit, false, 0, reg);
+    emit8(jit, 0x83);
+    emit8(jit, 0xc0 | (reg & 7));
+    emit8(jit, (uint8_t) imm);
+}
+
+static void emit_mov_imm(struct jit *jit, unsigned reg, uint32_t imm)
+{
+    if (imm == 0) {
+        emit_op_rr(jit, OP_XOR, reg, reg);
+        return;
+    }
+    emit_rex(jit, false, 0, reg);
+    emit8(jit, 0xb8 | (reg & 7));
+    emit32(jit, imm);
+}
+
+/* add or sub (ext 0 or 5) of the budget register, with an imm32. */
+static void emit_budget(struct jit *jit, unsigned ext, uint32_t imm)
+{
+    emit_rex(jit, true, 0, REG_BUDGET);
+    emit8(jit, 0x81);
+    emit8(jit, 0xc0 | ext << 3 | (REG_BUDGET & 7));
+    emit32(jit, imm);
+}
+
+/* mov between a register and [rdi + disp8], with load opcode 0x8b. */
+static void emit_regs_mov(struct jit *jit, uint8_t op, bool w, unsigned reg, size_t disp)
+{
+    emit_rex(jit, w, reg, RDI);
+    emit8(jit, op);
+    emit8(jit, 0x40 | (reg & 7) << 3 | RDI);
+    emit8(jit, (uint8_t) disp);
+}
+
+/*
+ * The ModRM and SIB bytes of M for a register operand: [rbx + 2*addr] if
+ * the address is known, else [rbx + 2*rax], with the address in eax.
+ */
+static void emit_m_operand(struct jit *jit, unsigned reg, bool known, unsigned addr)
+{
+    if (known) {
+        emit8(jit, 0x80 | (reg & 7) << 3 | REG_RAM);
+        emit32(jit, 2 * addr);
+    } else {
+        emit8(jit, 0x04 | (reg & 7) << 3);
+        emit8(jit, 0x40 | RAX << 3 | REG_RAM);
+    }
+}
+
+/* movsx reg, word M */
+static void emit_load_m(struct jit *jit, unsigned reg, bool known, unsigned addr)
+{
+    emit_rex(jit, false, reg, 0);
+    emit8(jit, 0x0f);
+    emit8(jit, 0xbf);
+    emit_m_operand(jit, reg, known, addr);
+}
+
+/* mov word M, reg */
+static void emit_store_m(struct jit *jit, unsigned reg, bool known, unsigned addr)
+{
+    emit8(jit, 0x66);
+    emit_rex(jit, false, reg, 0);
+    emit8(jit, 0x89);
+    emit_m_operand(jit, reg, known, addr);
+}
+
+/* mov eax, value; jmp exit */
+static void emit_exit(struct jit *jit, uint32_t value)
+{
+    emit8(jit, 0xb8);
+    emit32(jit, value);
+    emit8(jit, 0xe9);
+    emit_rel32(jit, jit->exit);
+}
+
+/*
+ * Leave for the executor, giving back the budget of the count instructions
+ * that were not executed.
+ */
+static void emit_side_exit(struct jit *jit, unsigned count, uint32_t value)
+{
+    emit_budget(jit, 0, count);
+    emit_exit(jit, value);
+}
+
+/*
+ * Jump to the known address target from the instruction at pc. Jumps to
+ * blocks that aren't compiled yet leave for the executor until they are.
+ */
+static void emit_jump(struct jit *jit, unsigned pc, unsigned target)
+{
+    if (pc > 0 && target == pc - 1 && jit->rom[target] == target) {
+        emit_exit(jit, target | JIT_HALT);
+    } else if (target >= jit->len || target == jit->halt) {
+        emit_exit(jit, target);
+    } else if (jit->blocks[target]) {
+        emit8(jit, 0xe9);
+        emit_rel32(jit, jit->blocks[target]);
+    } else {
+        if (jit->npatches == jit->max_patches) {
+            unsigned max = jit->max_patches ? 2 * jit->max_patches : 1024;
+            struct patch *p = realloc(jit->patches, max * sizeof(*p));
+
+            if (p == NULL) {
+                emit_exit(jit, target);  // stays slow, but correct
+                return;
+            }
+            jit->patches = p;
+            jit->max_patches = max;
+        }
+        jit->patches[jit->npatches] = (struct patch) {
+            .offset = jit->used,
+            .next = jit->pending[target],
+        };
+        jit->pending[target] = jit->npatches++;
+        emit_exit(jit, target);
+    }
+}
+
+/*
+ * Jump to the address in reg through the table of compiled blocks.
+ */
+static void emit_computed_jump(struct jit *jit, unsigned reg)
+{
+    emit_mov_rr(jit, RAX, reg);
+    emit8(jit, 0x25);                   // and eax, MAX_HACK_ADDRESS
+    emit32(jit, MAX_HACK_ADDRESS);
+    emit8(jit, 0x49);                   // mov rcx, [r14 + 8*rax]
+    emit8(jit, 0x8b);
+    emit8(jit, 0x0c);
+    emit8(jit, 0xc0 | RAX << 3 | (REG_BLOCKS & 7));
+    emit8(jit, 0x48);                   // test rcx, rcx
+    emit8(jit, OP_TEST);
+    emit8(jit, 0xc9);
+    emit8(jit, 0x0f);                   // jz exit
+    emit8(jit, 0x84);
+    emit_rel32(jit, jit->exit);
+    emit8(jit, 0xff);                   // jmp rcx
+    emit8(jit, 0xe1);
+}
+
+/*
+ * Compute the comp field into ecx, from D and y, which holds A or M.
+ */
+static void emit_comp(struct jit *jit, unsigned comp, unsigned y)
+{
+    switch (comp) {
+    case COMP_0:
+        emit_mov_imm(jit, RCX, 0);
+        return;
+    case COMP_1:
+        emit_mov_imm(jit, RCX, 1);
+        return;
+    case COMP_MINUS_1:
+        emit_mov_imm(jit, RCX, (uint32_t) -1);
+        return;
+    case COMP_D:
+    case COMP_NOT_D:
+    case COMP_MINUS_D:
+    case COMP_D_PLUS_1:
+    case COMP_D_MINUS_1:
+    case COMP_D_PLUS_A:
+    case COMP_D_MINUS_A:
+    case COMP_D_AND_A:
+    case COMP_D_OR_A:
+        emit_mov_rr(jit, RCX, REG_D);
+        break;
+    case COMP_A:
+    case COMP_NOT_A:
+    case COMP_MINUS_A:
+    case COMP_A_PLUS_1:
+    case COMP_A_MINUS_1:
+    case COMP_A_MINUS_D:
+        emit_mov_rr(jit, RCX, y);
+        break;
+    default:
+        // no mnemonic: go through the ALU control bits
+        emit_mov_rr(jit, RCX, REG_D);
+        emit_mov_rr(jit, RDX, y);
+        if (comp & 0x20) emit_mov_imm(jit, RCX, 0);
+        if (comp & 0x10) emit_unary(jit, EXT_NOT, RCX);
+        if (comp & 0x08) emit_mov_imm(jit, RDX, 0);
+        if (comp & 0x04) emit_unary(jit, EXT_NOT, RDX);
+        emit_op_rr(jit, comp & 0x02 ? OP_ADD : OP_AND, RCX, RDX);
+        if (comp & 0x01) emit_unary(jit, EXT_NOT, RCX);
+        return;
+    }
+
+    switch (comp) {
+    case COMP_NOT_D:
+    case COMP_NOT_A:
+        emit_unary(jit, EXT_NOT, RCX);
+        break;
+    case COMP_MINUS_D:
+    case COMP_MINUS_A:
+        emit_unary(jit, EXT_NEG, RCX);
+        break;
+    case COMP_D_PLUS_1:
+    case COMP_A_PLUS_1:
+        emit_add_imm8(jit, RCX, 1);
+        break;
+    case COMP_D_MINUS_1:
+    case COMP_A_MINUS_1:
+        emit_add_imm8(jit, RCX, -1);
+        break;
+    case COMP_D_PLUS_A:
+        emit_op_rr(jit, OP_ADD, RCX, y);
+        break;
+    case COMP_D_MINUS_A:
+        emit_op_rr(jit, OP_SUB, RCX, y);
+        break;
+    case COMP_A_MINUS_D:
+        emit_op_rr(jit, OP_SUB, RCX, REG_D);
+        break;
+    case COMP_D_AND_A:
+        emit_op_rr(jit, OP_AND, RCX, y);
+        break;
+    case COMP_D_OR_A:
+        emit_op_rr(jit, OP_OR, RCX, y);
+        break;
+    }
+}
+
+/*
+ * Compile the C-instruction at pc, where A holds the constant a if known.
+ * left counts the instructions of the block from this one on.
+ *
+ * \retval - false if the block ends here.
+ */
+static bool emit_c_inst(struct jit *jit, unsigned pc, bool known, unsigned a,
+                        unsigned left)
+{
+    uint16_t word = jit->rom[pc];
+    unsigned comp = hack_comp(word);
+    unsigned dest = hack_dest(word);
+    unsigned jump = hack_jump(word);
+    unsigned addr = a & MAX_HACK_ADDRESS;
+    unsigned y = REG_A;
+    size_t skip = 0;
+
+    if ((word & HACK_A_BIT) || (dest & DEST_M)) {
+        if (known && addr >= SYM_SCREEN) {
+            emit_side_exit(jit, left, pc | JIT_IO);
+            return false;
+        }
+        if (!known) {
+            emit_mov_rr(jit, RAX, REG_A);
+            emit8(jit, 0x25);           // and eax, MAX_HACK_ADDRESS
+            emit32(jit, MAX_HACK_ADDRESS);
+            emit8(jit, 0x3d);           // cmp eax, SYM_SCREEN
+            emit32(jit, SYM_SCREEN);
+            emit8(jit, 0x72);           // jb over the side exit
+            emit8(jit, 17);
+            emit_side_exit(jit, left, pc | JIT_IO);
+        }
+        if (word & HACK_A_BIT) {
+            emit_load_m(jit, RDX, known, addr);
+            y = RDX;
+        }
+    }
+
+    emit_comp(jit, comp, y);
+
+    // a jump goes to the value A had before this instruction
+    if (jump != JMP_NULL && !known && (dest & DEST_A)) {
+        emit_mov_rr(jit, RSI, REG_A);
+    }
+    if (dest & DEST_M) {
+        emit_store_m(jit, RCX, known, addr);
+    }
+    if (dest & DEST_A) {
+        emit_mov_rr(jit, REG_A, RCX);
+    }
+    if (dest & DEST_D) {
+        emit_mov_rr(jit, REG_D, RCX);
+    }
+
+    if (jump == JMP_NULL) {
+        return true;
+    }
+
+    if (jump != JMP_JMP) {
+        emit8(jit, 0x66);               // test cx, cx
+        emit8(jit, OP_TEST);
+        emit8(jit, 0xc9);
+        emit8(jit, 0x0f);
+        emit8(jit, skip_jcc[jump]);
+        skip = jit->used;
+        emit32(jit, 0);
+    }
+
+    if (known) {
+        emit_jump(jit, pc, a);
+    } else {
+        emit_computed_jump(jit, dest & DEST_A ? RSI : REG_A);
+    }
+
+    if (jump != JMP_JMP) {
+        uint32_t rel = jit->used - (skip + 4);
+
+        memcpy(jit->code + skip, &rel, 4);
+        emit_jump(jit, pc, pc + 1);
+    }
+
+    return false;
+}
+
+/*
+ * Point the jumps waiting for the block at pc to its code.
+ */
+static void resolve_pending(struct jit *jit, uint16_t pc)
+{
+    for (int32_t i = jit->pending[pc]; i >= 0; i = jit->patches[i].next) {
+        uint8_t *site = jit->code + jit->patches[i].offset;
+        uint32_t rel = (uint32_t) ((uint8_t *) jit->blocks[pc] - (site + 5));
+
+        site[0] = 0xe9;                 // jmp rel32 over mov eax, imm32
+        memcpy(site + 1, &rel, 4);
+    }
+    jit->pending[pc] = -1;
+}
+
+/*
+ * Throw all compiled code away.
+ */
+static void flush(struct jit *jit)
+{
+    memset(jit->blocks, 0, sizeof(jit->blocks));
+    for (unsigned i = 0; i < HACK_ROM_SIZE; i++) {
+        jit->pending[i] = -1;
+    }
+    jit->npatches = 0;
+    jit->used = jit->stubs;
+}
+
+/*
+ * Write the trampoline, jit->enter(regs, block), which loads the registers
+ * of compiled code from regs and jumps to block, and the exit stub, which
+ * stores them back and returns the value in eax.
+ */
+static void emit_stubs(struct jit *jit)
+{
+    void *enter = jit->code;
+
+    emit8(jit, 0x53);                   // push rbx
+    for (unsigned r = R12; r <= R15; r++) {
+        emit8(jit, 0x41);               // push r12..r15
+        emit8(jit, 0x50 | (r & 7));
+    }
+    emit8(jit, 0x57);                   // push rdi
+    emit_regs_mov(jit, 0x8b, true, REG_RAM, offsetof(struct jit_regs, ram));
+    emit_regs_mov(jit, 0x8b, true, REG_BLOCKS, offsetof(struct jit_regs, blocks));
+    emit_regs_mov(jit, 0x8b, true, REG_BUDGET, offsetof(struct jit_regs, budget));
+    emit_regs_mov(jit, 0x8b, false, REG_A, offsetof(struct jit_regs, a));
+    emit_regs_mov(jit, 0x8b, false, REG_D, offsetof(struct jit_regs, d));
+    emit8(jit, 0xff);                   // jmp rsi
+    emit8(jit, 0xe6);
+
+    jit->exit = jit->code + jit->used;
+    emit8(jit, 0x5f);                   // pop rdi
+    emit_regs_mov(jit, 0x89, true, REG_BUDGET, offsetof(struct jit_regs, budget));
+    emit_regs_mov(jit, 0x89, false, REG_A, offsetof(struct jit_regs, a));
+    emit_regs_mov(jit, 0x89, false, REG_D, offsetof(struct jit_regs, d));
+    for (unsigned r = R15; r >= R12; r--) {
+        emit8(jit, 0x41);               // pop r15..r12
+        emit8(jit, 0x58 | (r & 7));
+    }
+    emit8(jit, 0x5b);                   // pop rbx
+    emit8(jit, 0xc3);                   // ret
+
+    // no cast between object and function pointers in ISO C
+    memcpy(&jit->enter, &enter, sizeof(enter));
+    jit->stubs = jit->used;
+}
+
+bool jit_supported(void)
+{
+    return true;
+}
+
+struct jit *jit_create(const uint16_t *rom, unsigned len, long halt)
+{
+    struct jit *jit = calloc(1, sizeof(*jit));
+
+    if (jit == NULL) {
+        return NULL;
+    }
+
+    jit->code = mmap(NULL, CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (jit->code == MAP_FAILED) {
+        free(jit);
+        return NULL;
+    }
+
+    jit->rom = rom;
+    jit->len = len;
+    jit->halt = halt;
+    emit_stubs(jit);
+    flush(jit);
+
+    return jit;
+}
+
+void jit_destroy(struct jit *jit)
+{
+    if (jit) {
+        munmap(jit->code, CODE_SIZE);
+        free(jit->patches);
+        free(jit);
+    }
+}
+
+void jit_compile(struct jit *jit, uint16_t pc)
+{
+    unsigned n = 0;
+
+    if (jit->blocks[pc]) {
+        return;
+    }
+
+    // the block runs up to its first jump, and never into the halt address
+    while (n < MAX_BLOCK_LEN && pc + n < jit->len && pc + n != jit->halt) {
+        uint16_t word = jit->rom[pc + n++];
+
+        if ((word & HACK_C_INST) && hack_jump(word) != JMP_NULL) {
+            break;
+        }
+    }
+
+    if (jit->used + MAX_ENTRY_CODE + n * MAX_INST_CODE > CODE_SIZE) {
+        flush(jit);
+    }
+
+    void *start = jit->code + jit->used;
+    bool known = false, open = true;
+    unsigned a = 0;
+
+    // sub r15, n; jae body; add r15, n; mov eax, pc | JIT_BUDGET; jmp exit
+    emit_budget(jit, 5, n);
+    emit8(jit, 0x73);
+    emit8(jit, 17);
+    emit_side_exit(jit, n, pc | JIT_BUDGET);
+
+    for (unsigned i = pc; i < pc + n && open; i++) {
+        uint16_t word = jit->rom[i];
+
+        if (!(word & HACK_C_INST)) {
+            emit_mov_imm(jit, REG_A, word);
+            known = true;
+            a = word;
+            continue;
+        }
+
+        open = emit_c_inst(jit, i, known, a, pc + n - i);
+
+        if (hack_dest(word) & DEST_A) {
+            known = false;
+        }
+    }
+
+    // no jump at the end: fall through into the next block
+    if (open) {
+        emit_jump(jit, pc + n - 1, pc + n);
+    }
+
+    jit->blocks[pc] = start;
+    resolve_pending(jit, pc);
+}
+
+bool jit_compiled(const struct jit *jit, uint16_t pc)
+{
+    return jit->blocks[pc] != NULL;
+}
+
+uint32_t jit_run(struct jit *jit, struct jit_regs *regs, uint16_t pc)
+{
+    regs->blocks = jit->blocks;
+
+    return jit->enter(regs, jit->blocks[pc]);
+}
+
+#else
+
+bool jit_supported(void)
+{
+    return false;
+}
+
+struct jit *jit_create(const uint16_t *rom, unsigned len, long halt)
+{
+    (void) rom;
+    (void) len;
+    (void) halt;
+
+    return NULL;
+}
+
+void jit_destroy(struct jit *jit)
+{
+    (void) jit;
+}
+
+void jit_compile(struct jit *jit, uint16_t pc)
+{
+    (void) jit;
+    (void) pc;
+}
+
+bool jit_compiled(const struct jit *jit, uint16_t pc)
+{
+    (void) jit;
+    (void) pc;
+
+    return false;
+}
+
+uint32_t jit_run(struct jit *jit, struct jit_regs *regs, uint16_t pc)
+{
+    (void) jit;
+    (void) regs;
+
+    return pc;
+}
+
+#endif
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Just-in-time compiler of Hack machine code to x86-64.
+ *
+ * Code is compiled one basic block at a time, on request of the executor
+ * (see hackx.c), which picks the blocks that run often. A block ends at the
+ * first C-instruction that has a jump. Jumps to blocks that are compiled go
+ * straight to their code, without returning to the executor; computed jumps
+ * look their target up in a table of compiled blocks.
+ *
+ * Compiled code leaves to the executor whenever it reaches code that isn't
+ * compiled and before an access to the memory mapped I/O area, SCREEN and
+ * KBD, which is always left to the executor's interpreter.
+ *
+ * On hosts other than x86-64 Linux, jit_supported() is false and nothing
+ * gets compiled.
+ */
+
+/*
+ * Flags of the value jit_run() returns, along with the address to go on at.
+ */
+#define JIT_IO      0x10000  /* the instruction accesses SCREEN or KBD */
+#define JIT_BUDGET  0x20000  /* the budget doesn't cover the next block */
+#define JIT_HALT    0x40000  /* the program jumped to itself */
+#define JIT_PC(r)   ((uint16_t) ((r) & 0xffff))
+
+/*
+ * Machine state shared by the compiled code and the executor. Compiled code
+ * keeps A and D in host registers, where only their low 16 bits count.
+ */
+struct jit_regs {
+    int16_t *ram;
+    void **blocks;
+    /* Number of instructions left to execute. */
+    uint64_t budget;
+    int32_t a;
+    int32_t d;
+};
+
+struct jit;
+
+
+/*
+ * Whether code can be compiled on this host.
+ */
+bool jit_supported(void);
+
+/*
+ * Create a compiler for the rom of len instructions. Jumps to halt, if not
+ * negative, always return to the executor.
+ *
+ * \retval - the compiler, or NULL if the host doesn't support it or there
+ *           isn't enough memory.
+ */
+struct jit *jit_create(const uint16_t *rom, unsigned len, long halt);
+
+void jit_destroy(struct jit *jit);
+
+/*
+ * Compile the block that starts at pc. When the code buffer is full, all
+ * compiled code is thrown away first.
+ */
+void jit_compile(struct jit *jit, uint16_t pc);
+
+/*
+ * Whether the block that starts at pc is compiled.
+ */
+bool jit_compiled(const struct jit *jit, uint16_t pc);
+
+/*
+ * Run compiled code from the block at pc, which must be compiled, until it
+ * leaves compiled code.
+ *
+ * \retval - where to go on, with the JIT_* flags that tell why.
+ */
+uint32_t jit_run(struct jit *jit, struct jit_regs *regs, uint16_t pc);
@@ -0,0 +1,242 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "object.h"
+#include "hack_standard.h"
+#include "asm_malloc.h"
+#include "exit.h"
+
+#define OBJECT_MAGIC "HACKOBJ1"
+#define OBJECT_MAGIC_LEN 8
+
+/*
+ * Bounds on what a well formed object may hold, so that reading a broken one
+ * can't ask for absurd amounts of memory.
+ */
+#define MAX_OBJECT_SYMBOLS (1u << 20)
+#define MAX_OBJECT_STRINGS (1u << 26)
+
+
+/*
+ * Make room for one more element in *array, which has count elements of
+ * size bytes and room for *allocated.
+ */
+static void grow(void *array, uint32_t count, uint32_t *allocated, size_t size)
+{
+    void **p = array;
+
+    if (count == *allocated) {
+        *allocated = *allocated ? *allocated * 2 : 64;
+        *p = asm_realloc(*p, (size_t) *allocated * size);
+    }
+}
+
+void object_init(struct hack_object *obj)
+{
+    memset(obj, 0, sizeof(*obj));
+}
+
+void object_free(struct hack_object *obj)
+{
+    free(obj->code);
+    free(obj->exports);
+    free(obj->imports);
+    free(obj->relocs);
+    free(obj->strings);
+    memset(obj, 0, sizeof(*obj));
+}
+
+uint32_t object_add_string(struct hack_object *obj, const char *s)
+{
+    uint32_t offset = obj->strings_size;
+    size_t len = strlen(s) + 1;
+
+    while (obj->strings_size + len > obj->strings_allocated) {
+        obj->strings_allocated = obj->strings_allocated ? obj->strings_allocated * 2 : 1024;
+        obj->strings = asm_realloc(obj->strings, obj->strings_allocated);
+    }
+    memcpy(obj->strings + offset, s, len);
+    obj->strings_size += len;
+
+    return offset;
+}
+
+void object_add_word(struct hack_object *obj, uint16_t word)
+{
+    grow(&obj->code, obj->len, &obj->code_allocated, sizeof(uint16_t));
+    obj->code[obj->len++] = word;
+}
+
+void object_add_export(struct hack_object *obj, const char *name, uint32_t address)
+{
+    grow(&obj->exports, obj->nexports, &obj->exports_allocated, sizeof(struct object_export));
+    obj->exports[obj->nexports].name = object_add_string(obj, name);
+    obj->exports[obj->nexports++].address = address;
+}
+
+uint32_t object_add_import(struct hack_object *obj, const char *name)
+{
+    grow(&obj->imports, obj->nimports, &obj->imports_allocated, sizeof(uint32_t));
+    obj->imports[obj->nimports] = object_add_string(obj, name);
+    return obj->nimports++;
+}
+
+void object_add_reloc(struct hack_object *obj, uint32_t symbol)
+{
+    grow(&obj->relocs, obj->nrelocs, &obj->relocs_allocated, sizeof(struct object_reloc));
+    obj->relocs[obj->nrelocs].offset = obj->len - 1;
+    obj->relocs[obj->nrelocs++].symbol = symbol;
+}
+
+
+static void put_u16(FILE *fp, uint16_t v)
+{
+    unsigned char b[2] = { v & 0xff, v >> 8 };
+
+    fwrite(b, 1, sizeof(b), fp);
+}
+
+static void put_u32(FILE *fp, uint32_t v)
+{
+    unsigned char b[4] = { v & 0xff, (v >> 8) & 0xff, (v >> 16) & 0xff, v >> 24 };
+
+    fwrite(b, 1, sizeof(b), fp);
+}
+
+void object_write(const struct hack_object *obj, FILE *fp)
+{
+    fwrite(OBJECT_MAGIC, 1, OBJECT_MAGIC_LEN, fp);
+    put_u32(fp, obj->len);
+    put_u32(fp, obj->nexports);
+    put_u32(fp, obj->nimports);
+    put_u32(fp, obj->nrelocs);
+    put_u32(fp, obj->strings_size);
+
+    for (uint32_t i = 0; i < obj->len; i++) {
+        put_u16(fp, obj->code[i]);
+    }
+    for (uint32_t i = 0; i < obj->nexports; i++) {
+        put_u32(fp, obj->exports[i].name);
+        put_u32(fp, obj->exports[i].address);
+    }
+    for (uint32_t i = 0; i < obj->nimports; i++) {
+        put_u32(fp, obj->imports[i]);
+    }
+    for (uint32_t i = 0; i < obj->nrelocs; i++) {
+        put_u32(fp, obj->relocs[i].offset);
+        put_u32(fp, obj->relocs[i].symbol);
+    }
+    fwrite(obj->strings, 1, obj->strings_size, fp);
+}
+
+
+static bool get_u16(FILE *fp, uint16_t *v)
+{
+    unsigned char b[2];
+
+    if (fread(b, 1, sizeof(b), fp) != sizeof(b)) {
+        return false;
+    }
+    *v = b[0] | b[1] << 8;
+    return true;
+}
+
+static bool get_u32(FILE *fp, uint32_t *v)
+{
+    unsigned char b[4];
+
+    if (fread(b, 1, sizeof(b), fp) != sizeof(b)) {
+        return false;
+    }
+    *v = b[0] | b[1] << 8 | b[2] << 16 | (uint32_t) b[3] << 24;
+    return true;
+}
+
+static bool valid_name(const struct hack_object *obj, uint32_t name)
+{
+    return name < obj->strings_size && memchr(obj->strings + name, '\0', obj->strings_size - name);
+}
+
+/*
+ * Read the parts of an object whose header is in obj already.
+ */
+static bool read_body(struct hack_object *obj, FILE *fp)
+{
+    obj->code = asm_malloc(obj->len * sizeof(uint16_t) + 1);
+    obj->exports = asm_malloc(obj->nexports * sizeof(struct object_export) + 1);
+    obj->imports = asm_malloc(obj->nimports * sizeof(uint32_t) + 1);
+    obj->relocs = asm_malloc(obj->nrelocs * sizeof(struct object_reloc) + 1);
+    obj->strings = asm_malloc(obj->strings_size + 1);
+
+    for (uint32_t i = 0; i < obj->len; i++) {
+        if (!get_u16(fp, &obj->code[i])) {
+            return false;
+        }
+    }
+    for (uint32_t i = 0; i < obj->nexports; i++) {
+        if (!get_u32(fp, &obj->exports[i].name) || !get_u32(fp, &obj->exports[i].address)) {
+            return false;
+        }
+    }
+    for (uint32_t i = 0; i < obj->nimports; i++) {
+        if (!get_u32(fp, &obj->imports[i])) {
+            return false;
+        }
+    }
+    for (uint32_t i = 0; i < obj->nrelocs; i++) {
+        if (!get_u32(fp, &obj->relocs[i].offset) || !get_u32(fp, &obj->relocs[i].symbol)) {
+            return false;
+        }
+    }
+    if (fread(obj->strings, 1, obj->strings_size, fp) != obj->strings_size) {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < obj->nexports; i++) {
+        if (!valid_name(obj, obj->exports[i].name) || obj->exports[i].address > obj->len) {
+            return false;
+        }
+    }
+    for (uint32_t i = 0; i < obj->nimports; i++) {
+        if (!valid_name(obj, obj->imports[i])) {
+            return false;
+        }
+    }
+    for (uint32_t i = 0; i < obj->nrelocs; i++) {
+        const struct object_reloc *reloc = &obj->relocs[i];
+
+        // only A-instructions are relocated
+        if (reloc->offset >= obj->len || (obj->code[reloc->offset] & HACK_C_INST)
+            || (reloc->symbol != OBJECT_LOCAL && reloc->symbol >= obj->nimports)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int object_read(struct hack_object *obj, FILE *fp, const char *path, char *errmsg)
+{
+    char magic[OBJECT_MAGIC_LEN];
+
+    object_init(obj);
+
+    if (fread(magic, 1, OBJECT_MAGIC_LEN, fp) != OBJECT_MAGIC_LEN
+        || memcmp(magic, OBJECT_MAGIC, OBJECT_MAGIC_LEN)
+        || !get_u32(fp, &obj->len) || !get_u32(fp, &obj->nexports)
+        || !get_u32(fp, &obj->nimports) || !get_u32(fp, &obj->nrelocs)
+        || !get_u32(fp, &obj->strings_size)
+        || obj->len > HACK_ROM_SIZE || obj->nrelocs > obj->len
+        || obj->nexports > MAX_OBJECT_SYMBOLS || obj->nimports > MAX_OBJECT_SYMBOLS
+        || obj->strings_size > MAX_OBJECT_STRINGS) {
+        object_init(obj);
+        return error_format(errmsg, EXIT_INVALID_OBJECT, path);
+    }
+
+    if (!read_body(obj, fp)) {
+        object_free(obj);
+        return error_format(errmsg, EXIT_INVALID_OBJECT, path);
+    }
+    return 0;
+}
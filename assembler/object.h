@@ -0,0 +1,107 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+
+/*
+ * Relocatable object files (.hobj), as written by assembler -c and combined
+ * into a program by hacklink. A module is assembled on its own, with code
+ * addresses starting from 0, and its labels are exported for the others.
+ * Symbols that aren't labels of the module, or predefined, are imported,
+ * and become variables at link time unless another module exports them.
+ *
+ * The file is little-endian:
+ *
+ *     "HACKOBJ1"
+ *     u32 len, nexports, nimports, nrelocs, strings_size
+ *     u16 code[len]
+ *     { u32 name, u32 address } exports[nexports]
+ *     u32 imports[nimports]
+ *     { u32 offset, u32 symbol } relocs[nrelocs]
+ *     char strings[strings_size]
+ *
+ * Names are offsets of null terminated strings in strings. A relocation
+ * patches the A-instruction code[offset]: with the address of the import
+ * of index symbol, or, if symbol is OBJECT_LOCAL, by adding the address the
+ * module ends up at to the label address it holds.
+ *
+ * Imports are kept in the order of their first use, and relocations in that
+ * of the code, so that linking the objects of some modules allocates the
+ * same variable addresses as assembling their concatenation.
+ */
+
+#define OBJECT_EXTENSION ".hobj"
+#define OBJECT_LOCAL UINT32_MAX
+
+
+struct object_export {
+    uint32_t name;
+    uint32_t address;
+};
+
+struct object_reloc {
+    uint32_t offset;
+    uint32_t symbol;
+};
+
+/*
+ * Each array comes with the number of elements it has room for, while the
+ * object is built.
+ */
+struct hack_object {
+    uint16_t *code;
+    uint32_t len, code_allocated;
+    struct object_export *exports;
+    uint32_t nexports, exports_allocated;
+    uint32_t *imports;
+    uint32_t nimports, imports_allocated;
+    struct object_reloc *relocs;
+    uint32_t nrelocs, relocs_allocated;
+    char *strings;
+    uint32_t strings_size, strings_allocated;
+};
+
+
+/**
+ * Initialise an empty object, to be built with the object_add functions.
+ */
+void object_init(struct hack_object *obj);
+
+/**
+ * Free everything an object holds.
+ */
+void object_free(struct hack_object *obj);
+
+/**
+ * Add a string to the strings of obj.
+ *
+ * retval - its offset.
+ */
+uint32_t object_add_string(struct hack_object *obj, const char *s);
+
+void object_add_word(struct hack_object *obj, uint16_t word);
+void object_add_export(struct hack_object *obj, const char *name, uint32_t address);
+
+/**
+ * retval - the index of the new import.
+ */
+uint32_t object_add_import(struct hack_object *obj, const char *name);
+
+/**
+ * Have the last word added relocated against symbol, an import index or
+ * OBJECT_LOCAL.
+ */
+void object_add_reloc(struct hack_object *obj, uint32_t symbol);
+
+/**
+ * Write obj to fp.
+ */
+void object_write(const struct hack_object *obj, FILE *fp);
+
+/**
+ * Read an object from fp, which path names, and check that it is well
+ * formed. On failure obj holds nothing that needs to be freed.
+ *
+ * retval - 0 on success, else an exit code with its message in errmsg.
+ */
+int object_read(struct hack_object *obj, FILE *fp, const char *path, char *errmsg);
@@ -0,0 +1,49 @@
+#include <ctype.h>
+#include <string.h>
+
+#include "rom.h"
+#include "hack_standard.h"
+#include "exit.h"
+
+#define WORD_BITS 16
+
+int rom_load(FILE *fp, uint16_t rom[], unsigned *len, char *errmsg)
+{
+    // room for the word, a CR, a newline and the terminating null
+    char line[WORD_BITS + 3];
+    unsigned line_num = 0;
+
+    *len = 0;
+
+    while (fgets(line, sizeof(line), fp)) {
+        size_t n = strlen(line);
+        uint16_t word = 0;
+
+        line_num++;
+
+        // strip the line ending
+        while (n && isspace((unsigned char) line[n-1])) {
+            line[--n] = '\0';
+        }
+        if (n == 0) {
+            continue; // skip empty lines
+        }
+        if (n != WORD_BITS) {
+            return error_format(errmsg, EXIT_INVALID_HACK_WORD, line_num, line);
+        }
+
+        for (int i = 0; i < WORD_BITS; i++) {
+            if (line[i] != '0' && line[i] != '1') {
+                return error_format(errmsg, EXIT_INVALID_HACK_WORD, line_num, line);
+            }
+            word = (word << 1) | (line[i] - '0');
+        }
+
+        if (*len == HACK_ROM_SIZE) {
+            return error_format(errmsg, EXIT_TOO_MANY_INSTRUCTIONS, (unsigned) HACK_ROM_SIZE);
+        }
+        rom[(*len)++] = word;
+    }
+
+    return 0;
+}
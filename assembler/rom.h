@@ -0,0 +1,13 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+
+/*
+ * Load a .hack file, one instruction per line written as 16 binary digits,
+ * into rom, which must hold HACK_ROM_SIZE words.
+ *
+ * \param len - set to the number of instructions loaded
+ * \retval - 0 on success, else an exit code with its message in errmsg.
+ */
+int rom_load(FILE *fp, uint16_t rom[], unsigned *len, char *errmsg);
@@ -0,0 +1,78 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "server.h"
+#include "assembler.h"
+#include "exit.h"
+#include "ipc.h"
+#include "threadpool.h"
+
+
+static void *worker_init(void)
+{
+    return asm_context_init();
+}
+
+static void worker_free(void *ctx)
+{
+    asm_context_destroy(ctx);
+}
+
+/*
+ * Assemble the single file of a request with the worker's warm context.
+ */
+static void handle_request(void *ctx, const struct ipc_request *req,
+                           struct ipc_response *resp)
+{
+    char errmsg[MAX_ERROR_LEN + 1];
+    FILE *fp_in, *fp_out;
+
+    if (req->nfiles != 1) {
+        resp->status = error_format(errmsg, EXIT_MANY_FILES);
+        resp->msg = strdup(errmsg);
+        resp->msg_len = resp->msg ? strlen(resp->msg) : 0;
+        return;
+    }
+
+    fp_in = fmemopen(req->files[0].data, req->files[0].len, "r");
+    fp_out = open_memstream(&resp->out, &resp->out_len);
+
+    if (fp_in == NULL || fp_out == NULL) {
+        resp->status = error_format(errmsg, EXIT_OUT_OF_MEMORY);
+    } else {
+        resp->status = assemble(ctx, fp_in, fp_out, errmsg);
+    }
+
+    if (fp_in) {
+        fclose(fp_in);
+    }
+    if (fp_out) {
+        fclose(fp_out); // this finalizes resp->out and resp->out_len
+    }
+
+    if (resp->status) {
+        resp->msg = strdup(errmsg);
+        resp->msg_len = resp->msg ? strlen(resp->msg) : 0;
+    }
+}
+
+void asm_serve(const char *socket_path, int njobs)
+{
+    int fd = ipc_listen(socket_path);
+
+    if (fd < 0) {
+        exit_program(EXIT_SOCKET_ERROR, socket_path);
+    }
+
+    ThreadPool pool = threadpool_create(njobs, worker_init, worker_free);
+
+    if (pool == NULL) {
+        exit_program(EXIT_OUT_OF_MEMORY);
+    }
+
+    ipc_serve(fd, socket_path, IPC_TOOL_ASM, pool, handle_request);
+    threadpool_destroy(pool);
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stdlib.h>
+
+#include "ipc.h"
+
+/*
+ * The assembler can run as a daemon that assembles programs sent to it by the
+ * thin client (asmc) over a local socket, which saves paying for process
+ * startup and table setup on every invocation.
+ */
+
+/*
+ * The socket used by both ends, unless ASM_SOCKET_ENV says otherwise, called
+ * ASM_SOCKET_NAME in the directory of ipc_socket_path().
+ */
+#define ASM_SOCKET_NAME "nand2tetris-asm.sock"
+#define ASM_SOCKET_ENV "ASM_DAEMON_SOCKET"
+
+/**
+ * Path of the daemon socket according to the environment.
+ */
+static inline const char *server_socket_path(void)
+{
+    const char *path = getenv(ASM_SOCKET_ENV);
+    return path && *path ? path : ipc_socket_path(ASM_SOCKET_NAME);
+}
+
+/**
+ * Listen on socket_path and serve requests on njobs worker threads (one per
+ * CPU if njobs < 1) until SIGINT or SIGTERM is received.
+ */
+void asm_serve(const char *socket_path, int njobs);
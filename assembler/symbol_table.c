@@ -5,6 +5,7 @@
 
 #include "symbol_table.h"
 #include "asm_malloc.h"
+#include "arena.h"
 
 
 /*
@@ -12,10 +13,14 @@
  * a hash map. So currently lookups to the table take O(n) time. I may improve
  * this in the future by implementing a data structure with faster lookup times.
  *
- * Insertions happen at the back of the list. The rationale behind this is that
- * some predefined symbols are inserted first in the table and we want access to
- * these symbols to be as fast as possible, so we keep them at the front of the
- * list. By keeping a tail pointer we ensure that insertions take O(1) time.
+ * The predefined symbols never make it into the list. They are looked up in
+ * the static predef_symbols table first, which is sorted and binary searched.
+ *
+ * Insertions happen at the back of the list. By keeping a tail pointer we
+ * ensure that insertions take O(1) time.
+ *
+ * Entries and names are allocated from an arena owned by the table, so that
+ * clearing the table for the next program costs next to nothing.
  */
 
 
@@ -31,6 +36,8 @@ typedef struct table_entry *TableEntry;
 struct symbol_table {
    TableEntry head;
    TableEntry tail;
+   Arena arena;
+   hack_addr next_addr; // next address to be assigned to a variable
 };
 
 
@@ -39,17 +46,17 @@ SymbolTable symtab_init(void)
     SymbolTable table = asm_malloc(sizeof(struct symbol_table));
     table->head = NULL;
     table->tail = NULL;
+    table->arena = arena_init();
+    table->next_addr = SYMBOL_FIRST_VAR_ADDR;
     return table;
 }
 
 void symtab_add(SymbolTable table, const char *name, hack_addr address)
 {
-    TableEntry new_entry = asm_malloc(sizeof(struct table_entry));
+    TableEntry new_entry = arena_alloc(table->arena, sizeof(struct table_entry));
 
-    new_entry->name = asm_malloc(strlen(name) + 1);
+    new_entry->name = arena_strdup(table->arena, name);
     new_entry->next = NULL;
-    // the following is safe because we just allocated the exact space needed
-    strcpy(new_entry->name, name);
     new_entry->address = address;
 
     if (table->head == NULL) {
@@ -63,6 +70,12 @@ void symtab_add(SymbolTable table, const char *name, hack_addr address)
 }
 
 hack_addr symtab_lookup(SymbolTable table, const char *name) {
+    hack_addr address = predef_lookup(name);
+
+    if (address != SYMBOL_NOT_FOUND) {
+        return address;
+    }
+
     TableEntry entry = table->head;
 
     for (; entry != NULL; entry = entry->next) {
@@ -93,19 +106,17 @@ __attribute__((unused)) static bool symtab_address_assigned(SymbolTable table, h
 /**
  * Return the next available hack address that can be assigned to a new symbol.
  */
-static hack_addr symtab_get_next_avail_addr(__attribute__ ((unused)) SymbolTable table) {
-    static hack_addr address = 16;
-
+static hack_addr symtab_get_next_avail_addr(SymbolTable table) {
     // NOTICE: The following commented code prevents a single memory address
     // from being assigned to 2 different symbols. However, the HACK standard
     // does not predict this, and if we uncomment these lines we produce
     // different machine code than the official HACK assembler sometimes.
 
-    /*while (symtab_address_assigned(table, address)) {*/
-        /*address++;*/
+    /*while (symtab_address_assigned(table, table->next_addr)) {*/
+        /*table->next_addr++;*/
     /*}*/
 
-    return address++;
+    return table->next_addr++;
 }
 
 hack_addr symtab_resolve(SymbolTable table, const char *name) {
@@ -119,17 +130,25 @@ hack_addr symtab_resolve(SymbolTable table, const char *name) {
     return address;
 }
 
-
-void symtab_destroy(SymbolTable table)
+void symtab_foreach(SymbolTable table, void (*fn)(const char *name, hack_addr address, void *arg),
+                    void *arg)
 {
-    TableEntry tmp = NULL;
-
-    for (; table->head != NULL; table->head = tmp) {
-        tmp = table->head->next;
-        free(table->head->name);
-        free(table->head);
+    for (TableEntry entry = table->head; entry != NULL; entry = entry->next) {
+        fn(entry->name, entry->address, arg);
     }
+}
+
+void symtab_clear(SymbolTable table)
+{
+    arena_reset(table->arena);
+    table->head = NULL;
+    table->tail = NULL;
+    table->next_addr = SYMBOL_FIRST_VAR_ADDR;
+}
 
+void symtab_destroy(SymbolTable table)
+{
+    arena_destroy(table->arena);
     free(table);
 }
 
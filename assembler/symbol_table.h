@@ -4,6 +4,11 @@
 
 #define SYMBOL_NOT_FOUND -1
 
+/*
+ * Variables are assigned consecutive addresses starting from this one.
+ */
+#define SYMBOL_FIRST_VAR_ADDR 16
+
 
 typedef struct symbol_table *SymbolTable;
 
@@ -26,7 +31,7 @@ SymbolTable symtab_init(void);
 void symtab_add(SymbolTable table, const char *name, hack_addr address);
 
 /**
- * Search for a symbol in the symbol table.
+ * Search for a symbol in the predefined symbols and then in the symbol table.
  *
  * retval - Symbol's corresponding hack address if symbol exists in the table.
  *          SYMBOL_NOT_FOUND if symbol doesn't exist in the table.
@@ -44,6 +49,20 @@ hack_addr symtab_lookup(SymbolTable table, const char *name);
  */
 hack_addr symtab_resolve(SymbolTable table, const char *name);
 
+/**
+ * Call fn for every symbol of the table, predefined ones aside, in the order
+ * they were added.
+ */
+void symtab_foreach(SymbolTable table, void (*fn)(const char *name, hack_addr address, void *arg),
+                    void *arg);
+
+/**
+ * Remove all symbols from the table and start assigning variable addresses
+ * from the beginning again, so that the table can be reused for assembling
+ * another program.
+ */
+void symtab_clear(SymbolTable table);
+
 /**
  * Indicate you are complete with the symbol table. Free and delete any
  * remaining internal structures. You must *always* call this function to
@@ -0,0 +1,503 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#ifdef __NR_io_uring_setup
+#include <linux/io_uring.h>
+/* Headers of kernels that have this also have the openat op. */
+#ifdef IORING_FEAT_FAST_POLL
+#define HAVE_IO_URING 1
+#endif
+#endif
+#endif
+
+#include "filereader.h"
+#include "threadpool.h"
+
+/* Files being read at once at most, each with one request in flight. */
+#define QUEUE_DEPTH 64
+/* Workers of the pread() fallback, which wait on the disk, not the CPU. */
+#define READ_THREADS 16
+/* Bytes read first of a file whose size isn't known. */
+#define MIN_READ 4096
+/* Bytes asked for by a single read at most. */
+#define MAX_READ (1 << 30)
+
+
+/*
+ * A file being read. fd is -1 until it is opened and again once it is done.
+ */
+struct file_slot {
+    int fd;
+    /* Size of the file when it was opened, 0 if it isn't a regular file. */
+    size_t expected;
+    char *data;
+    size_t len;
+    size_t allocated;
+    int error;
+    bool done;
+    FileReader reader;
+};
+
+#ifdef HAVE_IO_URING
+/*
+ * The rings shared with the kernel, mapped as io_uring_setup(2) describes.
+ */
+struct ring {
+    int fd;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_map, *cq_map;
+    size_t sq_map_size, cq_map_size, sqes_size;
+    /* Requests queued but not passed to the kernel yet. */
+    unsigned to_submit;
+};
+#endif
+
+struct file_reader {
+    const char *const *paths;
+    int nfiles;
+    struct file_slot *files;
+    /* Indices of the files done, in the order they were, of which nreturned
+       have been handed out. */
+    int *done;
+    int ndone;
+    int nreturned;
+    pthread_mutex_t lock;
+    pthread_cond_t file_done;
+    /* Reading on these workers, if not through the ring. */
+    ThreadPool pool;
+#ifdef HAVE_IO_URING
+    bool uring;
+    struct ring ring;
+    /* Next file to open, and files opened or being opened and not done. */
+    int next_open;
+    int active;
+    /* Finish the files in flight rather than go on reading them. */
+    bool stopping;
+#endif
+};
+
+
+/*
+ * Make room for the rest of the file in slot, and a null.
+ *
+ * retval - the number of bytes to read next, 0 if out of memory.
+ */
+static size_t slot_room(struct file_slot *slot)
+{
+    if (slot->len + 1 >= slot->allocated) {
+        size_t size = slot->allocated ? slot->allocated * 2
+                      : (slot->expected > MIN_READ ? slot->expected : MIN_READ) + 1;
+        char *data = realloc(slot->data, size);
+
+        if (data == NULL) {
+            slot->error = ENOMEM;
+            return 0;
+        }
+        slot->data = data;
+        slot->allocated = size;
+    }
+
+    size_t room = slot->allocated - 1 - slot->len;
+
+    return room < MAX_READ ? room : MAX_READ;
+}
+
+/*
+ * Take fd, or the negated errno of the open that failed, for the file.
+ *
+ * retval - the number of bytes to read first, 0 on error.
+ */
+static size_t slot_opened(struct file_slot *slot, int fd)
+{
+    struct stat st;
+
+    if (fd < 0) {
+        slot->error = -fd;
+        return 0;
+    }
+    slot->fd = fd;
+    // a single read does for a file whose size is known
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        slot->expected = st.st_size;
+    }
+    return slot_room(slot);
+}
+
+/*
+ * Account for a read that returned n, or the negated errno it failed with.
+ *
+ * retval - the number of bytes to read next, 0 once the file is read or has
+ *          failed.
+ */
+static size_t slot_read(struct file_slot *slot, long n)
+{
+    if (n == -EINTR || n == -EAGAIN) {
+        return slot_room(slot);
+    } else if (n < 0) {
+        slot->error = -n;
+        return 0;
+    }
+
+    slot->len += n;
+    if (n == 0 || (slot->expected && slot->len >= slot->expected)) {
+        return 0;
+    }
+    return slot_room(slot);
+}
+
+/*
+ * Close the file and queue it to be handed out.
+ */
+static void slot_finish(struct file_slot *slot)
+{
+    FileReader reader = slot->reader;
+
+    if (slot->fd >= 0) {
+        close(slot->fd);
+        slot->fd = -1;
+    }
+    if (slot->error) {
+        free(slot->data);
+        slot->data = NULL;
+        slot->len = 0;
+    } else {
+        slot->data[slot->len] = '\0';
+    }
+    slot->done = true;
+    reader->done[reader->ndone++] = slot - reader->files;
+}
+
+/*
+ * Read a whole file with plain system calls, on a worker of the pool.
+ */
+static void read_job(void *ctx, void *arg)
+{
+    struct file_slot *slot = arg;
+    FileReader reader = slot->reader;
+    int fd = open(reader->paths[slot - reader->files], O_RDONLY | O_CLOEXEC);
+    size_t room = slot_opened(slot, fd < 0 ? -errno : fd);
+
+    (void) ctx;
+
+    while (room) {
+        ssize_t n = pread(slot->fd, slot->data + slot->len, room, slot->len);
+
+        room = slot_read(slot, n < 0 ? -errno : n);
+    }
+
+    pthread_mutex_lock(&reader->lock);
+    slot_finish(slot);
+    pthread_cond_signal(&reader->file_done);
+    pthread_mutex_unlock(&reader->lock);
+}
+
+
+#ifdef HAVE_IO_URING
+static void ring_free(struct ring *ring)
+{
+    if (ring->sqes != MAP_FAILED) {
+        munmap(ring->sqes, ring->sqes_size);
+    }
+    if (ring->cq_map != MAP_FAILED && ring->cq_map != ring->sq_map) {
+        munmap(ring->cq_map, ring->cq_map_size);
+    }
+    if (ring->sq_map != MAP_FAILED) {
+        munmap(ring->sq_map, ring->sq_map_size);
+    }
+    close(ring->fd);
+}
+
+/*
+ * Set up a ring of QUEUE_DEPTH entries.
+ *
+ * retval - 0 on success, -1 if the kernel doesn't let us.
+ */
+static int ring_init(struct ring *ring)
+{
+    struct io_uring_params p;
+
+    memset(&p, 0, sizeof(p));
+    ring->sq_map = ring->cq_map = ring->sqes = MAP_FAILED;
+    ring->to_submit = 0;
+
+    if ((ring->fd = syscall(__NR_io_uring_setup, QUEUE_DEPTH, &p)) < 0) {
+        return -1;
+    }
+    if (!(p.features & IORING_FEAT_FAST_POLL)) {
+        close(ring->fd);
+        return -1;
+    }
+
+    ring->sq_map_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ring->cq_map_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+
+    // both rings may come in one mapping
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_map_size > ring->sq_map_size) {
+            ring->sq_map_size = ring->cq_map_size;
+        }
+        ring->cq_map_size = ring->sq_map_size;
+    }
+
+    ring->sq_map = mmap(NULL, ring->sq_map_size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_map != MAP_FAILED && (p.features & IORING_FEAT_SINGLE_MMAP)) {
+        ring->cq_map = ring->sq_map;
+    } else if (ring->sq_map != MAP_FAILED) {
+        ring->cq_map = mmap(NULL, ring->cq_map_size, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    }
+    if (ring->cq_map != MAP_FAILED) {
+        ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    }
+    if (ring->sqes == MAP_FAILED) {
+        ring_free(ring);
+        return -1;
+    }
+
+    char *sq = ring->sq_map, *cq = ring->cq_map;
+
+    ring->sq_head = (unsigned *) (sq + p.sq_off.head);
+    ring->sq_tail = (unsigned *) (sq + p.sq_off.tail);
+    ring->sq_mask = (unsigned *) (sq + p.sq_off.ring_mask);
+    ring->sq_array = (unsigned *) (sq + p.sq_off.array);
+    ring->cq_head = (unsigned *) (cq + p.cq_off.head);
+    ring->cq_tail = (unsigned *) (cq + p.cq_off.tail);
+    ring->cq_mask = (unsigned *) (cq + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *) (cq + p.cq_off.cqes);
+
+    return 0;
+}
+
+/*
+ * Queue a request. There is always room, as no more files are in flight
+ * than the ring has entries.
+ */
+static void ring_queue(struct ring *ring, const struct io_uring_sqe *sqe)
+{
+    unsigned tail = *ring->sq_tail;
+    unsigned i = tail & *ring->sq_mask;
+
+    ring->sqes[i] = *sqe;
+    ring->sq_array[i] = i;
+    // the kernel must see the entry before the new tail
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ring->to_submit++;
+}
+
+static void queue_open(FileReader reader, int index)
+{
+    struct io_uring_sqe sqe;
+
+    memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode = IORING_OP_OPENAT;
+    sqe.fd = AT_FDCWD;
+    sqe.addr = (uintptr_t) reader->paths[index];
+    sqe.open_flags = O_RDONLY | O_CLOEXEC;
+    sqe.user_data = index;
+    ring_queue(&reader->ring, &sqe);
+}
+
+static void queue_read(FileReader reader, struct file_slot *slot, size_t room)
+{
+    struct io_uring_sqe sqe;
+
+    memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode = IORING_OP_READ;
+    sqe.fd = slot->fd;
+    sqe.addr = (uintptr_t) (slot->data + slot->len);
+    sqe.len = room;
+    sqe.off = slot->len;
+    sqe.user_data = slot - reader->files;
+    ring_queue(&reader->ring, &sqe);
+}
+
+/*
+ * Move the file a completed request was for on to its next one, or to done.
+ */
+static void complete(FileReader reader, struct file_slot *slot, int res)
+{
+    size_t room = slot->fd < 0 ? slot_opened(slot, res) : slot_read(slot, res);
+
+    if (room && !reader->stopping) {
+        queue_read(reader, slot, room);
+    } else {
+        slot_finish(slot);
+        reader->active--;
+    }
+}
+
+/*
+ * Open files while there is room, submit what is queued and handle the
+ * requests that complete, waiting for one at least.
+ */
+static void ring_progress(FileReader reader)
+{
+    struct ring *ring = &reader->ring;
+
+    while (!reader->stopping && reader->active < QUEUE_DEPTH
+           && reader->next_open < reader->nfiles) {
+        queue_open(reader, reader->next_open++);
+        reader->active++;
+    }
+
+    long n;
+
+    while ((n = syscall(__NR_io_uring_enter, ring->fd, ring->to_submit, 1,
+                        IORING_ENTER_GETEVENTS, NULL, 0)) < 0 && errno == EINTR) {
+        ;
+    }
+    if (n < 0) {
+        int error = errno;
+
+        // all files left fail, and the kernel may still write to the buffers
+        // of those in flight, which are given up
+        for (int i = 0; i < reader->nfiles; i++) {
+            struct file_slot *slot = &reader->files[i];
+
+            if (!slot->done) {
+                slot->error = error;
+                slot->data = NULL;
+                slot_finish(slot);
+            }
+        }
+        reader->active = 0;
+        reader->stopping = true;
+        return;
+    }
+    ring->to_submit -= n;
+
+    unsigned head = *ring->cq_head;
+    unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+
+    for (; head != tail; head++) {
+        const struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+
+        complete(reader, &reader->files[cqe->user_data], cqe->res);
+    }
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+}
+#endif
+
+
+FileReader file_reader_start(int nfiles, const char *const paths[])
+{
+    FileReader reader = calloc(1, sizeof(struct file_reader));
+
+    if (reader == NULL) {
+        return NULL;
+    }
+
+    reader->paths = paths;
+    reader->nfiles = nfiles;
+    reader->files = calloc(nfiles + 1, sizeof(struct file_slot));
+    reader->done = malloc((nfiles + 1) * sizeof(int));
+    pthread_mutex_init(&reader->lock, NULL);
+    pthread_cond_init(&reader->file_done, NULL);
+
+    if (reader->files == NULL || reader->done == NULL) {
+        file_reader_destroy(reader);
+        return NULL;
+    }
+    for (int i = 0; i < nfiles; i++) {
+        reader->files[i].fd = -1;
+        reader->files[i].reader = reader;
+    }
+    if (nfiles == 0) {
+        return reader;
+    }
+
+#ifdef HAVE_IO_URING
+    if (ring_init(&reader->ring) == 0) {
+        reader->uring = true;
+        return reader;
+    }
+#endif
+
+    reader->pool = threadpool_create(nfiles < READ_THREADS ? nfiles : READ_THREADS, NULL, NULL);
+    if (reader->pool == NULL) {
+        file_reader_destroy(reader);
+        return NULL;
+    }
+    for (int i = 0; i < nfiles; i++) {
+        // a file that can't be queued is read right away
+        if (threadpool_submit(reader->pool, read_job, &reader->files[i]) != 0) {
+            read_job(NULL, &reader->files[i]);
+        }
+    }
+
+    return reader;
+}
+
+bool file_reader_next(FileReader reader, struct file_contents *file)
+{
+#ifdef HAVE_IO_URING
+    while (reader->uring && reader->nreturned == reader->ndone
+           && reader->ndone < reader->nfiles) {
+        ring_progress(reader);
+    }
+#endif
+
+    pthread_mutex_lock(&reader->lock);
+
+    while (reader->nreturned == reader->ndone && reader->ndone < reader->nfiles) {
+        pthread_cond_wait(&reader->file_done, &reader->lock);
+    }
+    if (reader->nreturned == reader->nfiles) {
+        pthread_mutex_unlock(&reader->lock);
+        return false;
+    }
+
+    struct file_slot *slot = &reader->files[reader->done[reader->nreturned++]];
+
+    pthread_mutex_unlock(&reader->lock);
+
+    file->index = slot - reader->files;
+    file->data = slot->data;
+    file->len = slot->len;
+    file->error = slot->error;
+    slot->data = NULL;
+
+    return true;
+}
+
+void file_reader_destroy(FileReader reader)
+{
+    if (reader->pool) {
+        threadpool_destroy(reader->pool);
+    }
+#ifdef HAVE_IO_URING
+    if (reader->uring) {
+        reader->stopping = true;
+        while (reader->active > 0) {
+            ring_progress(reader);
+        }
+        ring_free(&reader->ring);
+    }
+#endif
+
+    if (reader->files) {
+        for (int i = 0; i < reader->nfiles; i++) {
+            free(reader->files[i].data);
+        }
+    }
+    pthread_mutex_destroy(&reader->lock);
+    pthread_cond_destroy(&reader->file_done);
+    free(reader->files);
+    free(reader->done);
+    free(reader);
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Reader of a whole set of files at once. The reads of all files are in
+ * flight together, through io_uring where the kernel has it and on a pool of
+ * threads calling pread() otherwise, and each file is handed out as soon as
+ * it is read in full, whatever the order it was given in. With many small
+ * files on a slow disk the cost is then about that of the slowest read,
+ * rather than that of all of them one after the other.
+ */
+
+typedef struct file_reader *FileReader;
+
+struct file_contents {
+    /* Index of the file among the paths given. */
+    int index;
+    /* Its bytes, null terminated, which the caller must free; NULL on error. */
+    char *data;
+    size_t len;
+    /* errno of what failed, else 0. */
+    int error;
+};
+
+
+/**
+ * Start reading the nfiles files at paths, which must outlive the reader.
+ *
+ * retval - The new reader or NULL if out of memory.
+ */
+FileReader file_reader_start(int nfiles, const char *const paths[]);
+
+/**
+ * Wait for the next file to be read in full, or to fail to be.
+ *
+ * retval - true with file filled in, false once all files have been.
+ */
+bool file_reader_next(FileReader reader, struct file_contents *file);
+
+/**
+ * Wait for the reads in flight, and free the reader along with the contents
+ * of the files it hasn't handed out.
+ */
+void file_reader_destroy(FileReader reader);
@@ -0,0 +1,394 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "ipc.h"
+
+
+struct connection {
+    int fd;
+    enum ipc_tool tool;
+    ipc_handler handler;
+};
+
+static volatile sig_atomic_t stop_serving = 0;
+
+
+static int write_all(int fd, const void *buf, size_t len)
+{
+    const char *p = buf;
+
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n <= 0) {
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+static int read_all(int fd, void *buf, size_t len)
+{
+    char *p = buf;
+
+    while (len > 0) {
+        ssize_t n = read(fd, p, len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n <= 0) {
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+static int write_u32(int fd, uint32_t value)
+{
+    return write_all(fd, &value, sizeof(value));
+}
+
+static int read_u32(int fd, uint32_t *value)
+{
+    return read_all(fd, value, sizeof(*value));
+}
+
+/*
+ * Read len bytes into a newly allocated, NUL-terminated buffer.
+ */
+static char *read_string(int fd, uint32_t len)
+{
+    char *s = malloc(len + 1);
+
+    if (s == NULL) {
+        return NULL;
+    }
+    if (read_all(fd, s, len) != 0) {
+        free(s);
+        return NULL;
+    }
+    s[len] = '\0';
+
+    return s;
+}
+
+static int recv_request(int fd, struct ipc_request *req)
+{
+    uint32_t magic;
+
+    req->nfiles = 0;
+    req->files = NULL;
+
+    if (read_u32(fd, &magic) != 0 || magic != IPC_MAGIC) {
+        return -1;
+    }
+    if (read_u32(fd, &req->tool) != 0
+     || read_u32(fd, &req->flags) != 0
+     || read_u32(fd, &req->nfiles) != 0) {
+        return -1;
+    }
+    if (req->nfiles > IPC_MAX_FILES) {
+        req->nfiles = 0;
+        return -1;
+    }
+
+    // each file is bounded, but so must be all of them together
+    uint64_t total = 0;
+
+    req->files = calloc(req->nfiles ? req->nfiles : 1, sizeof(struct ipc_file));
+    if (req->files == NULL) {
+        req->nfiles = 0;
+        return -1;
+    }
+
+    for (uint32_t i = 0; i < req->nfiles; i++) {
+        uint32_t name_len;
+        struct ipc_file *file = &req->files[i];
+
+        if (read_u32(fd, &name_len) != 0 || read_u32(fd, &file->len) != 0) {
+            return -1;
+        }
+        if (name_len > IPC_MAX_FILE_SIZE || file->len > IPC_MAX_FILE_SIZE) {
+            return -1;
+        }
+        total += (uint64_t) name_len + file->len;
+        if (total > IPC_MAX_REQUEST_SIZE) {
+            return -1;
+        }
+        if ((file->name = read_string(fd, name_len)) == NULL) {
+            return -1;
+        }
+        if ((file->data = read_string(fd, file->len)) == NULL) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static int send_response(int fd, const struct ipc_response *resp)
+{
+    // the lengths go in 32 bits, and a cut down program must not pass for one
+    if (resp->out_len > UINT32_MAX || resp->msg_len > UINT32_MAX) {
+        return -1;
+    }
+    if (write_u32(fd, resp->status) != 0
+     || write_u32(fd, resp->out_len) != 0
+     || write_u32(fd, resp->msg_len) != 0
+     || write_all(fd, resp->out, resp->out_len) != 0
+     || write_all(fd, resp->msg, resp->msg_len) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+static void serve_connection(void *ctx, void *arg)
+{
+    struct connection *conn = arg;
+    struct ipc_request req;
+    struct ipc_response resp = {0};
+
+    if (recv_request(conn->fd, &req) == 0 && req.tool == conn->tool) {
+        conn->handler(ctx, &req, &resp);
+        send_response(conn->fd, &resp);
+    }
+
+    ipc_free_files(req.files, req.nfiles);
+    free(resp.out);
+    free(resp.msg);
+    close(conn->fd);
+    free(conn);
+}
+
+static void on_signal(__attribute__((unused)) int signum)
+{
+    stop_serving = 1;
+}
+
+static int make_address(const char *path, struct sockaddr_un *addr)
+{
+    if (strlen(path) >= sizeof(addr->sun_path)) {
+        return -1;
+    }
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    strcpy(addr->sun_path, path);
+    return 0;
+}
+
+const char *ipc_socket_path(const char *name)
+{
+    static char path[sizeof(((struct sockaddr_un *) NULL)->sun_path)];
+    const char *runtime_dir = getenv("XDG_RUNTIME_DIR");
+
+    if (runtime_dir && *runtime_dir) {
+        snprintf(path, sizeof(path), "%s/%s", runtime_dir, name);
+    } else {
+        // the directory may exist already, connecting checks whose it is
+        snprintf(path, sizeof(path), "/tmp/nand2tetris-%u", (unsigned) getuid());
+        mkdir(path, 0700);
+        snprintf(path + strlen(path), sizeof(path) - strlen(path), "/%s", name);
+    }
+
+    return path;
+}
+
+int ipc_listen(const char *path)
+{
+    struct sockaddr_un addr;
+    mode_t mask;
+    int fd;
+
+    if (make_address(path, &addr) != 0) {
+        return -1;
+    }
+    if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+        return -1;
+    }
+
+    unlink(path);
+
+    // no one else may connect, not even between bind() and chmod()
+    mask = umask(0077);
+    if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0) {
+        umask(mask);
+        close(fd);
+        return -1;
+    }
+    umask(mask);
+
+    if (chmod(path, 0600) != 0 || listen(fd, SOMAXCONN) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+int ipc_connect(const char *path)
+{
+    struct sockaddr_un addr;
+    struct stat st;
+    int fd;
+
+    if (make_address(path, &addr) != 0) {
+        return -1;
+    }
+    // a socket someone else put there would get the files of the request
+    if (lstat(path, &st) != 0 || !S_ISSOCK(st.st_mode) || st.st_uid != geteuid()) {
+        return -1;
+    }
+    if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+        return -1;
+    }
+    if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+void ipc_serve(int listen_fd, const char *path, enum ipc_tool tool,
+               ThreadPool pool, ipc_handler handler)
+{
+    struct sigaction sa;
+
+    // No SA_RESTART, so that accept() returns with EINTR and we get to stop.
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    // A client going away mid-response must not kill the daemon.
+    signal(SIGPIPE, SIG_IGN);
+
+    while (!stop_serving) {
+        int fd = accept(listen_fd, NULL, NULL);
+
+        if (fd < 0) {
+            continue;
+        }
+
+        struct connection *conn = malloc(sizeof(struct connection));
+        if (conn == NULL) {
+            close(fd);
+            continue;
+        }
+        conn->fd = fd;
+        conn->tool = tool;
+        conn->handler = handler;
+
+        if (threadpool_submit(pool, serve_connection, conn) != 0) {
+            close(fd);
+            free(conn);
+        }
+    }
+
+    close(listen_fd);
+    unlink(path);
+}
+
+int ipc_call(int fd, const struct ipc_request *req, struct ipc_response *resp)
+{
+    uint32_t status, out_len, msg_len;
+
+    resp->out = NULL;
+    resp->msg = NULL;
+
+    if (write_u32(fd, IPC_MAGIC) != 0
+     || write_u32(fd, req->tool) != 0
+     || write_u32(fd, req->flags) != 0
+     || write_u32(fd, req->nfiles) != 0) {
+        return -1;
+    }
+
+    for (uint32_t i = 0; i < req->nfiles; i++) {
+        const struct ipc_file *file = &req->files[i];
+        uint32_t name_len = strlen(file->name);
+
+        if (write_u32(fd, name_len) != 0
+         || write_u32(fd, file->len) != 0
+         || write_all(fd, file->name, name_len) != 0
+         || write_all(fd, file->data, file->len) != 0) {
+            return -1;
+        }
+    }
+
+    if (read_u32(fd, &status) != 0
+     || read_u32(fd, &out_len) != 0
+     || read_u32(fd, &msg_len) != 0) {
+        return -1;
+    }
+    if ((resp->out = read_string(fd, out_len)) == NULL) {
+        return -1;
+    }
+    if ((resp->msg = read_string(fd, msg_len)) == NULL) {
+        free(resp->out);
+        resp->out = NULL;
+        return -1;
+    }
+
+    resp->status = status;
+    resp->out_len = out_len;
+    resp->msg_len = msg_len;
+
+    return 0;
+}
+
+int ipc_read_file(const char *filename, struct ipc_file *file)
+{
+    struct stat file_stat;
+    FILE *fp = fopen(filename, "r");
+
+    if (fp == NULL) {
+        return -1;
+    }
+    if (fstat(fileno(fp), &file_stat) != 0 || file_stat.st_size > IPC_MAX_FILE_SIZE) {
+        fclose(fp);
+        return -1;
+    }
+
+    file->len = file_stat.st_size;
+    file->data = malloc(file->len + 1);
+    file->name = malloc(strlen(filename) + 1);
+
+    if (file->data == NULL || file->name == NULL
+     || fread(file->data, 1, file->len, fp) != file->len) {
+        free(file->data);
+        free(file->name);
+        fclose(fp);
+        return -1;
+    }
+
+    file->data[file->len] = '\0';
+    strcpy(file->name, filename);
+    fclose(fp);
+
+    return 0;
+}
+
+void ipc_free_files(struct ipc_file *files, uint32_t nfiles)
+{
+    if (files == NULL) {
+        return;
+    }
+    for (uint32_t i = 0; i < nfiles; i++) {
+        free(files[i].name);
+        free(files[i].data);
+    }
+    free(files);
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "threadpool.h"
+
+/*
+ * Wire protocol spoken between the toolchain daemons and their thin clients
+ * over a local (AF_UNIX) stream socket. Every connection carries exactly one
+ * request and one response. All integers are 32-bit in host byte order, since
+ * both ends always live on the same machine.
+ *
+ * request:  magic, tool, flags, nfiles, { name_len, data_len, name, data } * nfiles
+ * response: status, out_len, msg_len, out, msg
+ *
+ * A status of 0 means success and out holds the generated code. Any other
+ * status is the exit code the tool would have returned on the command line
+ * and msg holds the error message it would have printed. On success, msg
+ * holds whatever else the tool would have printed, if anything.
+ */
+
+#define IPC_MAGIC 0x4e325454  /* "N2TT" */
+
+/* Refuse anything bigger than this in a single file, to avoid absurd allocations. */
+#define IPC_MAX_FILE_SIZE (64 * 1024 * 1024)
+#define IPC_MAX_FILES 1000
+/* Nor requests bigger than this in all, names included. */
+#define IPC_MAX_REQUEST_SIZE (256 * 1024 * 1024)
+
+enum ipc_tool {
+    IPC_TOOL_ASM = 1,
+    IPC_TOOL_VM = 2,
+};
+
+struct ipc_file {
+    char *name;
+    char *data;
+    uint32_t len;
+};
+
+struct ipc_request {
+    uint32_t tool;
+    uint32_t flags;   /* tool specific options, as given to the client */
+    uint32_t nfiles;
+    struct ipc_file *files;
+};
+
+struct ipc_response {
+    uint32_t status;
+    char *out;
+    size_t out_len;
+    char *msg;
+    size_t msg_len;
+};
+
+/*
+ * Handles a single request on a daemon worker. ctx is the worker's context
+ * as returned by the pool's ctx_init. The handler fills in resp; out and msg
+ * must be malloc'ed (or NULL) and are freed after the response has been sent.
+ */
+typedef void (*ipc_handler)(void *ctx, const struct ipc_request *req,
+                            struct ipc_response *resp);
+
+
+/**
+ * Default path of the socket called name: in $XDG_RUNTIME_DIR, or else in a
+ * directory of the user's own under /tmp, created with mode 0700 if need be,
+ * so that other users can neither reach the daemon nor take its place.
+ *
+ * retval - the path, in a buffer that the next call overwrites.
+ */
+const char *ipc_socket_path(const char *name);
+
+/**
+ * Create a listening socket bound to path, replacing any stale socket file.
+ * Only the user may connect to it (mode 0600).
+ *
+ * retval - file descriptor on success, -1 on failure.
+ */
+int ipc_listen(const char *path);
+
+/**
+ * Connect to the daemon listening on path, which must be a socket of the
+ * user's own.
+ *
+ * retval - file descriptor on success, -1 on failure.
+ */
+int ipc_connect(const char *path);
+
+/**
+ * Accept connections on listen_fd until SIGINT or SIGTERM is received and
+ * run handler for each of them on a worker of pool. The socket file at path
+ * is removed on return.
+ */
+void ipc_serve(int listen_fd, const char *path, enum ipc_tool tool,
+               ThreadPool pool, ipc_handler handler);
+
+/**
+ * Send a request and wait for the response. Used by the thin clients.
+ *
+ * retval - 0 on success, -1 on any I/O or protocol error.
+ */
+int ipc_call(int fd, const struct ipc_request *req, struct ipc_response *resp);
+
+/**
+ * Read a whole file into a malloc'ed buffer.
+ *
+ * retval - 0 on success, -1 if the file couldn't be read.
+ */
+int ipc_read_file(const char *filename, struct ipc_file *file);
+
+/**
+ * Free the names and buffers of nfiles files.
+ */
+void ipc_free_files(struct ipc_file *files, uint32_t nfiles);
@@ -0,0 +1,229 @@
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCAN_X86 1
+#endif
+
+#include "scan.h"
+
+/* Bytes of text classified into a word of each bitmap. */
+#define BLOCK 64
+
+
+/*
+ * Which bytes of a block are newlines, slashes and whitespace, as isspace()
+ * has it in the C locale.
+ */
+struct block_bits {
+    uint64_t newlines;
+    uint64_t slashes;
+    uint64_t spaces;
+};
+
+typedef void (*classify_fn)(const unsigned char *p, struct block_bits *b);
+
+
+static void classify_bytes(const unsigned char *p, size_t n, struct block_bits *b)
+{
+    memset(b, 0, sizeof(*b));
+
+    for (size_t i = 0; i < n; i++) {
+        uint64_t bit = (uint64_t) 1 << i;
+
+        if (p[i] == '\n') {
+            b->newlines |= bit;
+        } else if (p[i] == '/') {
+            b->slashes |= bit;
+        }
+        if (p[i] == ' ' || (p[i] >= '\t' && p[i] <= '\r')) {
+            b->spaces |= bit;
+        }
+    }
+}
+
+#ifndef __SSE2__
+static void classify_scalar(const unsigned char *p, struct block_bits *b)
+{
+    classify_bytes(p, BLOCK, b);
+}
+#endif
+
+#ifdef __SSE2__
+static void classify_sse2(const unsigned char *p, struct block_bits *b)
+{
+    const __m128i newline = _mm_set1_epi8('\n');
+    const __m128i slash = _mm_set1_epi8('/');
+    const __m128i space = _mm_set1_epi8(' ');
+    const __m128i tab = _mm_set1_epi8('\t');
+    const __m128i four = _mm_set1_epi8(4);
+
+    memset(b, 0, sizeof(*b));
+
+    for (int i = 0; i < BLOCK / 16; i++) {
+        __m128i x = _mm_loadu_si128((const __m128i *) (p + 16 * i));
+        // \t to \r become 0 to 4, anything else more
+        __m128i ctl = _mm_sub_epi8(x, tab);
+        __m128i ws = _mm_or_si128(_mm_cmpeq_epi8(x, space),
+                                  _mm_cmpeq_epi8(_mm_min_epu8(ctl, four), ctl));
+
+        b->newlines |= (uint64_t) (uint16_t) _mm_movemask_epi8(_mm_cmpeq_epi8(x, newline)) << (16 * i);
+        b->slashes |= (uint64_t) (uint16_t) _mm_movemask_epi8(_mm_cmpeq_epi8(x, slash)) << (16 * i);
+        b->spaces |= (uint64_t) (uint16_t) _mm_movemask_epi8(ws) << (16 * i);
+    }
+}
+#endif
+
+#ifdef SCAN_X86
+__attribute__((target("avx2")))
+static void classify_avx2(const unsigned char *p, struct block_bits *b)
+{
+    const __m256i newline = _mm256_set1_epi8('\n');
+    const __m256i slash = _mm256_set1_epi8('/');
+    const __m256i space = _mm256_set1_epi8(' ');
+    const __m256i tab = _mm256_set1_epi8('\t');
+    const __m256i four = _mm256_set1_epi8(4);
+
+    memset(b, 0, sizeof(*b));
+
+    for (int i = 0; i < BLOCK / 32; i++) {
+        __m256i x = _mm256_loadu_si256((const __m256i *) (p + 32 * i));
+        __m256i ctl = _mm256_sub_epi8(x, tab);
+        __m256i ws = _mm256_or_si256(_mm256_cmpeq_epi8(x, space),
+                                     _mm256_cmpeq_epi8(_mm256_min_epu8(ctl, four), ctl));
+
+        b->newlines |= (uint64_t) (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(x, newline)) << (32 * i);
+        b->slashes |= (uint64_t) (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(x, slash)) << (32 * i);
+        b->spaces |= (uint64_t) (uint32_t) _mm256_movemask_epi8(ws) << (32 * i);
+    }
+}
+#endif
+
+/*
+ * The widest classifier the CPU runs.
+ */
+static classify_fn best_classifier(void)
+{
+#ifdef SCAN_X86
+    if (__builtin_cpu_supports("avx2")) {
+        return classify_avx2;
+    }
+#endif
+#ifdef __SSE2__
+    return classify_sse2;
+#else
+    return classify_scalar;
+#endif
+}
+
+int scanner_init(struct scanner *sc, const char *text, size_t len)
+{
+    // a word to spare past the end, for comments to look one byte ahead
+    size_t nwords = len / BLOCK + 2;
+    classify_fn classify = best_classifier();
+    const unsigned char *p = (const unsigned char *) text;
+    struct block_bits b;
+    size_t w;
+
+    sc->text = text;
+    sc->len = len;
+    sc->pos = 0;
+    sc->line = 0;
+    sc->newlines = calloc(nwords, sizeof(uint64_t));
+    sc->comments = calloc(nwords, sizeof(uint64_t));
+    sc->spaces = calloc(nwords, sizeof(uint64_t));
+
+    if (sc->newlines == NULL || sc->comments == NULL || sc->spaces == NULL) {
+        scanner_free(sc);
+        return -1;
+    }
+
+    for (w = 0; w < len / BLOCK; w++) {
+        classify(p + w * BLOCK, &b);
+        sc->newlines[w] = b.newlines;
+        sc->comments[w] = b.slashes;
+        sc->spaces[w] = b.spaces;
+    }
+    classify_bytes(p + w * BLOCK, len % BLOCK, &b);
+    sc->newlines[w] = b.newlines;
+    sc->comments[w] = b.slashes;
+    sc->spaces[w] = b.spaces;
+
+    // a comment starts at a slash followed by another
+    for (w = 0; w + 1 < nwords; w++) {
+        sc->comments[w] &= (sc->comments[w] >> 1) | (sc->comments[w + 1] << 63);
+    }
+
+    return 0;
+}
+
+/*
+ * The first offset in [from, to) whose bit is set, or to. With flip all
+ * ones, that whose bit is clear.
+ */
+static size_t find_first(const uint64_t *bits, uint64_t flip, size_t from, size_t to)
+{
+    size_t w = from / BLOCK;
+    uint64_t word;
+
+    if (from >= to) {
+        return to;
+    }
+
+    word = (bits[w] ^ flip) & (~(uint64_t) 0 << (from % BLOCK));
+    while (!word) {
+        if (++w * BLOCK >= to) {
+            return to;
+        }
+        word = bits[w] ^ flip;
+    }
+
+    size_t i = w * BLOCK + __builtin_ctzll(word);
+
+    return i < to ? i : to;
+}
+
+/*
+ * The last offset before to whose bit is clear, which must be at from or
+ * after.
+ */
+static size_t find_last_clear(const uint64_t *bits, size_t from, size_t to)
+{
+    size_t w = (to - 1) / BLOCK;
+    uint64_t word = ~bits[w] & (~(uint64_t) 0 >> (BLOCK - 1 - (to - 1) % BLOCK));
+
+    while (!word && w > from / BLOCK) {
+        word = ~bits[--w];
+    }
+    return w * BLOCK + BLOCK - 1 - __builtin_clzll(word);
+}
+
+bool scanner_next(struct scanner *sc, struct scan_span *span)
+{
+    while (sc->pos < sc->len) {
+        size_t eol = find_first(sc->newlines, 0, sc->pos, sc->len);
+        size_t stop = find_first(sc->comments, 0, sc->pos, eol);
+        size_t start = find_first(sc->spaces, ~(uint64_t) 0, sc->pos, stop);
+
+        sc->line++;
+        sc->pos = eol + 1;
+
+        if (start < stop) {
+            span->text = sc->text + start;
+            span->len = find_last_clear(sc->spaces, start, stop) + 1 - start;
+            span->line = sc->line;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void scanner_free(struct scanner *sc)
+{
+    free(sc->newlines);
+    free(sc->comments);
+    free(sc->spaces);
+    sc->newlines = sc->comments = sc->spaces = NULL;
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Line scanner shared by the readers of .asm and .vm files. It splits a whole
+ * buffer into the spans of significant text of its lines: what is left of
+ * each line once a // comment and the whitespace around it are cut off.
+ * Lines left empty are skipped.
+ *
+ * The buffer is classified up front, 64 bytes at a time with SSE2 or AVX2
+ * where the CPU has them, into bitmaps of its newlines, comment starts and
+ * whitespace. Finding the bounds of a line is then a matter of a few bit
+ * scans rather than of a test per byte.
+ */
+
+struct scan_span {
+    const char *text;
+    size_t len;
+    /* Line of the buffer the span is on, from 1. */
+    unsigned line;
+};
+
+struct scanner {
+    const char *text;
+    size_t len;
+    /* Offset of the start of the next line, and its number. */
+    size_t pos;
+    unsigned line;
+    /* One bit per byte of text, 64 bytes a word. */
+    uint64_t *newlines;
+    uint64_t *comments;
+    uint64_t *spaces;
+};
+
+
+/**
+ * Prepare to scan the len bytes at text, which must outlive the scanner.
+ *
+ * retval - 0 on success, -1 if out of memory.
+ */
+int scanner_init(struct scanner *sc, const char *text, size_t len);
+
+/**
+ * Find the next line with significant text.
+ *
+ * retval - true with its span filled in, false at the end of the buffer.
+ */
+bool scanner_next(struct scanner *sc, struct scan_span *span);
+
+/**
+ * Free the bitmaps of a scanner.
+ */
+void scanner_free(struct scanner *sc);
@@ -0,0 +1,224 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "srcmap.h"
+
+#define SRCMAP_MAGIC "HACKMAP1"
+#define SRCMAP_MAGIC_LEN 8
+
+/*
+ * Bounds on what a well formed map may hold, so that reading a broken one
+ * can't ask for absurd amounts of memory.
+ */
+#define MAX_SRCMAP_ENTRIES (1u << 24)
+#define MAX_SRCMAP_STRINGS (1u << 26)
+
+
+void srcmap_init(struct source_map *map)
+{
+    memset(map, 0, sizeof(*map));
+}
+
+void srcmap_free(struct source_map *map)
+{
+    free(map->entries);
+    free(map->strings);
+    srcmap_init(map);
+}
+
+/*
+ * The offset of s in the strings of map. Ranges follow the code, so a file
+ * or function is almost always that of the entry before, the only one
+ * checked; anything else is added.
+ *
+ * retval - the offset, or UINT32_MAX if out of memory.
+ */
+static uint32_t add_string(struct source_map *map, const char *s, bool function)
+{
+    uint32_t offset = map->strings_size;
+    size_t len = strlen(s) + 1;
+
+    if (map->count) {
+        const struct srcmap_entry *last = &map->entries[map->count - 1];
+        uint32_t same = function ? last->function : last->file;
+
+        if (!strcmp(map->strings + same, s)) {
+            return same;
+        }
+    }
+
+    if (map->strings_size + len > map->strings_allocated) {
+        uint32_t size = map->strings_allocated ? map->strings_allocated : 1024;
+        char *strings;
+
+        while (map->strings_size + len > size) {
+            size *= 2;
+        }
+        if ((strings = realloc(map->strings, size)) == NULL) {
+            return UINT32_MAX;
+        }
+        map->strings = strings;
+        map->strings_allocated = size;
+    }
+    memcpy(map->strings + offset, s, len);
+    map->strings_size += len;
+
+    return offset;
+}
+
+int srcmap_add(struct source_map *map, uint32_t start, const char *file,
+               uint32_t line, const char *function)
+{
+    uint32_t file_offset = add_string(map, file, false);
+    uint32_t function_offset = add_string(map, function, true);
+    struct srcmap_entry *last = map->count ? &map->entries[map->count - 1] : NULL;
+
+    if (file_offset == UINT32_MAX || function_offset == UINT32_MAX) {
+        return -1;
+    }
+    if (last && last->start == start) {
+        last = --map->count ? last - 1 : NULL;
+    }
+    if (last && last->file == file_offset && last->line == line
+        && last->function == function_offset) {
+        return 0;
+    }
+    if (map->count == map->allocated) {
+        uint32_t allocated = map->allocated ? map->allocated * 2 : 256;
+        struct srcmap_entry *entries = realloc(map->entries, allocated * sizeof(struct srcmap_entry));
+
+        if (entries == NULL) {
+            return -1;
+        }
+        map->entries = entries;
+        map->allocated = allocated;
+    }
+
+    struct srcmap_entry *entry = &map->entries[map->count++];
+
+    entry->start = start;
+    entry->file = file_offset;
+    entry->line = line;
+    entry->function = function_offset;
+
+    return 0;
+}
+
+const struct srcmap_entry *srcmap_lookup(const struct source_map *map, uint32_t key)
+{
+    uint32_t lo = 0, hi = map->count;
+
+    // the first entry that starts past key
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+
+        if (map->entries[mid].start <= key) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo ? &map->entries[lo - 1] : NULL;
+}
+
+
+static void put_u32(FILE *fp, uint32_t v)
+{
+    unsigned char b[4] = { v & 0xff, (v >> 8) & 0xff, (v >> 16) & 0xff, v >> 24 };
+
+    fwrite(b, 1, sizeof(b), fp);
+}
+
+int srcmap_write(const struct source_map *map, FILE *fp)
+{
+    fwrite(SRCMAP_MAGIC, 1, SRCMAP_MAGIC_LEN, fp);
+    put_u32(fp, map->count);
+    put_u32(fp, map->strings_size);
+
+    for (uint32_t i = 0; i < map->count; i++) {
+        put_u32(fp, map->entries[i].start);
+        put_u32(fp, map->entries[i].file);
+        put_u32(fp, map->entries[i].line);
+        put_u32(fp, map->entries[i].function);
+    }
+    fwrite(map->strings, 1, map->strings_size, fp);
+
+    return ferror(fp) ? -1 : 0;
+}
+
+
+static bool get_u32(FILE *fp, uint32_t *v)
+{
+    unsigned char b[4];
+
+    if (fread(b, 1, sizeof(b), fp) != sizeof(b)) {
+        return false;
+    }
+    *v = b[0] | b[1] << 8 | b[2] << 16 | (uint32_t) b[3] << 24;
+    return true;
+}
+
+static bool valid_string(const struct source_map *map, uint32_t offset)
+{
+    return offset < map->strings_size
+           && memchr(map->strings + offset, '\0', map->strings_size - offset);
+}
+
+/*
+ * Read the entries and strings of a map whose header is in map already.
+ */
+static bool read_body(struct source_map *map, FILE *fp)
+{
+    map->entries = malloc(map->count * sizeof(struct srcmap_entry) + 1);
+    map->strings = malloc(map->strings_size + 1);
+    map->allocated = map->count;
+    map->strings_allocated = map->strings_size;
+
+    if (map->entries == NULL || map->strings == NULL) {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < map->count; i++) {
+        struct srcmap_entry *entry = &map->entries[i];
+
+        if (!get_u32(fp, &entry->start) || !get_u32(fp, &entry->file)
+            || !get_u32(fp, &entry->line) || !get_u32(fp, &entry->function)) {
+            return false;
+        }
+    }
+    if (fread(map->strings, 1, map->strings_size, fp) != map->strings_size) {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < map->count; i++) {
+        const struct srcmap_entry *entry = &map->entries[i];
+
+        if (!valid_string(map, entry->file) || !valid_string(map, entry->function)
+            || (i && entry->start < map->entries[i - 1].start)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int srcmap_read(struct source_map *map, FILE *fp)
+{
+    char magic[SRCMAP_MAGIC_LEN];
+
+    srcmap_init(map);
+
+    if (fread(magic, 1, SRCMAP_MAGIC_LEN, fp) != SRCMAP_MAGIC_LEN
+        || memcmp(magic, SRCMAP_MAGIC, SRCMAP_MAGIC_LEN)
+        || !get_u32(fp, &map->count) || !get_u32(fp, &map->strings_size)
+        || map->count > MAX_SRCMAP_ENTRIES || map->strings_size > MAX_SRCMAP_STRINGS) {
+        srcmap_init(map);
+        return -1;
+    }
+
+    if (!read_body(map, fp)) {
+        srcmap_free(map);
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+
+/*
+ * Source maps, which tie generated code back to the VM commands it comes
+ * from. vm -g writes the map of a .asm program keyed by its lines, and
+ * assembler -g composes it into that of the machine code, keyed by ROM
+ * address, for profilers and emulators to attribute addresses to VM files,
+ * lines and functions.
+ *
+ * A map is a list of ranges, each starting at the key of its entry and
+ * running up to that of the next one, or to the end of the code. Keys before
+ * the first entry, such as the bootstrap code, have no location, nor have
+ * those of an entry of line 0, such as the shared routines after the code.
+ * The file is little-endian:
+ *
+ *     "HACKMAP1"
+ *     u32 nentries, strings_size
+ *     { u32 start, file, line, function } entries[nentries]
+ *     char strings[strings_size]
+ *
+ * Entries are sorted by start, and are of a fixed size, so that a location
+ * can be looked up by a binary search of the file as it is. file and function
+ * are offsets of null terminated strings in strings, and line is that of the
+ * command in its file.
+ */
+
+#define SRCMAP_EXTENSION ".map"
+
+
+struct srcmap_entry {
+    uint32_t start;
+    uint32_t file;
+    uint32_t line;
+    uint32_t function;
+};
+
+struct source_map {
+    struct srcmap_entry *entries;
+    uint32_t count, allocated;
+    char *strings;
+    uint32_t strings_size, strings_allocated;
+};
+
+
+/**
+ * Initialise an empty map, to be built with srcmap_add().
+ */
+void srcmap_init(struct source_map *map);
+
+/**
+ * Free everything a map holds.
+ */
+void srcmap_free(struct source_map *map);
+
+/**
+ * Start a range at start, which must not be below that of the last one, for
+ * the command on line line of file, in function. An empty range before it is
+ * replaced, and a range with the same location as the one before is merged
+ * into it.
+ *
+ * retval - 0 on success, -1 if out of memory.
+ */
+int srcmap_add(struct source_map *map, uint32_t start, const char *file,
+               uint32_t line, const char *function);
+
+/**
+ * Find the range key falls in.
+ *
+ * retval - its entry, or NULL if key comes before all of them.
+ */
+const struct srcmap_entry *srcmap_lookup(const struct source_map *map, uint32_t key);
+
+/**
+ * Write a map to fp, which must be open in binary mode.
+ *
+ * retval - 0 on success, -1 on a write error.
+ */
+int srcmap_write(const struct source_map *map, FILE *fp);
+
+/**
+ * Read the map in fp into map.
+ *
+ * retval - 0 on success, -1 if fp doesn't hold a well formed map or if out
+ *          of memory.
+ */
+int srcmap_read(struct source_map *map, FILE *fp);
@@ -0,0 +1,176 @@
+#include <stdlib.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include "threadpool.h"
+
+
+struct job {
+    struct job *next;
+    threadpool_job fn;
+    void *arg;
+};
+
+struct thread_pool {
+    pthread_mutex_t lock;
+    pthread_cond_t job_ready;  /* signaled when a job is queued or on shutdown */
+    pthread_cond_t idle;       /* signaled when the last busy worker goes idle */
+    struct job *head;
+    struct job *tail;
+    int busy;
+    bool shutdown;
+    threadpool_ctx_init ctx_init;
+    threadpool_ctx_free ctx_free;
+    int nthreads;
+    pthread_t *threads;
+};
+
+
+static void *worker(void *arg)
+{
+    ThreadPool pool = arg;
+    sigset_t signals;
+
+    // Leave signal handling to the thread that created the pool.
+    sigfillset(&signals);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+    void *ctx = pool->ctx_init ? pool->ctx_init() : NULL;
+
+    pthread_mutex_lock(&pool->lock);
+
+    for (;;) {
+        while (pool->head == NULL && !pool->shutdown) {
+            pthread_cond_wait(&pool->job_ready, &pool->lock);
+        }
+        if (pool->head == NULL) {
+            break; // shutting down and nothing left to do
+        }
+
+        struct job *job = pool->head;
+        pool->head = job->next;
+        if (pool->head == NULL) {
+            pool->tail = NULL;
+        }
+        pool->busy++;
+
+        pthread_mutex_unlock(&pool->lock);
+        job->fn(ctx, job->arg);
+        free(job);
+        pthread_mutex_lock(&pool->lock);
+
+        if (--pool->busy == 0 && pool->head == NULL) {
+            pthread_cond_broadcast(&pool->idle);
+        }
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+
+    if (pool->ctx_free) {
+        pool->ctx_free(ctx);
+    }
+
+    return NULL;
+}
+
+ThreadPool threadpool_create(int nthreads, threadpool_ctx_init ctx_init,
+                             threadpool_ctx_free ctx_free)
+{
+    if (nthreads < 1) {
+        long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+        nthreads = ncpus > 0 ? ncpus : 1;
+    }
+
+    ThreadPool pool = malloc(sizeof(struct thread_pool));
+    if (pool == NULL) {
+        return NULL;
+    }
+    pool->threads = malloc(nthreads * sizeof(pthread_t));
+    if (pool->threads == NULL) {
+        free(pool);
+        return NULL;
+    }
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->job_ready, NULL);
+    pthread_cond_init(&pool->idle, NULL);
+    pool->head = NULL;
+    pool->tail = NULL;
+    pool->busy = 0;
+    pool->shutdown = false;
+    pool->ctx_init = ctx_init;
+    pool->ctx_free = ctx_free;
+    pool->nthreads = 0;
+
+    for (int i = 0; i < nthreads; i++) {
+        if (pthread_create(&pool->threads[i], NULL, worker, pool) != 0) {
+            break;
+        }
+        pool->nthreads++;
+    }
+
+    if (pool->nthreads == 0) {
+        threadpool_destroy(pool);
+        return NULL;
+    }
+
+    return pool;
+}
+
+int threadpool_submit(ThreadPool pool, threadpool_job fn, void *arg)
+{
+    struct job *job = malloc(sizeof(struct job));
+
+    if (job == NULL) {
+        return -1;
+    }
+    job->next = NULL;
+    job->fn = fn;
+    job->arg = arg;
+
+    pthread_mutex_lock(&pool->lock);
+    if (pool->tail == NULL) {
+        pool->head = job;
+    } else {
+        pool->tail->next = job;
+    }
+    pool->tail = job;
+    pthread_cond_signal(&pool->job_ready);
+    pthread_mutex_unlock(&pool->lock);
+
+    return 0;
+}
+
+void threadpool_wait(ThreadPool pool)
+{
+    pthread_mutex_lock(&pool->lock);
+    while (pool->head != NULL || pool->busy > 0) {
+        pthread_cond_wait(&pool->idle, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void threadpool_destroy(ThreadPool pool)
+{
+    pthread_mutex_lock(&pool->lock);
+    pool->shutdown = true;
+    pthread_cond_broadcast(&pool->job_ready);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 0; i < pool->nthreads; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->job_ready);
+    pthread_cond_destroy(&pool->idle);
+    free(pool->threads);
+    free(pool);
+}
+
+int threadpool_size(ThreadPool pool)
+{
+    return pool->nthreads;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+/*
+ * A fixed-size pool of worker threads consuming jobs from a FIFO queue.
+ *
+ * Every worker may own a context object which is created once when the worker
+ * starts and is handed to every job that worker runs. This lets callers keep
+ * expensive per-thread state (symbol tables, buffers, etc.) warm across jobs.
+ */
+
+typedef struct thread_pool *ThreadPool;
+
+typedef void (*threadpool_job)(void *ctx, void *arg);
+typedef void *(*threadpool_ctx_init)(void);
+typedef void (*threadpool_ctx_free)(void *ctx);
+
+
+/**
+ * Start a pool of nthreads workers. If nthreads is less than 1, one worker per
+ * online CPU is started. ctx_init and ctx_free may be NULL, in which case jobs
+ * receive a NULL context.
+ *
+ * retval - The new pool or NULL if the pool couldn't be created.
+ */
+ThreadPool threadpool_create(int nthreads, threadpool_ctx_init ctx_init,
+                             threadpool_ctx_free ctx_free);
+
+/**
+ * Queue a job to be run by the first idle worker.
+ *
+ * retval - 0 on success, -1 if the job couldn't be queued.
+ */
+int threadpool_submit(ThreadPool pool, threadpool_job job, void *arg);
+
+/**
+ * Block until the queue is empty and all workers are idle.
+ */
+void threadpool_wait(ThreadPool pool);
+
+/**
+ * Wait for all queued jobs to finish, stop the workers and free the pool.
+ */
+void threadpool_destroy(ThreadPool pool);
+
+/**
+ * Number of workers the pool was started with.
+ */
+int threadpool_size(ThreadPool pool);
@@ -0,0 +1,17 @@
+// File name: projects/07/StackArithmetic/OverflowTest/OverflowTest.tst
+
+load OverflowTest.asm,
+output-file OverflowTest.out,
+compare-to OverflowTest.cmp,
+output-list RAM[0]%D2.6.2
+        RAM[256]%D2.6.2 RAM[257]%D2.6.2 RAM[258]%D2.6.2 RAM[259]%D2.6.2;
+
+set RAM[0] 256,  // initializes the stack pointer
+
+repeat 200 {     // enough cycles to complete the execution
+  ticktock;
+}
+
+// outputs the stack pointer (RAM[0]) and
+// the stack contents: RAM[256]-RAM[259]
+output;